@@ -0,0 +1,22 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <cstdio>
+
+// Wall-clock stopwatch, started on construction
+struct Timer {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    void reset() { start = std::chrono::steady_clock::now(); }
+
+    double elapsedMs() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+inline double gigabytesPerSecond(double bytes, double ms) {
+    return ms > 0 ? bytes / (ms * 1e6) : 0;
+}
+
+#endif // BENCH_H
@@ -0,0 +1,89 @@
+// Create/destroy throughput for many small tensors: one vkAllocateMemory per buffer vs. the memory arena.
+// The dedicated path is capped at maxMemoryAllocationCount, which is exactly the limit the arena avoids.
+//
+// Usage: ./bench_arena [tensor count] [tensor bytes]
+
+#include <cstdlib>
+#include <algorithm>
+#include <random>
+
+#include "./util.h"
+#include "./allocator.h"
+#include "./bench.h"
+
+static void report(const char* name, size_t count, double createMs, double destroyMs) {
+    printf("%-10s %8zu buffers   create %10.0f buffers/s   destroy %10.0f buffers/s\n", name, count,
+           count / (createMs / 1000.0), count / (destroyMs / 1000.0));
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000;
+    VkDeviceSize tensorBytes = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1024;
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    MemoryMode modes[] = {MEMORY_HOST_VISIBLE, MEMORY_DEVICE_LOCAL};
+    for (MemoryMode mode : modes) {
+        printf("%s memory, %llu byte tensors\n", mode == MEMORY_DEVICE_LOCAL ? "device-local" : "host-visible",
+               (unsigned long long)tensorBytes);
+
+        // One allocation per buffer
+        size_t dedicatedCount = std::min<size_t>(count, properties.limits.maxMemoryAllocationCount - 64);
+        std::vector<Buffer> buffers;
+        buffers.reserve(count);
+
+        Timer timer;
+        for (size_t i = 0; i < dedicatedCount; i++) {
+            buffers.push_back(createBuffer(physicalDevice, device, tensorBytes, 0, mode));
+        }
+        double createMs = timer.elapsedMs();
+
+        timer.reset();
+        destroyBuffers(buffers);
+        double destroyMs = timer.elapsedMs();
+        buffers.clear();
+
+        report("dedicated", dedicatedCount, createMs, destroyMs);
+
+        // Sub-allocated from the arena
+        MemoryArena arena = createMemoryArena(physicalDevice, device);
+
+        timer.reset();
+        for (size_t i = 0; i < count; i++) {
+            buffers.push_back(createBuffer(arena, tensorBytes, 0, mode));
+        }
+        createMs = timer.elapsedMs();
+
+        // Free every other buffer and refill with mixed sizes, which exercises range recycling
+        std::mt19937 rng(42);
+        std::vector<Buffer> freed;
+        for (size_t i = 0; i < buffers.size(); i += 2) freed.push_back(buffers[i]);
+        destroyBuffers(freed);
+        printArenaStats(arena);
+
+        for (size_t i = 0; i < buffers.size(); i += 2) {
+            buffers[i] = createBuffer(arena, tensorBytes / 2 + rng() % tensorBytes, 0, mode);
+        }
+        printArenaStats(arena);
+
+        timer.reset();
+        destroyBuffers(buffers);
+        destroyMs = timer.elapsedMs();
+        buffers.clear();
+
+        report("arena", count, createMs, destroyMs);
+        printArenaStats(arena);
+        destroyMemoryArena(arena);
+    }
+
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return 0;
+}
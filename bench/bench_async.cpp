@@ -0,0 +1,118 @@
+// Blocking vs. asynchronous submission of many small batches.
+// Every batch costs the host some time to prepare (simulated work plus recording the command buffer).
+// With executeCommandBuffer the host and the GPU take turns; with submitAsync the host prepares the
+// next batch while the previous ones are still running.
+//
+// Usage: ./bench_async [batches] [host work us per batch] [max in flight] [elements]
+
+#include <cstdlib>
+#include <algorithm>
+
+#include "./util.h"
+#include "./kernel.h"
+#include "./submit.h"
+#include "./bench.h"
+
+// Stands in for whatever the host does between batches: encoding, uploads, running the frontend
+static void hostWork(double microseconds) {
+    Timer timer;
+    while (timer.elapsedMs() * 1000.0 < microseconds) {}
+}
+
+static void recordBatch(VkCommandBuffer commandBuffer, std::vector<Kernel>& kernels) {
+    vkResetCommandBuffer(commandBuffer, 0);
+    recordKernels(commandBuffer, kernels);
+}
+
+int main(int argc, char** argv) {
+    uint32_t batches = argc > 1 ? std::atoi(argv[1]) : 500;
+    double hostWorkUs = argc > 2 ? std::atof(argv[2]) : 200;
+    uint32_t maxInFlight = argc > 3 ? std::atoi(argv[3]) : 4;
+    uint32_t nelem = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : (1 << 20);
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    // Command buffers get re-recorded for every batch, so they have to be individually resettable
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    VkCommandPool commandPool;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create command pool!");
+    }
+
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+
+    VkDeviceSize bytes = VkDeviceSize(nelem) * sizeof(float);
+    std::vector<Buffer> buffers = {
+        createBuffer(physicalDevice, device, bytes, 0, MEMORY_DEVICE_LOCAL),
+        createBuffer(physicalDevice, device, bytes, 1, MEMORY_DEVICE_LOCAL),
+        createBuffer(physicalDevice, device, bytes, 2, MEMORY_DEVICE_LOCAL),
+    };
+
+    // A batch is a handful of dependent dispatches
+    Kernel add = createKernel(registry, ADD, {buffers[0], buffers[1]}, buffers[2]);
+    std::vector<Kernel> kernels(4, add);
+
+    std::vector<VkCommandBuffer> commandBuffers(maxInFlight);
+    for (VkCommandBuffer& commandBuffer : commandBuffers) commandBuffer = createCommandBuffer(device, commandPool);
+
+    // GPU time of one batch on its own, the lower bound for a fully overlapped run
+    recordBatch(commandBuffers[0], kernels);
+    executeCommandBuffer(device, commandBuffers[0], queue);
+    Timer timer;
+    executeCommandBuffer(device, commandBuffers[0], queue);
+    double gpuBatchMs = timer.elapsedMs();
+
+    // Blocking: prepare, submit, wait, repeat
+    timer.reset();
+    for (uint32_t i = 0; i < batches; i++) {
+        hostWork(hostWorkUs);
+        recordBatch(commandBuffers[0], kernels);
+        executeCommandBuffer(device, commandBuffers[0], queue);
+    }
+    double syncMs = timer.elapsedMs();
+
+    // Asynchronous: each command buffer is reused once the submission that last used it has finished
+    SubmitQueue submitQueue = createSubmitQueue(device, queue, maxInFlight);
+    std::vector<Submission> slots(maxInFlight);
+    uint32_t completed = 0;
+
+    timer.reset();
+    for (uint32_t i = 0; i < batches; i++) {
+        Submission& slot = slots[i % maxInFlight];
+        hostWork(hostWorkUs);
+
+        if (slot.state) waitSubmission(submitQueue, slot);
+        recordBatch(commandBuffers[i % maxInFlight], kernels);
+        slot = submitAsync(submitQueue, commandBuffers[i % maxInFlight], [&completed]() { completed++; });
+    }
+    waitIdle(submitQueue);
+    double asyncMs = timer.elapsedMs();
+
+    double idealMs = batches * std::max(gpuBatchMs, hostWorkUs / 1000.0);
+
+    printf("%u batches, %.0f us host work each, %u in flight, one batch takes %.3f ms on the GPU\n",
+           batches, hostWorkUs, maxInFlight, gpuBatchMs);
+    printf("%-10s %12s %14s\n", "mode", "total ms", "batches/s");
+    printf("%-10s %12.2f %14.1f\n", "blocking", syncMs, batches / (syncMs / 1000.0));
+    printf("%-10s %12.2f %14.1f\n", "async", asyncMs, batches / (asyncMs / 1000.0));
+    printf("%-10s %12.2f %14.1f\n", "ideal", idealMs, batches / (idealMs / 1000.0));
+    printf("speedup: %.2fx, callbacks: %u/%u\n", syncMs / asyncMs, completed, batches);
+
+    destroySubmitQueue(submitQueue);
+    destroyKernel(add);
+    destroyBuffers(buffers);
+    destroyPipelineRegistry(registry);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return completed == batches ? 0 : 1;
+}
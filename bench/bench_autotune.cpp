@@ -0,0 +1,54 @@
+// Tunes the launch shape (workgroup size, items per thread, vector width) of a set of elementwise kernels
+// on the current device and writes the winners to kernel_tuning.txt, where createKernel picks them up
+// in later runs (see src/autotune.h). Prints each kernel's bandwidth with the default shape and the best one,
+// and how many shapes gave a different result than the default one and were left out.
+//
+// Usage: ./bench_autotune [elements] [output file]
+
+#include <cstdlib>
+
+#include "./util.h"
+#include "./autotune.h"
+
+struct Target {
+    Ops op;
+    std::string dtype;
+    std::string destDtype;
+};
+
+int main(int argc, char** argv) {
+    uint32_t nelem = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : (1 << 22);
+    std::string path = argc > 2 ? argv[2] : "kernel_tuning.txt";
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+    loadKernelConfigs(registry, path);
+
+    // Memory bound, compute bound and mixed ops, plus a conversion
+    std::vector<Target> targets = {
+        {ADD, "float", ""}, {MUL, "float", ""}, {MULACC, "float", ""}, {WHERE, "float", ""},
+        {EXP2, "float", ""}, {SIN, "float", ""}, {ADD, "int", ""}, {IDIV, "int", ""},
+        {THREEFRY, "uint", ""}, {CAST, "float", "int"},
+    };
+
+    printf("%-20s %10s %10s %8s %22s %9s\n", "kernel", "default", "best", "speedup", "workgroup x items x vec", "rejected");
+    for (const Target& target : targets) {
+        TuningResult result = autotuneKernel(registry, queue, queueFamilyIndex, target.op, target.dtype, target.destDtype, nelem);
+        printf("%-20s %10.2f %10.2f %7.2fx %10u x %u x %u %9u\n", result.kernelName.c_str(), result.defaultGbps, result.bestGbps,
+               result.bestGbps / result.defaultGbps, result.best.workgroupSize, result.best.itemsPerThread, result.best.vectorWidth,
+               result.rejected);
+    }
+
+    saveKernelConfigs(registry, path);
+    printf("GB/s over %u elements, %u shapes tried per kernel. Saved to %s\n", nelem, uint32_t(kernelConfigCandidates(physicalDevice).size()), path.c_str());
+
+    destroyPipelineRegistry(registry);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+    return 0;
+}
@@ -0,0 +1,112 @@
+// CPU cost per run of a graph of many small kernels: recorded again for every run vs. captured once and replayed
+// (src/capture.h), with the replays alternating between two sets of input and output buffers like double buffering.
+// The graph is x = x + b, `length` times, unfused so that every op is a dispatch of its own.
+//
+// Usage: ./bench_capture [elements] [length] [iterations]
+
+#include <cstdlib>
+
+#include "./util.h"
+#include "./graph.h"
+#include "./capture.h"
+#include "./bench.h"
+
+static void fillInputs(Buffer& a, Buffer& b, uint32_t nelem, float scale) {
+    float* dataA = hostPointer<float>(a);
+    float* dataB = hostPointer<float>(b);
+    for (uint32_t i = 0; i < nelem; i++) {
+        dataA[i] = scale * float(i % 1024);
+        dataB[i] = float(i % 8) / 4.0f;
+    }
+}
+
+static bool checkOutput(Buffer& a, Buffer& b, Buffer& out, uint32_t nelem, uint32_t length) {
+    const float* dataA = hostPointer<float>(a);
+    const float* dataB = hostPointer<float>(b);
+    const float* result = hostPointer<float>(out);
+    for (uint32_t i = 0; i < nelem; i++) {
+        if (result[i] != dataA[i] + float(length) * dataB[i]) return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    uint32_t nelem = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4096;
+    uint32_t length = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 64;
+    int iterations = argc > 3 ? std::atoi(argv[3]) : 1000;
+    VkDeviceSize bytes = VkDeviceSize(nelem) * sizeof(float);
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+    VkCommandPool commandPool = createCommandPool(device, queueFamilyIndex);
+
+    // Two sets of a, b and out
+    std::vector<Buffer> buffers;
+    for (uint32_t i = 0; i < 6; i++) buffers.push_back(createBuffer(physicalDevice, device, bytes, i % 3, MEMORY_HOST_VISIBLE));
+    fillInputs(buffers[0], buffers[1], nelem, 1.0f);
+    fillInputs(buffers[3], buffers[4], nelem, 2.0f);
+
+    Graph graph;
+    uint32_t x = addInput(graph, buffers[0]);
+    uint32_t b = addInput(graph, buffers[1]);
+    for (uint32_t i = 0; i < length; i++) x = addOp(graph, ADD, {x, b});
+    markOutput(graph, x, buffers[2]);
+    CompiledGraph compiled = compileGraph(registry, graph, false);
+
+    printf("%u elements, %zu kernels, %d runs\n", nelem, compiled.kernels.size(), iterations);
+    printf("%-10s %14s %14s %10s\n", "mode", "record us/run", "total us/run", "result");
+
+    // Recorded for every run, the way a single dispatch is recorded into a one-shot command buffer
+    double recordMs = 0;
+    Timer total;
+    for (int i = 0; i < iterations; i++) {
+        Timer timer;
+        VkCommandBuffer commandBuffer = createCommandBuffer(device, commandPool);
+        recordGraph(commandBuffer, compiled);
+        recordMs += timer.elapsedMs();
+
+        executeCommandBuffer(device, commandBuffer, queue);
+        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    }
+    double totalMs = total.elapsedMs();
+    bool correct = checkOutput(buffers[0], buffers[1], buffers[2], nelem, length);
+    printf("%-10s %14.2f %14.2f %10s\n", "record", 1000 * recordMs / iterations, 1000 * totalMs / iterations, correct ? "ok" : "MISMATCH");
+    double recordTotalMs = totalMs;
+
+    GraphCapture capture = captureGraph(registry, compiled, graph, commandPool);
+    ReplayBindings slots[2] = {
+        ReplayBindings{{buffers[0], buffers[1]}, {buffers[2]}},
+        ReplayBindings{{buffers[3], buffers[4]}, {buffers[5]}},
+    };
+
+    recordMs = 0;
+    total.reset();
+    for (int i = 0; i < iterations; i++) {
+        Timer timer;
+        VkCommandBuffer commandBuffer = replayCommandBuffer(capture, slots[i % 2]);
+        recordMs += timer.elapsedMs();
+
+        executeCommandBuffer(device, commandBuffer, queue);
+    }
+    totalMs = total.elapsedMs();
+    correct = checkOutput(buffers[0], buffers[1], buffers[2], nelem, length) &&
+              (iterations < 2 || checkOutput(buffers[3], buffers[4], buffers[5], nelem, length));
+    printf("%-10s %14.2f %14.2f %10s\n", "replay", 1000 * recordMs / iterations, 1000 * totalMs / iterations, correct ? "ok" : "MISMATCH");
+    printf("speedup: %.2fx, %u recordings for %llu replays\n", recordTotalMs / totalMs, capture.recordings,
+           static_cast<unsigned long long>(capture.replayCount));
+
+    destroyGraphCapture(capture);
+    destroyCompiledGraph(compiled);
+    destroyBuffers(buffers);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    destroyPipelineRegistry(registry);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return 0;
+}
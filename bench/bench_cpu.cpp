@@ -0,0 +1,186 @@
+// CPU backend (src/cpu_backend.h) vs. the GPU for ADD from 1 element up, end to end: for the GPU that includes
+// the submission and the wait, which is what small kernels are dominated by. Prints the size the runtime
+// switches to the GPU at, then checks every elementwise op and cast of every dtype run on the GPU against
+// the CPU backend.
+// Runs without a Vulkan device as well, then only the CPU numbers are printed.
+//
+// Usage: ./bench_cpu [max elements] [iterations]
+
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "./runtime.h"
+#include "./bench.h"
+
+static double medianUs(std::vector<double> times) {
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+template <typename F>
+static double timeUs(int iterations, F f) {
+    f();
+    std::vector<double> times;
+    for (int i = 0; i < iterations; i++) {
+        Timer timer;
+        f();
+        times.push_back(timer.elapsedMs() * 1000.0);
+    }
+    return medianUs(times);
+}
+
+// Inputs every op is defined for: positive, non-zero divisors and shift amounts below 32.
+// All of them are exact in every dtype.
+static void fillInputs(Buffer& buffer, uint32_t nelem, const std::string& dtype, uint32_t seed) {
+    for (uint32_t i = 0; i < nelem; i++) {
+        uint32_t value = (i * 2654435761u + seed) % 31 + 1;
+        if (dtype == "float") hostPointer<float>(buffer)[i] = float(value) * 0.25f;
+        else if (dtype == "float16") hostPointer<Float16>(buffer)[i] = toFloat16(float(value) * 0.25f);
+        else if (dtype == "bfloat16") hostPointer<Bfloat16>(buffer)[i] = toBfloat16(float(value) * 0.25f);
+        else if (dtype == "int8") hostPointer<int8_t>(buffer)[i] = int8_t(value);
+        else hostPointer<uint32_t>(buffer)[i] = value;
+    }
+}
+
+static float floatAt(const std::string& dtype, const char* data, uint32_t i) {
+    if (dtype == "float16") return toFloat(reinterpret_cast<const Float16*>(data)[i]);
+    if (dtype == "bfloat16") return toFloat(reinterpret_cast<const Bfloat16*>(data)[i]);
+    return reinterpret_cast<const float*>(data)[i];
+}
+
+// Transcendentals are only accurate to a few ulp on GPUs, everything else has to match exactly.
+// GPUs may round to float16 towards zero instead of to nearest, so narrow floats get an ulp or two.
+static bool matches(Ops op, const std::string& dtype, const char* gpu, const char* cpu, uint32_t i) {
+    VkDeviceSize size = getTypeSize(dtype);
+    if (op == BITCAST || !isFloatDtype(dtype)) return memcmp(gpu + i * size, cpu + i * size, size) == 0;
+
+    float a = floatAt(dtype, gpu, i);
+    float b = floatAt(dtype, cpu, i);
+    float tolerance = (op == EXP2 || op == LOG2 || op == SIN || op == SQRT || op == RECIP) ? 1e-3f : 1e-6f;
+    if (dtype == "float16") tolerance = std::max(tolerance, 2e-3f);
+    if (dtype == "bfloat16") tolerance = std::max(tolerance, 1.6e-2f);
+    return std::fabs(a - b) <= tolerance * std::max(1.0f, std::fabs(b));
+}
+
+// Runs `op` on the GPU and on the CPU backend and counts the elements that differ
+static uint32_t compareBackends(Runtime& runtime, Ops op, const std::vector<Buffer>& src, uint32_t nelem,
+                                const std::string& dtype, const std::string& destDtype) {
+    const std::string& outType = destDtype.empty() ? dtype : destDtype;
+    std::vector<Buffer> dest = {
+        createRuntimeBuffer(runtime, VkDeviceSize(nelem) * getTypeSize(outType), 3),
+        createRuntimeBuffer(runtime, VkDeviceSize(nelem) * getTypeSize(outType), 4),
+    };
+
+    Kernel gpu = createKernel(runtime.registry, op, src, dest[0], dtype, destDtype);
+    Kernel cpu = createCpuKernel(op, src, dest[1], dtype, destDtype);
+    runKernel(runtime, gpu);
+    runKernel(runtime, cpu);
+
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < nelem; i++) {
+        if (!matches(op, outType, hostPointer<char>(dest[0]), hostPointer<char>(dest[1]), i)) mismatches++;
+    }
+    if (mismatches > 0) {
+        std::string name = dtype + (destDtype.empty() ? "" : "->" + destDtype);
+        printf("%-10s %-16s %u of %u elements differ\n", opName(op), name.c_str(), mismatches, nelem);
+    }
+
+    destroyKernel(gpu);
+    destroyKernel(cpu);
+    destroyBuffers(dest);
+    return mismatches;
+}
+
+// Every elementwise op of every dtype, and every CAST and BITCAST between them
+static uint32_t validate(Runtime& runtime) {
+    const uint32_t nelem = 100003; // not a multiple of 4, so the GPU's scalar tail runs too
+    const std::vector<std::string> dtypes = {"float", "int", "uint", "float16", "bfloat16", "int8"};
+    uint32_t failures = 0;
+
+    for (const std::string& dtype : dtypes) {
+        if (!supportsDtype(runtime.physicalDevice, dtype)) {
+            printf("%s: no storage buffer support on this device, skipped\n", dtype.c_str());
+            continue;
+        }
+
+        std::vector<Buffer> buffers;
+        for (uint32_t i = 0; i < 3; i++) {
+            buffers.push_back(createRuntimeBuffer(runtime, VkDeviceSize(nelem) * getTypeSize(dtype), i));
+            fillInputs(buffers[i], nelem, dtype, i * 7);
+        }
+
+        for (int op = EXP2; op <= MULACC; op++) {
+            if (op == CAST || op == BITCAST || !supportsOp(Ops(op), dtype)) continue;
+
+            // Vulkan allows 2.5 ulp for float division, so trunc(a / b) can land on the other side of an integer
+            if (isFloatDtype(dtype) && (op == IDIV || op == MOD)) continue;
+
+            std::vector<Buffer> src(buffers.begin(), buffers.begin() + opArity(Ops(op)));
+            if (compareBackends(runtime, Ops(op), src, nelem, dtype, "") > 0) failures++;
+        }
+
+        for (const std::string& destDtype : dtypes) {
+            if (destDtype == dtype || !supportsDtype(runtime.physicalDevice, destDtype)) continue;
+
+            if (compareBackends(runtime, CAST, {buffers[0]}, nelem, dtype, destDtype) > 0) failures++;
+            if (getTypeSize(dtype) == getTypeSize(destDtype) &&
+                compareBackends(runtime, BITCAST, {buffers[0]}, nelem, dtype, destDtype) > 0) failures++;
+        }
+
+        destroyBuffers(buffers);
+    }
+
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    uint32_t maxElements = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : (1 << 24);
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 20;
+
+    Runtime runtime = createRuntime();
+
+    printf("CPU: %u threads, %s. ", threadCount(*runtime.threadPool), cpuSimdName());
+    if (runtime.hasGpu && runtime.gpuThreshold != UINT32_MAX) printf("Kernels from %u elements up run on the GPU.\n", runtime.gpuThreshold);
+    else printf("Every kernel runs on the CPU.\n");
+
+    printf("%12s %12s %12s %10s %10s %8s\n", "elements", "cpu us", "gpu us", "cpu GB/s", "gpu GB/s", "routed");
+    for (uint32_t nelem = 1; nelem <= maxElements; nelem *= 4) {
+        VkDeviceSize bytes = VkDeviceSize(nelem) * sizeof(float);
+        std::vector<Buffer> buffers = {
+            createRuntimeBuffer(runtime, bytes, 0),
+            createRuntimeBuffer(runtime, bytes, 1),
+            createRuntimeBuffer(runtime, bytes, 2),
+        };
+        fillInputs(buffers[0], nelem, "float", 0);
+        fillInputs(buffers[1], nelem, "float", 1);
+
+        Kernel cpu = createCpuKernel(ADD, {buffers[0], buffers[1]}, buffers[2]);
+        double cpuUs = timeUs(iterations, [&]() { runKernel(runtime, cpu); });
+        destroyKernel(cpu);
+
+        double gpuUs = 0;
+        if (runtime.hasGpu) {
+            Kernel gpu = createKernel(runtime.registry, ADD, {buffers[0], buffers[1]}, buffers[2]);
+            gpuUs = timeUs(iterations, [&]() { runKernel(runtime, gpu); });
+            destroyKernel(gpu);
+        }
+
+        Kernel routed = createRuntimeKernel(runtime, ADD, {buffers[0], buffers[1]}, buffers[2]);
+        printf("%12u %12.2f %12.2f %10.2f %10.2f %8s\n", nelem, cpuUs, gpuUs,
+               gigabytesPerSecond(3.0 * bytes, cpuUs / 1000.0), gigabytesPerSecond(3.0 * bytes, gpuUs / 1000.0),
+               routed.backend == BACKEND_CPU ? "cpu" : "gpu");
+        destroyKernel(routed);
+
+        destroyBuffers(buffers);
+    }
+
+    uint32_t failures = 0;
+    if (runtime.hasGpu) {
+        failures = validate(runtime);
+        printf("GPU vs. CPU backend: %s\n", failures == 0 ? "all ops match" : "MISMATCH");
+    }
+
+    destroyRuntime(runtime);
+    return failures == 0 ? 0 : 1;
+}
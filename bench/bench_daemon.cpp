@@ -0,0 +1,139 @@
+// Per-request latency of out = a * b + a, run the one-shot way (instance, device, pipeline, buffers and copies
+// created for every run, like src/main.cpp) vs. sent to a daemon (src/daemon.h) that keeps all of it warm
+// and reads the tensors straight out of shared memory. The daemon runs on a thread of this process,
+// the client talks to it over the socket all the same.
+//
+// Usage: ./bench_daemon [elements] [requests]
+
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+
+#include "./util.h"
+#include "./staging.h"
+#include "./graph.h"
+#include "./daemon.h"
+#include "./bench.h"
+
+static bool checkResult(const float* a, const float* b, const float* out, uint32_t nelem) {
+    for (uint32_t i = 0; i < nelem; i++) {
+        if (out[i] != a[i] * b[i] + a[i]) return false;
+    }
+    return true;
+}
+
+static double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// Everything a process without a daemon has to do for one graph
+static bool runOneShot(const std::vector<float>& a, const std::vector<float>& b, std::vector<float>& out) {
+    uint32_t nelem = static_cast<uint32_t>(a.size());
+    VkDeviceSize bytes = VkDeviceSize(nelem) * sizeof(float);
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    StagingRing stagingRing = createStagingRing(physicalDevice, device, queueFamilyIndex, queue, 16 << 20, 2);
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+    VkCommandPool commandPool = createCommandPool(device, queueFamilyIndex);
+
+    std::vector<Buffer> buffers = {
+        createBuffer(physicalDevice, device, bytes, 0, MEMORY_DEVICE_LOCAL),
+        createBuffer(physicalDevice, device, bytes, 1, MEMORY_DEVICE_LOCAL),
+        createBuffer(physicalDevice, device, bytes, 2, MEMORY_DEVICE_LOCAL),
+    };
+    copyToBuffer(stagingRing, buffers[0], a.data(), 0, bytes);
+    copyToBuffer(stagingRing, buffers[1], b.data(), 0, bytes);
+
+    Graph graph;
+    uint32_t x = addInput(graph, buffers[0]);
+    uint32_t y = addInput(graph, buffers[1]);
+    markOutput(graph, addOp(graph, MULACC, {x, y, x}), buffers[2]);
+
+    CompiledGraph compiled = compileGraph(registry, graph);
+    VkCommandBuffer commandBuffer = createCommandBuffer(device, commandPool);
+    recordGraph(commandBuffer, compiled);
+    executeCommandBuffer(device, commandBuffer, queue);
+    copyBufferFromDevice(stagingRing, buffers[2], out.data(), 0, bytes);
+
+    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    destroyCompiledGraph(compiled);
+    destroyBuffers(buffers);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    destroyPipelineRegistry(registry);
+    destroyStagingRing(stagingRing);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return checkResult(a.data(), b.data(), out.data(), nelem);
+}
+
+int main(int argc, char** argv) {
+    uint32_t nelem = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1 << 20;
+    int requests = argc > 2 ? std::atoi(argv[2]) : 100;
+    VkDeviceSize bytes = VkDeviceSize(nelem) * sizeof(float);
+
+    std::vector<float> dataA(nelem), dataB(nelem), resultData(nelem);
+    for (uint32_t i = 0; i < nelem; i++) {
+        dataA[i] = float(i % 1024);
+        dataB[i] = float(i % 8) / 4.0f;
+    }
+
+    printf("%u elements, out = a * b + a\n", nelem);
+    printf("%-10s %10s %12s %12s %10s\n", "mode", "requests", "median ms", "first ms", "result");
+
+    // Cold starts are slow enough that a handful of runs gives a stable median
+    std::vector<double> oneShotMs;
+    bool correct = true;
+    for (int i = 0; i < std::min(requests, 5); i++) {
+        Timer timer;
+        correct = runOneShot(dataA, dataB, resultData) && correct;
+        oneShotMs.push_back(timer.elapsedMs());
+    }
+    printf("%-10s %10zu %12.3f %12.3f %10s\n", "one-shot", oneShotMs.size(), median(oneShotMs), oneShotMs[0], correct ? "ok" : "MISMATCH");
+
+    std::string socketPath = "/tmp/bench_daemon." + std::to_string(getpid()) + ".sock";
+    Daemon daemon = createDaemon(socketPath);
+    std::thread server([&daemon]() { runDaemon(daemon); });
+
+    int socket = connectDaemon(socketPath);
+    SharedTensor a = createSharedTensor(bytes);
+    SharedTensor b = createSharedTensor(bytes);
+    SharedTensor out = createSharedTensor(bytes);
+    std::memcpy(a.data, dataA.data(), bytes);
+    std::memcpy(b.data, dataB.data(), bytes);
+
+    WireGraph graph;
+    uint32_t x = wireInput(graph, a, nelem);
+    uint32_t y = wireInput(graph, b, nelem);
+    wireOutput(graph, wireOp(graph, MULACC, {x, y, x}), out);
+
+    // The first request maps the tensors and compiles the graph, the rest only submit
+    std::vector<double> daemonMs;
+    for (int i = 0; i < requests; i++) {
+        Timer timer;
+        runRemoteGraph(socket, graph);
+        daemonMs.push_back(timer.elapsedMs());
+    }
+    correct = checkResult(dataA.data(), dataB.data(), static_cast<float*>(out.data), nelem);
+    printf("%-10s %10zu %12.3f %12.3f %10s\n", "daemon", daemonMs.size(), median(daemonMs), daemonMs[0], correct ? "ok" : "MISMATCH");
+    printf("speedup: %.1fx, tensors %s\n", median(oneShotMs) / median(daemonMs),
+           daemon.importAlignment != 0 ? "imported" : "copied (no VK_EXT_external_memory_host)");
+
+    shutdownDaemon(socket);
+    server.join();
+    close(socket);
+
+    destroySharedTensor(a);
+    destroySharedTensor(b);
+    destroySharedTensor(out);
+    destroyDaemon(daemon);
+
+    return 0;
+}
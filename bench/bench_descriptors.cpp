@@ -0,0 +1,178 @@
+// Host cost of setting up and recording many small dispatches, one kernel after the other, with each way of
+// binding their buffers (src/descriptors.h):
+//   pool per kernel   a descriptor pool, set and writes for every kernel, which is what kernels used to do
+//   allocator         sets from the registry's growable pools, given back one by one when the kernel is destroyed
+//   frame reset       sets from a separate allocator that is reset once per frame instead
+//   push descriptors  no set at all, the buffers are written into the command buffer (VK_KHR_push_descriptor)
+// Every variant records into one command buffer that is then run once, and the result is checked.
+//
+// Usage: ./bench_descriptors [kernels] [iterations]
+
+#include <cstdlib>
+#include <algorithm>
+
+#include "./util.h"
+#include "./kernel.h"
+#include "./bench.h"
+
+struct Context {
+    VkDevice device;
+    VkQueue queue;
+    VkCommandBuffer commandBuffer;
+    std::vector<Buffer> buffers;
+    uint32_t nelem;
+};
+
+static void begin(Context& context) {
+    vkResetCommandBuffer(context.commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(context.commandBuffer, &beginInfo);
+}
+
+// Runs what was recorded and checks c = a + b
+static bool finish(Context& context) {
+    vkEndCommandBuffer(context.commandBuffer);
+    memset(hostPointer<float>(context.buffers[2]), 0, context.nelem * sizeof(float));
+    executeCommandBuffer(context.device, context.commandBuffer, context.queue);
+
+    for (uint32_t i = 0; i < context.nelem; i++) {
+        if (hostPointer<float>(context.buffers[2])[i] != float(i) + 1.0f) return false;
+    }
+    return true;
+}
+
+// Median host time per kernel in microseconds, for creating and recording `kernels` kernels with `run` and
+// destroying them with `cleanup`, which has to wait until the command buffer has run
+template <typename F, typename G>
+static double usPerKernel(Context& context, uint32_t kernels, int iterations, bool& passed, F run, G cleanup) {
+    std::vector<double> times;
+    passed = true;
+
+    for (int i = 0; i < iterations; i++) {
+        begin(context);
+        Timer timer;
+        run();
+        double ms = timer.elapsedMs();
+
+        passed = finish(context) && passed;
+
+        timer.reset();
+        cleanup();
+        times.push_back((ms + timer.elapsedMs()) * 1000.0 / kernels);
+    }
+
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+static void recordDispatch(Context& context, const Pipeline& pipeline) {
+    vkCmdBindPipeline(context.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+    vkCmdPushConstants(context.commandBuffer, pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &context.nelem);
+    vkCmdDispatch(context.commandBuffer, elementwiseGroupCount(context.nelem), 1, 1);
+}
+
+int main(int argc, char** argv) {
+    uint32_t kernels = argc > 1 ? std::atoi(argv[1]) : 10000;
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 5;
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+
+    Context context;
+    context.device = createDevice(physicalDevice, queueFamilyIndex);
+    context.queue = getQueue(context.device, queueFamilyIndex, 0);
+    context.nelem = 1024;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    VkCommandPool commandPool;
+    if (vkCreateCommandPool(context.device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create command pool!");
+    }
+    context.commandBuffer = createCommandBuffer(context.device, commandPool);
+
+    VkDeviceSize bytes = VkDeviceSize(context.nelem) * sizeof(float);
+    for (uint32_t i = 0; i < 3; i++) context.buffers.push_back(createBuffer(physicalDevice, context.device, bytes, i, MEMORY_HOST_VISIBLE));
+    for (uint32_t i = 0; i < context.nelem; i++) {
+        hostPointer<float>(context.buffers[0])[i] = float(i);
+        hostPointer<float>(context.buffers[1])[i] = 1.0f;
+    }
+
+    // Separate registries, so the pipelines of one have descriptor set layouts and the other's have push layouts
+    PipelineRegistry setRegistry = createPipelineRegistry(physicalDevice, context.device, "", false);
+    PipelineRegistry pushRegistry = createPipelineRegistry(physicalDevice, context.device, "", true);
+
+    // Builds the pipeline up front, only descriptor handling is timed
+    Kernel warmup = createKernel(setRegistry, ADD, {context.buffers[0], context.buffers[1]}, context.buffers[2]);
+    Pipeline& pipeline = *warmup.pipeline;
+    std::vector<Buffer> bindings = context.buffers;
+
+    printf("%-18s %12s %8s\n", "binding", "us/kernel", "check");
+    bool passed;
+
+    std::vector<VkDescriptorPool> pools;
+    double poolUs = usPerKernel(context, kernels, iterations, passed, [&]() {
+        for (uint32_t i = 0; i < kernels; i++) {
+            VkDescriptorPool pool = createDescriptorPool(context.device, bindings);
+            VkDescriptorSet set = createDescriptorSet(context.device, pool, pipeline.descriptorSetLayout, bindings);
+            vkCmdBindDescriptorSets(context.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, 1, &set, 0, nullptr);
+            recordDispatch(context, pipeline);
+            pools.push_back(pool);
+        }
+    }, [&]() {
+        for (VkDescriptorPool pool : pools) vkDestroyDescriptorPool(context.device, pool, nullptr);
+        pools.clear();
+    });
+    printf("%-18s %12.3f %8s\n", "pool per kernel", poolUs, passed ? "ok" : "FAILED");
+
+    std::vector<Kernel> created;
+    auto createAndRecord = [&](PipelineRegistry& registry) {
+        for (uint32_t i = 0; i < kernels; i++) {
+            created.push_back(createKernel(registry, ADD, {context.buffers[0], context.buffers[1]}, context.buffers[2]));
+            recordKernel(context.commandBuffer, created.back());
+        }
+    };
+    auto destroyCreated = [&]() {
+        for (Kernel& kernel : created) destroyKernel(kernel);
+        created.clear();
+    };
+
+    double allocatorUs = usPerKernel(context, kernels, iterations, passed, [&]() { createAndRecord(setRegistry); }, destroyCreated);
+    printf("%-18s %12.3f %8s\n", "allocator", allocatorUs, passed ? "ok" : "FAILED");
+
+    DescriptorAllocator frameAllocator = createDescriptorAllocator(context.device, 1024);
+    double frameUs = usPerKernel(context, kernels, iterations, passed, [&]() {
+        // The previous frame has finished, all of its sets go back in one call per pool
+        resetDescriptorAllocator(frameAllocator);
+        for (uint32_t i = 0; i < kernels; i++) {
+            DescriptorAllocation allocation = allocateDescriptorSet(frameAllocator, pipeline.descriptorSetLayout, bindings);
+            vkCmdBindDescriptorSets(context.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, 1, &allocation.set, 0, nullptr);
+            recordDispatch(context, pipeline);
+        }
+    }, []() {});
+    printf("%-18s %12.3f %8s\n", "frame reset", frameUs, passed ? "ok" : "FAILED");
+
+    if (pushRegistry.pushDescriptorSet != nullptr) {
+        double pushUs = usPerKernel(context, kernels, iterations, passed, [&]() { createAndRecord(pushRegistry); }, destroyCreated);
+        printf("%-18s %12.3f %8s\n", "push descriptors", pushUs, passed ? "ok" : "FAILED");
+    } else {
+        printf("%-18s %12s\n", "push descriptors", "n/a (no VK_KHR_push_descriptor)");
+    }
+
+    destroyKernel(warmup);
+    destroyDescriptorAllocator(frameAllocator);
+    destroyPipelineRegistry(pushRegistry);
+    destroyPipelineRegistry(setRegistry);
+    destroyBuffers(context.buffers);
+    vkDestroyCommandPool(context.device, commandPool, nullptr);
+    vkDestroyDevice(context.device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+    return 0;
+}
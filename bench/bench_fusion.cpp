@@ -0,0 +1,139 @@
+// Fused vs. unfused execution of a long chain of elementwise ops.
+// Unfused, every op is its own dispatch and writes its result to global memory. Fused, the whole
+// chain is one generated shader that reads the two inputs and writes the one output.
+//
+// Usage: ./bench_fusion [elements] [chain length] [iterations]
+
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "./util.h"
+#include "./staging.h"
+#include "./graph.h"
+#include "./bench.h"
+
+// result = f_n(... f_1(a) ...), with `a` and `b` feeding back in along the way. Values stay bounded for any length.
+static uint32_t buildChain(Graph& graph, uint32_t a, uint32_t b, uint32_t length) {
+    uint32_t t = a;
+    for (uint32_t i = 0; i < length; i++) {
+        switch (i % 6) {
+            case 0: t = addOp(graph, MULACC, {t, b, a}); break;
+            case 1: t = addOp(graph, MAX, {t, a}); break;
+            case 2: t = addOp(graph, MUL, {t, b}); break;
+            case 3: t = addOp(graph, SUB, {t, b}); break;
+            case 4: t = addOp(graph, NEG, {t}); break;
+            default: t = addOp(graph, ADD, {t, a}); break;
+        }
+    }
+    return t;
+}
+
+static float referenceChain(float a, float b, uint32_t length) {
+    float t = a;
+    for (uint32_t i = 0; i < length; i++) {
+        switch (i % 6) {
+            case 0: t = std::fma(t, b, a); break;
+            case 1: t = std::max(t, a); break;
+            case 2: t = t * b; break;
+            case 3: t = t - b; break;
+            case 4: t = -t; break;
+            default: t = t + a; break;
+        }
+    }
+    return t;
+}
+
+// Bytes a compiled graph reads and writes in global memory per run
+static double bytesMoved(const CompiledGraph& compiled) {
+    double bytes = 0;
+    for (const FusedKernel& kernel : compiled.kernels) {
+        bytes += double(kernel.inputs.size() + kernel.outputs.size()) * kernel.nelem * sizeof(float);
+    }
+    return bytes;
+}
+
+int main(int argc, char** argv) {
+    uint32_t nelem = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : (1 << 24);
+    uint32_t length = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 32;
+    int iterations = argc > 3 ? std::atoi(argv[3]) : 10;
+    VkDeviceSize bytes = VkDeviceSize(nelem) * sizeof(float);
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    StagingRing stagingRing = createStagingRing(physicalDevice, device, queueFamilyIndex, queue, 64 << 20, 4);
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+    VkCommandPool commandPool = createCommandPool(device, queueFamilyIndex);
+
+    std::vector<float> dataA(nelem), dataB(nelem), resultData(nelem);
+    for (uint32_t i = 0; i < nelem; i++) {
+        dataA[i] = float(i % 1024) / 1024.0f;
+        dataB[i] = 0.5f + float(i % 7) / 16.0f;
+    }
+
+    std::vector<Buffer> buffers = {
+        createBuffer(physicalDevice, device, bytes, 0, MEMORY_DEVICE_LOCAL),
+        createBuffer(physicalDevice, device, bytes, 1, MEMORY_DEVICE_LOCAL),
+        createBuffer(physicalDevice, device, bytes, 2, MEMORY_DEVICE_LOCAL),
+    };
+    copyToBuffer(stagingRing, buffers[0], dataA.data(), 0, bytes);
+    copyToBuffer(stagingRing, buffers[1], dataB.data(), 0, bytes);
+
+    Graph graph;
+    uint32_t a = addInput(graph, buffers[0]);
+    uint32_t b = addInput(graph, buffers[1]);
+    markOutput(graph, buildChain(graph, a, b, length), buffers[2]);
+
+    printf("%u elements, chain of %u ops\n", nelem, length);
+    printf("%-8s %8s %12s %12s %12s %12s %10s\n", "mode", "kernels", "compile ms", "MB moved", "run ms", "GB/s", "result");
+
+    double unfusedMs = 0;
+    for (bool fuse : {false, true}) {
+        Timer timer;
+        CompiledGraph compiled = compileGraph(registry, graph, fuse);
+        double compileMs = timer.elapsedMs();
+
+        VkCommandBuffer commandBuffer = createCommandBuffer(device, commandPool);
+        recordGraph(commandBuffer, compiled);
+
+        // Warmup
+        executeCommandBuffer(device, commandBuffer, queue);
+
+        timer.reset();
+        for (int i = 0; i < iterations; i++) {
+            executeCommandBuffer(device, commandBuffer, queue);
+        }
+        double runMs = timer.elapsedMs() / iterations;
+        if (!fuse) unfusedMs = runMs;
+
+        copyBufferFromDevice(stagingRing, buffers[2], resultData.data(), 0, bytes);
+
+        bool correct = true;
+        for (uint32_t i = 0; i < nelem && correct; i++) {
+            float expected = referenceChain(dataA[i], dataB[i], length);
+            correct = std::fabs(resultData[i] - expected) <= 1e-4f * std::fabs(expected) + 1e-5f;
+        }
+
+        double moved = bytesMoved(compiled);
+        printf("%-8s %8zu %12.2f %12.1f %12.3f %12.2f %10s\n", fuse ? "fused" : "unfused", compiled.kernels.size(),
+               compileMs, moved / 1e6, runMs, gigabytesPerSecond(moved, runMs), correct ? "ok" : "MISMATCH");
+
+        if (fuse) printf("speedup: %.2fx\n", unfusedMs / runMs);
+
+        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+        destroyCompiledGraph(compiled);
+    }
+
+    destroyBuffers(buffers);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    destroyPipelineRegistry(registry);
+    destroyStagingRing(stagingRing);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+// Bandwidth of every elementwise kernel, for every dtype it supports.
+// The element count is deliberately not a multiple of 4, so the scalar tail runs as well.
+// Each result is checked against a CPU reference (THREEFRY only gets timed).
+//
+// Usage: ./bench_kernels [elements] [kernel iterations]
+
+#include <cstdlib>
+#include <cmath>
+
+#include "./util.h"
+#include "./staging.h"
+#include "./kernel.h"
+#include "./bench.h"
+
+template<typename T>
+static T reference(Ops op, T a, T b, T c);
+
+template<>
+float reference<float>(Ops op, float a, float b, float c) {
+    switch (op) {
+        case EXP2: return std::exp2(a);
+        case LOG2: return std::log2(a);
+        case SIN: return std::sin(a);
+        case SQRT: return std::sqrt(a);
+        case RECIP: return 1.0f / a;
+        case NEG: return -a;
+        case ADD: return a + b;
+        case SUB: return a - b;
+        case MUL: return a * b;
+        case IDIV: return std::trunc(a / b);
+        case MOD: return a - b * std::trunc(a / b);
+        case MAX: return std::max(a, b);
+        case CMPLT: return a < b;
+        case CMPNE: return a != b;
+        case WHERE: return a != 0 ? b : c;
+        case MULACC: return a * b + c;
+        default: return 0;
+    }
+}
+
+template<typename T>
+static T integerReference(Ops op, T a, T b, T c) {
+    switch (op) {
+        case NEG: return -a;
+        case ADD: return a + b;
+        case SUB: return a - b;
+        case MUL: return a * b;
+        case IDIV: return a / b;
+        case MOD: return a % b;
+        case MAX: return std::max(a, b);
+        case CMPLT: return a < b;
+        case CMPNE: return a != b;
+        case XOR: return a ^ b;
+        case SHL: return a << b;
+        case SHR: return a >> b;
+        case OR: return a | b;
+        case AND: return a & b;
+        case WHERE: return a != 0 ? b : c;
+        case MULACC: return a * b + c;
+        default: return 0;
+    }
+}
+
+template<>
+int32_t reference<int32_t>(Ops op, int32_t a, int32_t b, int32_t c) { return integerReference(op, a, b, c); }
+
+template<>
+uint32_t reference<uint32_t>(Ops op, uint32_t a, uint32_t b, uint32_t c) { return integerReference(op, a, b, c); }
+
+static bool matches(float got, float expected) {
+    // Transcendentals on the GPU are only accurate to a few ulp
+    return got == expected || std::fabs(got - expected) <= 1e-3f * std::fabs(expected) + 1e-6f;
+}
+
+static bool matches(int32_t got, int32_t expected) { return got == expected; }
+static bool matches(uint32_t got, uint32_t expected) { return got == expected; }
+
+// Small non-negative inputs keep every op defined: no division by zero, no oversized shifts
+template<typename T>
+static void fillInputs(std::vector<std::vector<T>>& inputs, uint32_t nelem) {
+    for (uint32_t i = 0; i < nelem; i++) {
+        inputs[0][i] = T(i % 5);
+        inputs[1][i] = T(1 + i % 7);
+        inputs[2][i] = T(i % 11);
+    }
+}
+
+template<typename T>
+static bool check(Ops op, std::vector<std::vector<T>>& inputs, std::vector<T>& result, uint32_t nelem) {
+    if (op == THREEFRY) return true;
+
+    for (uint32_t i = 0; i < nelem; i++) {
+        T expected = reference<T>(op, inputs[0][i], inputs[1][i], inputs[2][i]);
+        if (!matches(result[i], expected)) {
+            fprintf(stderr, "%s mismatch at %u: got %g, expected %g\n", opName(op), i, double(result[i]), double(expected));
+            return false;
+        }
+    }
+    return true;
+}
+
+struct BenchContext {
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    StagingRing* stagingRing;
+    PipelineRegistry* registry;
+    uint32_t nelem;
+    int iterations;
+};
+
+template<typename T>
+static bool benchDtype(BenchContext& ctx, const std::string& dtype) {
+    VkDeviceSize bytes = VkDeviceSize(ctx.nelem) * sizeof(T);
+
+    std::vector<std::vector<T>> inputs(3, std::vector<T>(ctx.nelem));
+    std::vector<T> result(ctx.nelem);
+    fillInputs(inputs, ctx.nelem);
+
+    std::vector<Buffer> sources;
+    for (uint32_t i = 0; i < 3; i++) {
+        sources.push_back(createBuffer(ctx.physicalDevice, ctx.device, bytes, i, MEMORY_DEVICE_LOCAL));
+        copyToBuffer(*ctx.stagingRing, sources[i], inputs[i].data(), 0, bytes);
+    }
+    Buffer dest = createBuffer(ctx.physicalDevice, ctx.device, bytes, 3, MEMORY_DEVICE_LOCAL);
+
+    bool success = true;
+    for (int op = EXP2; op <= MULACC; op++) {
+        if (op == CAST || op == BITCAST || !supportsOp(Ops(op), dtype)) continue;
+
+        uint32_t arity = opArity(Ops(op));
+        std::vector<Buffer> src(sources.begin(), sources.begin() + arity);
+        Kernel kernel = createKernel(*ctx.registry, Ops(op), src, dest, dtype);
+
+        // All iterations go into one submission, the barriers keep them from overlapping
+        std::vector<Kernel> kernels(ctx.iterations, kernel);
+        VkCommandBuffer commandBuffer = createCommandBuffer(ctx.device, ctx.commandPool);
+        recordKernels(commandBuffer, kernels);
+
+        // Warmup
+        executeCommandBuffer(ctx.device, commandBuffer, ctx.queue);
+
+        Timer timer;
+        executeCommandBuffer(ctx.device, commandBuffer, ctx.queue);
+        double kernelMs = timer.elapsedMs() / ctx.iterations;
+
+        copyBufferFromDevice(*ctx.stagingRing, dest, result.data(), 0, bytes);
+        bool correct = check<T>(Ops(op), inputs, result, ctx.nelem);
+        success = success && correct;
+
+        printf("%-10s %-6s %12u %12.2f %10s\n", opName(Ops(op)), dtype.c_str(), ctx.nelem,
+               gigabytesPerSecond(double(arity + 1) * bytes, kernelMs), correct ? "ok" : "MISMATCH");
+
+        vkFreeCommandBuffers(ctx.device, ctx.commandPool, 1, &commandBuffer);
+        destroyKernel(kernel);
+    }
+
+    sources.push_back(dest);
+    destroyBuffers(sources);
+    return success;
+}
+
+// CAST and BITCAST between every pair of dtypes
+static bool benchCasts(BenchContext& ctx) {
+    static const char* dtypes[] = {"float", "int", "uint"};
+    VkDeviceSize bytes = VkDeviceSize(ctx.nelem) * 4;
+
+    std::vector<float> input(ctx.nelem);
+    std::vector<uint32_t> result(ctx.nelem);
+    for (uint32_t i = 0; i < ctx.nelem; i++) input[i] = float(i % 1000);
+
+    Buffer src = createBuffer(ctx.physicalDevice, ctx.device, bytes, 0, MEMORY_DEVICE_LOCAL);
+    Buffer dest = createBuffer(ctx.physicalDevice, ctx.device, bytes, 1, MEMORY_DEVICE_LOCAL);
+
+    // The same bits are read as every source dtype, small floats are valid ints and uints bit-wise too
+    copyToBuffer(*ctx.stagingRing, src, input.data(), 0, bytes);
+
+    bool success = true;
+    for (const char* from : dtypes) {
+        for (const char* to : dtypes) {
+            if (std::string(from) == to) continue;
+
+            for (Ops op : {CAST, BITCAST}) {
+                Kernel kernel = createKernel(*ctx.registry, op, {src}, dest, from, to);
+
+                std::vector<Kernel> kernels(ctx.iterations, kernel);
+                VkCommandBuffer commandBuffer = createCommandBuffer(ctx.device, ctx.commandPool);
+                recordKernels(commandBuffer, kernels);
+                executeCommandBuffer(ctx.device, commandBuffer, ctx.queue);
+
+                Timer timer;
+                executeCommandBuffer(ctx.device, commandBuffer, ctx.queue);
+                double kernelMs = timer.elapsedMs() / ctx.iterations;
+
+                copyBufferFromDevice(*ctx.stagingRing, dest, result.data(), 0, bytes);
+
+                bool correct = true;
+                for (uint32_t i = 0; i < ctx.nelem && correct; i++) {
+                    uint32_t bits;
+                    memcpy(&bits, &input[i], sizeof(bits));
+
+                    // Source value as the source dtype, then converted (CAST) or reinterpreted (BITCAST)
+                    uint32_t expected = bits;
+                    if (op == CAST) {
+                        double value = std::string(from) == "float" ? double(input[i]) : std::string(from) == "int" ? double(int32_t(bits)) : double(bits);
+                        if (std::string(to) == "float") {
+                            float converted = float(value);
+                            memcpy(&expected, &converted, sizeof(expected));
+                        } else {
+                            expected = std::string(to) == "int" ? uint32_t(int32_t(value)) : uint32_t(value);
+                        }
+                    }
+                    correct = result[i] == expected;
+                }
+                success = success && correct;
+
+                std::string name = std::string(opName(op)) + " " + from + "->" + to;
+                printf("%-24s %12u %12.2f %10s\n", name.c_str(), ctx.nelem,
+                       gigabytesPerSecond(2.0 * bytes, kernelMs), correct ? "ok" : "MISMATCH");
+
+                vkFreeCommandBuffers(ctx.device, ctx.commandPool, 1, &commandBuffer);
+                destroyKernel(kernel);
+            }
+        }
+    }
+
+    std::vector<Buffer> buffers = {src, dest};
+    destroyBuffers(buffers);
+    return success;
+}
+
+int main(int argc, char** argv) {
+    uint32_t nelem = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : (1 << 24) + 3;
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 20;
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    StagingRing stagingRing = createStagingRing(physicalDevice, device, queueFamilyIndex, queue, 64 << 20, 4);
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+    VkCommandPool commandPool = createCommandPool(device, queueFamilyIndex);
+
+    BenchContext ctx{physicalDevice, device, queue, commandPool, &stagingRing, &registry, nelem, iterations};
+
+    printf("%-10s %-6s %12s %12s %10s\n", "op", "dtype", "elements", "GB/s", "result");
+    bool success = benchDtype<float>(ctx, "float");
+    success = benchDtype<int32_t>(ctx, "int") && success;
+    success = benchDtype<uint32_t>(ctx, "uint") && success;
+
+    printf("\n%-24s %12s %12s %10s\n", "cast", "elements", "GB/s", "result");
+    success = benchCasts(ctx) && success;
+
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    destroyPipelineRegistry(registry);
+    destroyStagingRing(stagingRing);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+// GFLOP/s of the matmul kernels (src/matmul.h): the naive one, the tiled one and, on devices with
+// VK_KHR_cooperative_matrix, the one on the matrix units, against the multithreaded CPU reference.
+// Square matrices with and without transposed operands, and a batch of smaller ones. Every GPU result
+// is checked against the CPU's.
+//
+// Usage: ./bench_matmul [size] [iterations]
+
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "./util.h"
+#include "./staging.h"
+#include "./matmul.h"
+#include "./cpu_backend.h"
+#include "./bench.h"
+
+struct BenchContext {
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    StagingRing* stagingRing;
+    PipelineRegistry* registry;
+    ThreadPool* threadPool;
+    int iterations;
+};
+
+static double gflops(const MatmulShape& shape, double ms) {
+    return ms > 0 ? 2.0 * shape.batch * shape.M * shape.N * shape.K / (ms * 1e6) : 0;
+}
+
+// Summation order differs between the kernels and the CPU. float16 inputs lose a lot more than that.
+static bool matches(const std::vector<float>& got, const std::vector<float>& expected, uint32_t K, bool float16Inputs) {
+    float tolerance = float16Inputs ? 2e-3f * std::sqrt(float(K)) : 1e-5f * K;
+    for (size_t i = 0; i < got.size(); i++) {
+        if (!(std::fabs(got[i] - expected[i]) <= tolerance + 1e-4f * std::fabs(expected[i]))) return false;
+    }
+    return true;
+}
+
+static void printRow(const std::string& label, const char* kernel, double ms, const MatmulShape& shape, const char* result) {
+    printf("%-22s %-18s %10.3f %10.1f %10s\n", label.c_str(), kernel, ms, gflops(shape, ms), result);
+}
+
+static bool benchKernel(BenchContext& ctx, const std::string& label, MatmulPath path, Buffer& a, Buffer& b, Buffer& c,
+                        const MatmulShape& shape, const std::vector<float>& expected) {
+    MatmulKernel kernel = createMatmulKernel(*ctx.registry, a, b, c, shape, path);
+
+    VkCommandBuffer commandBuffer = createCommandBuffer(ctx.device, ctx.commandPool);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    for (int i = 0; i < ctx.iterations; i++) {
+        if (i > 0) recordKernelBarrier(commandBuffer);
+        recordMatmulKernel(commandBuffer, kernel);
+    }
+    vkEndCommandBuffer(commandBuffer);
+
+    // Warmup
+    executeCommandBuffer(ctx.device, commandBuffer, ctx.queue);
+
+    Timer timer;
+    executeCommandBuffer(ctx.device, commandBuffer, ctx.queue);
+    double ms = timer.elapsedMs() / ctx.iterations;
+
+    std::vector<float> result(expected.size());
+    copyBufferFromDevice(*ctx.stagingRing, c, result.data(), 0, result.size() * sizeof(float));
+    bool correct = matches(result, expected, shape.K, kernel.float16Inputs);
+
+    std::string name = matmulPathName(kernel.path);
+    if (kernel.path == MATMUL_COOPERATIVE) name += kernel.float16Inputs ? " (f16 in)" : " (f32)";
+    printRow(label, name.c_str(), ms, shape, correct ? "ok" : "MISMATCH");
+
+    vkFreeCommandBuffers(ctx.device, ctx.commandPool, 1, &commandBuffer);
+    destroyMatmulKernel(kernel);
+    return correct;
+}
+
+// Runs every kernel on random operands for `shape`, the CPU result is the reference
+static bool benchShape(BenchContext& ctx, const std::string& label, const MatmulShape& shape) {
+    size_t countA = size_t(shape.batch) * shape.M * shape.K;
+    size_t countB = size_t(shape.batch) * shape.K * shape.N;
+    size_t countC = size_t(shape.batch) * shape.M * shape.N;
+
+    std::vector<float> dataA(countA), dataB(countB), expected(countC);
+    for (size_t i = 0; i < countA; i++) dataA[i] = float(rand()) / RAND_MAX * 2.0f - 1.0f;
+    for (size_t i = 0; i < countB; i++) dataB[i] = float(rand()) / RAND_MAX * 2.0f - 1.0f;
+
+    runCpuMatmul(*ctx.threadPool, dataA.data(), dataB.data(), expected.data(), shape);
+    Timer timer;
+    runCpuMatmul(*ctx.threadPool, dataA.data(), dataB.data(), expected.data(), shape);
+    printRow(label, "cpu", timer.elapsedMs(), shape, "reference");
+
+    std::vector<Buffer> buffers = {
+        createBuffer(ctx.physicalDevice, ctx.device, countA * sizeof(float), 0, MEMORY_DEVICE_LOCAL),
+        createBuffer(ctx.physicalDevice, ctx.device, countB * sizeof(float), 1, MEMORY_DEVICE_LOCAL),
+        createBuffer(ctx.physicalDevice, ctx.device, countC * sizeof(float), 2, MEMORY_DEVICE_LOCAL),
+    };
+    copyToBuffer(*ctx.stagingRing, buffers[0], dataA.data(), 0, countA * sizeof(float));
+    copyToBuffer(*ctx.stagingRing, buffers[1], dataB.data(), 0, countB * sizeof(float));
+
+    bool success = true;
+    std::vector<MatmulPath> paths = {MATMUL_NAIVE, MATMUL_TILED};
+    if (!ctx.registry->cooperativeMatrixShapes.empty()) paths.push_back(MATMUL_COOPERATIVE);
+
+    for (MatmulPath path : paths) {
+        try {
+            success = benchKernel(ctx, label, path, buffers[0], buffers[1], buffers[2], shape, expected) && success;
+        } catch (const std::exception& error) {
+            printf("%-22s %-18s skipped, %s\n", label.c_str(), matmulPathName(path), error.what());
+        }
+    }
+
+    destroyBuffers(buffers);
+    return success;
+}
+
+int main(int argc, char** argv) {
+    uint32_t size = argc > 1 ? std::atoi(argv[1]) : 1024;
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 10;
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    StagingRing stagingRing = createStagingRing(physicalDevice, device, queueFamilyIndex, queue, 64 << 20, 4);
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+    loadCooperativeMatrixShapes(instance, registry);
+    VkCommandPool commandPool = createCommandPool(device, queueFamilyIndex);
+    ThreadPool* threadPool = createThreadPool();
+
+    BenchContext ctx{physicalDevice, device, queue, commandPool, &stagingRing, &registry, threadPool, iterations};
+
+    printf("cooperative matrix shapes:");
+    for (const VkCooperativeMatrixPropertiesKHR& shape : registry.cooperativeMatrixShapes) {
+        printf(" %ux%ux%u%s", shape.MSize, shape.NSize, shape.KSize, shape.AType == VK_COMPONENT_TYPE_FLOAT16_KHR ? "(f16)" : "(f32)");
+    }
+    printf("%s\n", registry.cooperativeMatrixShapes.empty() ? " none" : "");
+    printf("cpu: %u threads, %s\n", threadCount(*threadPool), cpuSimdName());
+    printf("%-22s %-18s %10s %10s %10s\n", "shape", "kernel", "ms", "GFLOP/s", "result");
+
+    std::string square = std::to_string(size) + "^3";
+    uint32_t batchSize = std::max(16u, size / 4);
+    std::string batched = "8 x " + std::to_string(batchSize) + "^3";
+
+    bool success = true;
+    success = benchShape(ctx, square, matmulShape(size, size, size)) && success;
+    success = benchShape(ctx, square + " A^T", matmulShape(size, size, size, 1, true, false)) && success;
+    success = benchShape(ctx, square + " B^T", matmulShape(size, size, size, 1, false, true)) && success;
+    success = benchShape(ctx, batched, matmulShape(batchSize, batchSize, batchSize, 8)) && success;
+
+    // Sizes that are not a multiple of any tile
+    uint32_t odd = size - size / 8 + 3;
+    success = benchShape(ctx, std::to_string(odd) + "x" + std::to_string(odd + 2) + "x" + std::to_string(odd - 1),
+                         matmulShape(odd, odd + 2, odd - 1)) && success;
+
+    destroyThreadPool(threadPool);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    destroyPipelineRegistry(registry);
+    destroyStagingRing(stagingRing);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+// Compares host-visible, device-local and imported host buffers on large arrays.
+// For each memory mode and size it measures upload, add.comp and download bandwidth.
+// Imported buffers are the host arrays themselves, so they have no transfers to measure.
+//
+// Usage: ./bench_memory_modes [max elements] [kernel iterations]
+
+#include <cstdlib>
+#include <algorithm>
+
+#include "./util.h"
+#include "./staging.h"
+#include "./bench.h"
+
+static const char* modeName(MemoryMode mode) {
+    switch (mode) {
+        case MEMORY_DEVICE_LOCAL: return "device-local";
+        case MEMORY_HOST_IMPORTED: return "imported";
+        default: return "host-visible";
+    }
+}
+
+int main(int argc, char** argv) {
+    VkDeviceSize maxElements = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : (1 << 26);
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 10;
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    // A single storage buffer binding can not be larger than maxStorageBufferRange
+    maxElements = std::min<VkDeviceSize>(maxElements, properties.limits.maxStorageBufferRange / sizeof(float));
+
+    StagingRing stagingRing = createStagingRing(physicalDevice, device, queueFamilyIndex, queue, 64 << 20, 4);
+    VkCommandPool commandPool = createCommandPool(device, queueFamilyIndex);
+
+    // The pipeline is independent of buffer sizes, only the layout (three storage buffers) matters
+    Buffer dummy = createBuffer(physicalDevice, device, 256 * sizeof(float), 0);
+    std::vector<Buffer> layoutBuffers = {dummy, dummy, dummy};
+    layoutBuffers[1].binding = 1;
+    layoutBuffers[2].binding = 2;
+
+    VkDescriptorSetLayout descriptorSetLayout = createDescriptorSetLayout(device, layoutBuffers);
+    VkPipelineLayout pipelineLayout = createPipelineLayout(device, descriptorSetLayout);
+    std::vector<char> shaderCode = readFile("shaders/add.spv");
+    VkShaderModule shaderModule = createShaderModule(device, shaderCode);
+    VkPipeline pipeline = createPipeline(device, pipelineLayout, shaderModule, "main");
+
+    printf("%-14s %12s %14s %14s %14s\n", "mode", "elements", "upload GB/s", "kernel GB/s", "download GB/s");
+
+    std::vector<MemoryMode> modes = {MEMORY_HOST_VISIBLE, MEMORY_DEVICE_LOCAL};
+    if (getHostImportAlignment(physicalDevice) != 0) modes.push_back(MEMORY_HOST_IMPORTED);
+
+    for (MemoryMode mode : modes) {
+        // Sizes are kept at multiples of add.comp's workgroup size, so every dispatched thread has an element
+        for (VkDeviceSize nelem = 1 << 20; nelem <= maxElements; nelem *= 4) {
+            VkDeviceSize bytes = nelem * sizeof(float);
+
+            std::vector<float, AlignedAllocator<float>> dataA(nelem), dataB(nelem), resultData(nelem);
+            for (VkDeviceSize i = 0; i < nelem; i++) {
+                dataA[i] = float(i % 1024);
+                dataB[i] = float(i % 7);
+            }
+
+            std::vector<Buffer> bufferList;
+            if (mode == MEMORY_HOST_IMPORTED) {
+                bufferList = {
+                    importHostBuffer(physicalDevice, device, dataA.data(), bytes, 0),
+                    importHostBuffer(physicalDevice, device, dataB.data(), bytes, 1),
+                    importHostBuffer(physicalDevice, device, resultData.data(), bytes, 2),
+                };
+            } else {
+                bufferList = {
+                    createBuffer(physicalDevice, device, bytes, 0, mode),
+                    createBuffer(physicalDevice, device, bytes, 1, mode),
+                    createBuffer(physicalDevice, device, bytes, 2, mode),
+                };
+            }
+
+            Timer timer;
+            if (mode != MEMORY_HOST_IMPORTED) {
+                copyToBuffer(stagingRing, bufferList[0], dataA.data(), 0, bytes);
+                copyToBuffer(stagingRing, bufferList[1], dataB.data(), 0, bytes);
+            }
+            double uploadMs = timer.elapsedMs();
+
+            VkDescriptorPool descriptorPool = createDescriptorPool(device, bufferList);
+            VkDescriptorSet descriptorSet = createDescriptorSet(device, descriptorPool, descriptorSetLayout, bufferList);
+            VkCommandBuffer commandBuffer = createCommandBuffer(device, commandPool);
+            recordCommandBuffer(commandBuffer, pipeline, pipelineLayout, descriptorSet, (uint32_t)(nelem / 256), 1, 1);
+
+            // Warmup
+            executeCommandBuffer(device, commandBuffer, queue);
+
+            timer.reset();
+            for (int i = 0; i < iterations; i++) {
+                executeCommandBuffer(device, commandBuffer, queue);
+            }
+            double kernelMs = timer.elapsedMs() / iterations;
+
+            timer.reset();
+            if (mode != MEMORY_HOST_IMPORTED) {
+                copyBufferFromDevice(stagingRing, bufferList[2], resultData.data(), 0, bytes);
+            }
+            double downloadMs = timer.elapsedMs();
+
+            for (VkDeviceSize i = 0; i < nelem; i += nelem / 16) {
+                if (resultData[i] != dataA[i] + dataB[i]) {
+                    fprintf(stderr, "Mismatch at %llu in %s mode\n", (unsigned long long)i, modeName(mode));
+                    return 1;
+                }
+            }
+
+            if (mode == MEMORY_HOST_IMPORTED) {
+                printf("%-14s %12llu %14s %14.2f %14s\n", modeName(mode), (unsigned long long)nelem,
+                       "zero-copy", gigabytesPerSecond(3.0 * bytes, kernelMs), "zero-copy");
+            } else {
+                printf("%-14s %12llu %14.2f %14.2f %14.2f\n", modeName(mode), (unsigned long long)nelem,
+                       gigabytesPerSecond(2.0 * bytes, uploadMs),
+                       gigabytesPerSecond(3.0 * bytes, kernelMs),
+                       gigabytesPerSecond(bytes, downloadMs));
+            }
+
+            vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+            vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+            destroyBuffers(bufferList);
+        }
+    }
+
+    std::vector<Buffer> dummyList = {dummy};
+    destroyBuffers(dummyList);
+    destroyStagingRing(stagingRing);
+
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyShaderModule(device, shaderModule, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+// Memory planning of intermediates: x = a, then x = x + b `length` times, compiled without fusion so every
+// step is its own kernel and every value but the last is an intermediate. With one buffer per intermediate
+// the graph needs `length - 1` of them, planned by liveness (src/memory_planner.h) two of them take turns.
+//
+// Usage: ./bench_memory_plan [elements] [length] [iterations]
+
+#include <cstdlib>
+
+#include "./util.h"
+#include "./staging.h"
+#include "./graph.h"
+#include "./bench.h"
+
+int main(int argc, char** argv) {
+    uint32_t nelem = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1 << 22;
+    uint32_t length = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+    int iterations = argc > 3 ? std::atoi(argv[3]) : 10;
+    VkDeviceSize bytes = VkDeviceSize(nelem) * sizeof(float);
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    StagingRing stagingRing = createStagingRing(physicalDevice, device, queueFamilyIndex, queue, 64 << 20, 4);
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+    VkCommandPool commandPool = createCommandPool(device, queueFamilyIndex);
+
+    // Multiples of 1/4 keep every partial sum exact
+    std::vector<float> dataA(nelem), dataB(nelem), resultData(nelem);
+    for (uint32_t i = 0; i < nelem; i++) {
+        dataA[i] = float(i % 1024);
+        dataB[i] = float(i % 8) / 4.0f;
+    }
+
+    std::vector<Buffer> buffers = {
+        createBuffer(physicalDevice, device, bytes, 0, MEMORY_DEVICE_LOCAL),
+        createBuffer(physicalDevice, device, bytes, 1, MEMORY_DEVICE_LOCAL),
+        createBuffer(physicalDevice, device, bytes, 2, MEMORY_DEVICE_LOCAL),
+    };
+    copyToBuffer(stagingRing, buffers[0], dataA.data(), 0, bytes);
+    copyToBuffer(stagingRing, buffers[1], dataB.data(), 0, bytes);
+
+    printf("%u elements, chain of %u unfused adds\n", nelem, length);
+    printf("%-8s %8s %14s %12s %12s %10s\n", "mode", "kernels", "arena MiB", "run ms", "GB/s", "result");
+
+    for (bool reuse : {false, true}) {
+        Graph graph;
+        uint32_t x = addInput(graph, buffers[0]);
+        uint32_t b = addInput(graph, buffers[1]);
+        for (uint32_t i = 0; i < length; i++) x = addOp(graph, ADD, {x, b});
+        markOutput(graph, x, buffers[2]);
+
+        CompiledGraph compiled = compileGraph(registry, graph, false, reuse);
+        VkCommandBuffer commandBuffer = createCommandBuffer(device, commandPool);
+        recordGraph(commandBuffer, compiled);
+
+        // Warmup
+        executeCommandBuffer(device, commandBuffer, queue);
+
+        Timer timer;
+        for (int i = 0; i < iterations; i++) {
+            executeCommandBuffer(device, commandBuffer, queue);
+        }
+        double runMs = timer.elapsedMs() / iterations;
+
+        copyBufferFromDevice(stagingRing, buffers[2], resultData.data(), 0, bytes);
+
+        bool correct = true;
+        for (uint32_t i = 0; i < nelem && correct; i++) {
+            correct = resultData[i] == dataA[i] + float(length) * dataB[i];
+        }
+
+        double moved = 0;
+        for (const FusedKernel& kernel : compiled.kernels) moved += double(kernel.bytes);
+        printf("%-8s %8zu %14.1f %12.3f %12.2f %10s\n", reuse ? "planned" : "naive", compiled.kernels.size(),
+               compiled.memoryPlan.peak / (1024.0 * 1024.0), runMs, gigabytesPerSecond(moved, runMs), correct ? "ok" : "MISMATCH");
+        if (reuse) printMemoryPlan(compiled.memoryPlan);
+
+        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+        destroyCompiledGraph(compiled);
+    }
+
+    destroyBuffers(buffers);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    destroyPipelineRegistry(registry);
+    destroyStagingRing(stagingRing);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+// Data-parallel scaling across devices (src/multi_device.h): `c = a + b` and a full SUM over host arrays,
+// split across 1, 2, ... of the selected devices, end to end including the transfers. Results are checked
+// against a CPU loop. With a single device, VKCOMPUTE_DEVICES=0,0 opens it twice, which exercises the
+// partitioning and the final combination without a second GPU (e.g. on lavapipe).
+//
+// Usage: ./bench_multi_gpu [MiB per array] [iterations]
+
+#include <cstdlib>
+#include <algorithm>
+
+#include "./multi_device.h"
+#include "./bench.h"
+
+template <typename F>
+static double medianMs(int iterations, F f) {
+    f();
+    std::vector<double> times;
+    for (int i = 0; i < iterations; i++) {
+        Timer timer;
+        f();
+        times.push_back(timer.elapsedMs());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+int main(int argc, char** argv) {
+    uint64_t mib = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 256;
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 5;
+    uint64_t nelem = (mib << 20) / sizeof(float);
+
+    VkInstance instance = createInstance();
+    std::vector<VkPhysicalDevice> physicalDevices = selectPhysicalDevices(instance);
+
+    printf("Devices, best first:\n");
+    for (size_t i = 0; i < physicalDevices.size(); i++) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevices[i], &properties);
+        printf("  %zu: %s (score %016llx)\n", i, properties.deviceName, (unsigned long long)scorePhysicalDevice(physicalDevices[i]));
+    }
+
+    std::vector<float> a(nelem), b(nelem), c(nelem);
+    std::vector<uint32_t> values(nelem);
+    uint32_t expectedSum = 0;
+    for (uint64_t i = 0; i < nelem; i++) {
+        a[i] = float(i % 1024);
+        b[i] = float(i % 7);
+        values[i] = uint32_t(i % 1000);
+        expectedSum += values[i];
+    }
+
+    printf("%8s %10s %10s %8s %10s %10s %8s %8s\n", "devices", "add ms", "add GB/s", "speedup", "sum ms", "sum GB/s", "speedup", "check");
+
+    double addBaseline = 0, sumBaseline = 0;
+    bool allPassed = true;
+
+    for (size_t count = 1; count <= physicalDevices.size(); count++) {
+        std::vector<VkPhysicalDevice> subset(physicalDevices.begin(), physicalDevices.begin() + count);
+        MultiDevice multi = createMultiDevice(subset);
+
+        std::fill(c.begin(), c.end(), -1.0f);
+        double addMs = medianMs(iterations, [&]() { runElementwiseMulti(multi, ADD, {a.data(), b.data()}, c.data(), nelem); });
+
+        uint32_t sum = 0;
+        double sumMs = medianMs(iterations, [&]() { runReduceMulti(multi, SUM, values.data(), &sum, nelem, "uint"); });
+
+        bool passed = sum == expectedSum;
+        for (uint64_t i = 0; i < nelem && passed; i++) passed = c[i] == a[i] + b[i];
+        allPassed = allPassed && passed;
+
+        if (count == 1) {
+            addBaseline = addMs;
+            sumBaseline = sumMs;
+        }
+
+        printf("%8zu %10.2f %10.2f %7.2fx %10.2f %10.2f %7.2fx %8s\n", count,
+               addMs, gigabytesPerSecond(3.0 * nelem * sizeof(float), addMs), addBaseline / addMs,
+               sumMs, gigabytesPerSecond(double(nelem) * sizeof(uint32_t), sumMs), sumBaseline / sumMs,
+               passed ? "ok" : "FAILED");
+
+        destroyMultiDevice(multi);
+    }
+
+    vkDestroyInstance(instance, nullptr);
+    return allPassed ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+// Startup cost of building every kernel in ./shaders, with and without the on-disk pipeline cache.
+// Each shader is built in several specializations to stand in for the dozens of kernels of a real graph.
+// Mesa keeps its own shader cache, run with MESA_SHADER_CACHE_DISABLE=true to measure ours alone.
+//
+// Usage: ./bench_pipeline_cache [specializations per shader]
+
+#include <cstdlib>
+#include <cstdio>
+#include <dirent.h>
+
+#include "./util.h"
+#include "./pipeline_cache.h"
+#include "./bench.h"
+
+static const char* cachePath = "bench_pipeline_cache.bin";
+
+static std::vector<std::string> listShaders(const std::string& directory) {
+    std::vector<std::string> paths;
+
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) throw std::runtime_error("Failed to open the shaders directory!");
+
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".spv") == 0) paths.push_back(directory + "/" + name);
+    }
+
+    closedir(dir);
+    return paths;
+}
+
+// Builds all kernels. The layout is a superset of what any of our shaders uses, which keeps this generic.
+static double buildAll(PipelineRegistry& registry, const std::vector<std::string>& shaders, uint32_t specializations) {
+    Timer timer;
+
+    for (const std::string& path : shaders) {
+        for (uint32_t i = 0; i < specializations; i++) {
+            // Constant ids the shader does not declare are ignored by the driver, but still make a distinct pipeline
+            SpecializationConstants constants;
+            constants.set(1000, i);
+            getPipeline(registry, path, "main", 8, &constants, 128);
+        }
+    }
+
+    return timer.elapsedMs();
+}
+
+int main(int argc, char** argv) {
+    uint32_t specializations = argc > 1 ? std::atoi(argv[1]) : 8;
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+
+    std::vector<std::string> shaders = listShaders("shaders");
+    size_t kernelCount = shaders.size() * specializations;
+
+    std::remove(cachePath);
+
+    PipelineRegistry cold = createPipelineRegistry(physicalDevice, device, cachePath);
+    double coldMs = buildAll(cold, shaders, specializations);
+    destroyPipelineRegistry(cold);
+
+    PipelineRegistry warm = createPipelineRegistry(physicalDevice, device, cachePath);
+    double warmMs = buildAll(warm, shaders, specializations);
+    double registryMs = buildAll(warm, shaders, specializations);
+    destroyPipelineRegistry(warm);
+
+    printf("%zu kernels (%zu shaders x %u specializations)\n", kernelCount, shaders.size(), specializations);
+    printf("  cold start (no cache):      %10.2f ms  (%8.3f ms/kernel)\n", coldMs, coldMs / kernelCount);
+    printf("  warm start (disk cache):    %10.2f ms  (%8.3f ms/kernel)\n", warmMs, warmMs / kernelCount);
+    printf("  registry hit (in-process):  %10.2f ms  (%8.3f ms/kernel)\n", registryMs, registryMs / kernelCount);
+
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+// Random tensors made on the host and uploaded through the staging ring vs. generated on the device (src/random.h),
+// for uniform values in [0, 1), [-2, 3) and [1, 2) and normal values in every float dtype. The device result is
+// checked against the CPU reference: uniform values bit for bit and inside [a, b), normal ones within a few ulps of
+// the dtype (log, sqrt and cos differ between devices), plus the mean and standard deviation of the normal float values.
+//
+// Usage: ./bench_random [elements] [iterations]
+
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "./util.h"
+#include "./staging.h"
+#include "./random.h"
+#include "./bench.h"
+
+static const uint64_t seed = 0x5eed0fc0ffee1234ull;
+
+struct RandomCase {
+    const char* name;
+    Distribution distribution;
+    float a, b;
+};
+
+// The second uniform range catches a device that fuses a + (b - a) * u, with a = 0 and b = 1 that rounds the same.
+// In the third, float16 and bfloat16 values round up to b unless they are clamped.
+static const RandomCase cases[] = {
+    {"uniform", DISTRIBUTION_UNIFORM, 0.0f, 1.0f},
+    {"unif-2,3", DISTRIBUTION_UNIFORM, -2.0f, 3.0f},
+    {"unif1,2", DISTRIBUTION_UNIFORM, 1.0f, 2.0f},
+    {"normal", DISTRIBUTION_NORMAL, 0.0f, 1.0f},
+};
+
+static float widenAt(const std::string& dtype, const std::vector<char>& data, size_t i) {
+    if (dtype == "float") {
+        float value;
+        memcpy(&value, data.data() + 4 * i, sizeof(value));
+        return value;
+    }
+
+    uint16_t bits;
+    memcpy(&bits, data.data() + 2 * i, sizeof(bits));
+    return dtype == "float16" ? toFloat(Float16{bits}) : toFloat(Bfloat16{bits});
+}
+
+static bool checkResult(const std::string& dtype, Distribution distribution, const std::vector<char>& result,
+                        const std::vector<char>& expected, uint32_t nelem) {
+    if (distribution == DISTRIBUTION_UNIFORM) return memcmp(result.data(), expected.data(), result.size()) == 0;
+
+    float ulp = dtype == "float" ? 1.0f / (1 << 20) : dtype == "float16" ? 1.0f / (1 << 9) : 1.0f / (1 << 6);
+    for (uint32_t i = 0; i < nelem; i++) {
+        float want = widenAt(dtype, expected, i);
+        if (std::fabs(widenAt(dtype, result, i) - want) > ulp * std::max(1.0f, std::fabs(want))) return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    uint32_t nelem = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : (1u << 24);
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 10;
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    StagingRing stagingRing = createStagingRing(physicalDevice, device, queueFamilyIndex, queue, 64 << 20, 4);
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+    VkCommandPool commandPool = createCommandPool(device, queueFamilyIndex);
+    ThreadPool* pool = createThreadPool();
+
+    printf("%u elements, %u host threads\n", nelem, threadCount(*pool));
+    printf("%-8s %-9s %10s %10s %10s %10s %9s %10s\n", "dist", "dtype", "host ms", "host GB/s", "device ms", "dev GB/s", "speedup", "result");
+
+    bool success = true;
+    for (const std::string& dtype : {std::string("float"), std::string("float16"), std::string("bfloat16")}) {
+        if (!supportsDtype(physicalDevice, dtype)) {
+            printf("%-8s %-9s skipped, no %s storage on this device\n", "", dtype.c_str(), dtype.c_str());
+            continue;
+        }
+
+        VkDeviceSize bytes = VkDeviceSize(nelem) * getTypeSize(dtype);
+        Buffer dest = createBuffer(physicalDevice, device, bytes, 0, MEMORY_DEVICE_LOCAL);
+
+        for (const RandomCase& randomCase : cases) {
+            Distribution distribution = randomCase.distribution;
+            float a = randomCase.a, b = randomCase.b;
+            RandomParams params = randomParams(nelem, seed, 0, a, b, dtype);
+            std::vector<char> expected(bytes);
+
+            // Host: generate into memory and upload, what a framework without device RNG does
+            Timer timer;
+            for (int i = 0; i < iterations; i++) {
+                fillRandomCpu(*pool, expected.data(), distribution, params, dtype);
+                copyToBuffer(stagingRing, dest, expected.data(), 0, bytes);
+            }
+            double hostMs = timer.elapsedMs() / iterations;
+
+            RandomKernel kernel = createRandomKernel(registry, dest, distribution, seed, 0, a, b, dtype);
+            VkCommandBuffer commandBuffer = createCommandBuffer(device, commandPool);
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            vkBeginCommandBuffer(commandBuffer, &beginInfo);
+            for (int i = 0; i < iterations; i++) {
+                if (i > 0) recordKernelBarrier(commandBuffer);
+                recordRandomKernel(commandBuffer, kernel);
+            }
+            vkEndCommandBuffer(commandBuffer);
+
+            // Warmup, and it overwrites the host upload so the check below sees the device values
+            executeCommandBuffer(device, commandBuffer, queue);
+
+            timer.reset();
+            executeCommandBuffer(device, commandBuffer, queue);
+            double deviceMs = timer.elapsedMs() / iterations;
+
+            std::vector<char> result(bytes);
+            copyBufferFromDevice(stagingRing, dest, result.data(), 0, bytes);
+            bool correct = checkResult(dtype, distribution, result, expected, nelem);
+            for (uint32_t i = 0; i < nelem && correct && distribution == DISTRIBUTION_UNIFORM; i++) {
+                float value = widenAt(dtype, result, i);
+                correct = value >= a && value < b;
+            }
+
+            printf("%-8s %-9s %10.3f %10.2f %10.3f %10.2f %8.1fx %10s\n", randomCase.name, dtype.c_str(), hostMs,
+                   gigabytesPerSecond(double(bytes), hostMs), deviceMs, gigabytesPerSecond(double(bytes), deviceMs),
+                   hostMs / deviceMs, correct ? "ok" : "MISMATCH");
+
+            if (distribution == DISTRIBUTION_NORMAL && dtype == "float") {
+                double sum = 0, sumSquares = 0;
+                for (uint32_t i = 0; i < nelem; i++) {
+                    double value = widenAt(dtype, result, i);
+                    sum += value;
+                    sumSquares += value * value;
+                }
+                double mean = sum / nelem;
+                double stddev = std::sqrt(sumSquares / nelem - mean * mean);
+                bool plausible = std::fabs(mean) < 5.0 / std::sqrt(double(nelem)) + 1e-3 && std::fabs(stddev - 1.0) < 1e-2;
+                printf("         normal float: mean %.5f, stddev %.5f %s\n", mean, stddev, plausible ? "" : "(off)");
+                correct = correct && plausible;
+            }
+            success = success && correct;
+
+            vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+            destroyRandomKernel(kernel);
+        }
+
+        std::vector<Buffer> buffers = {dest};
+        destroyBuffers(buffers);
+    }
+
+    destroyThreadPool(pool);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    destroyPipelineRegistry(registry);
+    destroyStagingRing(stagingRing);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+// Throughput of the reduction kernels against a single threaded CPU loop, from 1K to 1G elements.
+// Full reductions (float SUM and MAX, uint PROD, int SUM) and axis reductions over a 2D view.
+// Sizes that do not fit into one storage buffer binding or into memory are skipped.
+//
+// Usage: ./bench_reduce [max elements] [iterations]
+
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#include "./util.h"
+#include "./staging.h"
+#include "./reduce.h"
+#include "./bench.h"
+
+struct BenchContext {
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    StagingRing* stagingRing;
+    PipelineRegistry* registry;
+    int iterations;
+};
+
+template<typename T>
+static T cpuReduce(Ops op, const T* data, const ReduceShape& shape, uint32_t output) {
+    uint64_t base = uint64_t(output / shape.innerCount) * shape.outerStride + uint64_t(output % shape.innerCount) * shape.innerStride;
+
+    // Float sums are accumulated in double, that is the value the GPU result is compared against
+    double sum = 0;
+    T acc = op == PROD ? T(1) : op == SUM ? T(0) : data[base];
+    for (uint32_t r = 0; r < shape.reduceCount; r++) {
+        T value = data[base + uint64_t(r) * shape.reduceStride];
+        if (op == SUM) acc += value;
+        if (op == PROD) acc *= value;
+        if (op == REDUCE_MAX) acc = std::max(acc, value);
+        sum += double(value);
+    }
+    return op == SUM && std::is_floating_point<T>::value ? T(sum) : acc;
+}
+
+static bool matches(float got, float expected, uint32_t count) {
+    // Summation order differs between CPU and GPU, allow for that
+    return std::fabs(got - expected) <= 1e-6f * count + 1e-5f * std::fabs(expected);
+}
+
+template<typename T>
+static bool matches(T got, T expected, uint32_t) { return got == expected; }
+
+template<typename T>
+static bool benchReduce(BenchContext& ctx, Ops op, const std::string& dtype, const std::string& label,
+                        const std::vector<T>& data, Buffer& src, const ReduceShape& shape) {
+    uint32_t outputs = shape.outerCount * shape.innerCount;
+    uint64_t nelem = uint64_t(outputs) * shape.reduceCount;
+    VkDeviceSize outputBytes = VkDeviceSize(outputs) * sizeof(T);
+
+    Buffer dest = createBuffer(ctx.physicalDevice, ctx.device, outputBytes, 1, MEMORY_DEVICE_LOCAL);
+    ReduceKernel kernel = createReduceKernel(*ctx.registry, op, src, dest, shape, dtype);
+
+    VkCommandBuffer commandBuffer = createCommandBuffer(ctx.device, ctx.commandPool);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    for (int i = 0; i < ctx.iterations; i++) {
+        if (i > 0) recordKernelBarrier(commandBuffer);
+        recordReduceKernel(commandBuffer, kernel);
+    }
+    vkEndCommandBuffer(commandBuffer);
+
+    // Warmup
+    executeCommandBuffer(ctx.device, commandBuffer, ctx.queue);
+
+    Timer timer;
+    executeCommandBuffer(ctx.device, commandBuffer, ctx.queue);
+    double gpuMs = timer.elapsedMs() / ctx.iterations;
+
+    std::vector<T> result(outputs);
+    copyBufferFromDevice(*ctx.stagingRing, dest, result.data(), 0, outputBytes);
+
+    timer.reset();
+    std::vector<T> expected(outputs);
+    for (uint32_t i = 0; i < outputs; i++) expected[i] = cpuReduce(op, data.data(), shape, i);
+    double cpuMs = timer.elapsedMs();
+
+    bool correct = true;
+    for (uint32_t i = 0; i < outputs && correct; i++) correct = matches(result[i], expected[i], shape.reduceCount);
+
+    double bytes = double(nelem) * sizeof(T);
+    printf("%-10s %-6s %-14s %12llu %4zu %10.3f %10.2f %10.3f %10.2f %10s\n", opName(op), dtype.c_str(), label.c_str(),
+           (unsigned long long)nelem, kernel.passes.size(), gpuMs, gigabytesPerSecond(bytes, gpuMs),
+           cpuMs, gigabytesPerSecond(bytes, cpuMs), correct ? "ok" : "MISMATCH");
+
+    vkFreeCommandBuffers(ctx.device, ctx.commandPool, 1, &commandBuffer);
+    destroyReduceKernel(kernel);
+    std::vector<Buffer> buffers = {dest};
+    destroyBuffers(buffers);
+    return correct;
+}
+
+// Uploads `data` and runs a full reduction plus both axis reductions of a [rows, cols] view of it
+template<typename T>
+static bool benchSize(BenchContext& ctx, Ops op, const std::string& dtype, const std::vector<T>& data, bool axes) {
+    uint32_t nelem = static_cast<uint32_t>(data.size());
+    VkDeviceSize bytes = VkDeviceSize(nelem) * sizeof(T);
+
+    Buffer src = createBuffer(ctx.physicalDevice, ctx.device, bytes, 0, MEMORY_DEVICE_LOCAL);
+    copyToBuffer(*ctx.stagingRing, src, data.data(), 0, bytes);
+
+    bool success = benchReduce(ctx, op, dtype, "full", data, src, fullReduceShape(nelem));
+
+    if (axes) {
+        uint32_t cols = 1;
+        while (uint64_t(cols) * cols < nelem) cols *= 2;
+        uint32_t rows = nelem / cols;
+
+        success = benchReduce(ctx, op, dtype, "[r,c] axis 0", data, src, axisReduceShape({rows, cols}, {cols, 1}, 0)) && success;
+        success = benchReduce(ctx, op, dtype, "[r,c] axis 1", data, src, axisReduceShape({rows, cols}, {cols, 1}, 1)) && success;
+    }
+
+    std::vector<Buffer> buffers = {src};
+    destroyBuffers(buffers);
+    return success;
+}
+
+int main(int argc, char** argv) {
+    uint64_t maxElements = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : (1ull << 30);
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 10;
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    StagingRing stagingRing = createStagingRing(physicalDevice, device, queueFamilyIndex, queue, 64 << 20, 4);
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+    VkCommandPool commandPool = createCommandPool(device, queueFamilyIndex);
+
+    BenchContext ctx{physicalDevice, device, queue, commandPool, &stagingRing, &registry, iterations};
+
+    printf("subgroup arithmetic: %s\n", supportsSubgroupArithmetic(physicalDevice) ? "yes" : "no (shared memory only)");
+    printf("%-10s %-6s %-14s %12s %4s %10s %10s %10s %10s %10s\n",
+           "op", "dtype", "shape", "elements", "pass", "gpu ms", "gpu GB/s", "cpu ms", "cpu GB/s", "result");
+
+    bool success = true;
+    for (uint64_t nelem = 1 << 10; nelem <= maxElements; nelem *= 4) {
+        if (nelem * sizeof(float) > properties.limits.maxStorageBufferRange) {
+            printf("%llu elements: skipped, larger than maxStorageBufferRange\n", (unsigned long long)nelem);
+            continue;
+        }
+
+        try {
+            std::vector<float> floats(nelem);
+            for (uint64_t i = 0; i < nelem; i++) floats[i] = float(i % 1000) / 1000.0f;
+            success = benchSize(ctx, SUM, "float", floats, true) && success;
+            success = benchSize(ctx, REDUCE_MAX, "float", floats, false) && success;
+            floats = std::vector<float>();
+
+            // Mostly ones, so the product wraps around in an interesting but exactly reproducible way
+            std::vector<uint32_t> uints(nelem);
+            for (uint64_t i = 0; i < nelem; i++) uints[i] = i % 97 == 0 ? 3 : 1;
+            success = benchSize(ctx, PROD, "uint", uints, false) && success;
+            uints = std::vector<uint32_t>();
+
+            std::vector<int32_t> ints(nelem);
+            for (uint64_t i = 0; i < nelem; i++) ints[i] = int32_t(i % 201) - 100;
+            success = benchSize(ctx, SUM, "int", ints, false) && success;
+        } catch (const std::exception& error) {
+            // Usually the largest sizes running out of device or host memory
+            printf("%llu elements: skipped, %s\n", (unsigned long long)nelem, error.what());
+        }
+    }
+
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    destroyPipelineRegistry(registry);
+    destroyStagingRing(stagingRing);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return success ? 0 : 1;
+}
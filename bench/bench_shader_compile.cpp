@@ -0,0 +1,73 @@
+// Graph-build latency of generated kernels: the fused shaders of `count` different graphs compiled one after the
+// other, side by side on the compiler's thread pool, and again from the on-disk SPIR-V cache (src/shader_compiler.h).
+// Only shader generation and compilation are timed, so this runs without a GPU.
+//
+// Usage: ./bench_shader_compile [graphs]
+
+#include <cstdlib>
+
+#include "./util.h"
+#include "./graph.h"
+#include "./bench.h"
+
+// Every graph is a different chain of elementwise ops, so no two shaders are the same
+static std::string generateShader(uint32_t index, Buffer& buffer) {
+    const Ops ops[] = {ADD, MUL, SUB, MAX};
+
+    Graph graph;
+    uint32_t a = addInput(graph, buffer);
+    uint32_t b = addInput(graph, buffer);
+    uint32_t x = a;
+    uint32_t length = 3 + index / 16;
+    for (uint32_t i = 0; i < length; i++) x = addOp(graph, ops[(index >> (2 * (i % 2))) & 3], {x, i % 2 == 0 ? b : a});
+    markOutput(graph, addOp(graph, SQRT, {x}), buffer);
+
+    std::vector<FusedKernel> kernels = fuseGraph(graph, 16, 4);
+    return generateFusedShader(graph, kernels[0]);
+}
+
+static void clearCache(const std::string& directory) {
+    std::string command = "rm -rf \"" + directory + "\"";
+    if (std::system(command.c_str()) != 0) throw std::runtime_error("Failed to clear " + directory + "!");
+}
+
+int main(int argc, char** argv) {
+    uint32_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 32;
+
+    Buffer buffer = createHostBuffer(1024 * sizeof(float), 0);
+    std::vector<ShaderSource> shaders;
+    for (uint32_t i = 0; i < count; i++) shaders.push_back(ShaderSource{generateShader(i, buffer), {}});
+
+    printf("%u generated kernels, compiled with %s\n", count, shaderCompilerName());
+    printf("%-10s %12s %12s\n", "mode", "total ms", "ms/kernel");
+
+    // Separate cache directories, so that the parallel run starts cold as well
+    setenv("VKCOMPUTE_SPIRV_CACHE", "bench_spirv_cache_serial", 1);
+    clearCache(spirvCacheDirectory());
+    Timer timer;
+    for (const ShaderSource& shader : shaders) compileGlsl(shader.source, shader.defines);
+    double serialMs = timer.elapsedMs();
+    printf("%-10s %12.1f %12.3f\n", "serial", serialMs, serialMs / count);
+
+    setenv("VKCOMPUTE_SPIRV_CACHE", "bench_spirv_cache_parallel", 1);
+    clearCache(spirvCacheDirectory());
+    timer.reset();
+    compileGlslParallel(shaders);
+    double parallelMs = timer.elapsedMs();
+    printf("%-10s %12.1f %12.3f\n", "parallel", parallelMs, parallelMs / count);
+
+    timer.reset();
+    compileGlslParallel(shaders);
+    double cachedMs = timer.elapsedMs();
+    printf("%-10s %12.1f %12.3f\n", "cached", cachedMs, cachedMs / count);
+
+    ShaderCompilerStats stats = shaderCompilerStats();
+    printf("speedup: %.1fx parallel, %.1fx cached (%u compiles, %u cache hits)\n", serialMs / parallelMs, serialMs / cachedMs,
+           stats.compiled, stats.cacheHits);
+
+    clearCache("bench_spirv_cache_serial");
+    clearCache("bench_spirv_cache_parallel");
+    std::vector<Buffer> buffers = {buffer};
+    destroyBuffers(buffers);
+    return 0;
+}
@@ -0,0 +1,107 @@
+// End-to-end throughput of streaming host arrays through the GPU in fixed-size tiles (src/stream.h).
+// c = a + b over arrays that do not have to fit in device memory: one tile is the serial baseline
+// (upload, add, download, repeat), two and three tiles overlap the copies with the compute.
+// With a dedicated transfer queue the copies run on the DMA engine next to the compute queue.
+//
+// Usage: ./bench_streaming [total MiB per array] [tile MiB]
+
+#include <cstdlib>
+#include <algorithm>
+
+#include "./util.h"
+#include "./kernel.h"
+#include "./stream.h"
+#include "./bench.h"
+
+struct StreamResult {
+    StreamStats stats;
+    bool correct;
+};
+
+static StreamResult streamAdd(VkPhysicalDevice physicalDevice, VkDevice device, PipelineRegistry& registry, const StreamQueues& queues,
+                              uint32_t tileCount, VkDeviceSize tileBytes, const std::vector<float>& a, const std::vector<float>& b, std::vector<float>& c) {
+    Stream stream = createStream(physicalDevice, device, queues, 2, 1, tileBytes, tileCount);
+
+    std::vector<Kernel> kernels;
+    for (StreamTile& tile : stream.tiles) {
+        kernels.push_back(createKernel(registry, ADD, tile.inputs, tile.outputs[0]));
+    }
+
+    StreamComputeFn recordAdd = [&kernels](VkCommandBuffer commandBuffer, StreamTile&, uint32_t tileIndex, VkDeviceSize bytes) {
+        Kernel& kernel = kernels[tileIndex];
+        kernel.nelem = static_cast<uint32_t>(bytes / sizeof(float));
+        recordKernel(commandBuffer, kernel);
+    };
+
+    VkDeviceSize bytes = a.size() * sizeof(float);
+    std::fill(c.begin(), c.end(), 0.0f);
+
+    // Warm-up on a single chunk, so the first timed run does not pay for lazy allocations in the driver
+    runStream(stream, {a.data(), b.data()}, {c.data()}, std::min(bytes, tileBytes), recordAdd);
+
+    StreamResult result;
+    result.stats = runStream(stream, {a.data(), b.data()}, {c.data()}, bytes, recordAdd);
+    result.correct = true;
+    for (size_t i = 0; i < c.size(); i++) {
+        if (c[i] != a[i] + b[i]) {
+            result.correct = false;
+            break;
+        }
+    }
+
+    for (Kernel& kernel : kernels) destroyKernel(kernel);
+    destroyStream(stream);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    VkDeviceSize totalMiB = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1024;
+    VkDeviceSize tileMiB = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16;
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t computeFamily = findComputeQueueFamily(physicalDevice);
+    uint32_t transferFamily = findTransferQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, computeFamily, transferFamily);
+
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+
+    size_t nelem = totalMiB * 1024 * 1024 / sizeof(float);
+    VkDeviceSize tileBytes = tileMiB * 1024 * 1024;
+    std::vector<float> a(nelem), b(nelem), c(nelem);
+    for (size_t i = 0; i < nelem; i++) {
+        a[i] = float(i % 1000);
+        b[i] = float(i % 7);
+    }
+
+    // Bytes moved over the bus per run: two inputs up, one output down
+    VkDeviceSize moved = 3 * nelem * sizeof(float);
+
+    std::vector<std::pair<const char*, StreamQueues>> queueModes = {
+        {"shared", getStreamQueues(device, computeFamily, UINT32_MAX)},
+    };
+    if (transferFamily != UINT32_MAX) {
+        queueModes.push_back({"dedicated", getStreamQueues(device, computeFamily, transferFamily)});
+    }
+
+    printf("%llu MiB per array, %llu MiB tiles, dedicated transfer queue: %s\n",
+           (unsigned long long)totalMiB, (unsigned long long)tileMiB, transferFamily != UINT32_MAX ? "yes" : "no");
+    printf("%-10s %6s %8s %12s %10s %8s\n", "queues", "tiles", "chunks", "total ms", "GB/s", "check");
+
+    bool allCorrect = true;
+    for (auto& mode : queueModes) {
+        for (uint32_t tileCount = 1; tileCount <= 3; tileCount++) {
+            StreamResult result = streamAdd(physicalDevice, device, registry, mode.second, tileCount, tileBytes, a, b, c);
+            allCorrect = allCorrect && result.correct;
+
+            printf("%-10s %6u %8u %12.2f %10.2f %8s\n", mode.first, tileCount, result.stats.chunks, result.stats.milliseconds,
+                   gigabytesPerSecond(moved, result.stats.milliseconds), result.correct ? "ok" : "FAIL");
+        }
+    }
+
+    destroyPipelineRegistry(registry);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return allCorrect ? 0 : 1;
+}
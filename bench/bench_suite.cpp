@@ -0,0 +1,317 @@
+// Regression suite: sweeps sizes from 1 element up to 1G elements (x4 per step) and measures
+//   - host->device and device->host throughput through the staging ring
+//   - the latency of an empty dispatch, submitted on its own and batched in one command buffer
+//   - GB/s of add.comp, a sample of the elementwise kernels (one per arity, plus a cast) and reductions
+// Sizes that do not fit the device, a single storage buffer binding or host memory are recorded as skipped.
+// Every result goes to a JSON file with a fixed layout, so two runs (e.g. before and after a change) can be diffed.
+// Needs nothing but a compute queue, it runs headless on lavapipe (VKCOMPUTE_DEVICE=llvmpipe).
+//
+// Usage: ./bench_suite [output json] [max elements] [samples]
+
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <unistd.h>
+
+#include "./util.h"
+#include "./staging.h"
+#include "./kernel.h"
+#include "./reduce.h"
+#include "./bench.h"
+
+struct SuiteResult {
+    std::string benchmark;
+    std::string variant;
+    uint64_t elements;
+    uint64_t bytes; // bytes moved per run, 0 for latency benchmarks
+    double us; // median time of one run
+    bool skipped;
+};
+
+struct Suite {
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    PipelineRegistry registry;
+    StagingRing stagingRing;
+    int samples;
+    std::vector<SuiteResult> results;
+};
+
+static double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// Median wall time of submitting the recorded command buffer and waiting for it
+static double timeCommandBuffer(Suite& suite) {
+    executeCommandBuffer(suite.device, suite.commandBuffer, suite.queue); // warm-up
+
+    std::vector<double> times;
+    for (int i = 0; i < suite.samples; i++) {
+        Timer timer;
+        executeCommandBuffer(suite.device, suite.commandBuffer, suite.queue);
+        times.push_back(timer.elapsedMs() * 1000.0);
+    }
+    return median(times);
+}
+
+static void beginRecording(Suite& suite) {
+    vkResetCommandBuffer(suite.commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    vkBeginCommandBuffer(suite.commandBuffer, &beginInfo);
+}
+
+// Small kernels are repeated inside one command buffer, so the submission cost is spread over many dispatches
+static uint32_t repeatsFor(VkDeviceSize bytes) {
+    return static_cast<uint32_t>(std::max<VkDeviceSize>(1, std::min<VkDeviceSize>(1000, (64 << 20) / std::max<VkDeviceSize>(bytes, 1))));
+}
+
+static void addResult(Suite& suite, const std::string& benchmark, const std::string& variant, uint64_t elements, uint64_t bytes, double us) {
+    suite.results.push_back(SuiteResult{benchmark, variant, elements, bytes, us, false});
+
+    if (bytes > 0) printf("%-10s %-14s %12llu %12.2f %10.2f\n", benchmark.c_str(), variant.c_str(), (unsigned long long)elements, us, gigabytesPerSecond(bytes, us / 1000.0));
+    else printf("%-10s %-14s %12llu %12.2f %10s\n", benchmark.c_str(), variant.c_str(), (unsigned long long)elements, us, "-");
+}
+
+static void measureLatency(Suite& suite) {
+    Pipeline& empty = getPipeline(suite.registry, "shaders/empty.spv", "main", 0);
+
+    // One dispatch per submission: what a caller that waits on every kernel pays
+    beginRecording(suite);
+    vkCmdBindPipeline(suite.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, empty.pipeline);
+    vkCmdDispatch(suite.commandBuffer, 1, 1, 1);
+    vkEndCommandBuffer(suite.commandBuffer);
+    addResult(suite, "latency", "submit", 1, 0, timeCommandBuffer(suite));
+
+    // Many dependent dispatches per submission: the cost of a dispatch plus a barrier on the GPU
+    const uint32_t batch = 1000;
+    beginRecording(suite);
+    vkCmdBindPipeline(suite.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, empty.pipeline);
+    for (uint32_t i = 0; i < batch; i++) {
+        if (i > 0) recordKernelBarrier(suite.commandBuffer);
+        vkCmdDispatch(suite.commandBuffer, 1, 1, 1);
+    }
+    vkEndCommandBuffer(suite.commandBuffer);
+    addResult(suite, "latency", "dispatch", 1, 0, timeCommandBuffer(suite) / batch);
+}
+
+static void measureTransfers(Suite& suite, Buffer& buffer, uint64_t nelem) {
+    VkDeviceSize bytes = nelem * sizeof(float);
+    std::vector<float> host(nelem), readBack(nelem);
+    for (uint64_t i = 0; i < nelem; i++) host[i] = float(i % 1024);
+
+    std::vector<double> upload, download;
+    for (int i = 0; i < suite.samples; i++) {
+        Timer timer;
+        copyToBuffer(suite.stagingRing, buffer, host.data(), 0, bytes);
+        upload.push_back(timer.elapsedMs() * 1000.0);
+
+        timer.reset();
+        copyBufferFromDevice(suite.stagingRing, buffer, readBack.data(), 0, bytes);
+        download.push_back(timer.elapsedMs() * 1000.0);
+    }
+
+    if (readBack != host) throw std::runtime_error("Transfer round trip returned different data!");
+
+    addResult(suite, "transfer", "host->device", nelem, bytes, median(upload));
+    addResult(suite, "transfer", "device->host", nelem, bytes, median(download));
+}
+
+// add.comp runs whole workgroups and stops at the end of the buffers, which are padded to whole workgroups here
+static void measureAddComp(Suite& suite, std::vector<Buffer>& buffers, uint64_t nelem) {
+    Pipeline& add = getPipeline(suite.registry, "shaders/add.spv", "main", 3);
+
+    std::vector<Buffer> bindings = {buffers[0], buffers[1], buffers[3]};
+    for (uint32_t i = 0; i < bindings.size(); i++) bindings[i].binding = i;
+    DescriptorBinding descriptors = createDescriptorBinding(suite.registry, add, bindings);
+
+    VkDeviceSize bytes = 3 * nelem * sizeof(float);
+    uint32_t repeats = repeatsFor(bytes);
+
+    beginRecording(suite);
+    vkCmdBindPipeline(suite.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, add.pipeline);
+    bindDescriptors(suite.commandBuffer, add, descriptors);
+    for (uint32_t i = 0; i < repeats; i++) {
+        if (i > 0) recordKernelBarrier(suite.commandBuffer);
+        vkCmdDispatch(suite.commandBuffer, static_cast<uint32_t>((nelem + 255) / 256), 1, 1);
+    }
+    vkEndCommandBuffer(suite.commandBuffer);
+
+    addResult(suite, "kernel", "add.comp", nelem, bytes, timeCommandBuffer(suite) / repeats);
+    destroyDescriptorBinding(suite.device, descriptors);
+}
+
+static void measureKernel(Suite& suite, std::vector<Buffer>& buffers, uint64_t nelem, Ops op, const std::string& destDtype) {
+    std::vector<Buffer> src(buffers.begin(), buffers.begin() + opArity(op));
+    Buffer dest = buffers[3];
+    dest.size = nelem * sizeof(float);
+
+    Kernel kernel = createKernel(suite.registry, op, src, dest, "float", destDtype);
+    VkDeviceSize bytes = VkDeviceSize(kernel.nelem) * (opArity(op) + 1) * sizeof(float);
+    uint32_t repeats = repeatsFor(bytes);
+
+    beginRecording(suite);
+    for (uint32_t i = 0; i < repeats; i++) {
+        if (i > 0) recordKernelBarrier(suite.commandBuffer);
+        recordKernel(suite.commandBuffer, kernel);
+    }
+    vkEndCommandBuffer(suite.commandBuffer);
+
+    std::string variant = opName(op) + std::string(" float") + (destDtype.empty() ? "" : "->" + destDtype);
+    addResult(suite, "kernel", variant, nelem, bytes, timeCommandBuffer(suite) / repeats);
+    destroyKernel(kernel);
+}
+
+static void measureReduce(Suite& suite, std::vector<Buffer>& buffers, uint64_t nelem, Ops op) {
+    Buffer src = buffers[0];
+    src.size = nelem * sizeof(float);
+
+    ReduceKernel kernel = createReduceKernel(suite.registry, op, src, buffers[3], fullReduceShape(static_cast<uint32_t>(nelem)), "float");
+    VkDeviceSize bytes = nelem * sizeof(float);
+    uint32_t repeats = repeatsFor(bytes);
+
+    beginRecording(suite);
+    for (uint32_t i = 0; i < repeats; i++) {
+        if (i > 0) recordKernelBarrier(suite.commandBuffer);
+        recordReduceKernel(suite.commandBuffer, kernel);
+    }
+    vkEndCommandBuffer(suite.commandBuffer);
+
+    addResult(suite, "reduce", opName(op) + std::string(" float"), nelem, bytes, timeCommandBuffer(suite) / repeats);
+    destroyReduceKernel(kernel);
+}
+
+static VkDeviceSize largestDeviceLocalHeap(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    VkDeviceSize largest = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+        if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            largest = std::max(largest, memoryProperties.memoryHeaps[i].size);
+        }
+    }
+    return largest;
+}
+
+static std::string escapeJson(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+// One result per line, in the order they were measured, so a plain diff lines up between runs
+static void writeJson(const Suite& suite, const std::string& path, const VkPhysicalDeviceProperties& properties) {
+    std::ofstream file(path);
+    if (!file.is_open()) throw std::runtime_error("Failed to open " + path + "!");
+
+    char line[512];
+    file << "{\n";
+    file << "  \"device\": \"" << escapeJson(properties.deviceName) << "\",\n";
+    file << "  \"driverVersion\": " << properties.driverVersion << ",\n";
+    file << "  \"samples\": " << suite.samples << ",\n";
+    file << "  \"results\": [\n";
+
+    for (size_t i = 0; i < suite.results.size(); i++) {
+        const SuiteResult& result = suite.results[i];
+        if (result.skipped) {
+            snprintf(line, sizeof(line), "    {\"benchmark\": \"%s\", \"variant\": \"%s\", \"elements\": %llu, \"skipped\": true}",
+                     result.benchmark.c_str(), escapeJson(result.variant).c_str(), (unsigned long long)result.elements);
+        } else {
+            snprintf(line, sizeof(line), "    {\"benchmark\": \"%s\", \"variant\": \"%s\", \"elements\": %llu, \"bytes\": %llu, \"us\": %.3f, \"gbps\": %.3f}",
+                     result.benchmark.c_str(), escapeJson(result.variant).c_str(), (unsigned long long)result.elements,
+                     (unsigned long long)result.bytes, result.us, gigabytesPerSecond(result.bytes, result.us / 1000.0));
+        }
+        file << line << (i + 1 < suite.results.size() ? ",\n" : "\n");
+    }
+
+    file << "  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    std::string outputPath = argc > 1 ? argv[1] : "bench_results.json";
+    uint64_t maxElements = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : (uint64_t(1) << 30);
+
+    Suite suite;
+    suite.samples = argc > 3 ? std::max(1, std::atoi(argv[3])) : 5;
+
+    VkInstance instance = createInstance();
+    suite.physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(suite.physicalDevice);
+    suite.device = createDevice(suite.physicalDevice, queueFamilyIndex);
+    suite.queue = getQueue(suite.device, queueFamilyIndex, 0);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(suite.physicalDevice, &properties);
+
+    // Every benchmark re-records the same command buffer
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+    if (vkCreateCommandPool(suite.device, &poolInfo, nullptr, &suite.commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create command pool!");
+    }
+    suite.commandBuffer = createCommandBuffer(suite.device, suite.commandPool);
+    suite.registry = createPipelineRegistry(suite.physicalDevice, suite.device);
+    suite.stagingRing = createStagingRing(suite.physicalDevice, suite.device, queueFamilyIndex, suite.queue, 64 << 20, 4);
+
+    // Four device-local buffers per size (three sources and a destination), and two host copies of one of them
+    VkDeviceSize deviceBudget = largestDeviceLocalHeap(suite.physicalDevice) / 4 * 3;
+    VkDeviceSize hostBudget = VkDeviceSize(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE) / 2;
+
+    printf("%-10s %-14s %12s %12s %10s\n", "benchmark", "variant", "elements", "us", "GB/s");
+    measureLatency(suite);
+
+    std::vector<Ops> unaryOps = {EXP2, SQRT};
+    std::vector<Ops> binaryOps = {ADD, MUL, MAX};
+    std::vector<Ops> ternaryOps = {WHERE, MULACC};
+    std::vector<Ops> reduceOps = {SUM, REDUCE_MAX};
+
+    for (uint64_t nelem = 1; nelem <= maxElements; nelem *= 4) {
+        VkDeviceSize bytes = alignUp(nelem, 256) * sizeof(float);
+
+        if (bytes > properties.limits.maxStorageBufferRange || 4 * bytes > deviceBudget || 2 * bytes > hostBudget) {
+            suite.results.push_back(SuiteResult{"sweep", "skipped", nelem, 0, 0.0, true});
+            printf("%-10s %-14s %12llu (does not fit)\n", "sweep", "skipped", (unsigned long long)nelem);
+            continue;
+        }
+
+        std::vector<Buffer> buffers;
+        for (uint32_t i = 0; i < 4; i++) buffers.push_back(createBuffer(suite.physicalDevice, suite.device, bytes, i, MEMORY_DEVICE_LOCAL));
+
+        // The transfer fills the first source, the other two get a copy of it
+        measureTransfers(suite, buffers[0], nelem);
+        std::vector<float> fill(nelem, 1.0f);
+        copyToBuffer(suite.stagingRing, buffers[1], fill.data(), 0, nelem * sizeof(float));
+        copyToBuffer(suite.stagingRing, buffers[2], fill.data(), 0, nelem * sizeof(float));
+
+        measureAddComp(suite, buffers, nelem);
+        for (Ops op : unaryOps) measureKernel(suite, buffers, nelem, op, "");
+        for (Ops op : binaryOps) measureKernel(suite, buffers, nelem, op, "");
+        for (Ops op : ternaryOps) measureKernel(suite, buffers, nelem, op, "");
+        measureKernel(suite, buffers, nelem, CAST, "int");
+        for (Ops op : reduceOps) measureReduce(suite, buffers, nelem, op);
+
+        destroyBuffers(buffers);
+    }
+
+    writeJson(suite, outputPath, properties);
+    printf("Wrote %zu results to %s\n", suite.results.size(), outputPath.c_str());
+
+    destroyStagingRing(suite.stagingRing);
+    destroyPipelineRegistry(suite.registry);
+    vkDestroyCommandPool(suite.device, suite.commandPool, nullptr);
+    vkDestroyDevice(suite.device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Requests per second with 1 to N host threads, each serving requests of its own: create an ADD kernel on the
+// thread's buffers, record it, submit and wait for the result. Three ways to get the work to the GPU:
+//   locked:  a command pool per thread, one fence and vkQueueSubmit per request, with a mutex around the queue
+//   batched: the executor (src/executor.h) on one queue, submissions of all threads batched into few vkQueueSubmits
+//   queues:  the executor on every queue of the compute family, only run when the family has more than one
+// Results are checked after every thread's last request.
+//
+// Usage: ./bench_threads [max threads] [requests per thread] [elements]
+
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "./util.h"
+#include "./kernel.h"
+#include "./executor.h"
+#include "./bench.h"
+
+enum Mode { MODE_LOCKED, MODE_BATCHED, MODE_QUEUES };
+
+struct BenchContext {
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    uint32_t queueFamilyIndex;
+    uint32_t queueCount;
+    PipelineRegistry* registry;
+    uint32_t requests;
+    uint32_t nelem;
+};
+
+// a, b and out of one thread
+static std::vector<Buffer> createThreadBuffers(BenchContext& ctx, uint32_t thread) {
+    VkDeviceSize bytes = VkDeviceSize(ctx.nelem) * sizeof(float);
+    std::vector<Buffer> buffers;
+    for (uint32_t i = 0; i < 3; i++) buffers.push_back(createBuffer(ctx.physicalDevice, ctx.device, bytes, i, MEMORY_HOST_VISIBLE));
+
+    float* a = hostPointer<float>(buffers[0]);
+    float* b = hostPointer<float>(buffers[1]);
+    for (uint32_t i = 0; i < ctx.nelem; i++) {
+        a[i] = float(i % 1024);
+        b[i] = float(thread);
+    }
+    return buffers;
+}
+
+static bool checkThreadBuffers(BenchContext& ctx, std::vector<Buffer>& buffers) {
+    const float* a = hostPointer<float>(buffers[0]);
+    const float* b = hostPointer<float>(buffers[1]);
+    const float* out = hostPointer<float>(buffers[2]);
+    for (uint32_t i = 0; i < ctx.nelem; i++) {
+        if (out[i] != a[i] + b[i]) return false;
+    }
+    return true;
+}
+
+static bool serveLocked(BenchContext& ctx, std::vector<Buffer>& buffers, VkQueue queue, std::mutex& queueMutex) {
+    // Descriptor sets per thread as well, so only the way work is submitted differs from the executor
+    VkCommandPool commandPool = createCommandPool(ctx.device, ctx.queueFamilyIndex, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+    VkCommandBuffer commandBuffer = createCommandBuffer(ctx.device, commandPool);
+    DescriptorAllocator descriptorAllocator = createDescriptorAllocator(ctx.device);
+    setThreadDescriptorAllocator(&descriptorAllocator);
+
+    for (uint32_t i = 0; i < ctx.requests; i++) {
+        Kernel kernel = createKernel(*ctx.registry, ADD, {buffers[0], buffers[1]}, buffers[2]);
+        std::vector<Kernel> kernels = {kernel};
+        recordKernels(commandBuffer, kernels);
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            executeCommandBuffer(ctx.device, commandBuffer, queue);
+        }
+        destroyKernel(kernel);
+    }
+
+    setThreadDescriptorAllocator(nullptr);
+    destroyDescriptorAllocator(descriptorAllocator);
+    vkFreeCommandBuffers(ctx.device, commandPool, 1, &commandBuffer);
+    vkDestroyCommandPool(ctx.device, commandPool, nullptr);
+    return checkThreadBuffers(ctx, buffers);
+}
+
+static bool serveExecutor(BenchContext& ctx, std::vector<Buffer>& buffers, Executor& executor) {
+    WorkerContext* context = createWorkerContext(executor);
+
+    for (uint32_t i = 0; i < ctx.requests; i++) {
+        Kernel kernel = createKernel(*ctx.registry, ADD, {buffers[0], buffers[1]}, buffers[2]);
+        WorkItem* work = beginWork(*context);
+        recordKernel(work->commandBuffer, kernel);
+        submitWork(*context, work);
+        waitWork(*context, work);
+        destroyKernel(kernel);
+    }
+
+    destroyWorkerContext(context);
+    return checkThreadBuffers(ctx, buffers);
+}
+
+// Runs `threads` threads of `mode` and returns requests per second, or 0 if a result was wrong
+static double runThreads(BenchContext& ctx, Mode mode, uint32_t threads, VkQueue queue, ExecutorStats& stats) {
+    std::vector<std::vector<Buffer>> buffers;
+    for (uint32_t t = 0; t < threads; t++) buffers.push_back(createThreadBuffers(ctx, t));
+
+    std::mutex queueMutex;
+    Executor* executor = mode == MODE_LOCKED ? nullptr :
+        createExecutor(ctx.device, ctx.queueFamilyIndex, mode == MODE_QUEUES ? ctx.queueCount : 1);
+
+    std::atomic<bool> correct(true);
+    std::vector<std::thread> workers;
+    Timer timer;
+    for (uint32_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            bool ok = mode == MODE_LOCKED ? serveLocked(ctx, buffers[t], queue, queueMutex) : serveExecutor(ctx, buffers[t], *executor);
+            if (!ok) correct = false;
+        });
+    }
+    for (std::thread& worker : workers) worker.join();
+    double ms = timer.elapsedMs();
+
+    stats = executor != nullptr ? executorStats(*executor) : ExecutorStats{uint64_t(threads) * ctx.requests, uint64_t(threads) * ctx.requests};
+    if (executor != nullptr) destroyExecutor(executor);
+    for (std::vector<Buffer>& threadBuffers : buffers) destroyBuffers(threadBuffers);
+
+    return correct ? 1000.0 * threads * ctx.requests / ms : 0.0;
+}
+
+int main(int argc, char** argv) {
+    uint32_t maxThreads = argc > 1 ? std::atoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    uint32_t requests = argc > 2 ? std::atoi(argv[2]) : 500;
+    uint32_t nelem = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 4096;
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    uint32_t queueCount = queueCountOf(physicalDevice, queueFamilyIndex);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex, UINT32_MAX, queueCount);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+    BenchContext ctx{physicalDevice, device, queueFamilyIndex, queueCount, &registry, requests, nelem};
+
+    // Build the pipeline up front, the first request of every thread would wait for it otherwise
+    {
+        std::vector<Buffer> warmup = createThreadBuffers(ctx, 0);
+        Kernel kernel = createKernel(registry, ADD, {warmup[0], warmup[1]}, warmup[2]);
+        destroyKernel(kernel);
+        destroyBuffers(warmup);
+    }
+
+    printf("%u elements, %u requests per thread, %u compute queue(s)\n", nelem, requests, queueCount);
+    printf("%-8s %8s %12s %9s %14s %10s\n", "mode", "threads", "requests/s", "scaling", "buffers/submit", "result");
+
+    const char* modeNames[] = {"locked", "batched", "queues"};
+    bool success = true;
+    for (Mode mode : {MODE_LOCKED, MODE_BATCHED, MODE_QUEUES}) {
+        if (mode == MODE_QUEUES && queueCount < 2) {
+            printf("%-8s skipped, the compute family has a single queue\n", modeNames[mode]);
+            continue;
+        }
+
+        double single = 0;
+        for (uint32_t threads = 1; threads <= maxThreads; threads = threads < maxThreads ? std::min(threads * 2, maxThreads) : threads + 1) {
+            ExecutorStats stats;
+            double rate = runThreads(ctx, mode, threads, queue, stats);
+            if (threads == 1) single = rate;
+
+            printf("%-8s %8u %12.0f %8.2fx %14.2f %10s\n", modeNames[mode], threads, rate, single > 0 ? rate / single : 0.0,
+                   stats.submits > 0 ? double(stats.commandBuffers) / stats.submits : 0.0, rate > 0 ? "ok" : "MISMATCH");
+            success = success && rate > 0;
+        }
+    }
+
+    destroyPipelineRegistry(registry);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+// Strided views vs. copies: out = A^T * bias + B for square matrices, with `bias` a row broadcast down every column.
+// With copies the transpose and the broadcast are materialized with CONTIGUOUS first, one dispatch each,
+// the way it has to be done without a shape tracker. With views (src/view.h) the fused kernel reads A and
+// bias through their strides directly and nothing but the result is written. Also checks that an input marked as
+// output is copied into the output buffer.
+//
+// Usage: ./bench_views [size] [iterations]
+
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "./util.h"
+#include "./staging.h"
+#include "./graph.h"
+#include "./bench.h"
+
+// Bytes a compiled graph reads and writes in global memory per run, broadcast reads counted in full
+static double bytesMoved(const CompiledGraph& compiled) {
+    double bytes = 0;
+    for (const FusedKernel& kernel : compiled.kernels) {
+        bytes += double(kernel.inputs.size() + kernel.outputs.size()) * kernel.nelem * sizeof(float);
+    }
+    return bytes;
+}
+
+static uint32_t buildGraph(Graph& graph, uint32_t a, uint32_t b, uint32_t bias, uint32_t size, bool copy) {
+    uint32_t transposed = addPermute(graph, addReshape(graph, a, {size, size}), {1, 0});
+    uint32_t rows = addExpand(graph, addReshape(graph, bias, {1, size}), {size, size});
+    if (copy) {
+        transposed = addContiguous(graph, transposed);
+        rows = addContiguous(graph, rows);
+    }
+    return addOp(graph, MULACC, {transposed, rows, addReshape(graph, b, {size, size})});
+}
+
+int main(int argc, char** argv) {
+    uint32_t size = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4096;
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 10;
+    uint32_t nelem = size * size;
+    VkDeviceSize bytes = VkDeviceSize(nelem) * sizeof(float);
+
+    VkInstance instance = createInstance();
+    VkPhysicalDevice physicalDevice = selectPhysicalDevice(instance);
+    uint32_t queueFamilyIndex = findComputeQueueFamily(physicalDevice);
+    VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
+    VkQueue queue = getQueue(device, queueFamilyIndex, 0);
+
+    StagingRing stagingRing = createStagingRing(physicalDevice, device, queueFamilyIndex, queue, 64 << 20, 4);
+    PipelineRegistry registry = createPipelineRegistry(physicalDevice, device);
+    VkCommandPool commandPool = createCommandPool(device, queueFamilyIndex);
+
+    std::vector<float> dataA(nelem), dataB(nelem), dataBias(size), resultData(nelem);
+    for (uint32_t i = 0; i < nelem; i++) {
+        dataA[i] = float(i % 1024) / 1024.0f;
+        dataB[i] = 0.5f + float(i % 7) / 16.0f;
+    }
+    for (uint32_t i = 0; i < size; i++) dataBias[i] = 1.0f + float(i % 5) / 8.0f;
+
+    std::vector<Buffer> buffers = {
+        createBuffer(physicalDevice, device, bytes, 0, MEMORY_DEVICE_LOCAL),
+        createBuffer(physicalDevice, device, bytes, 1, MEMORY_DEVICE_LOCAL),
+        createBuffer(physicalDevice, device, size * sizeof(float), 2, MEMORY_DEVICE_LOCAL),
+        createBuffer(physicalDevice, device, bytes, 3, MEMORY_DEVICE_LOCAL),
+    };
+    copyToBuffer(stagingRing, buffers[0], dataA.data(), 0, bytes);
+    copyToBuffer(stagingRing, buffers[1], dataB.data(), 0, bytes);
+    copyToBuffer(stagingRing, buffers[2], dataBias.data(), 0, size * sizeof(float));
+
+    printf("%ux%u matrices, out = A^T * bias + B\n", size, size);
+    printf("%-8s %8s %12s %12s %12s %10s\n", "mode", "kernels", "MB moved", "run ms", "GB/s", "result");
+
+    double copyMs = 0;
+    bool success = true;
+    for (bool copy : {true, false}) {
+        Graph graph;
+        uint32_t a = addInput(graph, buffers[0]);
+        uint32_t b = addInput(graph, buffers[1]);
+        uint32_t bias = addInput(graph, buffers[2]);
+        markOutput(graph, buildGraph(graph, a, b, bias, size, copy), buffers[3]);
+
+        CompiledGraph compiled = compileGraph(registry, graph, !copy);
+        VkCommandBuffer commandBuffer = createCommandBuffer(device, commandPool);
+        recordGraph(commandBuffer, compiled);
+
+        // Warmup
+        executeCommandBuffer(device, commandBuffer, queue);
+
+        Timer timer;
+        for (int i = 0; i < iterations; i++) {
+            executeCommandBuffer(device, commandBuffer, queue);
+        }
+        double runMs = timer.elapsedMs() / iterations;
+        if (copy) copyMs = runMs;
+
+        copyBufferFromDevice(stagingRing, buffers[3], resultData.data(), 0, bytes);
+
+        bool correct = true;
+        for (uint32_t row = 0; row < size && correct; row++) {
+            for (uint32_t col = 0; col < size && correct; col++) {
+                float expected = std::fma(dataA[col * size + row], dataBias[col], dataB[row * size + col]);
+                correct = std::fabs(resultData[row * size + col] - expected) <= 1e-5f * std::fabs(expected);
+            }
+        }
+
+        double moved = bytesMoved(compiled);
+        printf("%-8s %8zu %12.1f %12.3f %12.2f %10s\n", copy ? "copies" : "views", compiled.kernels.size(),
+               moved / 1e6, runMs, gigabytesPerSecond(moved, runMs), correct ? "ok" : "MISMATCH");
+
+        if (!copy) printf("speedup: %.2fx\n", copyMs / runMs);
+
+        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+        destroyCompiledGraph(compiled);
+        success = success && correct;
+    }
+
+    // An input marked as output is copied, the input keeps its own buffer
+    {
+        Graph graph;
+        uint32_t b = addInput(graph, buffers[1]);
+        markOutput(graph, b, buffers[3]);
+
+        CompiledGraph compiled = compileGraph(registry, graph);
+        VkCommandBuffer commandBuffer = createCommandBuffer(device, commandPool);
+        recordGraph(commandBuffer, compiled);
+        executeCommandBuffer(device, commandBuffer, queue);
+
+        std::vector<float> inputData(nelem);
+        copyBufferFromDevice(stagingRing, buffers[3], resultData.data(), 0, bytes);
+        copyBufferFromDevice(stagingRing, buffers[1], inputData.data(), 0, bytes);
+        bool correct = resultData == dataB && inputData == dataB;
+
+        printf("%-8s %8zu %12s %12s %12s %10s\n", "in->out", compiled.kernels.size(), "", "", "", correct ? "ok" : "MISMATCH");
+        success = success && correct;
+
+        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+        destroyCompiledGraph(compiled);
+    }
+
+    destroyBuffers(buffers);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    destroyPipelineRegistry(registry);
+    destroyStagingRing(stagingRing);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    return success ? 0 : 1;
+}
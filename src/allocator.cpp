@@ -0,0 +1,252 @@
+#include "./allocator.h"
+
+#include <algorithm>
+#include <iterator>
+
+MemoryArena createMemoryArena(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    MemoryArena arena;
+    arena.physicalDevice = physicalDevice;
+    arena.device = device;
+    arena.blockSize = blockSize;
+    // Buffers are bound as ranges of the block buffer, so their offsets have to be valid descriptor offsets
+    arena.minOffsetAlignment = properties.limits.minStorageBufferOffsetAlignment;
+    arena.used = 0;
+    arena.peakUsed = 0;
+    arena.liveAllocations = 0;
+
+    return arena;
+}
+
+// Looks up the memory type and alignment for a memory mode once, using a throwaway buffer.
+// Every block of a pool is created with the same usage flags, so they all share these requirements.
+static MemoryPool& getPool(MemoryArena& arena, MemoryMode memoryMode) {
+    auto it = arena.pools.find(memoryMode);
+    if (it != arena.pools.end()) return it->second;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = arena.minOffsetAlignment;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    VkBuffer probe;
+    if (vkCreateBuffer(arena.device, &bufferInfo, nullptr, &probe) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(arena.device, probe, &memRequirements);
+    vkDestroyBuffer(arena.device, probe, nullptr);
+
+    MemoryPool pool;
+    pool.memoryTypeIndex = findMemoryType(arena.physicalDevice, memRequirements.memoryTypeBits, memoryModeProperties(memoryMode));
+    pool.alignment = std::max(memRequirements.alignment, arena.minOffsetAlignment);
+
+    return arena.pools[memoryMode] = pool;
+}
+
+static MemoryBlock createBlock(MemoryArena& arena, MemoryPool& pool, MemoryMode memoryMode, VkDeviceSize size) {
+    MemoryBlock block;
+    block.size = size;
+    block.mapped = nullptr;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    if (vkCreateBuffer(arena.device, &bufferInfo, nullptr, &block.buffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create arena block buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(arena.device, block.buffer, &memRequirements);
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memRequirements.size;
+    allocInfo.memoryTypeIndex = pool.memoryTypeIndex;
+
+    if (vkAllocateMemory(arena.device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS) {
+        vkDestroyBuffer(arena.device, block.buffer, nullptr);
+        throw std::runtime_error("Failed to allocate arena block!");
+    }
+    if (vkBindBufferMemory(arena.device, block.buffer, block.memory, 0) != VK_SUCCESS) {
+        vkDestroyBuffer(arena.device, block.buffer, nullptr);
+        vkFreeMemory(arena.device, block.memory, nullptr);
+        throw std::runtime_error("Failed to bind arena block!");
+    }
+
+    // Host-visible blocks are mapped once, every buffer carved out of them gets a pointer into the mapping
+    if (memoryMode == MEMORY_HOST_VISIBLE) {
+        void* mapped;
+        if (vkMapMemory(arena.device, block.memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) {
+            vkDestroyBuffer(arena.device, block.buffer, nullptr);
+            vkFreeMemory(arena.device, block.memory, nullptr);
+            throw std::runtime_error("Failed to map arena block!");
+        }
+        block.mapped = static_cast<char*>(mapped);
+    }
+
+    block.freeRanges[0] = size;
+    return block;
+}
+
+// First fit: takes the first free range that can hold `size` bytes at an aligned offset.
+// Whatever is left of the range on either side goes back onto the free list.
+static bool allocateFromBlock(MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+    for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+        VkDeviceSize start = it->first;
+        VkDeviceSize end = it->first + it->second;
+        VkDeviceSize aligned = alignUp(start, alignment);
+
+        if (aligned + size > end) continue;
+
+        block.freeRanges.erase(it);
+        if (aligned > start) block.freeRanges[start] = aligned - start;
+        if (aligned + size < end) block.freeRanges[aligned + size] = end - (aligned + size);
+
+        block.allocations[aligned] = size;
+        offset = aligned;
+        return true;
+    }
+
+    return false;
+}
+
+// Carves a buffer out of the arena. The returned buffer shares its VkBuffer and memory with
+// the other buffers of the same block, it is identified by descriptorInfo.offset.
+Buffer createBuffer(MemoryArena& arena, VkDeviceSize size, uint32_t binding, MemoryMode memoryMode) {
+    if (memoryMode == MEMORY_HOST_IMPORTED) throw std::runtime_error("Imported buffers can not be allocated from an arena!");
+
+    MemoryPool& pool = getPool(arena, memoryMode);
+
+    // Allocations are padded to the alignment so that free ranges never end in unusable slivers
+    VkDeviceSize allocationSize = alignUp(size, pool.alignment);
+
+    MemoryBlock* block = nullptr;
+    VkDeviceSize offset = 0;
+
+    for (MemoryBlock& candidate : pool.blocks) {
+        if (allocateFromBlock(candidate, allocationSize, pool.alignment, offset)) {
+            block = &candidate;
+            break;
+        }
+    }
+
+    // Nothing fits, open a new block. Requests larger than the block size get a block of their own.
+    if (block == nullptr) {
+        pool.blocks.push_back(createBlock(arena, pool, memoryMode, std::max(arena.blockSize, allocationSize)));
+        block = &pool.blocks.back();
+
+        if (!allocateFromBlock(*block, allocationSize, pool.alignment, offset)) {
+            throw std::runtime_error("Failed to allocate from a fresh arena block!");
+        }
+    }
+
+    arena.used += allocationSize;
+    arena.peakUsed = std::max(arena.peakUsed, arena.used);
+    arena.liveAllocations++;
+
+    Buffer b;
+    b.buffer = block->buffer;
+    b.deviceMemory = block->memory;
+    b.descriptorInfo.buffer = block->buffer;
+    b.descriptorInfo.offset = offset;
+    b.descriptorInfo.range = size;
+    b.device = arena.device;
+    b.size = size;
+    b.binding = binding;
+    b.memoryMode = memoryMode;
+    b.mapped = block->mapped != nullptr ? block->mapped + offset : nullptr;
+    b.arena = &arena;
+
+    return b;
+}
+
+// Returns the buffer's range to its block, merging it with free neighbours
+void arenaFree(MemoryArena& arena, Buffer& buffer) {
+    MemoryPool& pool = getPool(arena, buffer.memoryMode);
+
+    for (MemoryBlock& block : pool.blocks) {
+        if (block.memory != buffer.deviceMemory) continue;
+
+        auto allocation = block.allocations.find(buffer.descriptorInfo.offset);
+        if (allocation == block.allocations.end()) throw std::runtime_error("Buffer was not allocated from this arena!");
+
+        VkDeviceSize offset = allocation->first;
+        VkDeviceSize size = allocation->second;
+        block.allocations.erase(allocation);
+
+        arena.used -= size;
+        arena.liveAllocations--;
+
+        auto next = block.freeRanges.lower_bound(offset);
+        if (next != block.freeRanges.end() && offset + size == next->first) {
+            size += next->second;
+            next = block.freeRanges.erase(next);
+        }
+
+        if (next != block.freeRanges.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset) {
+                prev->second += size;
+                return;
+            }
+        }
+
+        block.freeRanges[offset] = size;
+        return;
+    }
+
+    throw std::runtime_error("Buffer was not allocated from this arena!");
+}
+
+ArenaStats getArenaStats(const MemoryArena& arena) {
+    ArenaStats stats{};
+    stats.used = arena.used;
+    stats.peakUsed = arena.peakUsed;
+    stats.liveAllocations = arena.liveAllocations;
+
+    for (const auto& pool : arena.pools) {
+        for (const MemoryBlock& block : pool.second.blocks) {
+            stats.reserved += block.size;
+            stats.blockCount++;
+
+            for (const auto& range : block.freeRanges) {
+                stats.totalFree += range.second;
+                stats.largestFreeRange = std::max(stats.largestFreeRange, range.second);
+            }
+        }
+    }
+
+    stats.fragmentation = stats.totalFree > 0 ? 1.0 - double(stats.largestFreeRange) / double(stats.totalFree) : 0.0;
+    return stats;
+}
+
+void printArenaStats(const MemoryArena& arena) {
+    ArenaStats stats = getArenaStats(arena);
+
+    std::cout << "Arena: " << stats.blockCount << " blocks, "
+              << stats.reserved / (1024.0 * 1024.0) << " MiB reserved, "
+              << stats.used / (1024.0 * 1024.0) << " MiB used (peak "
+              << stats.peakUsed / (1024.0 * 1024.0) << " MiB), "
+              << stats.liveAllocations << " live buffers, "
+              << "fragmentation " << stats.fragmentation * 100.0 << "%" << std::endl;
+}
+
+void destroyMemoryArena(MemoryArena& arena) {
+    for (auto& pool : arena.pools) {
+        for (MemoryBlock& block : pool.second.blocks) {
+            if (block.mapped != nullptr) vkUnmapMemory(arena.device, block.memory);
+            vkDestroyBuffer(arena.device, block.buffer, nullptr);
+            vkFreeMemory(arena.device, block.memory, nullptr);
+        }
+    }
+
+    arena.pools.clear();
+    arena.used = 0;
+    arena.liveAllocations = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include "./util.h"
+
+// A large chunk of device memory with a single VkBuffer bound to all of it.
+// Buffers handed out by the arena are ranges of that VkBuffer, so creating one
+// costs neither a vkAllocateMemory nor a vkCreateBuffer.
+struct MemoryBlock {
+    VkDeviceMemory memory;
+    VkBuffer buffer;
+    VkDeviceSize size;
+    char* mapped; // nullptr unless the block is host-visible
+
+    // offset -> size, ordered by offset so that neighbouring free ranges can be merged
+    std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+    std::map<VkDeviceSize, VkDeviceSize> allocations;
+};
+
+// All blocks that share one memory type (there is one entry per MemoryMode in practice)
+struct MemoryPool {
+    uint32_t memoryTypeIndex;
+    VkDeviceSize alignment;
+    std::vector<MemoryBlock> blocks;
+};
+
+// Buffers keep a pointer to the arena they came from, so the arena must not move while they are alive
+struct MemoryArena {
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    VkDeviceSize blockSize;
+    VkDeviceSize minOffsetAlignment;
+    std::map<MemoryMode, MemoryPool> pools;
+
+    VkDeviceSize used;
+    VkDeviceSize peakUsed;
+    uint32_t liveAllocations;
+};
+
+struct ArenaStats {
+    VkDeviceSize reserved;      // sum of all block sizes, i.e. what the arena holds from the driver
+    VkDeviceSize used;          // bytes currently handed out, including alignment padding
+    VkDeviceSize peakUsed;
+    VkDeviceSize totalFree;
+    VkDeviceSize largestFreeRange;
+    uint32_t blockCount;
+    uint32_t liveAllocations;
+    double fragmentation;       // 0 when all free memory is one contiguous range, approaches 1 when it is scattered
+};
+
+MemoryArena createMemoryArena(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = 64 << 20);
+Buffer createBuffer(MemoryArena& arena, VkDeviceSize size, uint32_t binding, MemoryMode memoryMode = MEMORY_HOST_VISIBLE);
+void arenaFree(MemoryArena& arena, Buffer& buffer);
+ArenaStats getArenaStats(const MemoryArena& arena);
+void printArenaStats(const MemoryArena& arena);
+void destroyMemoryArena(MemoryArena& arena);
+
+#endif // ALLOCATOR_H
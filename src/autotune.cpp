@@ -0,0 +1,261 @@
+#include "./autotune.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+// Dispatches per timed command buffer, enough to hide the submission on small sizes
+static const uint32_t dispatchesPerRun = 10;
+
+// Every workgroup size, items per thread and vector width the device can run
+std::vector<KernelConfig> kernelConfigCandidates(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    uint32_t maxThreads = std::min(properties.limits.maxComputeWorkGroupSize[0], properties.limits.maxComputeWorkGroupInvocations);
+
+    std::vector<KernelConfig> candidates;
+    for (uint32_t workgroupSize : {64u, 128u, 256u, 512u, 1024u}) {
+        if (workgroupSize > maxThreads) continue;
+        for (uint32_t itemsPerThread : {1u, 2u, 4u, 8u}) {
+            for (uint32_t vectorWidth : {1u, 4u}) {
+                candidates.push_back(KernelConfig{workgroupSize, itemsPerThread, vectorWidth});
+            }
+        }
+    }
+
+    return candidates;
+}
+
+// Identifies the device and driver a configuration was tuned on. A driver update can move the optimum,
+// so configurations from an older driver are not used.
+static std::string deviceKey(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    char key[64];
+    snprintf(key, sizeof(key), "%04x:%04x:%08x", properties.vendorID, properties.deviceID, properties.driverVersion);
+    return key;
+}
+
+static void beginCommands(VkCommandBuffer commandBuffer) {
+    vkResetCommandBuffer(commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+}
+
+static void recordBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+                          VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// Input `source` of the tuned kernels: small integers from 1 to 7, exact in every dtype, without the denormals or
+// NaNs of garbage that run at a different speed and without zeros to divide by. They differ from element to element
+// and from source to source, so a shape that skips or mixes up elements changes the result.
+static std::vector<char> inputPattern(const std::string& dtype, uint32_t nelem, uint32_t source) {
+    size_t size = getTypeSize(dtype);
+    std::vector<char> data(size_t(nelem) * size);
+    for (uint32_t i = 0; i < nelem; i++) {
+        uint32_t value = (i % 7) * (source + 1) % 7 + 1;
+        char* dest = data.data() + size_t(i) * size;
+        if (dtype == "float") {
+            float f = float(value);
+            memcpy(dest, &f, sizeof(f));
+        } else if (dtype == "float16") {
+            Float16 h = toFloat16(float(value));
+            memcpy(dest, &h.bits, sizeof(h.bits));
+        } else if (dtype == "bfloat16") {
+            Bfloat16 h = toBfloat16(float(value));
+            memcpy(dest, &h.bits, sizeof(h.bits));
+        } else if (size == 4) {
+            memcpy(dest, &value, sizeof(value));
+        } else {
+            int8_t b = static_cast<int8_t>(value);
+            memcpy(dest, &b, sizeof(b));
+        }
+    }
+    return data;
+}
+
+// Runs the kernel once on a cleared destination and returns what it wrote. `readback` is a host-visible buffer
+// of the destination's size.
+static std::vector<char> kernelOutput(VkDevice device, VkCommandBuffer commandBuffer, VkQueue queue, Kernel& kernel, Buffer& dest, Buffer& readback) {
+    beginCommands(commandBuffer);
+    // Anything but what a kernel writes, so elements a shape never reaches don't keep the previous shape's values
+    vkCmdFillBuffer(commandBuffer, dest.buffer, dest.descriptorInfo.offset, dest.size, 0xa5a5a5a5);
+    recordBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+    recordKernel(commandBuffer, kernel);
+    recordBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+    VkBufferCopy region{dest.descriptorInfo.offset, readback.descriptorInfo.offset, dest.size};
+    vkCmdCopyBuffer(commandBuffer, dest.buffer, readback.buffer, 1, &region);
+    recordBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+    vkEndCommandBuffer(commandBuffer);
+    executeCommandBuffer(device, commandBuffer, queue);
+
+    std::vector<char> output(dest.size);
+    copyBufferFromDevice(readback, output.data(), 0, dest.size);
+    return output;
+}
+
+// Median time of a few runs of an already recorded command buffer, in milliseconds
+static double timeCommandBuffer(VkDevice device, VkCommandBuffer commandBuffer, VkQueue queue) {
+    executeCommandBuffer(device, commandBuffer, queue);
+
+    std::vector<double> times;
+    for (int i = 0; i < 3; i++) {
+        auto start = std::chrono::steady_clock::now();
+        executeCommandBuffer(device, commandBuffer, queue);
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    std::sort(times.begin(), times.end());
+    return times[1];
+}
+
+// Runs the kernel with every candidate shape on `nelem` elements and keeps the fastest in the registry,
+// where createKernel picks it up from then on. Save the result with saveKernelConfigs.
+// A shape only wins if its output matches the default shape's bit for bit: every shape computes each element
+// the same way, one that differs reads or writes the wrong elements (or none) and is counted in `rejected`.
+TuningResult autotuneKernel(PipelineRegistry& registry, VkQueue queue, uint32_t queueFamilyIndex, Ops op, const std::string& dtype, const std::string& destDtype, uint32_t nelem) {
+    std::string outType = destDtype.empty() ? dtype : destDtype;
+    uint32_t arity = opArity(op);
+
+    TuningResult result;
+    result.kernelName = kernelConfigName(op, dtype, outType);
+    result.best = defaultKernelConfig();
+    result.bestGbps = 0;
+    result.defaultGbps = 0;
+    result.rejected = 0;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    VkCommandPool commandPool;
+    if (vkCreateCommandPool(registry.device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create command pool!");
+    }
+    VkCommandBuffer commandBuffer = createCommandBuffer(registry.device, commandPool);
+
+    std::vector<Buffer> src;
+    for (uint32_t i = 0; i < arity; i++) {
+        src.push_back(createBuffer(registry.physicalDevice, registry.device, VkDeviceSize(nelem) * getTypeSize(dtype), i, MEMORY_DEVICE_LOCAL));
+    }
+    std::vector<Buffer> dest = {createBuffer(registry.physicalDevice, registry.device, VkDeviceSize(nelem) * getTypeSize(outType), arity, MEMORY_DEVICE_LOCAL)};
+    std::vector<Buffer> readback = {createBuffer(registry.physicalDevice, registry.device, dest[0].size, 0, MEMORY_HOST_VISIBLE)};
+
+    // Inputs go through host-visible copies of the sources
+    std::vector<Buffer> uploads;
+    beginCommands(commandBuffer);
+    for (uint32_t i = 0; i < arity; i++) {
+        std::vector<char> pattern = inputPattern(dtype, nelem, i);
+        uploads.push_back(createBuffer(registry.physicalDevice, registry.device, src[i].size, i, MEMORY_HOST_VISIBLE));
+        copyToBuffer(uploads[i], pattern.data(), 0, pattern.size());
+
+        VkBufferCopy region{uploads[i].descriptorInfo.offset, src[i].descriptorInfo.offset, src[i].size};
+        vkCmdCopyBuffer(commandBuffer, uploads[i].buffer, src[i].buffer, 1, &region);
+    }
+    recordBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    vkEndCommandBuffer(commandBuffer);
+    executeCommandBuffer(registry.device, commandBuffer, queue);
+    destroyBuffers(uploads);
+
+    KernelConfig fallback = defaultKernelConfig();
+    registry.kernelConfigs[result.kernelName] = fallback;
+    Kernel reference = createKernel(registry, op, src, dest[0], dtype, destDtype);
+    std::vector<char> expected = kernelOutput(registry.device, commandBuffer, queue, reference, dest[0], readback[0]);
+    destroyKernel(reference);
+
+    VkDeviceSize bytes = VkDeviceSize(nelem) * (arity * getTypeSize(dtype) + getTypeSize(outType)) * dispatchesPerRun;
+    for (const KernelConfig& candidate : kernelConfigCandidates(registry.physicalDevice)) {
+        registry.kernelConfigs[result.kernelName] = candidate;
+        Kernel kernel = createKernel(registry, op, src, dest[0], dtype, destDtype);
+
+        beginCommands(commandBuffer);
+        for (uint32_t i = 0; i < dispatchesPerRun; i++) {
+            if (i > 0) recordKernelBarrier(commandBuffer);
+            recordKernel(commandBuffer, kernel);
+        }
+        vkEndCommandBuffer(commandBuffer);
+
+        double gbps = bytes / (timeCommandBuffer(registry.device, commandBuffer, queue) * 1e6);
+        bool correct = kernelOutput(registry.device, commandBuffer, queue, kernel, dest[0], readback[0]) == expected;
+        destroyKernel(kernel);
+
+        if (candidate.workgroupSize == fallback.workgroupSize && candidate.itemsPerThread == fallback.itemsPerThread &&
+            candidate.vectorWidth == fallback.vectorWidth) {
+            result.defaultGbps = gbps;
+        }
+        if (!correct) {
+            result.rejected++;
+            continue;
+        }
+        if (gbps > result.bestGbps) {
+            result.bestGbps = gbps;
+            result.best = candidate;
+        }
+    }
+
+    registry.kernelConfigs[result.kernelName] = result.best;
+
+    destroyBuffers(src);
+    destroyBuffers(dest);
+    destroyBuffers(readback);
+    vkDestroyCommandPool(registry.device, commandPool, nullptr);
+
+    return result;
+}
+
+// One line per device and kernel: "<device> <kernel> <workgroup size> <items per thread> <vector width>".
+// Only lines for the registry's device and driver are loaded, a missing file is fine.
+void loadKernelConfigs(PipelineRegistry& registry, const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) return;
+
+    std::string device = deviceKey(registry.physicalDevice);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string lineDevice, kernelName;
+        KernelConfig config;
+        if (!(fields >> lineDevice >> kernelName >> config.workgroupSize >> config.itemsPerThread >> config.vectorWidth)) continue;
+        if (lineDevice == device) registry.kernelConfigs[kernelName] = config;
+    }
+}
+
+// Rewrites the file with the registry's configurations, lines for other devices are kept as they are
+void saveKernelConfigs(const PipelineRegistry& registry, const std::string& path) {
+    std::string device = deviceKey(registry.physicalDevice);
+    std::vector<std::string> lines;
+
+    std::ifstream existing(path);
+    std::string line;
+    while (std::getline(existing, line)) {
+        if (line.compare(0, device.size() + 1, device + " ") != 0) lines.push_back(line);
+    }
+    existing.close();
+
+    for (const auto& entry : registry.kernelConfigs) {
+        std::ostringstream out;
+        out << device << " " << entry.first << " " << entry.second.workgroupSize << " "
+            << entry.second.itemsPerThread << " " << entry.second.vectorWidth;
+        lines.push_back(out.str());
+    }
+
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open()) throw std::runtime_error("Failed to write kernel configurations!");
+    for (const std::string& entry : lines) file << entry << "\n";
+}
@@ -0,0 +1,23 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "./util.h"
+#include "./pipeline_cache.h"
+#include "./kernel.h"
+
+// Outcome of tuning one kernel: the fastest launch shape, how it compares to the default one,
+// and how many shapes were left out because their output was wrong
+struct TuningResult {
+    std::string kernelName;
+    KernelConfig best;
+    double bestGbps;
+    double defaultGbps;
+    uint32_t rejected;
+};
+
+std::vector<KernelConfig> kernelConfigCandidates(VkPhysicalDevice physicalDevice);
+TuningResult autotuneKernel(PipelineRegistry& registry, VkQueue queue, uint32_t queueFamilyIndex, Ops op, const std::string& dtype = "float", const std::string& destDtype = "", uint32_t nelem = 1 << 22);
+void loadKernelConfigs(PipelineRegistry& registry, const std::string& path = "kernel_tuning.txt");
+void saveKernelConfigs(const PipelineRegistry& registry, const std::string& path = "kernel_tuning.txt");
+
+#endif // AUTOTUNE_H
@@ -0,0 +1,146 @@
+#include "./capture.h"
+
+// The graph's own input and output buffers become the first recording, so replaying with them costs nothing extra
+GraphCapture captureGraph(PipelineRegistry& registry, CompiledGraph& compiled, const Graph& graph, VkCommandPool commandPool) {
+    GraphCapture capture;
+    capture.device = compiled.device;
+    capture.commandPool = commandPool;
+    capture.registry = &registry;
+    capture.compiled = &compiled;
+    capture.recordings = 0;
+    capture.replayCount = 0;
+
+    ReplayBindings original;
+    for (uint32_t id = 0; id < graph.nodes.size(); id++) {
+        const GraphNode& node = graph.nodes[id];
+        VkDeviceSize bytes = VkDeviceSize(node.nelem) * getTypeSize(node.dtype);
+        if (node.op == EMPTY) {
+            capture.inputs.push_back(id);
+            capture.inputBytes.push_back(bytes);
+            original.inputs.push_back(node.buffer);
+        } else if (node.isOutput) {
+            capture.outputs.push_back(id);
+            capture.outputBytes.push_back(bytes);
+            original.outputs.push_back(node.buffer);
+        }
+    }
+
+    replayCommandBuffer(capture, original);
+    return capture;
+}
+
+static void checkBindings(const GraphCapture& capture, const ReplayBindings& bindings) {
+    if (bindings.inputs.size() != capture.inputs.size() || bindings.outputs.size() != capture.outputs.size()) {
+        throw std::runtime_error("Replay needs " + std::to_string(capture.inputs.size()) + " inputs and " +
+                                 std::to_string(capture.outputs.size()) + " outputs.");
+    }
+    for (size_t i = 0; i < bindings.inputs.size(); i++) {
+        if (bindings.inputs[i].size < capture.inputBytes[i]) throw std::runtime_error("Replay input buffer is too small.");
+    }
+    for (size_t i = 0; i < bindings.outputs.size(); i++) {
+        if (bindings.outputs[i].size < capture.outputBytes[i]) throw std::runtime_error("Replay output buffer is too small.");
+    }
+}
+
+static ReplayKey replayKey(const ReplayBindings& bindings) {
+    ReplayKey key;
+    for (const Buffer& buffer : bindings.inputs) key.emplace_back(buffer.buffer, buffer.descriptorInfo.offset, buffer.descriptorInfo.range);
+    for (const Buffer& buffer : bindings.outputs) key.emplace_back(buffer.buffer, buffer.descriptorInfo.offset, buffer.descriptorInfo.range);
+    return key;
+}
+
+// Kernels that only touch intermediates keep the descriptors of the compiled graph, the others get new ones
+static CapturedReplay recordReplay(GraphCapture& capture, const ReplayBindings& bindings) {
+    CompiledGraph& compiled = *capture.compiled;
+
+    std::map<uint32_t, Buffer> swapped;
+    for (size_t i = 0; i < capture.inputs.size(); i++) swapped[capture.inputs[i]] = bindings.inputs[i];
+    for (size_t i = 0; i < capture.outputs.size(); i++) swapped[capture.outputs[i]] = bindings.outputs[i];
+
+    CapturedReplay replay;
+    std::vector<KernelBindings> kernelBindings(compiled.kernels.size());
+    std::vector<bool> ownsDescriptors(compiled.kernels.size(), false);
+    for (size_t k = 0; k < compiled.kernels.size(); k++) {
+        const FusedKernel& kernel = compiled.kernels[k];
+        kernelBindings[k].buffers = kernel.bindings;
+        kernelBindings[k].descriptors = &kernel.descriptors;
+
+        for (size_t b = 0; b < kernel.bindingNodes.size(); b++) {
+            auto it = swapped.find(kernel.bindingNodes[b]);
+            if (it == swapped.end()) continue;
+
+            kernelBindings[k].buffers[b] = it->second;
+            kernelBindings[k].buffers[b].binding = static_cast<uint32_t>(b);
+            ownsDescriptors[k] = true;
+        }
+    }
+
+    // Reserved up front, kernelBindings points into it
+    replay.descriptors.reserve(compiled.kernels.size());
+    for (size_t k = 0; k < compiled.kernels.size(); k++) {
+        if (!ownsDescriptors[k]) continue;
+        replay.descriptors.push_back(createDescriptorBinding(*capture.registry, *compiled.kernels[k].pipeline, kernelBindings[k].buffers));
+        kernelBindings[k].descriptors = &replay.descriptors.back();
+    }
+
+    replay.commandBuffer = createCommandBuffer(capture.device, capture.commandPool);
+    recordGraph(replay.commandBuffer, compiled, kernelBindings);
+    capture.recordings++;
+    return replay;
+}
+
+// The recording for these bindings, made on first use. Submit it however fits (executeCommandBuffer, submitAsync),
+// but not again before the last submission of it is done: the same bindings always give the same command buffer.
+VkCommandBuffer replayCommandBuffer(GraphCapture& capture, const ReplayBindings& bindings) {
+    checkBindings(capture, bindings);
+
+    ReplayKey key = replayKey(bindings);
+    auto it = capture.replays.find(key);
+    if (it == capture.replays.end()) it = capture.replays.insert(std::make_pair(key, recordReplay(capture, bindings))).first;
+
+    capture.replayCount++;
+    return it->second.commandBuffer;
+}
+
+// Runs the graph on `bindings` and waits for it
+void replayGraph(GraphCapture& capture, const ReplayBindings& bindings, VkQueue queue) {
+    executeCommandBuffer(capture.device, replayCommandBuffer(capture, bindings), queue);
+}
+
+static void destroyReplay(GraphCapture& capture, CapturedReplay& replay) {
+    vkFreeCommandBuffers(capture.device, capture.commandPool, 1, &replay.commandBuffer);
+    for (DescriptorBinding& descriptors : replay.descriptors) destroyDescriptorBinding(capture.device, descriptors);
+}
+
+// Frees the recording for these bindings, if there is one. Its last submission has to be done.
+void releaseReplay(GraphCapture& capture, const ReplayBindings& bindings) {
+    auto it = capture.replays.find(replayKey(bindings));
+    if (it == capture.replays.end()) return;
+
+    destroyReplay(capture, it->second);
+    capture.replays.erase(it);
+}
+
+// Frees every recording that binds `buffer`, call it before the buffer is destroyed. Returns how many there were.
+uint32_t releaseReplays(GraphCapture& capture, VkBuffer buffer) {
+    uint32_t released = 0;
+    for (auto it = capture.replays.begin(); it != capture.replays.end();) {
+        bool binds = false;
+        for (const auto& binding : it->first) binds = binds || std::get<0>(binding) == buffer;
+        if (!binds) {
+            ++it;
+            continue;
+        }
+
+        destroyReplay(capture, it->second);
+        it = capture.replays.erase(it);
+        released++;
+    }
+    return released;
+}
+
+// The compiled graph stays, it belongs to the caller
+void destroyGraphCapture(GraphCapture& capture) {
+    for (auto& entry : capture.replays) destroyReplay(capture, entry.second);
+    capture.replays.clear();
+}
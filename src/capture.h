@@ -0,0 +1,56 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <tuple>
+
+#include "./util.h"
+#include "./descriptors.h"
+#include "./graph.h"
+
+// Record once, replay many times. A capture holds a compiled graph recorded into reusable command buffers,
+// each replay only says which buffers to use for the graph's inputs and outputs this time.
+// Bindings are written into the command buffer when it's recorded (push descriptors), so every distinct set of
+// buffers gets a recording of its own on first use, and later replays with the same set just submit it again.
+// Cycle through a fixed ring of buffers (double buffering) and the recording cost is paid once per ring slot.
+// Recordings are kept until they are released: bound buffers have to outlive their recordings, so release them with
+// releaseReplays before a buffer is destroyed (a new buffer can get the old handle and would hit the stale recording),
+// and with releaseReplay when buffers are not reused, or every new set of them adds a recording that is never freed.
+
+// Buffers for the graph's inputs, in the order they were added, and its outputs, in the order of the ids markOutput returned
+struct ReplayBindings {
+    std::vector<Buffer> inputs;
+    std::vector<Buffer> outputs;
+};
+
+struct CapturedReplay {
+    VkCommandBuffer commandBuffer;
+    std::vector<DescriptorBinding> descriptors; // for the kernels that bind a swapped buffer
+};
+
+typedef std::vector<std::tuple<VkBuffer, VkDeviceSize, VkDeviceSize>> ReplayKey;
+
+struct GraphCapture {
+    VkDevice device;
+    VkCommandPool commandPool;
+    PipelineRegistry* registry;
+    CompiledGraph* compiled;
+
+    // Graph nodes in binding order, with the size a buffer for them needs
+    std::vector<uint32_t> inputs;
+    std::vector<uint32_t> outputs;
+    std::vector<VkDeviceSize> inputBytes;
+    std::vector<VkDeviceSize> outputBytes;
+
+    std::map<ReplayKey, CapturedReplay> replays;
+    uint32_t recordings;
+    uint64_t replayCount;
+};
+
+GraphCapture captureGraph(PipelineRegistry& registry, CompiledGraph& compiled, const Graph& graph, VkCommandPool commandPool);
+VkCommandBuffer replayCommandBuffer(GraphCapture& capture, const ReplayBindings& bindings);
+void replayGraph(GraphCapture& capture, const ReplayBindings& bindings, VkQueue queue);
+void releaseReplay(GraphCapture& capture, const ReplayBindings& bindings);
+uint32_t releaseReplays(GraphCapture& capture, VkBuffer buffer);
+void destroyGraphCapture(GraphCapture& capture);
+
+#endif // CAPTURE_H
@@ -0,0 +1,512 @@
+#include "./cpu_backend.h"
+#include "./profiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_SIMD_AVX2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CPU_SIMD_NEON 1
+#endif
+
+// Ranges shorter than this run on the calling thread, waking the workers costs more than it saves
+static const size_t parallelGrain = 1 << 16;
+
+// Picks chunks of the current parallelFor until there are none left. Called with the pool locked.
+static void runChunks(ThreadPool& pool, std::unique_lock<std::mutex>& lock) {
+    while (pool.nextChunk < pool.chunkCount) {
+        uint32_t chunk = pool.nextChunk++;
+
+        lock.unlock();
+        pool.task(chunk);
+        lock.lock();
+
+        if (++pool.finishedChunks == pool.chunkCount) pool.done.notify_all();
+    }
+}
+
+static void workerLoop(ThreadPool* pool) {
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    uint64_t seen = pool->generation;
+
+    while (true) {
+        pool->wake.wait(lock, [&]() { return pool->stopping || pool->generation != seen; });
+        if (pool->stopping) return;
+
+        seen = pool->generation;
+        runChunks(*pool, lock);
+    }
+}
+
+// `threads` counts the calling thread, 0 means one per hardware thread
+ThreadPool* createThreadPool(uint32_t threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    ThreadPool* pool = new ThreadPool();
+    pool->chunkCount = 0;
+    pool->nextChunk = 0;
+    pool->finishedChunks = 0;
+    pool->generation = 0;
+    pool->stopping = false;
+
+    for (uint32_t i = 1; i < threads; i++) {
+        pool->workers.emplace_back(workerLoop, pool);
+    }
+
+    return pool;
+}
+
+uint32_t threadCount(const ThreadPool& pool) {
+    return static_cast<uint32_t>(pool.workers.size()) + 1;
+}
+
+// Splits [0, count) into at most one chunk per thread, each at least `grain` long, and runs `body` on them.
+// Returns once every chunk is done. Only one parallelFor can run on a pool at a time, and `body` must not start another.
+void parallelFor(ThreadPool& pool, size_t count, size_t grain, const std::function<void(size_t begin, size_t end)>& body) {
+    if (count == 0) return;
+
+    size_t chunks = std::min<size_t>(threadCount(pool), (count + grain - 1) / std::max<size_t>(grain, 1));
+    if (chunks <= 1) {
+        body(0, count);
+        return;
+    }
+
+    // Whole cache lines per chunk, so no two threads write the same line
+    size_t chunkSize = alignUp((count + chunks - 1) / chunks, 64);
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.task = [&](uint32_t chunk) {
+        size_t begin = chunk * chunkSize;
+        size_t end = std::min(count, begin + chunkSize);
+        if (begin < end) body(begin, end);
+    };
+    pool.chunkCount = static_cast<uint32_t>(chunks);
+    pool.nextChunk = 0;
+    pool.finishedChunks = 0;
+    pool.generation++;
+    pool.wake.notify_all();
+
+    runChunks(pool, lock);
+    pool.done.wait(lock, [&]() { return pool.finishedChunks == pool.chunkCount; });
+    pool.task = nullptr;
+}
+
+// Runs `body` once per item, every item a chunk of its own. For a handful of expensive items (like shader compiles),
+// which parallelFor would put into a single cache-line sized chunk. Same restrictions as parallelFor.
+void parallelEach(ThreadPool& pool, size_t count, const std::function<void(size_t i)>& body) {
+    if (count == 0) return;
+    if (count == 1 || threadCount(pool) == 1) {
+        for (size_t i = 0; i < count; i++) body(i);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.task = [&](uint32_t chunk) { body(chunk); };
+    pool.chunkCount = static_cast<uint32_t>(count);
+    pool.nextChunk = 0;
+    pool.finishedChunks = 0;
+    pool.generation++;
+    pool.wake.notify_all();
+
+    runChunks(pool, lock);
+    pool.done.wait(lock, [&]() { return pool.finishedChunks == pool.chunkCount; });
+    pool.task = nullptr;
+}
+
+void destroyThreadPool(ThreadPool* pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->stopping = true;
+    }
+    pool->wake.notify_all();
+
+    for (std::thread& worker : pool->workers) worker.join();
+    delete pool;
+}
+
+// Same as threefry2x32 and threefryBits in src/shaders/threefry.glsl
+static uint32_t rotl32(uint32_t x, uint32_t r) {
+    return (x << r) | (x >> (32u - r));
+}
+
+void threefry2x32(const uint32_t key[2], const uint32_t counter[2], uint32_t out[2]) {
+    static const uint32_t rotations[8] = {13, 15, 26, 6, 17, 29, 16, 24};
+    uint32_t ks[3] = {key[0], key[1], 0x1BD11BDAu ^ key[0] ^ key[1]};
+
+    uint32_t x0 = counter[0] + key[0];
+    uint32_t x1 = counter[1] + key[1];
+
+    for (uint32_t r = 0; r < 20; r++) {
+        x0 += x1;
+        x1 = rotl32(x1, rotations[r % 8]);
+        x1 ^= x0;
+
+        if (r % 4 == 3) {
+            uint32_t s = r / 4 + 1;
+            x0 += ks[s % 3];
+            x1 += ks[(s + 1) % 3] + s;
+        }
+    }
+
+    out[0] = x0;
+    out[1] = x1;
+}
+
+uint32_t threefryBits(uint32_t counter, uint32_t key) {
+    uint32_t keys[2] = {key, 0u};
+    uint32_t counters[2] = {counter, 0u};
+    uint32_t out[2];
+    threefry2x32(keys, counters, out);
+    return out[0];
+}
+
+// Vectorized loops for the common ops. They return how many elements they handled,
+// the scalar loops below pick up the rest (and every op without a vector version).
+#if CPU_SIMD_AVX2
+static bool detectAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+static const bool hasAvx2 = detectAvx2();
+
+__attribute__((target("avx2,fma")))
+static size_t floatSimd(Ops op, const float* a, const float* b, const float* c, float* d, size_t n) {
+    size_t i = 0;
+    switch (op) {
+        case ADD: for (; i + 8 <= n; i += 8) _mm256_storeu_ps(d + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))); break;
+        case SUB: for (; i + 8 <= n; i += 8) _mm256_storeu_ps(d + i, _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))); break;
+        case MUL: for (; i + 8 <= n; i += 8) _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))); break;
+        case MAX: for (; i + 8 <= n; i += 8) _mm256_storeu_ps(d + i, _mm256_max_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))); break;
+        case MULACC:
+            for (; i + 8 <= n; i += 8) {
+                _mm256_storeu_ps(d + i, _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), _mm256_loadu_ps(c + i)));
+            }
+            break;
+        default: break;
+    }
+    return i;
+}
+
+#define LOAD_EPI32(p) _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))
+#define STORE_EPI32(p, v) _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v)
+
+__attribute__((target("avx2")))
+static size_t int32Simd(Ops op, bool isSigned, const int32_t* a, const int32_t* b, int32_t* d, size_t n) {
+    size_t i = 0;
+    switch (op) {
+        case ADD: for (; i + 8 <= n; i += 8) STORE_EPI32(d + i, _mm256_add_epi32(LOAD_EPI32(a + i), LOAD_EPI32(b + i))); break;
+        case SUB: for (; i + 8 <= n; i += 8) STORE_EPI32(d + i, _mm256_sub_epi32(LOAD_EPI32(a + i), LOAD_EPI32(b + i))); break;
+        case MUL: for (; i + 8 <= n; i += 8) STORE_EPI32(d + i, _mm256_mullo_epi32(LOAD_EPI32(a + i), LOAD_EPI32(b + i))); break;
+        case XOR: for (; i + 8 <= n; i += 8) STORE_EPI32(d + i, _mm256_xor_si256(LOAD_EPI32(a + i), LOAD_EPI32(b + i))); break;
+        case OR: for (; i + 8 <= n; i += 8) STORE_EPI32(d + i, _mm256_or_si256(LOAD_EPI32(a + i), LOAD_EPI32(b + i))); break;
+        case AND: for (; i + 8 <= n; i += 8) STORE_EPI32(d + i, _mm256_and_si256(LOAD_EPI32(a + i), LOAD_EPI32(b + i))); break;
+        case MAX:
+            if (isSigned) for (; i + 8 <= n; i += 8) STORE_EPI32(d + i, _mm256_max_epi32(LOAD_EPI32(a + i), LOAD_EPI32(b + i)));
+            else for (; i + 8 <= n; i += 8) STORE_EPI32(d + i, _mm256_max_epu32(LOAD_EPI32(a + i), LOAD_EPI32(b + i)));
+            break;
+        default: break;
+    }
+    return i;
+}
+#elif CPU_SIMD_NEON
+static size_t floatSimd(Ops op, const float* a, const float* b, const float* c, float* d, size_t n) {
+    size_t i = 0;
+    switch (op) {
+        case ADD: for (; i + 4 <= n; i += 4) vst1q_f32(d + i, vaddq_f32(vld1q_f32(a + i), vld1q_f32(b + i))); break;
+        case SUB: for (; i + 4 <= n; i += 4) vst1q_f32(d + i, vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i))); break;
+        case MUL: for (; i + 4 <= n; i += 4) vst1q_f32(d + i, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i))); break;
+        case MAX: for (; i + 4 <= n; i += 4) vst1q_f32(d + i, vmaxq_f32(vld1q_f32(a + i), vld1q_f32(b + i))); break;
+#if defined(__aarch64__)
+        case MULACC: for (; i + 4 <= n; i += 4) vst1q_f32(d + i, vfmaq_f32(vld1q_f32(c + i), vld1q_f32(a + i), vld1q_f32(b + i))); break;
+#endif
+        default: break;
+    }
+    return i;
+}
+
+static size_t int32Simd(Ops op, bool isSigned, const int32_t* a, const int32_t* b, int32_t* d, size_t n) {
+    size_t i = 0;
+    switch (op) {
+        case ADD: for (; i + 4 <= n; i += 4) vst1q_s32(d + i, vaddq_s32(vld1q_s32(a + i), vld1q_s32(b + i))); break;
+        case SUB: for (; i + 4 <= n; i += 4) vst1q_s32(d + i, vsubq_s32(vld1q_s32(a + i), vld1q_s32(b + i))); break;
+        case MUL: for (; i + 4 <= n; i += 4) vst1q_s32(d + i, vmulq_s32(vld1q_s32(a + i), vld1q_s32(b + i))); break;
+        case XOR: for (; i + 4 <= n; i += 4) vst1q_s32(d + i, veorq_s32(vld1q_s32(a + i), vld1q_s32(b + i))); break;
+        case OR: for (; i + 4 <= n; i += 4) vst1q_s32(d + i, vorrq_s32(vld1q_s32(a + i), vld1q_s32(b + i))); break;
+        case AND: for (; i + 4 <= n; i += 4) vst1q_s32(d + i, vandq_s32(vld1q_s32(a + i), vld1q_s32(b + i))); break;
+        case MAX:
+            if (isSigned) {
+                for (; i + 4 <= n; i += 4) vst1q_s32(d + i, vmaxq_s32(vld1q_s32(a + i), vld1q_s32(b + i)));
+            } else {
+                for (; i + 4 <= n; i += 4) {
+                    uint32x4_t x = vreinterpretq_u32_s32(vld1q_s32(a + i));
+                    uint32x4_t y = vreinterpretq_u32_s32(vld1q_s32(b + i));
+                    vst1q_s32(d + i, vreinterpretq_s32_u32(vmaxq_u32(x, y)));
+                }
+            }
+            break;
+        default: break;
+    }
+    return i;
+}
+#endif
+
+const char* cpuSimdName() {
+#if CPU_SIMD_AVX2
+    return hasAvx2 ? "avx2" : "scalar";
+#elif CPU_SIMD_NEON
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+static size_t vectorizedFloat(Ops op, const float* a, const float* b, const float* c, float* d, size_t n) {
+#if CPU_SIMD_AVX2
+    return hasAvx2 ? floatSimd(op, a, b, c, d, n) : 0;
+#elif CPU_SIMD_NEON
+    return floatSimd(op, a, b, c, d, n);
+#else
+    return 0;
+#endif
+}
+
+// int and uint share the bit patterns for everything but MAX
+static size_t vectorizedInt32(Ops op, bool isSigned, const void* a, const void* b, void* d, size_t n) {
+#if CPU_SIMD_AVX2
+    if (!hasAvx2) return 0;
+    return int32Simd(op, isSigned, static_cast<const int32_t*>(a), static_cast<const int32_t*>(b), static_cast<int32_t*>(d), n);
+#elif CPU_SIMD_NEON
+    return int32Simd(op, isSigned, static_cast<const int32_t*>(a), static_cast<const int32_t*>(b), static_cast<int32_t*>(d), n);
+#else
+    return 0;
+#endif
+}
+
+template <typename T, typename F>
+static void map1(const T* a, T* d, size_t i, size_t n, F f) {
+    for (; i < n; i++) d[i] = f(a[i]);
+}
+
+template <typename T, typename F>
+static void map2(const T* a, const T* b, T* d, size_t i, size_t n, F f) {
+    for (; i < n; i++) d[i] = f(a[i], b[i]);
+}
+
+template <typename T, typename F>
+static void map3(const T* a, const T* b, const T* c, T* d, size_t i, size_t n, F f) {
+    for (; i < n; i++) d[i] = f(a[i], b[i], c[i]);
+}
+
+// Signed integers wrap around like they do on the GPU, instead of overflowing
+template <typename T> static T wrapAdd(T a, T b) { return a + b; }
+template <typename T> static T wrapSub(T a, T b) { return a - b; }
+template <typename T> static T wrapMul(T a, T b) { return a * b; }
+template <typename T> static T wrapNeg(T a) { return -a; }
+static int32_t wrapAdd(int32_t a, int32_t b) { return int32_t(uint32_t(a) + uint32_t(b)); }
+static int32_t wrapSub(int32_t a, int32_t b) { return int32_t(uint32_t(a) - uint32_t(b)); }
+static int32_t wrapMul(int32_t a, int32_t b) { return int32_t(uint32_t(a) * uint32_t(b)); }
+static int32_t wrapNeg(int32_t a) { return int32_t(0u - uint32_t(a)); }
+
+// Division by zero is undefined on the GPU, here it gives 0 instead of a crash
+template <typename T> static T safeDiv(T a, T b) {
+    if (b == 0) return 0;
+    if (T(-1) < 0 && b == T(-1)) return wrapNeg(a);
+    return a / b;
+}
+
+template <typename T> static T safeMod(T a, T b) {
+    if (b == 0 || (T(-1) < 0 && b == T(-1))) return 0;
+    return a % b;
+}
+
+// Conversions between the dtypes a kernel stores and the ones it computes in
+template <typename T> static T widen(T value) { return value; }
+static float widen(Float16 value) { return toFloat(value); }
+static float widen(Bfloat16 value) { return toFloat(value); }
+static int32_t widen(int8_t value) { return value; }
+
+template <typename D, typename V> static void narrowInto(D& dest, V value) { dest = static_cast<D>(value); }
+template <typename V> static void narrowInto(Float16& dest, V value) { dest = toFloat16(static_cast<float>(value)); }
+template <typename V> static void narrowInto(Bfloat16& dest, V value) { dest = toBfloat16(static_cast<float>(value)); }
+template <typename V> static void narrowInto(int8_t& dest, V value) { dest = static_cast<int8_t>(static_cast<int32_t>(value)); }
+
+// Same results as apply() in src/shaders/elementwise.comp
+static void floatChunk(Ops op, const float* a, const float* b, const float* c, float* d, size_t n) {
+    size_t i = vectorizedFloat(op, a, b, c, d, n);
+
+    switch (op) {
+        case EXP2: map1(a, d, i, n, [](float x) { return std::exp2(x); }); break;
+        case LOG2: map1(a, d, i, n, [](float x) { return std::log2(x); }); break;
+        case SIN: map1(a, d, i, n, [](float x) { return std::sin(x); }); break;
+        case SQRT: map1(a, d, i, n, [](float x) { return std::sqrt(x); }); break;
+        case RECIP: map1(a, d, i, n, [](float x) { return 1.0f / x; }); break;
+        case NEG: map1(a, d, i, n, [](float x) { return -x; }); break;
+        case ADD: map2(a, b, d, i, n, [](float x, float y) { return x + y; }); break;
+        case SUB: map2(a, b, d, i, n, [](float x, float y) { return x - y; }); break;
+        case MUL: map2(a, b, d, i, n, [](float x, float y) { return x * y; }); break;
+        case IDIV: map2(a, b, d, i, n, [](float x, float y) { return std::trunc(x / y); }); break;
+        case MOD: map2(a, b, d, i, n, [](float x, float y) { return x - y * std::trunc(x / y); }); break;
+        case MAX: map2(a, b, d, i, n, [](float x, float y) { return x < y ? y : x; }); break;
+        case CMPLT: map2(a, b, d, i, n, [](float x, float y) { return x < y ? 1.0f : 0.0f; }); break;
+        case CMPNE: map2(a, b, d, i, n, [](float x, float y) { return x != y ? 1.0f : 0.0f; }); break;
+        case WHERE: map3(a, b, c, d, i, n, [](float x, float y, float z) { return x != 0.0f ? y : z; }); break;
+        case MULACC: map3(a, b, c, d, i, n, [](float x, float y, float z) { return std::fma(x, y, z); }); break;
+        default: break;
+    }
+}
+
+// float16 and bfloat16 are computed as floats and rounded once per result, like on the GPU
+template <typename T>
+static void narrowFloatChunk(Ops op, const T* a, const T* b, const T* c, T* d, size_t n) {
+    const size_t block = 256;
+    float wa[block], wb[block], wc[block], wd[block];
+
+    for (size_t begin = 0; begin < n; begin += block) {
+        size_t count = std::min(block, n - begin);
+        for (size_t i = 0; i < count; i++) {
+            wa[i] = toFloat(a[begin + i]);
+            wb[i] = toFloat(b[begin + i]);
+            wc[i] = toFloat(c[begin + i]);
+        }
+        floatChunk(op, wa, wb, wc, wd, count);
+        for (size_t i = 0; i < count; i++) narrowInto(d[begin + i], wd[i]);
+    }
+}
+
+// Also covers int8: the shift and wrap behaviour of 32 bit ints truncated to 8 bits is what the GPU computes
+template <typename T>
+static void integerChunk(Ops op, const T* a, const T* b, const T* c, T* d, size_t n) {
+    size_t i = sizeof(T) == 4 ? vectorizedInt32(op, T(-1) < 0, a, b, d, n) : 0;
+
+    switch (op) {
+        case NEG: map1(a, d, i, n, [](T x) { return wrapNeg(x); }); break;
+        case ADD: map2(a, b, d, i, n, [](T x, T y) { return wrapAdd(x, y); }); break;
+        case SUB: map2(a, b, d, i, n, [](T x, T y) { return wrapSub(x, y); }); break;
+        case MUL: map2(a, b, d, i, n, [](T x, T y) { return wrapMul(x, y); }); break;
+        case IDIV: map2(a, b, d, i, n, [](T x, T y) { return safeDiv(x, y); }); break;
+        case MOD: map2(a, b, d, i, n, [](T x, T y) { return safeMod(x, y); }); break;
+        case MAX: map2(a, b, d, i, n, [](T x, T y) { return x < y ? y : x; }); break;
+        case CMPLT: map2(a, b, d, i, n, [](T x, T y) { return T(x < y ? 1 : 0); }); break;
+        case CMPNE: map2(a, b, d, i, n, [](T x, T y) { return T(x != y ? 1 : 0); }); break;
+        case XOR: map2(a, b, d, i, n, [](T x, T y) { return T(x ^ y); }); break;
+        case OR: map2(a, b, d, i, n, [](T x, T y) { return T(x | y); }); break;
+        case AND: map2(a, b, d, i, n, [](T x, T y) { return T(x & y); }); break;
+        case SHL: map2(a, b, d, i, n, [](T x, T y) { return T(uint32_t(x) << (uint32_t(y) & 31u)); }); break;
+        case SHR: map2(a, b, d, i, n, [](T x, T y) { return T(x >> (uint32_t(y) & 31u)); }); break;
+        case THREEFRY: map2(a, b, d, i, n, [](T x, T y) { return T(threefryBits(uint32_t(x), uint32_t(y))); }); break;
+        case WHERE: map3(a, b, c, d, i, n, [](T x, T y, T z) { return x != 0 ? y : z; }); break;
+        case MULACC: map3(a, b, c, d, i, n, [](T x, T y, T z) { return wrapAdd(wrapMul(x, y), z); }); break;
+        default: break;
+    }
+}
+
+// Value conversion, out of range values are as undefined here as they are on the GPU.
+// Like cast.comp, narrow types are widened to float or int first and the result is narrowed again.
+template <typename S, typename D>
+static void castChunk(const void* src, void* dest, size_t n) {
+    const S* s = static_cast<const S*>(src);
+    D* d = static_cast<D*>(dest);
+    for (size_t i = 0; i < n; i++) narrowInto(d[i], widen(s[i]));
+}
+
+template <typename S>
+static void castFrom(const std::string& destDtype, const void* src, void* dest, size_t n) {
+    if (destDtype == "float") castChunk<S, float>(src, dest, n);
+    else if (destDtype == "int") castChunk<S, int32_t>(src, dest, n);
+    else if (destDtype == "float16") castChunk<S, Float16>(src, dest, n);
+    else if (destDtype == "bfloat16") castChunk<S, Bfloat16>(src, dest, n);
+    else if (destDtype == "int8") castChunk<S, int8_t>(src, dest, n);
+    else castChunk<S, uint32_t>(src, dest, n);
+}
+
+// Runs `op` on host memory, split across the pool. Sources without an operand for the op's arity are ignored.
+void runCpuElementwise(ThreadPool& pool, Ops op, const std::vector<const void*>& src, void* dest, size_t nelem, const std::string& dtype, const std::string& destDtype) {
+    if (!supportsOp(op, dtype) || src.size() != opArity(op)) {
+        throw std::runtime_error(std::string("CPU backend can not run ") + opName(op) + " on " + dtype + ".");
+    }
+
+    size_t srcSize = getTypeSize(dtype);
+    size_t destSize = getTypeSize(destDtype.empty() ? dtype : destDtype);
+
+    // Operands past the arity alias the last real one, like in the shader
+    const char* a = static_cast<const char*>(src[0]);
+    const char* b = src.size() > 1 ? static_cast<const char*>(src[1]) : a;
+    const char* c = src.size() > 2 ? static_cast<const char*>(src[2]) : b;
+    char* d = static_cast<char*>(dest);
+
+    parallelFor(pool, nelem, parallelGrain, [&](size_t begin, size_t end) {
+        const char* ca = a + begin * srcSize;
+        const char* cb = b + begin * srcSize;
+        const char* cc = c + begin * srcSize;
+        char* cd = d + begin * destSize;
+        size_t n = end - begin;
+
+        if (op == BITCAST) {
+            memcpy(cd, ca, n * destSize);
+        } else if (op == CAST) {
+            if (dtype == "float") castFrom<float>(destDtype, ca, cd, n);
+            else if (dtype == "int") castFrom<int32_t>(destDtype, ca, cd, n);
+            else if (dtype == "float16") castFrom<Float16>(destDtype, ca, cd, n);
+            else if (dtype == "bfloat16") castFrom<Bfloat16>(destDtype, ca, cd, n);
+            else if (dtype == "int8") castFrom<int8_t>(destDtype, ca, cd, n);
+            else castFrom<uint32_t>(destDtype, ca, cd, n);
+        } else if (dtype == "float16") {
+            narrowFloatChunk(op, reinterpret_cast<const Float16*>(ca), reinterpret_cast<const Float16*>(cb), reinterpret_cast<const Float16*>(cc), reinterpret_cast<Float16*>(cd), n);
+        } else if (dtype == "bfloat16") {
+            narrowFloatChunk(op, reinterpret_cast<const Bfloat16*>(ca), reinterpret_cast<const Bfloat16*>(cb), reinterpret_cast<const Bfloat16*>(cc), reinterpret_cast<Bfloat16*>(cd), n);
+        } else if (dtype == "int8") {
+            integerChunk(op, reinterpret_cast<const int8_t*>(ca), reinterpret_cast<const int8_t*>(cb), reinterpret_cast<const int8_t*>(cc), reinterpret_cast<int8_t*>(cd), n);
+        } else if (dtype == "float") {
+            floatChunk(op, reinterpret_cast<const float*>(ca), reinterpret_cast<const float*>(cb), reinterpret_cast<const float*>(cc), reinterpret_cast<float*>(cd), n);
+        } else if (dtype == "int") {
+            integerChunk(op, reinterpret_cast<const int32_t*>(ca), reinterpret_cast<const int32_t*>(cb), reinterpret_cast<const int32_t*>(cc), reinterpret_cast<int32_t*>(cd), n);
+        } else {
+            integerChunk(op, reinterpret_cast<const uint32_t*>(ca), reinterpret_cast<const uint32_t*>(cb), reinterpret_cast<const uint32_t*>(cc), reinterpret_cast<uint32_t*>(cd), n);
+        }
+    });
+}
+
+// Runs a kernel on the CPU. Works for GPU kernels as well, as long as their buffers are mapped,
+// which makes it a reference for checking GPU results (wait for the GPU to finish first).
+void runCpuKernel(ThreadPool& pool, Kernel& kernel) {
+    HostScope profile(opName(kernel.op), "cpu", VkDeviceSize(kernel.nelem) * (kernel.src.size() * getTypeSize(kernel.dtype) + getTypeSize(kernel.destDtype)));
+
+    std::vector<const void*> src;
+    for (Buffer& buffer : kernel.src) src.push_back(hostPointer<char>(buffer));
+    runCpuElementwise(pool, kernel.op, src, hostPointer<char>(kernel.dest), kernel.nelem, kernel.dtype, kernel.destDtype);
+}
+
+// Reference for the matmul kernels (src/matmul.h), parallel over the rows of C. Rows are accumulated
+// along K in i-k-j order, so the innermost loop runs over contiguous C and (untransposed) B.
+void runCpuMatmul(ThreadPool& pool, const float* a, const float* b, float* c, const MatmulShape& shape) {
+    HostScope profile("MATMUL", "cpu", (VkDeviceSize(shape.M) * shape.K + VkDeviceSize(shape.K) * shape.N +
+                                        VkDeviceSize(shape.M) * shape.N) * shape.batch * sizeof(float));
+
+    size_t rows = size_t(shape.batch) * shape.M;
+    size_t grain = std::max<size_t>(1, parallelGrain / (size_t(shape.N) * shape.K + 1));
+
+    parallelFor(pool, rows, grain, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            size_t batch = r / shape.M;
+            size_t row = r % shape.M;
+            const float* batchA = a + batch * shape.batchStrideA;
+            const float* batchB = b + batch * shape.batchStrideB;
+            float* out = c + batch * shape.batchStrideC + row * shape.N;
+
+            std::fill(out, out + shape.N, 0.0f);
+            for (size_t k = 0; k < shape.K; k++) {
+                float x = shape.transposeA ? batchA[k * shape.M + row] : batchA[row * shape.K + k];
+                if (shape.transposeB) {
+                    for (size_t n = 0; n < shape.N; n++) out[n] += x * batchB[n * shape.K + k];
+                } else {
+                    const float* rowB = batchB + k * shape.N;
+                    for (size_t n = 0; n < shape.N; n++) out[n] += x * rowB[n];
+                }
+            }
+        }
+    });
+}
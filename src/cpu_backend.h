@@ -0,0 +1,44 @@
+#ifndef CPU_BACKEND_H
+#define CPU_BACKEND_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "./util.h"
+#include "./kernel.h"
+#include "./matmul.h"
+
+// Fixed set of worker threads for parallelFor. The calling thread works on the range as well,
+// so a pool with N workers runs on N + 1 threads.
+struct ThreadPool {
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    // The current parallelFor, workers pick chunks until none are left
+    std::function<void(uint32_t)> task;
+    uint32_t chunkCount;
+    uint32_t nextChunk;
+    uint32_t finishedChunks;
+    uint64_t generation;
+    bool stopping;
+};
+
+ThreadPool* createThreadPool(uint32_t threads = 0);
+uint32_t threadCount(const ThreadPool& pool);
+void parallelFor(ThreadPool& pool, size_t count, size_t grain, const std::function<void(size_t begin, size_t end)>& body);
+void parallelEach(ThreadPool& pool, size_t count, const std::function<void(size_t i)>& body);
+void destroyThreadPool(ThreadPool* pool);
+
+void threefry2x32(const uint32_t key[2], const uint32_t counter[2], uint32_t out[2]);
+uint32_t threefryBits(uint32_t counter, uint32_t key);
+const char* cpuSimdName();
+void runCpuElementwise(ThreadPool& pool, Ops op, const std::vector<const void*>& src, void* dest, size_t nelem, const std::string& dtype, const std::string& destDtype);
+void runCpuKernel(ThreadPool& pool, Kernel& kernel);
+void runCpuMatmul(ThreadPool& pool, const float* a, const float* b, float* c, const MatmulShape& shape);
+
+#endif // CPU_BACKEND_H
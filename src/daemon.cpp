@@ -0,0 +1,542 @@
+#include "./daemon.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Order of the dtype indices on the wire
+static const char* const wireDtypes[] = {"float", "int", "uint", "float16", "bfloat16", "int8"};
+static const uint32_t wireDtypeCount = sizeof(wireDtypes) / sizeof(wireDtypes[0]);
+
+// Shared tensors are padded to this, which covers minImportedHostPointerAlignment of common drivers
+static const VkDeviceSize sharedTensorAlignment = 64 * 1024;
+
+// Compiled graphs a connection keeps around before they are all dropped
+static const size_t maxCachedGraphs = 64;
+
+// Mapped shared tensors a connection keeps around before they are all dropped, along with its graphs
+static const size_t maxCachedSegments = 256;
+
+SharedTensor createSharedTensor(VkDeviceSize bytes) {
+    SharedTensor tensor;
+    tensor.size = alignUp(std::max<VkDeviceSize>(bytes, 1), sharedTensorAlignment);
+
+    tensor.fd = memfd_create("vkcompute-tensor", MFD_CLOEXEC);
+    if (tensor.fd < 0) throw std::runtime_error("Failed to create memfd!");
+
+    if (ftruncate(tensor.fd, static_cast<off_t>(tensor.size)) != 0) {
+        close(tensor.fd);
+        throw std::runtime_error("Failed to resize memfd!");
+    }
+
+    tensor.data = mmap(nullptr, tensor.size, PROT_READ | PROT_WRITE, MAP_SHARED, tensor.fd, 0);
+    if (tensor.data == MAP_FAILED) {
+        close(tensor.fd);
+        throw std::runtime_error("Failed to map memfd!");
+    }
+    return tensor;
+}
+
+void destroySharedTensor(SharedTensor& tensor) {
+    munmap(tensor.data, tensor.size);
+    close(tensor.fd);
+    tensor.fd = -1;
+    tensor.data = nullptr;
+}
+
+uint32_t wireDtype(const std::string& dtype) {
+    for (uint32_t i = 0; i < wireDtypeCount; i++) {
+        if (dtype == wireDtypes[i]) return i;
+    }
+    throw std::runtime_error("Unknown dtype " + dtype + ".");
+}
+
+static uint32_t wireSegment(WireGraph& graph, const SharedTensor& tensor) {
+    auto it = std::find(graph.fds.begin(), graph.fds.end(), tensor.fd);
+    if (it != graph.fds.end()) return static_cast<uint32_t>(it - graph.fds.begin());
+
+    if (graph.fds.size() == daemonMaxSegments) throw std::runtime_error("Too many tensors in one graph.");
+    graph.fds.push_back(tensor.fd);
+    return static_cast<uint32_t>(graph.fds.size() - 1);
+}
+
+static void checkNodeCount(const WireGraph& graph) {
+    if (graph.nodes.size() == daemonMaxNodes) throw std::runtime_error("Too many nodes in one graph.");
+}
+
+static uint32_t pushWireNode(WireGraph& graph, uint32_t kind, uint32_t src, const std::vector<uint32_t>& args) {
+    if (args.size() > maxViewDims) throw std::runtime_error("Too many arguments for a wire node.");
+    checkNodeCount(graph);
+
+    WireNode node{};
+    node.kind = kind;
+    node.dtype = wireNoDtype;
+    node.count = static_cast<uint32_t>(args.size());
+    node.src[0] = src;
+    std::copy(args.begin(), args.end(), node.args);
+
+    graph.nodes.push_back(node);
+    return static_cast<uint32_t>(graph.nodes.size() - 1);
+}
+
+uint32_t wireInput(WireGraph& graph, const SharedTensor& tensor, uint32_t nelem, const std::string& dtype) {
+    if (VkDeviceSize(nelem) * getTypeSize(dtype) > tensor.size) throw std::runtime_error("Shared tensor is too small.");
+
+    uint32_t id = pushWireNode(graph, WIRE_INPUT, 0, {wireSegment(graph, tensor), nelem});
+    graph.nodes[id].dtype = wireDtype(dtype);
+    return id;
+}
+
+uint32_t wireOp(WireGraph& graph, Ops op, std::vector<uint32_t> src, const std::string& destDtype) {
+    if (src.empty() || src.size() > 3) throw std::runtime_error(std::string("Wrong number of sources for ") + opName(op) + ".");
+    checkNodeCount(graph);
+
+    WireNode node{};
+    node.kind = WIRE_OP;
+    node.op = op;
+    node.dtype = destDtype.empty() ? wireNoDtype : wireDtype(destDtype);
+    node.count = static_cast<uint32_t>(src.size());
+    std::copy(src.begin(), src.end(), node.src);
+
+    graph.nodes.push_back(node);
+    return static_cast<uint32_t>(graph.nodes.size() - 1);
+}
+
+uint32_t wireReshape(WireGraph& graph, uint32_t node, const std::vector<uint32_t>& shape) {
+    return pushWireNode(graph, WIRE_RESHAPE, node, shape);
+}
+
+uint32_t wirePermute(WireGraph& graph, uint32_t node, const std::vector<uint32_t>& order) {
+    return pushWireNode(graph, WIRE_PERMUTE, node, order);
+}
+
+uint32_t wireSlice(WireGraph& graph, uint32_t node, uint32_t dim, uint32_t start, uint32_t end, int32_t step) {
+    return pushWireNode(graph, WIRE_SLICE, node, {dim, start, end, static_cast<uint32_t>(step)});
+}
+
+uint32_t wireExpand(WireGraph& graph, uint32_t node, const std::vector<uint32_t>& shape) {
+    return pushWireNode(graph, WIRE_EXPAND, node, shape);
+}
+
+uint32_t wireContiguous(WireGraph& graph, uint32_t node) {
+    return pushWireNode(graph, WIRE_CONTIGUOUS, node, {});
+}
+
+void wireOutput(WireGraph& graph, uint32_t node, const SharedTensor& tensor) {
+    pushWireNode(graph, WIRE_OUTPUT, node, {wireSegment(graph, tensor)});
+}
+
+// Header and payload in one sendmsg, the descriptors ride along with the first byte
+static void sendMessage(int socket, uint32_t type, const void* payload, uint32_t size, const std::vector<int>& fds = {}) {
+    DaemonHeader header{daemonMagic, type, size, static_cast<uint32_t>(fds.size())};
+
+    iovec parts[2];
+    parts[0].iov_base = &header;
+    parts[0].iov_len = sizeof(header);
+    parts[1].iov_base = const_cast<void*>(payload);
+    parts[1].iov_len = size;
+
+    msghdr message{};
+    message.msg_iov = parts;
+    message.msg_iovlen = size > 0 ? 2 : 1;
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * std::max<size_t>(fds.size(), 1)));
+    if (!fds.empty()) {
+        message.msg_control = control.data();
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    }
+
+    size_t total = sizeof(header) + size;
+    ssize_t sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+    if (sent < 0) throw std::runtime_error("Failed to send to the daemon socket!");
+
+    // The rest of a partial send goes out without the descriptors
+    size_t done = static_cast<size_t>(sent);
+    while (done < total) {
+        const char* rest = done < sizeof(header) ? reinterpret_cast<const char*>(&header) + done
+                                                 : static_cast<const char*>(payload) + (done - sizeof(header));
+        size_t length = done < sizeof(header) ? sizeof(header) - done : total - done;
+        ssize_t n = send(socket, rest, length, MSG_NOSIGNAL);
+        if (n <= 0) throw std::runtime_error("Failed to send to the daemon socket!");
+        done += static_cast<size_t>(n);
+    }
+}
+
+static bool receiveAll(int socket, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = recv(socket, bytes, size, 0);
+        if (n <= 0) return false;
+        bytes += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Returns false when the other side hung up. Received descriptors belong to the caller.
+static bool receiveMessage(int socket, DaemonHeader& header, std::string& payload, std::vector<int>& fds) {
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * daemonMaxSegments));
+
+    iovec part;
+    part.iov_base = &header;
+    part.iov_len = sizeof(header);
+
+    msghdr message{};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+
+    ssize_t n = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    if (n <= 0) return false;
+
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* received = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        fds.insert(fds.end(), received, received + count);
+    }
+
+    if (static_cast<size_t>(n) < sizeof(header) && !receiveAll(socket, reinterpret_cast<char*>(&header) + n, sizeof(header) - n)) return false;
+    if (header.magic != daemonMagic || (message.msg_flags & MSG_CTRUNC) || fds.size() != header.fdCount) return false;
+
+    // The size comes from the other end, a graph never needs more than this
+    if (header.size > daemonMaxNodes * sizeof(WireNode)) return false;
+    payload.resize(header.size);
+    return header.size == 0 || receiveAll(socket, &payload[0], header.size);
+}
+
+int connectDaemon(const std::string& socketPath) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path is too long.");
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::runtime_error("Failed to create socket!");
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to connect to the daemon at " + socketPath + "!");
+    }
+    return fd;
+}
+
+static void expectOk(int socket) {
+    DaemonHeader header;
+    std::string payload;
+    std::vector<int> fds;
+    if (!receiveMessage(socket, header, payload, fds)) throw std::runtime_error("Lost the connection to the daemon!");
+    for (int fd : fds) close(fd);
+
+    if (header.type == DAEMON_ERROR) throw std::runtime_error("Daemon: " + payload);
+    if (header.type != DAEMON_OK) throw std::runtime_error("Unexpected answer from the daemon!");
+}
+
+// Blocks until the graph ran, the outputs are in their shared tensors then
+void runRemoteGraph(int socket, const WireGraph& graph) {
+    sendMessage(socket, DAEMON_RUN_GRAPH, graph.nodes.data(), static_cast<uint32_t>(graph.nodes.size() * sizeof(WireNode)), graph.fds);
+    expectOk(socket);
+}
+
+void shutdownDaemon(int socket) {
+    sendMessage(socket, DAEMON_SHUTDOWN, nullptr, 0);
+    expectOk(socket);
+}
+
+Daemon createDaemon(const std::string& socketPath) {
+    Daemon daemon{};
+    daemon.socketPath = socketPath;
+    daemon.running = true;
+    daemon.requests = 0;
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path is too long.");
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    daemon.instance = createInstance();
+    daemon.physicalDevice = selectPhysicalDevice(daemon.instance);
+    daemon.queueFamilyIndex = findComputeQueueFamily(daemon.physicalDevice);
+    daemon.device = createDevice(daemon.physicalDevice, daemon.queueFamilyIndex);
+    daemon.queue = getQueue(daemon.device, daemon.queueFamilyIndex, 0);
+    daemon.commandPool = createCommandPool(daemon.device, daemon.queueFamilyIndex);
+    daemon.registry = createPipelineRegistry(daemon.physicalDevice, daemon.device);
+    daemon.importAlignment = getHostImportAlignment(daemon.physicalDevice);
+
+    // A socket file left behind by a daemon that didn't shut down cleanly would make bind fail
+    unlink(socketPath.c_str());
+    daemon.listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (daemon.listenSocket < 0 ||
+        bind(daemon.listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(daemon.listenSocket, 16) != 0) {
+        throw std::runtime_error("Failed to listen on " + socketPath + "!");
+    }
+
+    return daemon;
+}
+
+static void destroyDaemonGraph(Daemon& daemon, DaemonGraph& graph) {
+    vkFreeCommandBuffers(daemon.device, daemon.commandPool, 1, &graph.commandBuffer);
+    destroyCompiledGraph(graph.compiled);
+}
+
+static void destroyGraphs(Daemon& daemon, DaemonClient& client) {
+    if (!client.graphs.empty()) vkQueueWaitIdle(daemon.queue);
+    for (auto& entry : client.graphs) destroyDaemonGraph(daemon, entry.second);
+    client.graphs.clear();
+}
+
+// Graphs bind the segments, so they go first
+static void destroySegments(Daemon& daemon, DaemonClient& client) {
+    destroyGraphs(daemon, client);
+    for (auto& entry : client.segments) {
+        std::vector<Buffer> buffers = {entry.second.buffer};
+        destroyBuffers(buffers);
+        munmap(entry.second.mapped, entry.second.size);
+    }
+    client.segments.clear();
+}
+
+static void destroyClient(Daemon& daemon, DaemonClient& client) {
+    destroySegments(daemon, client);
+    close(client.socket);
+}
+
+// Maps the memfd and wraps it in a buffer, imported when the device can, host-visible otherwise
+static DaemonSegment mapSegment(Daemon& daemon, int fd, VkDeviceSize size) {
+    DaemonSegment segment;
+    segment.size = size;
+    segment.mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (segment.mapped == MAP_FAILED) throw std::runtime_error("Failed to map shared tensor!");
+
+    segment.imported = daemon.importAlignment != 0 && size % daemon.importAlignment == 0;
+    try {
+        if (segment.imported) {
+            segment.buffer = importHostBuffer(daemon.physicalDevice, daemon.device, segment.mapped, size, 0);
+        } else {
+            segment.buffer = createBuffer(daemon.physicalDevice, daemon.device, size, 0, MEMORY_HOST_VISIBLE);
+        }
+    } catch (...) {
+        munmap(segment.mapped, size);
+        throw;
+    }
+    return segment;
+}
+
+static DaemonSegment& findSegment(Daemon& daemon, DaemonClient& client, int fd, std::pair<uint64_t, uint64_t>& key) {
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) throw std::runtime_error("Shared tensor is not a memfd.");
+
+    key = std::make_pair(uint64_t(info.st_dev), uint64_t(info.st_ino));
+    VkDeviceSize size = static_cast<VkDeviceSize>(info.st_size);
+
+    auto it = client.segments.find(key);
+    if (it != client.segments.end() && it->second.size == size) return it->second;
+
+    // The tensor was resized, every graph that binds the old mapping has to go with it
+    if (it != client.segments.end()) {
+        destroyGraphs(daemon, client);
+        std::vector<Buffer> buffers = {it->second.buffer};
+        destroyBuffers(buffers);
+        munmap(it->second.mapped, it->second.size);
+        client.segments.erase(it);
+    }
+
+    return client.segments.insert(std::make_pair(key, mapSegment(daemon, fd, size))).first->second;
+}
+
+// The first `bytes` of a segment, so that nodes get their element count from the buffer size
+static Buffer segmentRange(const DaemonSegment& segment, VkDeviceSize bytes) {
+    if (bytes > segment.size) throw std::runtime_error("Shared tensor is too small.");
+
+    Buffer buffer = segment.buffer;
+    buffer.size = bytes;
+    buffer.descriptorInfo.range = bytes;
+    return buffer;
+}
+
+static uint32_t checkedNode(const std::vector<uint32_t>& ids, uint32_t wireIndex, uint32_t node) {
+    if (node >= wireIndex || ids[node] == UINT32_MAX) throw std::runtime_error("Wire node refers to a node that does not exist.");
+    return ids[node];
+}
+
+static const char* checkedDtype(uint32_t dtype) {
+    if (dtype >= wireDtypeCount) throw std::runtime_error("Unknown dtype on the wire.");
+    return wireDtypes[dtype];
+}
+
+// Rebuilds the graph from the wire and compiles it, like a frontend that links against the library would
+static DaemonGraph buildDaemonGraph(Daemon& daemon, const std::vector<WireNode>& nodes, const std::vector<DaemonSegment*>& segments) {
+    DaemonGraph result;
+    Graph graph;
+    std::vector<uint32_t> ids(nodes.size(), UINT32_MAX);
+
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+        const WireNode& node = nodes[i];
+        if (node.count > maxViewDims) throw std::runtime_error("Wire node has too many arguments.");
+        std::vector<uint32_t> args(node.args, node.args + node.count);
+
+        switch (node.kind) {
+        case WIRE_INPUT: {
+            if (node.count != 2 || node.args[0] >= segments.size()) throw std::runtime_error("Bad input on the wire.");
+            std::string dtype = checkedDtype(node.dtype);
+            DaemonSegment* segment = segments[node.args[0]];
+            ids[i] = addInput(graph, segmentRange(*segment, VkDeviceSize(node.args[1]) * getTypeSize(dtype)), dtype);
+            result.inputs.push_back(segment);
+            break;
+        }
+        case WIRE_OP: {
+            if (node.count == 0 || node.count > 3 || node.op > MULACC) throw std::runtime_error("Bad op on the wire.");
+            std::vector<uint32_t> src;
+            for (uint32_t s = 0; s < node.count; s++) src.push_back(checkedNode(ids, i, node.src[s]));
+            ids[i] = addOp(graph, static_cast<Ops>(node.op), src, node.dtype == wireNoDtype ? "" : checkedDtype(node.dtype));
+            break;
+        }
+        case WIRE_RESHAPE: ids[i] = addReshape(graph, checkedNode(ids, i, node.src[0]), args); break;
+        case WIRE_PERMUTE: ids[i] = addPermute(graph, checkedNode(ids, i, node.src[0]), args); break;
+        case WIRE_EXPAND: ids[i] = addExpand(graph, checkedNode(ids, i, node.src[0]), args); break;
+        case WIRE_CONTIGUOUS: ids[i] = addContiguous(graph, checkedNode(ids, i, node.src[0])); break;
+        case WIRE_SLICE:
+            if (node.count != 4) throw std::runtime_error("Bad slice on the wire.");
+            ids[i] = addSlice(graph, checkedNode(ids, i, node.src[0]), args[0], args[1], args[2], static_cast<int32_t>(args[3]));
+            break;
+        case WIRE_OUTPUT: {
+            if (node.count != 1 || node.args[0] >= segments.size()) throw std::runtime_error("Bad output on the wire.");
+            uint32_t source = checkedNode(ids, i, node.src[0]);
+            DaemonSegment* segment = segments[node.args[0]];
+            const GraphNode& value = graph.nodes[source];
+            ids[i] = markOutput(graph, source, segmentRange(*segment, VkDeviceSize(value.nelem) * getTypeSize(value.dtype)));
+            result.outputs.push_back(segment);
+            break;
+        }
+        default:
+            throw std::runtime_error("Unknown wire node.");
+        }
+    }
+    if (result.outputs.empty()) throw std::runtime_error("Graph has no outputs.");
+
+    result.compiled = compileGraph(daemon.registry, graph);
+    result.commandBuffer = createCommandBuffer(daemon.device, daemon.commandPool);
+    recordGraph(result.commandBuffer, result.compiled);
+    return result;
+}
+
+static void runRequest(Daemon& daemon, DaemonClient& client, const std::string& payload, const std::vector<int>& fds) {
+    if (payload.size() % sizeof(WireNode) != 0) throw std::runtime_error("Truncated graph.");
+
+    // A frontend that sends new tensors every time would otherwise keep all of them mapped until it disconnects
+    if (client.segments.size() + fds.size() > maxCachedSegments) destroySegments(daemon, client);
+
+    std::vector<DaemonSegment*> segments;
+    std::string key = payload;
+    for (int fd : fds) {
+        std::pair<uint64_t, uint64_t> segmentKey;
+        segments.push_back(&findSegment(daemon, client, fd, segmentKey));
+        key.append(reinterpret_cast<const char*>(&segmentKey), sizeof(segmentKey));
+    }
+
+    auto it = client.graphs.find(key);
+    if (it == client.graphs.end()) {
+        std::vector<WireNode> nodes(payload.size() / sizeof(WireNode));
+        if (!nodes.empty()) std::memcpy(nodes.data(), payload.data(), payload.size());
+
+        if (client.graphs.size() == maxCachedGraphs) destroyGraphs(daemon, client);
+        it = client.graphs.insert(std::make_pair(key, buildDaemonGraph(daemon, nodes, segments))).first;
+    }
+    DaemonGraph& graph = it->second;
+
+    for (DaemonSegment* segment : graph.inputs) {
+        if (!segment->imported) copyToBuffer(segment->buffer, segment->mapped, 0, segment->size);
+    }
+    executeCommandBuffer(daemon.device, graph.commandBuffer, daemon.queue);
+    for (DaemonSegment* segment : graph.outputs) {
+        if (!segment->imported) copyBufferFromDevice(segment->buffer, segment->mapped, 0, segment->size);
+    }
+}
+
+// Returns false when the client is gone or broke the protocol
+static bool serveClient(Daemon& daemon, DaemonClient& client) {
+    DaemonHeader header;
+    std::string payload;
+    std::vector<int> fds;
+    if (!receiveMessage(client.socket, header, payload, fds)) {
+        for (int fd : fds) close(fd);
+        return false;
+    }
+
+    try {
+        if (header.type == DAEMON_RUN_GRAPH) {
+            runRequest(daemon, client, payload, fds);
+            daemon.requests++;
+        } else if (header.type == DAEMON_SHUTDOWN) {
+            daemon.running = false;
+        } else {
+            throw std::runtime_error("Unknown message type.");
+        }
+        for (int fd : fds) close(fd);
+        sendMessage(client.socket, DAEMON_OK, nullptr, 0);
+    } catch (const std::exception& e) {
+        for (int fd : fds) close(fd);
+        std::string message = e.what();
+        try {
+            sendMessage(client.socket, DAEMON_ERROR, message.data(), static_cast<uint32_t>(message.size()));
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Serves every connection from one thread, requests run one at a time in the order they arrive
+void runDaemon(Daemon& daemon) {
+    while (daemon.running) {
+        std::vector<pollfd> polled(1 + daemon.clients.size());
+        polled[0] = pollfd{daemon.listenSocket, POLLIN, 0};
+        for (size_t i = 0; i < daemon.clients.size(); i++) polled[i + 1] = pollfd{daemon.clients[i].socket, POLLIN, 0};
+
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed to poll the daemon sockets!");
+        }
+
+        for (size_t i = daemon.clients.size(); i > 0; i--) {
+            if (polled[i].revents == 0) continue;
+            if (!serveClient(daemon, daemon.clients[i - 1])) {
+                destroyClient(daemon, daemon.clients[i - 1]);
+                daemon.clients.erase(daemon.clients.begin() + (i - 1));
+            }
+        }
+
+        if (polled[0].revents & POLLIN) {
+            int socket = accept4(daemon.listenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+            if (socket >= 0) {
+                DaemonClient client;
+                client.socket = socket;
+                daemon.clients.push_back(client);
+            }
+        }
+    }
+}
+
+void destroyDaemon(Daemon& daemon) {
+    for (DaemonClient& client : daemon.clients) destroyClient(daemon, client);
+    daemon.clients.clear();
+
+    close(daemon.listenSocket);
+    unlink(daemon.socketPath.c_str());
+
+    vkDestroyCommandPool(daemon.device, daemon.commandPool, nullptr);
+    destroyPipelineRegistry(daemon.registry);
+    vkDestroyDevice(daemon.device, nullptr);
+    vkDestroyInstance(daemon.instance, nullptr);
+}
@@ -0,0 +1,136 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <map>
+#include <string>
+
+#include "./util.h"
+#include "./pipeline_cache.h"
+#include "./kernel.h"
+#include "./graph.h"
+
+// A backend process that stays up between requests, so the instance, the device, the pipelines and the compiled
+// graphs are warm. Frontends connect over a Unix domain socket and send graphs in the wire format below.
+// Tensor data never goes through the socket: every tensor is a memfd the frontend maps, sent along as a file
+// descriptor (SCM_RIGHTS). The daemon maps it as well and imports the mapping as a buffer, so the GPU reads
+// and writes the frontend's pages directly.
+//
+// Every message is a DaemonHeader followed by `size` bytes of payload, with `fdCount` descriptors attached to it.
+// DAEMON_RUN_GRAPH carries an array of WireNode and is answered once the graph ran, with DAEMON_OK or with
+// DAEMON_ERROR and the error message as payload.
+
+const uint32_t daemonMagic = 0x44434b56; // "VKCD"
+const uint32_t daemonMaxSegments = 64;
+const uint32_t daemonMaxNodes = 4096;
+
+enum DaemonMessage {
+    DAEMON_RUN_GRAPH,
+    DAEMON_OK,
+    DAEMON_ERROR,
+    DAEMON_SHUTDOWN,
+};
+
+struct DaemonHeader {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t size;
+    uint32_t fdCount;
+};
+
+// One graph node on the wire, mirroring the add* functions of graph.h. Nodes refer to earlier nodes by index,
+// tensors by the index of their descriptor in the message. Dtypes are indices into wireDtypes.
+enum WireKind {
+    WIRE_INPUT,      // args: segment, nelem
+    WIRE_OP,         // op, src[count], dtype: destination dtype or wireNoDtype
+    WIRE_RESHAPE,    // src[0], args[count]: shape
+    WIRE_PERMUTE,    // src[0], args[count]: order
+    WIRE_SLICE,      // src[0], args: dim, start, end, step
+    WIRE_EXPAND,     // src[0], args[count]: shape
+    WIRE_CONTIGUOUS, // src[0]
+    WIRE_OUTPUT,     // src[0], args: segment
+};
+
+const uint32_t wireNoDtype = UINT32_MAX;
+
+struct WireNode {
+    uint32_t kind;
+    uint32_t op;
+    uint32_t dtype;
+    uint32_t count;
+    uint32_t src[3];
+    uint32_t args[maxViewDims];
+};
+
+// Client side: a memfd of at least `bytes`, padded so that the daemon can import it, and mapped
+struct SharedTensor {
+    int fd;
+    void* data;
+    VkDeviceSize size;
+};
+
+struct WireGraph {
+    std::vector<WireNode> nodes;
+    std::vector<int> fds;
+};
+
+SharedTensor createSharedTensor(VkDeviceSize bytes);
+void destroySharedTensor(SharedTensor& tensor);
+uint32_t wireDtype(const std::string& dtype);
+uint32_t wireInput(WireGraph& graph, const SharedTensor& tensor, uint32_t nelem, const std::string& dtype = "float");
+uint32_t wireOp(WireGraph& graph, Ops op, std::vector<uint32_t> src, const std::string& destDtype = "");
+uint32_t wireReshape(WireGraph& graph, uint32_t node, const std::vector<uint32_t>& shape);
+uint32_t wirePermute(WireGraph& graph, uint32_t node, const std::vector<uint32_t>& order);
+uint32_t wireSlice(WireGraph& graph, uint32_t node, uint32_t dim, uint32_t start, uint32_t end, int32_t step = 1);
+uint32_t wireExpand(WireGraph& graph, uint32_t node, const std::vector<uint32_t>& shape);
+uint32_t wireContiguous(WireGraph& graph, uint32_t node);
+void wireOutput(WireGraph& graph, uint32_t node, const SharedTensor& tensor);
+int connectDaemon(const std::string& socketPath);
+void runRemoteGraph(int socket, const WireGraph& graph);
+void shutdownDaemon(int socket);
+
+// Server side. A segment is one shared tensor, mapped and imported once per connection and kept until it closes.
+// Devices that can't import host memory get a host-visible buffer instead, which costs a copy each way.
+struct DaemonSegment {
+    void* mapped;
+    VkDeviceSize size;
+    Buffer buffer;
+    bool imported;
+};
+
+struct DaemonGraph {
+    CompiledGraph compiled;
+    VkCommandBuffer commandBuffer;
+    std::vector<DaemonSegment*> inputs;
+    std::vector<DaemonSegment*> outputs;
+};
+
+// Segments are keyed by device and inode of the memfd, graphs by their wire format and the segments they use,
+// so a frontend that sends the same graph over the same tensors again only pays for the submit
+struct DaemonClient {
+    int socket;
+    std::map<std::pair<uint64_t, uint64_t>, DaemonSegment> segments;
+    std::map<std::string, DaemonGraph> graphs;
+};
+
+struct Daemon {
+    VkInstance instance;
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    uint32_t queueFamilyIndex;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    PipelineRegistry registry;
+    VkDeviceSize importAlignment; // 0 if the device can't import host memory
+
+    std::string socketPath;
+    int listenSocket;
+    bool running;
+    std::vector<DaemonClient> clients;
+    uint64_t requests;
+};
+
+Daemon createDaemon(const std::string& socketPath);
+void runDaemon(Daemon& daemon);
+void destroyDaemon(Daemon& daemon);
+
+#endif // DAEMON_H
@@ -0,0 +1,19 @@
+// Long-running backend for frontends in other processes (see daemon.h for the protocol).
+// Keeps the device and every compiled graph warm until a client sends DAEMON_SHUTDOWN.
+//
+// Usage: ./ComputeDaemon [socket path]
+
+#include "./daemon.h"
+
+int main(int argc, char** argv) {
+    std::string socketPath = argc > 1 ? argv[1] : "/tmp/vkcompute.sock";
+
+    Daemon daemon = createDaemon(socketPath);
+    std::cout << "Listening on " << socketPath << std::endl;
+
+    runDaemon(daemon);
+
+    std::cout << "Served " << daemon.requests << " requests" << std::endl;
+    destroyDaemon(daemon);
+    return 0;
+}
@@ -0,0 +1,230 @@
+#include "./descriptors.h"
+#include "./pipeline_cache.h"
+
+#include <algorithm>
+
+// Pools get at most this many sets, past that more pools are added rather than bigger ones
+static const uint32_t maxPoolSets = 4096;
+
+// Storage buffers per set a pool is sized for. Elementwise kernels use up to 4, fused kernels can use more,
+// but a pool only runs out when the average goes above this.
+static const uint32_t buffersPerSet = 4;
+
+bool DescriptorLayoutKey::operator<(const DescriptorLayoutKey& other) const {
+    if (push != other.push) return push < other.push;
+    return types < other.types;
+}
+
+DescriptorLayoutCache createDescriptorLayoutCache(VkDevice device) {
+    DescriptorLayoutCache cache;
+    cache.device = device;
+    return cache;
+}
+
+VkDescriptorSetLayout getDescriptorSetLayout(DescriptorLayoutCache& cache, const DescriptorLayoutKey& key) {
+    VkDescriptorSetLayout& layout = cache.layouts[key];
+    if (layout != VK_NULL_HANDLE) return layout;
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings(key.types.size());
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = key.types[i];
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.flags = key.push ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(cache.device, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+        cache.layouts.erase(key);
+        throw std::runtime_error("Failed to create descriptor set layout!");
+    }
+
+    return layout;
+}
+
+// `bindingCount` storage buffers at bindings 0..bindingCount-1, which is what all our kernels use
+VkDescriptorSetLayout getDescriptorSetLayout(DescriptorLayoutCache& cache, uint32_t bindingCount, bool push) {
+    DescriptorLayoutKey key;
+    key.types.assign(bindingCount, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    key.push = push;
+    return getDescriptorSetLayout(cache, key);
+}
+
+void destroyDescriptorLayoutCache(DescriptorLayoutCache& cache) {
+    for (auto& entry : cache.layouts) {
+        vkDestroyDescriptorSetLayout(cache.device, entry.second, nullptr);
+    }
+    cache.layouts.clear();
+}
+
+DescriptorAllocator createDescriptorAllocator(VkDevice device, uint32_t setsPerPool) {
+    DescriptorAllocator allocator;
+    allocator.device = device;
+    allocator.current = 0;
+    allocator.nextPoolSets = setsPerPool;
+    return allocator;
+}
+
+// The pool holds at least `bindingCount` buffers, so the set it was added for fits even if it has more
+// bindings than a whole pool's worth of average sets (fused kernels can use maxPerStageDescriptorStorageBuffers)
+static VkDescriptorPool addPool(DescriptorAllocator& allocator, uint32_t bindingCount) {
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = std::max(allocator.nextPoolSets * buffersPerSet, bindingCount);
+
+    // Kernels give their set back when they are destroyed
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = allocator.nextPoolSets;
+
+    VkDescriptorPool pool;
+    if (vkCreateDescriptorPool(allocator.device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor pool!");
+    }
+
+    allocator.pools.push_back(pool);
+    allocator.nextPoolSets = std::min(allocator.nextPoolSets * 2, maxPoolSets);
+    return pool;
+}
+
+static VkResult tryAllocate(VkDevice device, VkDescriptorPool pool, VkDescriptorSetLayout layout, VkDescriptorSet* set) {
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+    return vkAllocateDescriptorSets(device, &allocInfo, set);
+}
+
+// Allocates a set and points its bindings at `buffers`. Full pools are skipped, sets freed in
+// earlier pools are found again once the later ones are full as well.
+DescriptorAllocation allocateDescriptorSet(DescriptorAllocator& allocator, VkDescriptorSetLayout layout, const std::vector<Buffer>& buffers) {
+    DescriptorAllocation allocation{};
+
+    for (size_t attempt = 0; attempt < allocator.pools.size() && allocation.set == VK_NULL_HANDLE; attempt++) {
+        uint32_t index = static_cast<uint32_t>((allocator.current + attempt) % allocator.pools.size());
+        VkResult result = tryAllocate(allocator.device, allocator.pools[index], layout, &allocation.set);
+
+        if (result == VK_SUCCESS) {
+            allocation.pool = allocator.pools[index];
+            allocator.current = index;
+        } else if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) {
+            throw std::runtime_error("Failed to allocate descriptor set!");
+        } else {
+            allocation.set = VK_NULL_HANDLE;
+        }
+    }
+
+    if (allocation.set == VK_NULL_HANDLE) {
+        allocation.pool = addPool(allocator, static_cast<uint32_t>(buffers.size()));
+        allocator.current = static_cast<uint32_t>(allocator.pools.size() - 1);
+        if (tryAllocate(allocator.device, allocation.pool, layout, &allocation.set) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate descriptor set!");
+        }
+    }
+
+    std::vector<VkWriteDescriptorSet> descriptorWrites(buffers.size());
+    for (size_t i = 0; i < buffers.size(); i++) {
+        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[i].dstSet = allocation.set;
+        descriptorWrites[i].dstBinding = buffers[i].binding;
+        descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[i].descriptorCount = 1;
+        descriptorWrites[i].pBufferInfo = &buffers[i].descriptorInfo;
+    }
+    vkUpdateDescriptorSets(allocator.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+    return allocation;
+}
+
+void freeDescriptorSet(VkDevice device, DescriptorAllocation& allocation) {
+    if (allocation.set == VK_NULL_HANDLE) return;
+    if (allocation.mutex != nullptr) {
+        std::lock_guard<std::mutex> lock(*allocation.mutex);
+        vkFreeDescriptorSets(device, allocation.pool, 1, &allocation.set);
+    } else {
+        vkFreeDescriptorSets(device, allocation.pool, 1, &allocation.set);
+    }
+    allocation.set = VK_NULL_HANDLE;
+    allocation.pool = VK_NULL_HANDLE;
+    allocation.mutex = nullptr;
+}
+
+// Returns every set of every pool at once. None of them may still be used by a pending submission.
+void resetDescriptorAllocator(DescriptorAllocator& allocator) {
+    for (VkDescriptorPool pool : allocator.pools) vkResetDescriptorPool(allocator.device, pool, 0);
+    allocator.current = 0;
+}
+
+void destroyDescriptorAllocator(DescriptorAllocator& allocator) {
+    for (VkDescriptorPool pool : allocator.pools) vkDestroyDescriptorPool(allocator.device, pool, nullptr);
+    allocator.pools.clear();
+    allocator.current = 0;
+}
+
+// Allocator of the calling thread, nullptr for threads that use the registry's
+static thread_local DescriptorAllocator* threadAllocator = nullptr;
+
+// Makes kernels created on the calling thread take their descriptor sets from `allocator` instead of the registry's
+// shared one (nullptr switches back). Sets have to be freed on the same thread, the allocator's pools are not locked.
+// Sets from the registry's allocator remember its mutex and are freed under it, from any thread.
+void setThreadDescriptorAllocator(DescriptorAllocator* allocator) {
+    threadAllocator = allocator;
+}
+
+// Push descriptor pipelines only need the buffer infos, indexed by binding. Everything else gets a set.
+DescriptorBinding createDescriptorBinding(PipelineRegistry& registry, const Pipeline& pipeline, const std::vector<Buffer>& buffers) {
+    DescriptorBinding binding{};
+
+    if (pipeline.pushDescriptorSet == nullptr) {
+        if (threadAllocator != nullptr) {
+            binding.allocation = allocateDescriptorSet(*threadAllocator, pipeline.descriptorSetLayout, buffers);
+        } else {
+            std::lock_guard<std::mutex> lock(*registry.mutex);
+            binding.allocation = allocateDescriptorSet(registry.descriptorAllocator, pipeline.descriptorSetLayout, buffers);
+            binding.allocation.mutex = registry.mutex.get();
+        }
+        return binding;
+    }
+
+    binding.buffers.resize(pipeline.bindingCount);
+    for (const Buffer& buffer : buffers) {
+        if (buffer.binding >= pipeline.bindingCount) throw std::runtime_error("Buffer binding is outside the pipeline layout!");
+        binding.buffers[buffer.binding] = buffer.descriptorInfo;
+    }
+
+    return binding;
+}
+
+void bindDescriptors(VkCommandBuffer commandBuffer, const Pipeline& pipeline, const DescriptorBinding& binding) {
+    if (pipeline.pushDescriptorSet == nullptr) {
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, 1, &binding.allocation.set, 0, nullptr);
+        return;
+    }
+
+    VkWriteDescriptorSet writes[maxPushBindings];
+    uint32_t count = static_cast<uint32_t>(binding.buffers.size());
+    for (uint32_t i = 0; i < count; i++) {
+        writes[i] = VkWriteDescriptorSet{};
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstBinding = i;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].descriptorCount = 1;
+        writes[i].pBufferInfo = &binding.buffers[i];
+    }
+
+    pipeline.pushDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.layout, 0, count, writes);
+}
+
+void destroyDescriptorBinding(VkDevice device, DescriptorBinding& binding) {
+    freeDescriptorSet(device, binding.allocation);
+    binding.buffers.clear();
+}
@@ -0,0 +1,71 @@
+#ifndef DESCRIPTORS_H
+#define DESCRIPTORS_H
+
+#include <mutex>
+
+#include "./util.h"
+
+struct Pipeline;
+struct PipelineRegistry;
+
+// Push descriptors are only used for layouts up to this many bindings, the least every driver supports
+// (maxPushDescriptors). Recording them then gets by with a fixed array of writes on the stack.
+const uint32_t maxPushBindings = 32;
+
+// Binding signature of a descriptor set layout: the type of each binding, in binding order,
+// and whether the layout is meant for push descriptors
+struct DescriptorLayoutKey {
+    std::vector<VkDescriptorType> types;
+    bool push;
+
+    bool operator<(const DescriptorLayoutKey& other) const;
+};
+
+// Every layout is created once per device. Pipelines with the same signature share the layout.
+struct DescriptorLayoutCache {
+    VkDevice device;
+    std::map<DescriptorLayoutKey, VkDescriptorSetLayout> layouts;
+};
+
+// A descriptor set along with the pool it has to be returned to
+struct DescriptorAllocation {
+    VkDescriptorSet set;
+    VkDescriptorPool pool;
+    std::mutex* mutex; // held while the pool is used if it is shared between threads (the registry's), else nullptr
+};
+
+// Hands out descriptor sets from a list of pools. When all of them are full another one is added,
+// twice the size of the last. Sets can be freed one at a time, or all at once with resetDescriptorAllocator,
+// e.g. once per frame for sets that only live for one submission.
+struct DescriptorAllocator {
+    VkDevice device;
+    std::vector<VkDescriptorPool> pools;
+    uint32_t current;
+    uint32_t nextPoolSets;
+};
+
+// How a dispatch gets its buffers: either a descriptor set from the registry's allocator, or on devices with
+// VK_KHR_push_descriptor the buffer infos themselves, which are written straight into the command buffer
+// and need no set at all.
+struct DescriptorBinding {
+    DescriptorAllocation allocation;
+    std::vector<VkDescriptorBufferInfo> buffers;
+};
+
+DescriptorLayoutCache createDescriptorLayoutCache(VkDevice device);
+VkDescriptorSetLayout getDescriptorSetLayout(DescriptorLayoutCache& cache, const DescriptorLayoutKey& key);
+VkDescriptorSetLayout getDescriptorSetLayout(DescriptorLayoutCache& cache, uint32_t bindingCount, bool push = false);
+void destroyDescriptorLayoutCache(DescriptorLayoutCache& cache);
+
+DescriptorAllocator createDescriptorAllocator(VkDevice device, uint32_t setsPerPool = 64);
+DescriptorAllocation allocateDescriptorSet(DescriptorAllocator& allocator, VkDescriptorSetLayout layout, const std::vector<Buffer>& buffers);
+void freeDescriptorSet(VkDevice device, DescriptorAllocation& allocation);
+void resetDescriptorAllocator(DescriptorAllocator& allocator);
+void destroyDescriptorAllocator(DescriptorAllocator& allocator);
+
+void setThreadDescriptorAllocator(DescriptorAllocator* allocator);
+DescriptorBinding createDescriptorBinding(PipelineRegistry& registry, const Pipeline& pipeline, const std::vector<Buffer>& buffers);
+void bindDescriptors(VkCommandBuffer commandBuffer, const Pipeline& pipeline, const DescriptorBinding& binding);
+void destroyDescriptorBinding(VkDevice device, DescriptorBinding& binding);
+
+#endif // DESCRIPTORS_H
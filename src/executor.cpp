@@ -0,0 +1,259 @@
+#include "./executor.h"
+
+#include <algorithm>
+
+// How long the submitter blocks on the oldest batch before it looks for new work again.
+// Work that arrives meanwhile is not late, the GPU is still busy with what came before it.
+static const uint64_t fencePollNs = 50000;
+
+static VkFence acquireFence(QueueSubmitter& submitter) {
+    if (!submitter.freeFences.empty()) {
+        VkFence fence = submitter.freeFences.back();
+        submitter.freeFences.pop_back();
+        return fence;
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkFence fence;
+    if (vkCreateFence(submitter.device, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create fence!");
+    }
+    return fence;
+}
+
+// Marks the items done and wakes whoever waits for them. Taking the mutex once after setting the flags
+// makes sure no waiter checked its flag before and goes to sleep after the notify.
+static void completeItems(QueueSubmitter& submitter, const std::vector<WorkItem*>& items, bool failed) {
+    for (WorkItem* item : items) {
+        item->failed = failed;
+        item->done.store(true, std::memory_order_release);
+    }
+
+    { std::lock_guard<std::mutex> lock(submitter.mutex); }
+    submitter.completed.notify_all();
+}
+
+// Submits everything on the pending list with one vkQueueSubmit. The list is a stack, reversing it puts
+// each thread's command buffers back in the order they were pushed.
+static void submitBatch(QueueSubmitter& submitter, WorkItem* head) {
+    SubmittedBatch batch;
+    for (WorkItem* item = head; item != nullptr; item = item->next) batch.items.push_back(item);
+    std::reverse(batch.items.begin(), batch.items.end());
+
+    std::vector<VkCommandBuffer> commandBuffers;
+    commandBuffers.reserve(batch.items.size());
+    for (WorkItem* item : batch.items) commandBuffers.push_back(item->commandBuffer);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+    submitInfo.pCommandBuffers = commandBuffers.data();
+
+    VkFence fence = VK_NULL_HANDLE;
+    try {
+        fence = acquireFence(submitter);
+    } catch (const std::exception&) {
+        completeItems(submitter, batch.items, true);
+        return;
+    }
+
+    if (vkQueueSubmit(submitter.queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+        submitter.freeFences.push_back(fence);
+        completeItems(submitter, batch.items, true);
+        return;
+    }
+
+    batch.fence = fence;
+    submitter.submitCount++;
+    submitter.itemCount += batch.items.size();
+    submitter.inFlight.push_back(std::move(batch));
+}
+
+// Waits up to `timeoutNs` for the oldest batch, then retires it and every later one that has finished as well
+static void retireBatches(QueueSubmitter& submitter, uint64_t timeoutNs) {
+    if (vkWaitForFences(submitter.device, 1, &submitter.inFlight.front().fence, VK_TRUE, timeoutNs) != VK_SUCCESS) return;
+
+    while (!submitter.inFlight.empty() && vkGetFenceStatus(submitter.device, submitter.inFlight.front().fence) == VK_SUCCESS) {
+        SubmittedBatch& batch = submitter.inFlight.front();
+        vkResetFences(submitter.device, 1, &batch.fence);
+        submitter.freeFences.push_back(batch.fence);
+        completeItems(submitter, batch.items, false);
+        submitter.inFlight.pop_front();
+    }
+}
+
+static void submitterLoop(QueueSubmitter* submitter) {
+    while (true) {
+        WorkItem* head = submitter->pending.exchange(nullptr);
+        if (head != nullptr) submitBatch(*submitter, head);
+
+        if (!submitter->inFlight.empty()) {
+            // Only block on the GPU when there was nothing new to submit
+            retireBatches(*submitter, head != nullptr ? 0 : fencePollNs);
+            continue;
+        }
+        if (head != nullptr) continue;
+
+        // Nothing pending and nothing in flight: sleep until submitWork pushes something.
+        // submitWork pushes before it reads `idle`, this sets `idle` before it reads the list, so one of them sees the other.
+        std::unique_lock<std::mutex> lock(submitter->mutex);
+        submitter->idle = true;
+        submitter->wake.wait(lock, [&] { return submitter->pending.load() != nullptr || submitter->stopping.load(); });
+        submitter->idle = false;
+        if (submitter->pending.load() == nullptr) return;
+    }
+}
+
+// The device has to have been created with at least `queueCount` queues in the family (see createDevice)
+Executor* createExecutor(VkDevice device, uint32_t queueFamilyIndex, uint32_t queueCount) {
+    Executor* executor = new Executor();
+    executor->device = device;
+    executor->queueFamilyIndex = queueFamilyIndex;
+    executor->nextQueue = 0;
+
+    for (uint32_t i = 0; i < std::max(1u, queueCount); i++) {
+        QueueSubmitter* submitter = new QueueSubmitter();
+        submitter->device = device;
+        submitter->queue = getQueue(device, queueFamilyIndex, i);
+        submitter->pending = nullptr;
+        submitter->idle = false;
+        submitter->stopping = false;
+        submitter->submitCount = 0;
+        submitter->itemCount = 0;
+        submitter->thread = std::thread(submitterLoop, submitter);
+        executor->submitters.push_back(submitter);
+    }
+
+    return executor;
+}
+
+// Descriptor sets of kernels created on the calling thread come from the context's allocator from now on
+WorkerContext* createWorkerContext(Executor& executor) {
+    WorkerContext* context = new WorkerContext();
+    context->executor = &executor;
+    context->submitter = executor.submitters[executor.nextQueue++ % executor.submitters.size()];
+    context->commandPool = createCommandPool(executor.device, executor.queueFamilyIndex, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+    context->descriptorAllocator = createDescriptorAllocator(executor.device);
+    setThreadDescriptorAllocator(&context->descriptorAllocator);
+    return context;
+}
+
+// Returns a work item whose command buffer is ready for recording, with the barrier described in executor.h in it
+WorkItem* beginWork(WorkerContext& context) {
+    WorkItem* item;
+    if (!context.freeItems.empty()) {
+        item = context.freeItems.back();
+        context.freeItems.pop_back();
+    } else {
+        item = new WorkItem();
+        item->commandBuffer = createCommandBuffer(context.executor->device, context.commandPool);
+        context.items.push_back(item);
+    }
+    item->done = false;
+    item->submitted = false;
+    item->failed = false;
+    item->next = nullptr;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(item->commandBuffer, &beginInfo) != VK_SUCCESS) {
+        context.freeItems.push_back(item);
+        throw std::runtime_error("Failed to begin recording command buffer!");
+    }
+
+    // Orders the item after everything submitted to the queue before it, kernels as well as copies
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+    vkCmdPipelineBarrier(item->commandBuffer, stages, stages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    return item;
+}
+
+// Ends the recording and hands the command buffer to the context's queue. Never blocks.
+void submitWork(WorkerContext& context, WorkItem* item) {
+    if (vkEndCommandBuffer(item->commandBuffer) != VK_SUCCESS) {
+        context.freeItems.push_back(item);
+        throw std::runtime_error("Failed to record command buffer!");
+    }
+
+    QueueSubmitter& submitter = *context.submitter;
+    item->submitted = true;
+    item->next = submitter.pending.load(std::memory_order_relaxed);
+    while (!submitter.pending.compare_exchange_weak(item->next, item)) {
+    }
+
+    if (submitter.idle.load()) {
+        std::lock_guard<std::mutex> lock(submitter.mutex);
+        submitter.wake.notify_one();
+    }
+}
+
+bool pollWork(const WorkItem* item) {
+    return item->done.load(std::memory_order_acquire);
+}
+
+// Blocks until the work has run, then recycles the item and its command buffer
+void waitWork(WorkerContext& context, WorkItem* item) {
+    QueueSubmitter& submitter = *context.submitter;
+    if (!pollWork(item)) {
+        std::unique_lock<std::mutex> lock(submitter.mutex);
+        submitter.completed.wait(lock, [&] { return pollWork(item); });
+    }
+
+    context.freeItems.push_back(item);
+    if (item->failed) throw std::runtime_error("Failed to submit command buffer!");
+}
+
+// Waits for everything the context submitted and not waited for yet, recordings never submitted are dropped
+void destroyWorkerContext(WorkerContext* context) {
+    for (WorkItem* item : context->items) {
+        if (item->submitted && !pollWork(item)) {
+            std::unique_lock<std::mutex> lock(context->submitter->mutex);
+            context->submitter->completed.wait(lock, [&] { return pollWork(item); });
+        }
+    }
+
+    for (WorkItem* item : context->items) {
+        vkFreeCommandBuffers(context->executor->device, context->commandPool, 1, &item->commandBuffer);
+        delete item;
+    }
+
+    setThreadDescriptorAllocator(nullptr);
+    destroyDescriptorAllocator(context->descriptorAllocator);
+    vkDestroyCommandPool(context->executor->device, context->commandPool, nullptr);
+    delete context;
+}
+
+ExecutorStats executorStats(const Executor& executor) {
+    ExecutorStats stats{0, 0};
+    for (const QueueSubmitter* submitter : executor.submitters) {
+        stats.submits += submitter->submitCount;
+        stats.commandBuffers += submitter->itemCount;
+    }
+    return stats;
+}
+
+// Lets every submitter finish what was pushed so far, then stops the threads
+void destroyExecutor(Executor* executor) {
+    for (QueueSubmitter* submitter : executor->submitters) {
+        {
+            std::lock_guard<std::mutex> lock(submitter->mutex);
+            submitter->stopping = true;
+        }
+        submitter->wake.notify_one();
+        submitter->thread.join();
+
+        for (VkFence fence : submitter->freeFences) {
+            vkDestroyFence(executor->device, fence, nullptr);
+        }
+        delete submitter;
+    }
+
+    delete executor;
+}
@@ -0,0 +1,97 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "./util.h"
+#include "./descriptors.h"
+
+// Many host threads recording and submitting work to one device at once, e.g. one thread per client request.
+//
+// Each thread records with a WorkerContext of its own: a command pool and a descriptor allocator nobody else
+// touches, so recording takes no locks (kernels still come from the shared PipelineRegistry, which locks while it
+// builds a pipeline). Finished command buffers are pushed onto a lock-free list of one of the device's queues.
+// A submitter thread per queue owns the queue, vkQueueSubmit needs it externally synchronized, and takes the whole
+// list at once: while the GPU is busy, work from all threads piles up and goes out with a single vkQueueSubmit.
+// Contexts are spread round-robin over the queues of the family, so families with several queues feed them all.
+// Command buffers in one batch are not ordered by the submit, so beginWork starts every recording with a barrier
+// against everything submitted to the queue before it: items of one thread may depend on each other without a
+// waitWork in between. Items of different threads can end up on different queues, those need a waitWork.
+// The profiler is not thread safe, leave it off while more than one thread records.
+
+// One command buffer on its way to the GPU, owned by the WorkerContext it came from
+struct WorkItem {
+    VkCommandBuffer commandBuffer;
+    std::atomic<bool> done;
+    bool submitted;
+    bool failed;    // vkQueueSubmit failed, valid once done is set
+    WorkItem* next; // on the submitter's pending list
+};
+
+// Command buffers sent with one vkQueueSubmit, done once the fence signals
+struct SubmittedBatch {
+    VkFence fence;
+    std::vector<WorkItem*> items;
+};
+
+struct QueueSubmitter {
+    VkDevice device;
+    VkQueue queue;
+    std::thread thread;
+
+    // Lock-free stack, pushed by any thread and emptied in one exchange by the submitter thread
+    std::atomic<WorkItem*> pending;
+    std::atomic<bool> idle;
+    std::atomic<bool> stopping;
+
+    // Only for sleeping: the submitter while there is nothing to do, other threads while they wait for their work
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable completed;
+
+    // Only touched by the submitter thread
+    std::deque<SubmittedBatch> inFlight;
+    std::vector<VkFence> freeFences;
+
+    std::atomic<uint64_t> submitCount;
+    std::atomic<uint64_t> itemCount;
+};
+
+struct Executor {
+    VkDevice device;
+    uint32_t queueFamilyIndex;
+    std::vector<QueueSubmitter*> submitters;
+    std::atomic<uint32_t> nextQueue;
+};
+
+// State of one thread. Create, use and destroy it on that thread.
+struct WorkerContext {
+    Executor* executor;
+    QueueSubmitter* submitter;
+    VkCommandPool commandPool;
+    DescriptorAllocator descriptorAllocator;
+
+    std::vector<WorkItem*> items;
+    std::vector<WorkItem*> freeItems;
+};
+
+struct ExecutorStats {
+    uint64_t submits;
+    uint64_t commandBuffers;
+};
+
+Executor* createExecutor(VkDevice device, uint32_t queueFamilyIndex, uint32_t queueCount = 1);
+WorkerContext* createWorkerContext(Executor& executor);
+WorkItem* beginWork(WorkerContext& context);
+void submitWork(WorkerContext& context, WorkItem* item);
+bool pollWork(const WorkItem* item);
+void waitWork(WorkerContext& context, WorkItem* item);
+void destroyWorkerContext(WorkerContext* context);
+ExecutorStats executorStats(const Executor& executor);
+void destroyExecutor(Executor* executor);
+
+#endif // EXECUTOR_H
@@ -0,0 +1,743 @@
+#include "./graph.h"
+#include "./profiler.h"
+
+#include <algorithm>
+#include <set>
+
+// Inputs are flat, addReshape gives them a shape
+uint32_t addInput(Graph& graph, Buffer buffer, const std::string& dtype) {
+    GraphNode node;
+    node.op = EMPTY;
+    node.dtype = dtype;
+    node.nelem = static_cast<uint32_t>(buffer.size / getTypeSize(dtype));
+    node.view = contiguousView({node.nelem});
+    node.hasBuffer = true;
+    node.isOutput = false;
+    node.buffer = buffer;
+
+    graph.nodes.push_back(node);
+    return static_cast<uint32_t>(graph.nodes.size() - 1);
+}
+
+// Adds an elementwise op. The result has the dtype of the sources, unless it is a CAST or BITCAST to `destDtype`.
+uint32_t addOp(Graph& graph, Ops op, std::vector<uint32_t> src, const std::string& destDtype) {
+    if (op > MULACC) throw std::runtime_error(std::string(opName(op)) + " can not be added to the graph yet.");
+    if (src.size() != opArity(op)) throw std::runtime_error(std::string("Wrong number of sources for ") + opName(op) + ".");
+
+    for (uint32_t id : src) {
+        if (id >= graph.nodes.size()) throw std::runtime_error("Source node does not exist.");
+    }
+
+    const GraphNode& first = graph.nodes[src[0]];
+    for (uint32_t id : src) {
+        if (graph.nodes[id].dtype != first.dtype || !sameShape(graph.nodes[id].view, first.view)) {
+            throw std::runtime_error(std::string("All sources of ") + opName(op) + " need the same dtype and shape.");
+        }
+    }
+
+    if (!supportsOp(op, first.dtype)) {
+        throw std::runtime_error(std::string("Operation ") + opName(op) + " is not supported for dtype " + first.dtype + ".");
+    }
+
+    bool isCast = op == CAST || op == BITCAST;
+    if (isCast && (destDtype.empty() || destDtype == first.dtype)) throw std::runtime_error("CAST and BITCAST need a different destination dtype.");
+    if (op == BITCAST && getTypeSize(destDtype) != getTypeSize(first.dtype)) throw std::runtime_error("BITCAST needs types of the same size.");
+
+    GraphNode node;
+    node.op = op;
+    node.src = src;
+    node.dtype = isCast ? destDtype : first.dtype;
+    node.nelem = first.nelem;
+    node.view = contiguousView(viewShape(first.view));
+    node.hasBuffer = false;
+    node.isOutput = false;
+
+    graph.nodes.push_back(node);
+    return static_cast<uint32_t>(graph.nodes.size() - 1);
+}
+
+// A VIEW node reads the buffer of its source through `view`. Views of views are folded into one,
+// so the source of a VIEW is never another VIEW.
+static uint32_t addView(Graph& graph, uint32_t id, const View& view) {
+    const GraphNode& node = graph.nodes.at(id);
+    uint32_t baseId = node.op == VIEW ? node.src[0] : id;
+    const GraphNode& base = graph.nodes[baseId];
+
+    int64_t lowest, highest;
+    viewRange(view, lowest, highest);
+    if (lowest < 0 || highest >= base.nelem) throw std::runtime_error("View " + viewString(view) + " reaches outside of its source.");
+
+    // The source as it is, nothing to add
+    if (isContiguous(view) && sameShape(view, base.view)) return baseId;
+
+    GraphNode viewNode;
+    viewNode.op = VIEW;
+    viewNode.src = {baseId};
+    viewNode.dtype = base.dtype;
+    viewNode.nelem = viewNelem(view);
+    viewNode.view = view;
+    viewNode.hasBuffer = false;
+    viewNode.isOutput = false;
+
+    graph.nodes.push_back(viewNode);
+    return static_cast<uint32_t>(graph.nodes.size() - 1);
+}
+
+// Copies a node, a VIEW usually, into a buffer of its own, in row-major order
+static uint32_t addCopy(Graph& graph, uint32_t id) {
+    const GraphNode& source = graph.nodes.at(id);
+
+    GraphNode node;
+    node.op = CONTIGUOUS;
+    node.src = {id};
+    node.dtype = source.dtype;
+    node.nelem = source.nelem;
+    node.view = contiguousView(viewShape(source.view));
+    node.hasBuffer = false;
+    node.isOutput = false;
+
+    graph.nodes.push_back(node);
+    return static_cast<uint32_t>(graph.nodes.size() - 1);
+}
+
+// Views only change how kernels index the source buffer, nothing is copied. The copy happens when it has to:
+// for a reshape the strides can't express (addReshape inserts it), or explicitly with addContiguous.
+uint32_t addReshape(Graph& graph, uint32_t node, const std::vector<uint32_t>& shape) {
+    if (!canReshape(graph.nodes.at(node).view, shape)) node = addCopy(graph, node);
+    return addView(graph, node, reshapeView(graph.nodes[node].view, shape));
+}
+
+uint32_t addPermute(Graph& graph, uint32_t node, const std::vector<uint32_t>& order) {
+    return addView(graph, node, permuteView(graph.nodes.at(node).view, order));
+}
+
+uint32_t addSlice(Graph& graph, uint32_t node, uint32_t dim, uint32_t start, uint32_t end, int32_t step) {
+    return addView(graph, node, sliceView(graph.nodes.at(node).view, dim, start, end, step));
+}
+
+uint32_t addExpand(Graph& graph, uint32_t node, const std::vector<uint32_t>& shape) {
+    return addView(graph, node, expandView(graph.nodes.at(node).view, shape));
+}
+
+// Materializes a view, unless it already reads its source in row-major order
+uint32_t addContiguous(Graph& graph, uint32_t node) {
+    const GraphNode& source = graph.nodes.at(node);
+    if (source.op != VIEW || isContiguous(source.view)) return node;
+    return addCopy(graph, node);
+}
+
+// The result of `node` gets written to `buffer` when the graph runs. Views, inputs and nodes that already
+// have an output buffer are copied into it, which is why this returns the node that is actually written.
+uint32_t markOutput(Graph& graph, uint32_t node, Buffer buffer) {
+    const GraphNode& source = graph.nodes.at(node);
+    if (source.op == VIEW || source.op == EMPTY || source.isOutput) node = addCopy(graph, node);
+
+    GraphNode& target = graph.nodes[node];
+    if (buffer.size < VkDeviceSize(target.nelem) * getTypeSize(target.dtype)) throw std::runtime_error("Output buffer is too small.");
+
+    target.isOutput = true;
+    target.hasBuffer = true;
+    target.buffer = buffer;
+    return node;
+}
+
+static std::vector<std::vector<uint32_t>> findConsumers(const Graph& graph) {
+    std::vector<std::vector<uint32_t>> consumers(graph.nodes.size());
+    for (uint32_t id = 0; id < graph.nodes.size(); id++) {
+        for (uint32_t src : graph.nodes[id].src) consumers[src].push_back(id);
+    }
+    return consumers;
+}
+
+// Kahn's algorithm. Nodes without pending sources are taken in index order, so a graph
+// built front to back comes out in the order it was built.
+std::vector<uint32_t> topologicalOrder(const Graph& graph) {
+    std::vector<std::vector<uint32_t>> consumers = findConsumers(graph);
+    std::vector<uint32_t> pending(graph.nodes.size());
+    std::set<uint32_t> ready;
+
+    for (uint32_t id = 0; id < graph.nodes.size(); id++) {
+        pending[id] = static_cast<uint32_t>(graph.nodes[id].src.size());
+        if (pending[id] == 0) ready.insert(id);
+    }
+
+    std::vector<uint32_t> order;
+    while (!ready.empty()) {
+        uint32_t id = *ready.begin();
+        ready.erase(ready.begin());
+        order.push_back(id);
+
+        for (uint32_t consumer : consumers[id]) {
+            if (--pending[consumer] == 0) ready.insert(consumer);
+        }
+    }
+
+    if (order.size() != graph.nodes.size()) throw std::runtime_error("The compute graph has a cycle!");
+    return order;
+}
+
+// Nodes that some output depends on, everything else is never computed
+static std::vector<bool> findLiveNodes(const Graph& graph) {
+    std::vector<bool> live(graph.nodes.size(), false);
+    std::vector<uint32_t> stack;
+
+    for (uint32_t id = 0; id < graph.nodes.size(); id++) {
+        if (graph.nodes[id].isOutput) stack.push_back(id);
+    }
+
+    while (!stack.empty()) {
+        uint32_t id = stack.back();
+        stack.pop_back();
+        if (live[id]) continue;
+
+        live[id] = true;
+        for (uint32_t src : graph.nodes[id].src) stack.push_back(src);
+    }
+
+    return live;
+}
+
+// Bindings a kernel made of `members` would need. Consumers that are not placed yet count as
+// outside the group, so this can only overestimate.
+static uint32_t countBindings(const Graph& graph, const std::vector<std::vector<uint32_t>>& consumers, const std::set<uint32_t>& members) {
+    std::set<uint32_t> inputs;
+    uint32_t outputs = 0;
+
+    for (uint32_t id : members) {
+        for (uint32_t src : graph.nodes[id].src) {
+            if (!members.count(src)) inputs.insert(src);
+        }
+
+        bool escapes = graph.nodes[id].isOutput;
+        for (uint32_t consumer : consumers[id]) escapes = escapes || !members.count(consumer);
+        if (escapes) outputs++;
+    }
+
+    return static_cast<uint32_t>(inputs.size()) + outputs;
+}
+
+// Inputs that are read through a strided view, each one takes a ViewParams in the push constants
+static bool isStridedInput(const GraphNode& node) {
+    return node.op == VIEW && !isContiguous(node.view);
+}
+
+static uint32_t countViews(const Graph& graph, const std::set<uint32_t>& members) {
+    std::set<uint32_t> views;
+    for (uint32_t id : members) {
+        for (uint32_t src : graph.nodes[id].src) {
+            if (!members.count(src) && isStridedInput(graph.nodes[src])) views.insert(src);
+        }
+    }
+    return static_cast<uint32_t>(views.size());
+}
+
+// A kernel can't read a view of a value it computes itself, other threads compute the elements the view needs.
+// Reshapes join the kernel of their source instead (see fuseGraph), so this only sees the other views.
+static bool readsOwnView(const Graph& graph, const GraphNode& node, const std::set<uint32_t>& members) {
+    for (uint32_t src : node.src) {
+        if (graph.nodes[src].op == VIEW && !members.count(src) && members.count(graph.nodes[src].src[0])) return true;
+    }
+    return false;
+}
+
+// Splits the graph into kernels. Walking the nodes in topological order, each elementwise op joins the
+// kernel before it as long as the element count matches and the kernel stays within `maxBindings`
+// storage buffers and `maxViews` strided inputs, so chains and trees of elementwise ops end up in a single dispatch.
+// VIEW nodes are not computed, the kernels that use them read their source through the view. When that
+// source is computed in the same kernel, the kernel ends there and the source is written out, unless the
+// view is just a reshape.
+// With `fuse` set to false every op becomes its own kernel, which is what we had before.
+std::vector<FusedKernel> fuseGraph(const Graph& graph, uint32_t maxBindings, uint32_t maxViews, bool fuse) {
+    std::vector<std::vector<uint32_t>> consumers = findConsumers(graph);
+    std::vector<bool> live = findLiveNodes(graph);
+
+    std::vector<FusedKernel> kernels;
+    std::vector<int> kernelOf(graph.nodes.size(), -1);
+    std::set<uint32_t> members;
+
+    for (uint32_t id : topologicalOrder(graph)) {
+        const GraphNode& node = graph.nodes[id];
+        if (node.op == EMPTY || !live[id]) continue;
+
+        // A reshape of a value computed in this kernel is the same value, it stays in registers.
+        // Any other view is read from its source's buffer by the kernels that use it.
+        if (node.op == VIEW) {
+            bool alias = fuse && members.count(node.src[0]) && !isStridedInput(node) && node.nelem == graph.nodes[node.src[0]].nelem;
+            if (!alias) continue;
+
+            members.insert(id);
+            kernels.back().nodes.push_back(id);
+            kernelOf[id] = static_cast<int>(kernels.size() - 1);
+            continue;
+        }
+
+        bool join = fuse && !kernels.empty() && kernels.back().nelem == node.nelem && !readsOwnView(graph, node, members);
+        if (join) {
+            members.insert(id);
+            join = countBindings(graph, consumers, members) <= maxBindings && countViews(graph, members) <= maxViews;
+            if (!join) members.erase(id);
+        }
+
+        if (!join) {
+            kernels.push_back(FusedKernel{});
+            kernels.back().nelem = node.nelem;
+            members = {id};
+        }
+
+        kernels.back().nodes.push_back(id);
+        kernelOf[id] = static_cast<int>(kernels.size() - 1);
+    }
+
+    // Now that every node is placed, find what each kernel actually reads and writes
+    for (size_t k = 0; k < kernels.size(); k++) {
+        FusedKernel& kernel = kernels[k];
+
+        for (uint32_t id : kernel.nodes) {
+            for (uint32_t src : graph.nodes[id].src) {
+                bool inside = kernelOf[src] == static_cast<int>(k);
+                if (!inside && std::find(kernel.inputs.begin(), kernel.inputs.end(), src) == kernel.inputs.end()) {
+                    kernel.inputs.push_back(src);
+                }
+            }
+
+            bool escapes = graph.nodes[id].isOutput;
+            for (uint32_t consumer : consumers[id]) escapes = escapes || kernelOf[consumer] != static_cast<int>(k);
+            if (escapes) kernel.outputs.push_back(id);
+        }
+    }
+
+    return kernels;
+}
+
+// Type a value is computed in. float16 and bfloat16 are computed as floats and int8 as ints, like in elementwise.comp.
+static const char* scalarType(const std::string& dtype) {
+    if (isFloatDtype(dtype)) return "float";
+    if (dtype == "int" || dtype == "int8") return "int";
+    return "uint";
+}
+
+static const char* vectorType(const std::string& dtype) {
+    if (isFloatDtype(dtype)) return "vec4";
+    if (dtype == "int" || dtype == "int8") return "ivec4";
+    return "uvec4";
+}
+
+// Type a value is stored as in its buffer
+static const char* storageType(const std::string& dtype, bool vectorized) {
+    if (dtype == "float16") return vectorized ? "f16vec4" : "float16_t";
+    if (dtype == "bfloat16") return vectorized ? "u16vec4" : "uint16_t";
+    if (dtype == "int8") return vectorized ? "i8vec4" : "int8_t";
+    return vectorized ? vectorType(dtype) : scalarType(dtype);
+}
+
+static std::string widenExpression(const std::string& dtype, const std::string& value, bool vectorized) {
+    if (dtype == "bfloat16") return std::string("bfloat16ToFloat(") + (vectorized ? "uvec4(" : "uint(") + value + "))";
+    if (getTypeSize(dtype) < 4) return std::string(vectorized ? vectorType(dtype) : scalarType(dtype)) + "(" + value + ")";
+    return value;
+}
+
+static std::string narrowExpression(const std::string& dtype, const std::string& value, bool vectorized) {
+    if (dtype == "bfloat16") return std::string(storageType(dtype, vectorized)) + "(floatToBfloat16(" + value + "))";
+    if (getTypeSize(dtype) < 4) return std::string(storageType(dtype, vectorized)) + "(" + value + ")";
+    return value;
+}
+
+// Rounds (or wraps) a computed value to what its dtype can hold, so that fused kernels see the same
+// intermediate values as separate ones, which store every result
+static std::string representableExpression(const std::string& dtype, const std::string& value) {
+    if (dtype == "float16") return "float16ToFloat(floatToFloat16(" + value + "))";
+    if (dtype == "bfloat16") return "bfloat16ToFloat(floatToBfloat16(" + value + "))";
+    if (dtype == "int8") return "((" + value + " << 24) >> 24)";
+    return value;
+}
+
+// GLSL for a single op, with the same semantics as the cases in elementwise.comp and cast.comp
+static std::string opExpression(const Graph& graph, const GraphNode& node, bool vectorized) {
+    std::string type = vectorized ? vectorType(node.dtype) : scalarType(node.dtype);
+    std::string uintType = vectorized ? "uvec4" : "uint";
+    const std::string& srcDtype = graph.nodes[node.src[0]].dtype;
+    bool isFloat = isFloatDtype(srcDtype);
+
+    std::string a = "t" + std::to_string(node.src[0]);
+    std::string b = node.src.size() > 1 ? "t" + std::to_string(node.src[1]) : "";
+    std::string c = node.src.size() > 2 ? "t" + std::to_string(node.src[2]) : "";
+
+    switch (node.op) {
+        case EXP2: return "exp2(" + a + ")";
+        case LOG2: return "log2(" + a + ")";
+        case SIN: return "sin(" + a + ")";
+        case SQRT: return "sqrt(" + a + ")";
+        case RECIP: return "(" + type + "(1) / " + a + ")";
+        case NEG: return "(-" + a + ")";
+        case CONTIGUOUS: case VIEW: return a;
+        case CAST: return type + "(" + a + ")";
+        case BITCAST:
+            // The only narrow pair of the same size, both are computed as floats
+            if (srcDtype == "float16") return "bfloat16ToFloat(floatToFloat16(" + a + "))";
+            if (srcDtype == "bfloat16") return "float16ToFloat(floatToBfloat16(" + a + "))";
+            if (isFloat) return type + "(floatBitsToUint(" + a + "))";
+            if (node.dtype == "float") return "uintBitsToFloat(" + uintType + "(" + a + "))";
+            return type + "(" + a + ")";
+        case ADD: return "(" + a + " + " + b + ")";
+        case SUB: return "(" + a + " - " + b + ")";
+        case MUL: return "(" + a + " * " + b + ")";
+        case IDIV: return isFloat ? "trunc(" + a + " / " + b + ")" : "(" + a + " / " + b + ")";
+        case MOD: return isFloat ? "(" + a + " - " + b + " * trunc(" + a + " / " + b + "))" : "(" + a + " % " + b + ")";
+        case MAX: return "max(" + a + ", " + b + ")";
+        case CMPLT: return vectorized ? type + "(lessThan(" + a + ", " + b + "))" : type + "(" + a + " < " + b + ")";
+        case CMPNE: return vectorized ? type + "(notEqual(" + a + ", " + b + "))" : type + "(" + a + " != " + b + ")";
+        case XOR: return "(" + a + " ^ " + b + ")";
+        case SHL: return "(" + a + " << " + b + ")";
+        case SHR: return "(" + a + " >> " + b + ")";
+        case OR: return "(" + a + " | " + b + ")";
+        case AND: return "(" + a + " & " + b + ")";
+        case THREEFRY: return type + "(threefryBits(" + uintType + "(" + a + "), " + uintType + "(" + b + ")))";
+        case WHERE:
+            if (vectorized) return "mix(" + c + ", " + b + ", notEqual(" + a + ", " + type + "(0)))";
+            return "(" + a + " != " + type + "(0) ? " + b + " : " + c + ")";
+        case MULACC: return isFloat ? "fma(" + a + ", " + b + ", " + c + ")" : "(" + a + " * " + b + " + " + c + ")";
+        default:
+            throw std::runtime_error(std::string("No code generation for ") + opName(node.op) + ".");
+    }
+}
+
+// Loads the inputs, evaluates every node into a local and stores the outputs, for element (or vec4) `index`
+static std::string generateBody(const Graph& graph, const FusedKernel& kernel, bool vectorized, const std::string& index) {
+    std::ostringstream body;
+    const char* suffix = vectorized ? "" : "s";
+
+    uint32_t views = 0;
+    for (size_t k = 0; k < kernel.inputs.size(); k++) {
+        const GraphNode& node = graph.nodes[kernel.inputs[k]];
+        const char* type = vectorized ? vectorType(node.dtype) : scalarType(node.dtype);
+        std::string value;
+
+        if (isStridedInput(node)) {
+            // Gathered one element at a time, the four of a vec4 are not next to each other
+            std::string view = "views[" + std::to_string(views++) + "]";
+            std::string buffer = "in" + std::to_string(k) + "s";
+            if (vectorized) {
+                value = std::string(type) + "(";
+                for (uint32_t j = 0; j < 4; j++) {
+                    std::string load = buffer + "[viewIndex(" + view + ", " + index + " * 4u + " + std::to_string(j) + "u)]";
+                    value += (j > 0 ? ", " : "") + widenExpression(node.dtype, load, false);
+                }
+                value += ")";
+            } else {
+                value = widenExpression(node.dtype, buffer + "[viewIndex(" + view + ", " + index + ")]", false);
+            }
+        } else {
+            std::string load = std::string("in") + std::to_string(k) + suffix + "[" + index + "]";
+            value = widenExpression(node.dtype, load, vectorized);
+        }
+
+        body << "        " << type << " t" << kernel.inputs[k] << " = " << value << ";\n";
+    }
+
+    for (uint32_t id : kernel.nodes) {
+        const GraphNode& node = graph.nodes[id];
+        const char* type = vectorized ? vectorType(node.dtype) : scalarType(node.dtype);
+        body << "        " << type << " t" << id << " = " << representableExpression(node.dtype, opExpression(graph, node, vectorized)) << ";\n";
+    }
+
+    for (size_t k = 0; k < kernel.outputs.size(); k++) {
+        const std::string& dtype = graph.nodes[kernel.outputs[k]].dtype;
+        std::string value = "t" + std::to_string(kernel.outputs[k]);
+        body << "        out" << k << suffix << "[" << index << "] = " << narrowExpression(dtype, value, vectorized) << ";\n";
+    }
+
+    return body.str();
+}
+
+// Writes the GLSL for a fused kernel. The layout follows elementwise.comp: inputs first, then outputs,
+// every buffer declared as vec4 for the main loop and as scalars for the tail. Strided inputs get their
+// view from the push constants, after the element count, so the source only depends on which inputs are strided.
+std::string generateFusedShader(const Graph& graph, const FusedKernel& kernel) {
+    std::ostringstream glsl;
+
+    bool usesThreefry = false;
+    bool usesNarrow = false;
+    for (uint32_t id : kernel.nodes) {
+        usesThreefry = usesThreefry || graph.nodes[id].op == THREEFRY;
+        usesNarrow = usesNarrow || getTypeSize(graph.nodes[id].dtype) < 4;
+    }
+
+    // Storage extensions for the buffers that hold narrow dtypes
+    bool stores16 = false, stores8 = false;
+    std::vector<uint32_t> buffers = kernel.inputs;
+    buffers.insert(buffers.end(), kernel.outputs.begin(), kernel.outputs.end());
+    for (uint32_t id : buffers) {
+        VkDeviceSize size = getTypeSize(graph.nodes[id].dtype);
+        stores16 = stores16 || size == 2;
+        stores8 = stores8 || size == 1;
+        usesNarrow = usesNarrow || size < 4;
+    }
+
+    uint32_t views = 0;
+    for (uint32_t id : kernel.inputs) views += isStridedInput(graph.nodes[id]) ? 1 : 0;
+
+    glsl << "#version 450\n";
+    if (stores16) glsl << "#extension GL_EXT_shader_16bit_storage : require\n";
+    if (stores8) glsl << "#extension GL_EXT_shader_8bit_storage : require\n";
+    if (usesThreefry || usesNarrow || views > 0) glsl << "#extension GL_GOOGLE_include_directive : require\n";
+    if (usesThreefry) glsl << "#include \"threefry.glsl\"\n";
+    if (usesNarrow) glsl << "#include \"storage.glsl\"\n";
+    if (views > 0) glsl << "#include \"view.glsl\"\n";
+
+    glsl << "\n// Generated by fuseGraph():";
+    for (uint32_t id : kernel.nodes) glsl << " " << opName(graph.nodes[id].op);
+    glsl << "\n\n";
+
+    glsl << "layout(local_size_x = 256) in;\n\n";
+    glsl << "layout(push_constant) uniform PushConstants {\n    uint n;\n";
+    if (views > 0) glsl << "    View views[" << views << "];\n";
+    glsl << "};\n\n";
+
+    // Strided inputs are only ever read one element at a time
+    uint32_t binding = 0;
+    for (size_t k = 0; k < kernel.inputs.size(); k++, binding++) {
+        const std::string& dtype = graph.nodes[kernel.inputs[k]].dtype;
+        if (!isStridedInput(graph.nodes[kernel.inputs[k]])) {
+            glsl << "layout(binding = " << binding << ") readonly buffer In" << k << " { " << storageType(dtype, true) << " in" << k << "[]; };\n";
+        }
+        glsl << "layout(binding = " << binding << ") readonly buffer In" << k << "Scalar { " << storageType(dtype, false) << " in" << k << "s[]; };\n";
+    }
+    for (size_t k = 0; k < kernel.outputs.size(); k++, binding++) {
+        const std::string& dtype = graph.nodes[kernel.outputs[k]].dtype;
+        glsl << "layout(binding = " << binding << ") writeonly buffer Out" << k << " { " << storageType(dtype, true) << " out" << k << "[]; };\n";
+        glsl << "layout(binding = " << binding << ") writeonly buffer Out" << k << "Scalar { " << storageType(dtype, false) << " out" << k << "s[]; };\n";
+    }
+
+    glsl << "\nvoid main() {\n";
+    glsl << "    uint vectors = n / 4u;\n";
+    glsl << "    uint stride = gl_NumWorkGroups.x * gl_WorkGroupSize.x;\n\n";
+    glsl << "    for (uint i = gl_GlobalInvocationID.x; i < vectors; i += stride) {\n";
+    glsl << generateBody(graph, kernel, true, "i");
+    glsl << "    }\n\n";
+    glsl << "    uint tail = vectors * 4u + gl_GlobalInvocationID.x;\n";
+    glsl << "    if (tail < n) {\n";
+    glsl << generateBody(graph, kernel, false, "tail");
+    glsl << "    }\n";
+    glsl << "}\n";
+
+    return glsl.str();
+}
+
+static std::string generatedShaderKey(const std::string& source) {
+    return "generated:" + std::to_string(hashBytes(source.data(), source.size()));
+}
+
+// Fuses the graph, generates and compiles a shader per kernel and binds the buffers.
+// Values that cross a kernel boundary share one device-local arena, planned by their lifetimes (memory_planner.h).
+CompiledGraph compileGraph(PipelineRegistry& registry, const Graph& graph, bool fuse, bool reuseMemory) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(registry.physicalDevice, &properties);
+
+    for (const GraphNode& node : graph.nodes) {
+        if (!supportsDtype(registry, node.dtype)) {
+            throw std::runtime_error("Device has no storage buffer support for " + node.dtype + ".");
+        }
+    }
+
+    CompiledGraph compiled;
+    compiled.device = registry.device;
+    uint32_t maxViews = (properties.limits.maxPushConstantsSize - sizeof(uint32_t)) / sizeof(ViewParams);
+    compiled.kernels = fuseGraph(graph, properties.limits.maxPerStageDescriptorStorageBuffers, maxViews, fuse);
+
+    std::vector<Buffer> nodeBuffers(graph.nodes.size());
+    std::vector<bool> hasBuffer(graph.nodes.size());
+    for (size_t id = 0; id < graph.nodes.size(); id++) {
+        hasBuffer[id] = graph.nodes[id].hasBuffer;
+        if (hasBuffer[id]) nodeBuffers[id] = graph.nodes[id].buffer;
+    }
+
+    // Values that cross a kernel boundary live from the kernel that writes them to the last one that reads them.
+    // They all get a range of one arena, values that are never alive at the same time share it.
+    std::vector<int> tensorOf(graph.nodes.size(), -1);
+    std::vector<TensorLifetime> lifetimes;
+    for (uint32_t k = 0; k < compiled.kernels.size(); k++) {
+        for (uint32_t id : compiled.kernels[k].outputs) {
+            if (hasBuffer[id]) continue;
+
+            const GraphNode& node = graph.nodes[id];
+            tensorOf[id] = static_cast<int>(lifetimes.size());
+            lifetimes.push_back(TensorLifetime{VkDeviceSize(node.nelem) * getTypeSize(node.dtype), k, k});
+            hasBuffer[id] = true;
+        }
+    }
+    for (uint32_t k = 0; k < compiled.kernels.size(); k++) {
+        for (uint32_t id : compiled.kernels[k].inputs) {
+            uint32_t owner = graph.nodes[id].op == VIEW && !hasBuffer[id] ? graph.nodes[id].src[0] : id;
+            if (tensorOf[owner] >= 0) lifetimes[tensorOf[owner]].last = std::max(lifetimes[tensorOf[owner]].last, k);
+        }
+    }
+
+    // Without reuse every value lives through the whole graph, which is what one buffer per value amounts to
+    if (!reuseMemory) {
+        for (TensorLifetime& lifetime : lifetimes) {
+            lifetime.first = 0;
+            lifetime.last = static_cast<uint32_t>(compiled.kernels.size() - 1);
+        }
+    }
+
+    compiled.memoryPlan = planMemory(lifetimes, properties.limits.minStorageBufferOffsetAlignment);
+    if (!lifetimes.empty()) {
+        compiled.arena = createBuffer(registry.physicalDevice, registry.device, compiled.memoryPlan.peak, 0, MEMORY_DEVICE_LOCAL);
+    }
+    for (size_t id = 0; id < graph.nodes.size(); id++) {
+        if (tensorOf[id] < 0) continue;
+        nodeBuffers[id] = plannedBuffer(compiled.arena, compiled.memoryPlan, tensorOf[id]);
+        compiled.intermediates.push_back(nodeBuffers[id]);
+    }
+
+    // Generated SPIR-V is kept with the files the registry loaded, keyed by the hash of its source.
+    // Shaders the registry hasn't seen yet are compiled side by side.
+    // Other threads may load files into the map at the same time, so it's only touched under the registry's mutex,
+    // the compiler runs outside of it.
+    std::vector<ShaderSource> missing;
+    std::set<std::string> missingKeys;
+    for (FusedKernel& kernel : compiled.kernels) {
+        kernel.source = generateFusedShader(graph, kernel);
+    }
+    {
+        std::lock_guard<std::mutex> lock(*registry.mutex);
+        for (FusedKernel& kernel : compiled.kernels) {
+            std::string key = generatedShaderKey(kernel.source);
+            if (registry.spirvFiles.count(key) || !missingKeys.insert(key).second) continue;
+            missing.push_back(ShaderSource{kernel.source, {}});
+        }
+    }
+    std::vector<std::vector<char>> spirv = compileGlslParallel(missing);
+    {
+        std::lock_guard<std::mutex> lock(*registry.mutex);
+        // Another thread may have compiled the same kernel meanwhile and be reading its entry outside the lock,
+        // so an existing entry is never replaced
+        for (size_t i = 0; i < missing.size(); i++) {
+            registry.spirvFiles.emplace(generatedShaderKey(missing[i].source), std::move(spirv[i]));
+        }
+    }
+
+    for (FusedKernel& kernel : compiled.kernels) {
+        kernel.bytes = 0;
+        for (uint32_t id : kernel.inputs) kernel.bytes += VkDeviceSize(kernel.nelem) * getTypeSize(graph.nodes[id].dtype);
+        for (uint32_t id : kernel.outputs) kernel.bytes += VkDeviceSize(kernel.nelem) * getTypeSize(graph.nodes[id].dtype);
+
+        // Views read the buffer of their source, unless they are a reshape that was written out by an earlier kernel
+        kernel.views.clear();
+        kernel.bindingNodes.clear();
+        for (uint32_t id : kernel.inputs) {
+            const GraphNode& node = graph.nodes[id];
+            kernel.bindingNodes.push_back(node.op == VIEW && !hasBuffer[id] ? node.src[0] : id);
+            if (isStridedInput(node)) kernel.views.push_back(viewParams(node.view));
+        }
+        for (uint32_t id : kernel.outputs) kernel.bindingNodes.push_back(id);
+
+        std::vector<Buffer>& bindings = kernel.bindings;
+        bindings.clear();
+        for (uint32_t id : kernel.bindingNodes) bindings.push_back(nodeBuffers[id]);
+        for (uint32_t i = 0; i < bindings.size(); i++) bindings[i].binding = i;
+
+        const std::vector<char>* code;
+        {
+            std::lock_guard<std::mutex> lock(*registry.mutex);
+            code = &registry.spirvFiles.at(generatedShaderKey(kernel.source));
+        }
+        uint32_t pushConstantSize = static_cast<uint32_t>(sizeof(uint32_t) + kernel.views.size() * sizeof(ViewParams));
+        kernel.pipeline = &getPipeline(registry, *code, "main", static_cast<uint32_t>(bindings.size()), nullptr, pushConstantSize);
+        kernel.descriptors = createDescriptorBinding(registry, *kernel.pipeline, bindings);
+    }
+
+    return compiled;
+}
+
+static VkDeviceSize rangeEnd(const Buffer& buffer) {
+    if (buffer.descriptorInfo.range == VK_WHOLE_SIZE) return UINT64_MAX;
+    return buffer.descriptorInfo.offset + buffer.descriptorInfo.range;
+}
+
+static bool sharesMemory(const Buffer& a, const Buffer& b) {
+    return a.buffer == b.buffer && a.descriptorInfo.offset < rangeEnd(b) && b.descriptorInfo.offset < rangeEnd(a);
+}
+
+static bool sharesMemory(const Buffer& buffer, const std::vector<Buffer>& others) {
+    for (const Buffer& other : others) {
+        if (sharesMemory(buffer, other)) return true;
+    }
+    return false;
+}
+
+// Records every kernel of the graph with the buffers of the compiled graph
+void recordGraph(VkCommandBuffer commandBuffer, CompiledGraph& compiled) {
+    std::vector<KernelBindings> bindings;
+    for (const FusedKernel& kernel : compiled.kernels) bindings.push_back(KernelBindings{kernel.bindings, &kernel.descriptors});
+    recordGraph(commandBuffer, compiled, bindings);
+}
+
+// Records every kernel of the graph, in order, with `bindings` instead of the buffers it was compiled with.
+// A barrier only goes in front of a kernel that touches memory in use since the last one: reading what an earlier
+// kernel wrote, or writing what it read or wrote (the memory plan reuses ranges). Kernels in between may overlap.
+void recordGraph(VkCommandBuffer commandBuffer, CompiledGraph& compiled, const std::vector<KernelBindings>& bindings) {
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    std::vector<Buffer> written, read;
+    for (size_t i = 0; i < compiled.kernels.size(); i++) {
+        FusedKernel& kernel = compiled.kernels[i];
+        const std::vector<Buffer>& buffers = bindings[i].buffers;
+        size_t inputCount = kernel.inputs.size();
+
+        bool hazard = false;
+        for (size_t b = 0; b < buffers.size() && !hazard; b++) {
+            hazard = sharesMemory(buffers[b], written) || (b >= inputCount && sharesMemory(buffers[b], read));
+        }
+        if (hazard) {
+            recordKernelBarrier(commandBuffer);
+            written.clear();
+            read.clear();
+        }
+        read.insert(read.end(), buffers.begin(), buffers.begin() + inputCount);
+        written.insert(written.end(), buffers.begin() + inputCount, buffers.end());
+
+        uint32_t scope = NO_SCOPE;
+        if (activeProfiler()) {
+            std::string name = "fused " + std::to_string(kernel.nodes.size()) + " ops #" + std::to_string(i);
+            scope = beginGpuScope(commandBuffer, name, "graph", kernel.bytes);
+        }
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline->pipeline);
+        bindDescriptors(commandBuffer, *kernel.pipeline, *bindings[i].descriptors);
+        vkCmdPushConstants(commandBuffer, kernel.pipeline->layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &kernel.nelem);
+        if (!kernel.views.empty()) {
+            vkCmdPushConstants(commandBuffer, kernel.pipeline->layout, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(uint32_t),
+                               static_cast<uint32_t>(kernel.views.size() * sizeof(ViewParams)), kernel.views.data());
+        }
+        vkCmdDispatch(commandBuffer, elementwiseGroupCount(kernel.nelem), 1, 1);
+        endGpuScope(commandBuffer, scope);
+    }
+
+    // Outputs are often read through a mapping once the fence signals, which alone doesn't make the writes visible
+    VkMemoryBarrier toHost{};
+    toHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    toHost.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &toHost, 0, nullptr, 0, nullptr);
+
+    vkEndCommandBuffer(commandBuffer);
+}
+
+void destroyCompiledGraph(CompiledGraph& compiled) {
+    for (FusedKernel& kernel : compiled.kernels) {
+        destroyDescriptorBinding(compiled.device, kernel.descriptors);
+    }
+
+    // The intermediates are ranges of the arena
+    if (!compiled.intermediates.empty()) {
+        std::vector<Buffer> arena = {compiled.arena};
+        destroyBuffers(arena);
+    }
+    compiled.kernels.clear();
+    compiled.intermediates.clear();
+}
@@ -0,0 +1,85 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "./util.h"
+#include "./kernel.h"
+#include "./pipeline_cache.h"
+#include "./view.h"
+#include "./memory_planner.h"
+#include "./shader_compiler.h"
+
+// One value in the compute graph. Inputs are EMPTY nodes backed by a buffer the caller owns,
+// VIEW nodes read the buffer of their source in a different shape or order (see view.h),
+// every other node is an elementwise op over the nodes listed in `src`, CONTIGUOUS being a copy.
+struct GraphNode {
+    Ops op;
+    std::vector<uint32_t> src;
+    std::string dtype;
+    uint32_t nelem;
+    View view; // contiguous in the node's shape, except for VIEW nodes, where it indexes the source
+
+    // Set for inputs and outputs, everything else only exists if a kernel boundary forces it to
+    bool hasBuffer;
+    bool isOutput;
+    Buffer buffer;
+};
+
+struct Graph {
+    std::vector<GraphNode> nodes;
+};
+
+// A group of nodes that runs as a single dispatch. Values that never leave the group stay in registers,
+// only `inputs` are read from and `outputs` written to global memory.
+struct FusedKernel {
+    std::vector<uint32_t> nodes;
+    std::vector<uint32_t> inputs;
+    std::vector<uint32_t> outputs;
+    uint32_t nelem;
+    VkDeviceSize bytes; // global memory traffic of one dispatch
+    std::vector<ViewParams> views; // of the strided inputs, in input order
+
+    // Inputs, then outputs, with the node whose buffer each one is (a view binds the buffer of its source)
+    std::vector<Buffer> bindings;
+    std::vector<uint32_t> bindingNodes;
+
+    std::string source;
+    Pipeline* pipeline;
+    DescriptorBinding descriptors;
+};
+
+struct CompiledGraph {
+    VkDevice device;
+    std::vector<FusedKernel> kernels;
+
+    // Values that cross a kernel boundary live in ranges of `arena`, which the compiled graph owns.
+    // The ranges of values that are not alive at the same time overlap, `memoryPlan` has the sizes.
+    Buffer arena;
+    std::vector<Buffer> intermediates;
+    MemoryPlan memoryPlan;
+};
+
+// What one recording of a compiled graph binds to a kernel, see capture.h
+struct KernelBindings {
+    std::vector<Buffer> buffers;
+    const DescriptorBinding* descriptors;
+};
+
+uint32_t addInput(Graph& graph, Buffer buffer, const std::string& dtype = "float");
+uint32_t addOp(Graph& graph, Ops op, std::vector<uint32_t> src, const std::string& destDtype = "");
+uint32_t addReshape(Graph& graph, uint32_t node, const std::vector<uint32_t>& shape);
+uint32_t addPermute(Graph& graph, uint32_t node, const std::vector<uint32_t>& order);
+uint32_t addSlice(Graph& graph, uint32_t node, uint32_t dim, uint32_t start, uint32_t end, int32_t step = 1);
+uint32_t addExpand(Graph& graph, uint32_t node, const std::vector<uint32_t>& shape);
+uint32_t addContiguous(Graph& graph, uint32_t node);
+uint32_t markOutput(Graph& graph, uint32_t node, Buffer buffer);
+
+std::vector<uint32_t> topologicalOrder(const Graph& graph);
+std::vector<FusedKernel> fuseGraph(const Graph& graph, uint32_t maxBindings, uint32_t maxViews, bool fuse = true);
+std::string generateFusedShader(const Graph& graph, const FusedKernel& kernel);
+
+CompiledGraph compileGraph(PipelineRegistry& registry, const Graph& graph, bool fuse = true, bool reuseMemory = true);
+void recordGraph(VkCommandBuffer commandBuffer, CompiledGraph& compiled);
+void recordGraph(VkCommandBuffer commandBuffer, CompiledGraph& compiled, const std::vector<KernelBindings>& bindings);
+void destroyCompiledGraph(CompiledGraph& compiled);
+
+#endif // GRAPH_H
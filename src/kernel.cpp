@@ -0,0 +1,198 @@
+#include "./kernel.h"
+#include "./profiler.h"
+
+#include <algorithm>
+
+static const char* opNames[] = {
+  "EXP2", "LOG2", "CAST", "BITCAST", "SIN", "SQRT", "RECIP", "NEG",
+  "ADD", "MUL", "IDIV", "MAX", "MOD", "CMPLT", "CMPNE", "XOR", "SHL", "SHR", "OR", "AND", "THREEFRY", "SUB",
+  "WHERE", "MULACC",
+  "SUM", "PROD", "REDUCE_MAX",
+  "EMPTY", "CONST", "COPY", "CONTIGUOUS", "ASSIGN", "VIEW",
+};
+
+const char* opName(Ops op) {
+  return opNames[op];
+}
+
+// Number of source buffers an elementwise op reads
+uint32_t opArity(Ops op) {
+  if (op <= NEG) return 1;
+  if (op <= SUB) return 2;
+  if (op <= MULACC) return 3;
+  throw std::runtime_error(std::string(opName(op)) + " is not an elementwise op.");
+}
+
+// Transcendentals only exist for floats, bit ops only for integers
+bool supportsOp(Ops op, const std::string& dtype) {
+  if (op > MULACC) return false;
+
+  bool isFloat = isFloatDtype(dtype);
+  switch (op) {
+    case EXP2: case LOG2: case SIN: case SQRT: case RECIP:
+      return isFloat;
+    case XOR: case SHL: case SHR: case OR: case AND:
+      return !isFloat;
+    case THREEFRY:
+      return dtype == "uint";
+    default:
+      return true;
+  }
+}
+
+// Every thread handles `itemsPerThread` vec4s (or elements) per iteration of a grid-stride loop,
+// so the group count is capped at the guaranteed minimum of maxComputeWorkGroupCount
+uint32_t elementwiseGroupCount(uint32_t nelem, const KernelConfig& config) {
+  uint32_t units = config.vectorWidth == 4 ? (nelem + 3) / 4 : nelem;
+  uint64_t perGroup = uint64_t(config.workgroupSize) * config.itemsPerThread;
+  uint64_t groups = (units + perGroup - 1) / perGroup;
+  return static_cast<uint32_t>(std::max<uint64_t>(1, std::min<uint64_t>(groups, 65535)));
+}
+
+// Name the launch shape of a kernel is tuned and stored under, e.g. "ADD_float" or "CAST_float_int"
+std::string kernelConfigName(Ops op, const std::string& dtype, const std::string& destDtype) {
+  std::string name = std::string(opName(op)) + "_" + dtype;
+  if (op == CAST || op == BITCAST) name += "_" + destDtype;
+  return name;
+}
+
+static std::string shaderPath(Ops op, const std::string& dtype, const std::string& destDtype) {
+  static const char* arityNames[] = {"", "unary", "binary", "ternary"};
+
+  if (op == CAST || op == BITCAST) return "shaders/cast_" + dtype + "_" + destDtype + ".spv";
+  return std::string("shaders/") + arityNames[opArity(op)] + "_" + dtype + ".spv";
+}
+
+// Checks the op against its dtypes and buffers and fills in everything but the backend specific parts
+static Kernel describeKernel(Ops op, std::vector<Buffer> src, Buffer dest, const std::string& dtype, const std::string& destDtype) {
+  std::string outType = destDtype.empty() ? dtype : destDtype;
+
+  if (!supportsOp(op, dtype)) {
+    std::ostringstream msg;
+    msg << "Operation " << opName(op) << " is not supported for dtype " << dtype << ".";
+    throw std::runtime_error(msg.str());
+  }
+
+  uint32_t arity = opArity(op);
+  if (src.size() != arity) {
+    std::ostringstream msg;
+    msg << "Operation " << opName(op) << " takes " << arity << " sources, got " << src.size() << ".";
+    throw std::runtime_error(msg.str());
+  }
+
+  if ((op == CAST || op == BITCAST) == (dtype == outType)) {
+    throw std::runtime_error("Only CAST and BITCAST change the dtype, and they have to.");
+  }
+  if (op == BITCAST && getTypeSize(dtype) != getTypeSize(outType)) {
+    throw std::runtime_error("BITCAST needs types of the same size.");
+  }
+
+  Kernel kernel;
+  kernel.op = op;
+  kernel.dtype = dtype;
+  kernel.destDtype = outType;
+  kernel.nelem = static_cast<uint32_t>(dest.size / getTypeSize(outType));
+
+  for (const Buffer& buffer : src) {
+    if (buffer.size < kernel.nelem * getTypeSize(dtype)) throw std::runtime_error("Source buffer is smaller than the destination.");
+  }
+
+  // Sources are bound at 0..arity-1 and the destination right after, whatever bindings the buffers came with
+  for (uint32_t i = 0; i < arity; i++) src[i].binding = i;
+  dest.binding = arity;
+  kernel.src = src;
+  kernel.dest = dest;
+
+  return kernel;
+}
+
+// Builds a kernel that applies `op` to `src` and writes the result to `dest`.
+// The element count is taken from the size of the destination buffer.
+Kernel createKernel(PipelineRegistry& registry, Ops op, std::vector<Buffer> src, Buffer dest, const std::string& dtype, const std::string& destDtype) {
+  Kernel kernel = describeKernel(op, src, dest, dtype, destDtype);
+  if (!supportsDtype(registry, dtype) || !supportsDtype(registry, kernel.destDtype)) {
+    throw std::runtime_error("Device has no storage buffer support for " + dtype + " or " + kernel.destDtype + ".");
+  }
+  kernel.backend = BACKEND_GPU;
+  kernel.device = registry.device;
+
+  kernel.config = getKernelConfig(registry, kernelConfigName(op, dtype, kernel.destDtype));
+
+  SpecializationConstants constants;
+  constants.set(0, op);
+  constants.set(1, kernel.config.workgroupSize);
+  constants.set(2, kernel.config.itemsPerThread);
+  constants.set(3, kernel.config.vectorWidth);
+  kernel.pipeline = &getPipeline(registry, shaderPath(op, dtype, kernel.destDtype), "main", opArity(op) + 1, &constants, sizeof(uint32_t));
+
+  std::vector<Buffer> bindings = kernel.src;
+  bindings.push_back(kernel.dest);
+  kernel.descriptors = createDescriptorBinding(registry, *kernel.pipeline, bindings);
+
+  return kernel;
+}
+
+// Same op for the CPU backend (see cpu_backend.h). Every buffer has to be mapped: host-visible, imported or host-only.
+Kernel createCpuKernel(Ops op, std::vector<Buffer> src, Buffer dest, const std::string& dtype, const std::string& destDtype) {
+  Kernel kernel = describeKernel(op, src, dest, dtype, destDtype);
+  kernel.backend = BACKEND_CPU;
+  kernel.device = VK_NULL_HANDLE;
+  kernel.pipeline = nullptr;
+  kernel.descriptors = DescriptorBinding{};
+  kernel.config = defaultKernelConfig();
+
+  for (const Buffer& buffer : kernel.src) {
+    if (buffer.mapped == nullptr) throw std::runtime_error("CPU kernels need host-visible buffers.");
+  }
+  if (kernel.dest.mapped == nullptr) throw std::runtime_error("CPU kernels need host-visible buffers.");
+
+  return kernel;
+}
+
+// Records the dispatch for a kernel. The command buffer has to be in the recording state.
+void recordKernel(VkCommandBuffer commandBuffer, Kernel& kernel) {
+  uint32_t scope = NO_SCOPE;
+  if (activeProfiler()) {
+    VkDeviceSize bytes = VkDeviceSize(kernel.nelem) * (kernel.src.size() * getTypeSize(kernel.dtype) + getTypeSize(kernel.destDtype));
+    scope = beginGpuScope(commandBuffer, std::string(opName(kernel.op)) + " " + kernel.destDtype, "kernel", bytes);
+  }
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline->pipeline);
+  bindDescriptors(commandBuffer, *kernel.pipeline, kernel.descriptors);
+  vkCmdPushConstants(commandBuffer, kernel.pipeline->layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &kernel.nelem);
+  vkCmdDispatch(commandBuffer, elementwiseGroupCount(kernel.nelem, kernel.config), 1, 1);
+
+  endGpuScope(commandBuffer, scope);
+}
+
+// Makes the writes of every kernel recorded so far visible to the ones recorded after
+void recordKernelBarrier(VkCommandBuffer commandBuffer) {
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// Records a list of kernels into a fresh command buffer, in order, with a barrier between each pair
+void recordKernels(VkCommandBuffer commandBuffer, std::vector<Kernel>& kernels) {
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+  for (size_t i = 0; i < kernels.size(); i++) {
+    if (i > 0) recordKernelBarrier(commandBuffer);
+    recordKernel(commandBuffer, kernels[i]);
+  }
+
+  vkEndCommandBuffer(commandBuffer);
+}
+
+// The pipeline belongs to the registry, only the descriptors are owned by the kernel
+void destroyKernel(Kernel& kernel) {
+  if (kernel.backend == BACKEND_CPU) return;
+  destroyDescriptorBinding(kernel.device, kernel.descriptors);
+}
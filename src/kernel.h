@@ -1,16 +1,61 @@
 #ifndef KERNEL_H
 #define KERNEL_H
 
+#include "./util.h"
+#include "./pipeline_cache.h"
+
+// Opcodes match optypes and src/shaders/ops.glsl
 enum Ops {
   // Unary
   EXP2, LOG2, CAST, BITCAST, SIN, SQRT, RECIP, NEG,
 
-  // 
+  // Binary
+  ADD, MUL, IDIV, MAX, MOD, CMPLT, CMPNE, XOR, SHL, SHR, OR, AND, THREEFRY, SUB,
+
+  // Ternary
+  WHERE, MULACC,
+
+  // Reduce (MAX is taken by the binary op)
+  SUM, PROD, REDUCE_MAX,
+
+  // Meta
+  EMPTY, CONST, COPY, CONTIGUOUS, ASSIGN, VIEW,
 };
 
+// Where a kernel runs. CPU kernels have no pipeline or descriptors and work on the host mapping of their buffers.
+enum Backend {
+  BACKEND_GPU,
+  BACKEND_CPU,
+};
+
+// A single elementwise op, ready to be recorded into a command buffer (or run by the CPU backend).
+// `dtype` is the element type of the sources, `destDtype` the one of the destination
+// (they only differ for CAST and BITCAST).
 struct Kernel {
-  
+  Backend backend;
+  Ops op;
+  std::vector<Buffer> src;
+  Buffer dest;
+  std::string dtype;
+  std::string destDtype;
+  uint32_t nelem;
+
+  VkDevice device;
+  Pipeline* pipeline;
+  DescriptorBinding descriptors;
+  KernelConfig config;
 };
 
+const char* opName(Ops op);
+uint32_t opArity(Ops op);
+bool supportsOp(Ops op, const std::string& dtype);
+uint32_t elementwiseGroupCount(uint32_t nelem, const KernelConfig& config = defaultKernelConfig());
+std::string kernelConfigName(Ops op, const std::string& dtype, const std::string& destDtype = "");
+Kernel createKernel(PipelineRegistry& registry, Ops op, std::vector<Buffer> src, Buffer dest, const std::string& dtype = "float", const std::string& destDtype = "");
+Kernel createCpuKernel(Ops op, std::vector<Buffer> src, Buffer dest, const std::string& dtype = "float", const std::string& destDtype = "");
+void recordKernel(VkCommandBuffer commandBuffer, Kernel& kernel);
+void recordKernelBarrier(VkCommandBuffer commandBuffer);
+void recordKernels(VkCommandBuffer commandBuffer, std::vector<Kernel>& kernels);
+void destroyKernel(Kernel& kernel);
 
 #endif // KERNEL_H
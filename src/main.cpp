@@ -6,6 +6,11 @@
 #include <cstdlib>
 
 #include "./util.h"
+#include "./staging.h"
+#include "./pipeline_cache.h"
+#include "./kernel.h"
+#include "./autotune.h"
+#include "./profiler.h"
 
 
 // These are the steps we need to take in order to execute a compute shader
@@ -32,8 +37,8 @@
 //   we will need an interface that lets us define the requirements of a kernel.
 //   this program will take these requirements and create the necessary buffers for it.
 //   when running multiple kernels, we will need to create multiple pipelines - one for each kernel.
-//   buffer reuse optimization should be handled one layer of abstraction above this one -
-//   in the frontend where we have access to the entire compute graph.
+//   buffer reuse is handled one layer of abstraction above this one - compileGraph plans the
+//   intermediates of the entire compute graph by their lifetimes (memory_planner.h).
 
 
 int main() {
@@ -53,46 +58,55 @@ int main() {
     uint32_t queueIndex = 0;
     VkDevice device = createDevice(physicalDevice, queueFamilyIndex);
 
+    VkQueue queue = getQueue(device, queueFamilyIndex, queueIndex);
+
+    // Opt-in profiling: VKCOMPUTE_PROFILE=trace.json records GPU timestamps and host timings
+    // and writes them as a Chrome trace (open it in chrome://tracing or ui.perfetto.dev)
+    const char* tracePath = std::getenv("VKCOMPUTE_PROFILE");
+    Profiler profiler;
+    if (tracePath) {
+        profiler = createProfiler(physicalDevice, device, queueFamilyIndex);
+        setActiveProfiler(&profiler);
+    }
+
     // Allocate memory on the GPU
-    Buffer a = createBuffer(physicalDevice, device, bufferSize, 0);
-    Buffer b = createBuffer(physicalDevice, device, bufferSize, 1);
-    Buffer result = createBuffer(physicalDevice, device, bufferSize, 2);
+    // The buffers live in device-local memory, data only moves when we explicitly ask for it
+    Buffer a = createBuffer(physicalDevice, device, bufferSize, 0, MEMORY_DEVICE_LOCAL);
+    Buffer b = createBuffer(physicalDevice, device, bufferSize, 1, MEMORY_DEVICE_LOCAL);
+    Buffer result = createBuffer(physicalDevice, device, bufferSize, 2, MEMORY_DEVICE_LOCAL);
     
     // TODO: We could make this an array
     std::vector<Buffer> bufferList = {a, b, result};
 
-    // Transfer data from CPU to GPU
-    copyToBuffer(device, a.deviceMemory, dataA.data(), 0, bufferSize);
-    copyToBuffer(device, b.deviceMemory, dataB.data(), 0, bufferSize);
+    // Host-visible buffer used to move data in and out of device-local memory
+    StagingRing stagingRing = createStagingRing(physicalDevice, device, queueFamilyIndex, queue, 1 << 20);
 
-    // Descriptor set layout
-    VkDescriptorSetLayout descriptorSetLayout = createDescriptorSetLayout(device, bufferList);
+    // Transfer data from CPU to GPU
+    copyToBuffer(stagingRing, a, dataA.data(), 0, bufferSize);
+    copyToBuffer(stagingRing, b, dataB.data(), 0, bufferSize);
 
     // Pipeline creation (each operation will have it's own pipeline)
-    std::vector<char> shaderCode = readFile("shaders/add.spv");
-    VkPipelineLayout pipelineLayout = createPipelineLayout(device, descriptorSetLayout);
-    VkShaderModule computeShaderModule = createShaderModule(device, shaderCode);
+    // The registry builds the shader module, descriptor set layout, pipeline layout and pipeline once
+    // and keeps the driver's pipeline cache in pipeline_cache.bin, so the next run starts faster.
+    PipelineRegistry pipelineRegistry = createPipelineRegistry(physicalDevice, device);
 
-    // Compute pipeline
-    // TODO: Pipeline names should reflect the type of kernel it is running.
-    VkPipeline computePipeline = createPipeline(device, pipelineLayout, computeShaderModule, "main");
+    // Launch shapes found by bench_autotune for this device, if it has been run
+    loadKernelConfigs(pipelineRegistry);
 
-    // Descriptor pool and descriptor sets
-    VkDescriptorPool descriptorPool = createDescriptorPool(device, bufferList);
-    VkDescriptorSet descriptorSet = createDescriptorSet(device, descriptorPool, descriptorSetLayout, bufferList);
+    // The kernel picks the elementwise shader for the op and dtype and owns its descriptor set
+    Kernel addKernel = createKernel(pipelineRegistry, ADD, {a, b}, result, "float");
 
     // Command buffer
     VkCommandPool commandPool = createCommandPool(device, queueFamilyIndex);
     VkCommandBuffer commandBuffer = createCommandBuffer(device, commandPool);
 
-    VkQueue queue = getQueue(device, queueFamilyIndex, queueIndex);
-
-    recordCommandBuffer(commandBuffer, computePipeline, pipelineLayout, descriptorSet, (uint32_t)ceil(nelem / 256.0), 1, 1);
+    std::vector<Kernel> kernels = {addKernel};
+    recordKernels(commandBuffer, kernels);
     executeCommandBuffer(device, commandBuffer, queue);
 
     // Read back the result
     std::vector<float> resultData(nelem);
-    copyBufferFromDevice(device, result.deviceMemory, resultData.data(), 0, bufferSize);
+    copyBufferFromDevice(stagingRing, result, resultData.data(), 0, bufferSize);
 
     // Verify the result
     bool success = true;
@@ -109,17 +123,22 @@ int main() {
     if (success) std::cout << "Success: The computation result is correct." << std::endl;
     else std::cout << "Error: The computation result is incorrect." << std::endl;
 
+    if (tracePath) {
+        collectProfile(profiler);
+        printProfileSummary(profiler);
+        writeChromeTrace(profiler, tracePath);
+        destroyProfiler(profiler);
+    }
+
     // Buffer Cleanup
+    destroyStagingRing(stagingRing);
     destroyBuffers(bufferList);
 
     // Descriptor Cleanup
-    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-    vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    destroyKernel(addKernel);
 
     // MISC
-    vkDestroyPipeline(device, computePipeline, nullptr);
-    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-    vkDestroyShaderModule(device, computeShaderModule, nullptr);
+    destroyPipelineRegistry(pipelineRegistry);
     vkDestroyCommandPool(device, commandPool, nullptr);
     vkDestroyDevice(device, nullptr);
     vkDestroyInstance(instance, nullptr);
@@ -0,0 +1,189 @@
+#include "./matmul.h"
+#include "./profiler.h"
+
+#include <algorithm>
+
+// Tile of C per workgroup of the tiled and naive shaders, has to match src/shaders/matmul*.comp
+static const uint32_t tiledTile = 64;
+static const uint32_t naiveTile = 16;
+
+// The cooperative shader computes this many matrix unit tiles along M and along N per workgroup
+static const uint32_t cooperativeTiles = 2;
+
+static const uint32_t maxGroupCount = 65535;
+
+// Contiguous matrices, one after the other
+MatmulShape matmulShape(uint32_t M, uint32_t N, uint32_t K, uint32_t batch, bool transposeA, bool transposeB) {
+    return MatmulShape{batch, M, N, K, transposeA, transposeB, M * K, K * N, M * N};
+}
+
+const char* matmulPathName(MatmulPath path) {
+    switch (path) {
+        case MATMUL_AUTO: return "auto";
+        case MATMUL_NAIVE: return "naive";
+        case MATMUL_TILED: return "tiled";
+        case MATMUL_COOPERATIVE: return "cooperative";
+    }
+    return "unknown";
+}
+
+// Asks the device which matrix unit shapes it has. Only subgroup scoped ones with float32 results are kept,
+// float32 or float16 inputs. The query is an instance level function, which is why this is not part of
+// createPipelineRegistry. Without it (or without VK_KHR_cooperative_matrix) matmuls never use the matrix units.
+void loadCooperativeMatrixShapes(VkInstance instance, PipelineRegistry& registry) {
+    registry.cooperativeMatrixShapes.clear();
+    if (!supportsCooperativeMatrix(registry.physicalDevice)) return;
+
+    auto getProperties = reinterpret_cast<PFN_vkGetPhysicalDeviceCooperativeMatrixPropertiesKHR>(
+        vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCooperativeMatrixPropertiesKHR"));
+    if (getProperties == nullptr) return;
+
+    uint32_t count = 0;
+    getProperties(registry.physicalDevice, &count, nullptr);
+    std::vector<VkCooperativeMatrixPropertiesKHR> shapes(count);
+    for (VkCooperativeMatrixPropertiesKHR& shape : shapes) {
+        shape = VkCooperativeMatrixPropertiesKHR{};
+        shape.sType = VK_STRUCTURE_TYPE_COOPERATIVE_MATRIX_PROPERTIES_KHR;
+    }
+    getProperties(registry.physicalDevice, &count, shapes.data());
+
+    bool float16 = supportsFloat16Arithmetic(registry.physicalDevice);
+    for (const VkCooperativeMatrixPropertiesKHR& shape : shapes) {
+        bool inputs = shape.AType == shape.BType &&
+                      (shape.AType == VK_COMPONENT_TYPE_FLOAT32_KHR || (float16 && shape.AType == VK_COMPONENT_TYPE_FLOAT16_KHR));
+        bool outputs = shape.CType == VK_COMPONENT_TYPE_FLOAT32_KHR && shape.ResultType == VK_COMPONENT_TYPE_FLOAT32_KHR;
+        if (inputs && outputs && shape.scope == VK_SCOPE_SUBGROUP_KHR && !shape.saturatingAccumulation) {
+            registry.cooperativeMatrixShapes.push_back(shape);
+        }
+    }
+}
+
+static uint32_t subgroupSize(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+    subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &subgroupProperties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    return subgroupProperties.subgroupSize;
+}
+
+static bool fileExists(const std::string& path) {
+    return std::ifstream(path).good();
+}
+
+// The biggest matrix unit shape with the given input type whose tiles fit into shared memory, nullptr if there is none.
+// The SPIR-V only exists when the build's glslangValidator knows GL_KHR_cooperative_matrix.
+static const VkCooperativeMatrixPropertiesKHR* findCooperativeShape(const PipelineRegistry& registry, VkComponentTypeKHR inputType) {
+    std::string path = inputType == VK_COMPONENT_TYPE_FLOAT16_KHR ? "shaders/matmul_coopmat_f16.spv" : "shaders/matmul_coopmat.spv";
+    if (!fileExists(path)) return nullptr;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(registry.physicalDevice, &properties);
+    VkDeviceSize inputSize = inputType == VK_COMPONENT_TYPE_FLOAT16_KHR ? 2 : 4;
+
+    const VkCooperativeMatrixPropertiesKHR* best = nullptr;
+    for (const VkCooperativeMatrixPropertiesKHR& shape : registry.cooperativeMatrixShapes) {
+        if (shape.AType != inputType) continue;
+
+        VkDeviceSize tileM = VkDeviceSize(shape.MSize) * cooperativeTiles;
+        VkDeviceSize tileN = VkDeviceSize(shape.NSize) * cooperativeTiles;
+        VkDeviceSize shared = (tileM + tileN) * shape.KSize * inputSize + tileM * tileN * sizeof(float);
+        if (shared > properties.limits.maxComputeSharedMemorySize) continue;
+
+        if (best == nullptr || uint64_t(shape.MSize) * shape.NSize * shape.KSize > uint64_t(best->MSize) * best->NSize * best->KSize) {
+            best = &shape;
+        }
+    }
+
+    return best;
+}
+
+// Picks the shader for `path`. C has to hold every batch entry, A and B everything the strides reach.
+MatmulKernel createMatmulKernel(PipelineRegistry& registry, Buffer a, Buffer b, Buffer c, const MatmulShape& shape, MatmulPath path) {
+    if (shape.batch == 0 || shape.M == 0 || shape.N == 0 || shape.K == 0) throw std::runtime_error("Empty matmul.");
+
+    uint64_t lastBatch = shape.batch - 1;
+    if ((lastBatch * shape.batchStrideA + uint64_t(shape.M) * shape.K) * sizeof(float) > a.size) {
+        throw std::runtime_error("Matmul reads past the end of A.");
+    }
+    if ((lastBatch * shape.batchStrideB + uint64_t(shape.K) * shape.N) * sizeof(float) > b.size) {
+        throw std::runtime_error("Matmul reads past the end of B.");
+    }
+    if ((lastBatch * shape.batchStrideC + uint64_t(shape.M) * shape.N) * sizeof(float) > c.size) {
+        throw std::runtime_error("Destination buffer is too small for the matmul.");
+    }
+
+    const VkCooperativeMatrixPropertiesKHR* cooperative = findCooperativeShape(registry, VK_COMPONENT_TYPE_FLOAT32_KHR);
+    bool float16Inputs = false;
+    if (path == MATMUL_COOPERATIVE && cooperative == nullptr) {
+        cooperative = findCooperativeShape(registry, VK_COMPONENT_TYPE_FLOAT16_KHR);
+        float16Inputs = true;
+        if (cooperative == nullptr) throw std::runtime_error("Device has no usable cooperative matrix shape.");
+    }
+    if (path == MATMUL_AUTO) path = cooperative != nullptr ? MATMUL_COOPERATIVE : MATMUL_TILED;
+
+    MatmulKernel kernel;
+    kernel.shape = shape;
+    kernel.path = path;
+    kernel.float16Inputs = float16Inputs;
+    kernel.device = registry.device;
+    kernel.params = MatmulParams{shape.M, shape.N, shape.K, shape.batchStrideA, shape.batchStrideB, shape.batchStrideC};
+    kernel.bytes = (VkDeviceSize(shape.M) * shape.K + VkDeviceSize(shape.K) * shape.N + VkDeviceSize(shape.M) * shape.N) *
+                   shape.batch * sizeof(float);
+
+    SpecializationConstants constants;
+    constants.set(0, shape.transposeA);
+    constants.set(1, shape.transposeB);
+
+    std::string spirvPath;
+    uint32_t tileM, tileN;
+    if (path == MATMUL_COOPERATIVE) {
+        spirvPath = float16Inputs ? "shaders/matmul_coopmat_f16.spv" : "shaders/matmul_coopmat.spv";
+        constants.set(2, subgroupSize(registry.physicalDevice));
+        constants.set(3, cooperative->MSize);
+        constants.set(4, cooperative->NSize);
+        constants.set(5, cooperative->KSize);
+        tileM = cooperative->MSize * cooperativeTiles;
+        tileN = cooperative->NSize * cooperativeTiles;
+    } else {
+        spirvPath = path == MATMUL_NAIVE ? "shaders/matmul_naive.spv" : "shaders/matmul.spv";
+        tileM = tileN = path == MATMUL_NAIVE ? naiveTile : tiledTile;
+    }
+
+    kernel.groupCountX = (shape.N + tileN - 1) / tileN;
+    kernel.groupCountY = (shape.M + tileM - 1) / tileM;
+    kernel.groupCountZ = shape.batch;
+    if (kernel.groupCountX > maxGroupCount || kernel.groupCountY > maxGroupCount || kernel.groupCountZ > maxGroupCount) {
+        throw std::runtime_error("Matmul is too large for a single dispatch.");
+    }
+
+    kernel.pipeline = &getPipeline(registry, spirvPath, "main", 3, &constants, sizeof(MatmulParams));
+
+    std::vector<Buffer> bindings = {a, b, c};
+    for (uint32_t i = 0; i < bindings.size(); i++) bindings[i].binding = i;
+    kernel.descriptors = createDescriptorBinding(registry, *kernel.pipeline, bindings);
+
+    return kernel;
+}
+
+void recordMatmulKernel(VkCommandBuffer commandBuffer, MatmulKernel& kernel) {
+    uint32_t scope = NO_SCOPE;
+    if (activeProfiler()) {
+        std::string name = std::string("MATMUL ") + matmulPathName(kernel.path) + " " + std::to_string(kernel.shape.M) + "x" +
+                           std::to_string(kernel.shape.N) + "x" + std::to_string(kernel.shape.K);
+        scope = beginGpuScope(commandBuffer, name, "matmul", kernel.bytes);
+    }
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline->pipeline);
+    bindDescriptors(commandBuffer, *kernel.pipeline, kernel.descriptors);
+    vkCmdPushConstants(commandBuffer, kernel.pipeline->layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MatmulParams), &kernel.params);
+    vkCmdDispatch(commandBuffer, kernel.groupCountX, kernel.groupCountY, kernel.groupCountZ);
+    endGpuScope(commandBuffer, scope);
+}
+
+void destroyMatmulKernel(MatmulKernel& kernel) {
+    destroyDescriptorBinding(kernel.device, kernel.descriptors);
+}
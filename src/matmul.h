@@ -0,0 +1,65 @@
+#ifndef MATMUL_H
+#define MATMUL_H
+
+#include "./util.h"
+#include "./kernel.h"
+#include "./pipeline_cache.h"
+
+// C = op(A) * op(B) for `batch` row-major float matrices: op(A) is M x K, op(B) is K x N, C is M x N.
+// A transposed operand is stored the other way round (K x M or N x K). Batch strides are in elements,
+// a stride of 0 uses the same matrix for the whole batch.
+struct MatmulShape {
+    uint32_t batch;
+    uint32_t M;
+    uint32_t N;
+    uint32_t K;
+    bool transposeA;
+    bool transposeB;
+    uint32_t batchStrideA;
+    uint32_t batchStrideB;
+    uint32_t batchStrideC;
+};
+
+// Push constants of the matmul shaders, in declaration order
+struct MatmulParams {
+    uint32_t M;
+    uint32_t N;
+    uint32_t K;
+    uint32_t batchStrideA;
+    uint32_t batchStrideB;
+    uint32_t batchStrideC;
+};
+
+// Which shader computes the product. MATMUL_AUTO takes the matrix units when they can do float32
+// (the result is then as exact as the tiled kernel's) and the tiled kernel otherwise.
+// MATMUL_COOPERATIVE falls back to float16 inputs with float32 accumulation when that is all the device has.
+enum MatmulPath {
+    MATMUL_AUTO,
+    MATMUL_NAIVE,
+    MATMUL_TILED,
+    MATMUL_COOPERATIVE,
+};
+
+struct MatmulKernel {
+    MatmulShape shape;
+    MatmulPath path;
+    bool float16Inputs;
+
+    VkDevice device;
+    Pipeline* pipeline;
+    DescriptorBinding descriptors;
+    MatmulParams params;
+    uint32_t groupCountX;
+    uint32_t groupCountY;
+    uint32_t groupCountZ;
+    VkDeviceSize bytes;
+};
+
+MatmulShape matmulShape(uint32_t M, uint32_t N, uint32_t K, uint32_t batch = 1, bool transposeA = false, bool transposeB = false);
+const char* matmulPathName(MatmulPath path);
+void loadCooperativeMatrixShapes(VkInstance instance, PipelineRegistry& registry);
+MatmulKernel createMatmulKernel(PipelineRegistry& registry, Buffer a, Buffer b, Buffer c, const MatmulShape& shape, MatmulPath path = MATMUL_AUTO);
+void recordMatmulKernel(VkCommandBuffer commandBuffer, MatmulKernel& kernel);
+void destroyMatmulKernel(MatmulKernel& kernel);
+
+#endif // MATMUL_H
@@ -0,0 +1,73 @@
+#include "./memory_planner.h"
+
+#include <algorithm>
+
+static bool overlaps(const TensorLifetime& a, const TensorLifetime& b) {
+    return a.first <= b.last && b.first <= a.last;
+}
+
+// Greedy by size: the largest tensors are placed first, each one into the smallest gap between the tensors
+// already placed that live at the same time, or after the last of them if no gap is big enough.
+// Same idea as interval colouring, with colours that are byte ranges of different widths.
+MemoryPlan planMemory(const std::vector<TensorLifetime>& tensors, VkDeviceSize alignment) {
+    MemoryPlan plan;
+    plan.offsets.assign(tensors.size(), 0);
+    plan.peak = 0;
+    plan.naive = 0;
+
+    for (const TensorLifetime& tensor : tensors) {
+        if (tensor.first > tensor.last) throw std::runtime_error("Tensor is read before it is written!");
+        plan.sizes.push_back(alignUp(tensor.size, alignment));
+        plan.naive += plan.sizes.back();
+    }
+
+    std::vector<size_t> order(tensors.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return plan.sizes[a] > plan.sizes[b]; });
+
+    std::vector<size_t> placed;
+    for (size_t t : order) {
+        // Byte ranges that are taken while this tensor is alive
+        std::vector<std::pair<VkDeviceSize, VkDeviceSize>> taken;
+        for (size_t other : placed) {
+            if (overlaps(tensors[t], tensors[other])) taken.push_back({plan.offsets[other], plan.offsets[other] + plan.sizes[other]});
+        }
+        std::sort(taken.begin(), taken.end());
+
+        VkDeviceSize end = 0;
+        VkDeviceSize best = 0;
+        VkDeviceSize bestGap = UINT64_MAX;
+        for (const auto& range : taken) {
+            if (range.first >= end + plan.sizes[t] && range.first - end < bestGap) {
+                best = end;
+                bestGap = range.first - end;
+            }
+            end = std::max(end, range.second);
+        }
+        if (bestGap == UINT64_MAX) best = end;
+
+        plan.offsets[t] = best;
+        plan.peak = std::max(plan.peak, best + plan.sizes[t]);
+        placed.push_back(t);
+    }
+
+    return plan;
+}
+
+// Range of the arena that belongs to `tensor`. The arena owns the memory, only it gets destroyed.
+Buffer plannedBuffer(const Buffer& arena, const MemoryPlan& plan, size_t tensor) {
+    Buffer buffer = arena;
+    buffer.descriptorInfo.offset = arena.descriptorInfo.offset + plan.offsets[tensor];
+    buffer.descriptorInfo.range = plan.sizes[tensor];
+    buffer.size = plan.sizes[tensor];
+    if (arena.mapped != nullptr) buffer.mapped = static_cast<char*>(arena.mapped) + plan.offsets[tensor];
+    return buffer;
+}
+
+void printMemoryPlan(const MemoryPlan& plan) {
+    double saved = plan.naive > 0 ? 100.0 * (1.0 - double(plan.peak) / plan.naive) : 0.0;
+    std::cout << "Memory plan: " << plan.offsets.size() << " intermediates, "
+              << plan.peak / (1024.0 * 1024.0) << " MiB planned vs. "
+              << plan.naive / (1024.0 * 1024.0) << " MiB with a buffer each ("
+              << saved << "% saved)" << std::endl;
+}
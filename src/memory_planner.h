@@ -0,0 +1,26 @@
+#ifndef MEMORY_PLANNER_H
+#define MEMORY_PLANNER_H
+
+#include "./util.h"
+
+// A tensor that only lives for part of a list of kernels: written by kernel `first`, last read by kernel `last`
+struct TensorLifetime {
+    VkDeviceSize size;
+    uint32_t first;
+    uint32_t last;
+};
+
+// Where every tensor lives within one arena buffer. Tensors whose lifetimes overlap never share bytes,
+// all others may.
+struct MemoryPlan {
+    std::vector<VkDeviceSize> offsets; // one per tensor, in the order they were planned
+    std::vector<VkDeviceSize> sizes;   // padded to the alignment
+    VkDeviceSize peak;  // size of the arena, i.e. what the plan needs
+    VkDeviceSize naive; // what one buffer per tensor would take
+};
+
+MemoryPlan planMemory(const std::vector<TensorLifetime>& tensors, VkDeviceSize alignment);
+Buffer plannedBuffer(const Buffer& arena, const MemoryPlan& plan, size_t tensor);
+void printMemoryPlan(const MemoryPlan& plan);
+
+#endif // MEMORY_PLANNER_H
@@ -0,0 +1,295 @@
+#include "./multi_device.h"
+#include "./reduce.h"
+#include "./profiler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <exception>
+#include <functional>
+#include <thread>
+
+// Largest scratch buffer per device, shards beyond this are run in pieces
+static const VkDeviceSize maxScratchBytes = VkDeviceSize(64) << 20;
+
+static bool isCpuDevice(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    return properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
+}
+
+// The devices a multi-device run uses, best first. CPU drivers are left out when there is a GPU,
+// an even share of the work would make them the slowest shard by far.
+// VKCOMPUTE_DEVICES=<i>,<j>,... picks devices by their rank instead. An index can appear more than once,
+// each time the device is opened as another logical device, e.g. "0,0" runs two shards on a single lavapipe.
+std::vector<VkPhysicalDevice> selectPhysicalDevices(VkInstance& instance, uint32_t maxDevices) {
+    std::vector<VkPhysicalDevice> ranked = rankPhysicalDevices(instance);
+    std::vector<VkPhysicalDevice> selected;
+
+    const char* wanted = std::getenv("VKCOMPUTE_DEVICES");
+    if (wanted) {
+        std::stringstream list(wanted);
+        std::string index;
+        while (std::getline(list, index, ',')) {
+            // strtoul alone would read "" or "1x" as a device and wrap "-1" around to a huge index
+            char* end = nullptr;
+            unsigned long i = std::strtoul(index.c_str(), &end, 10);
+            if (index.empty() || !isdigit(static_cast<unsigned char>(index[0])) || *end != '\0') {
+                throw std::runtime_error("VKCOMPUTE_DEVICES entry \"" + index + "\" is not a device index!");
+            }
+            if (i >= ranked.size()) throw std::runtime_error("VKCOMPUTE_DEVICES names device " + index + ", there are only " + std::to_string(ranked.size()) + "!");
+            selected.push_back(ranked[i]);
+        }
+    } else {
+        bool hasGpu = false;
+        for (VkPhysicalDevice physicalDevice : ranked) hasGpu = hasGpu || !isCpuDevice(physicalDevice);
+
+        for (VkPhysicalDevice physicalDevice : ranked) {
+            if (!hasGpu || !isCpuDevice(physicalDevice)) selected.push_back(physicalDevice);
+        }
+    }
+
+    if (selected.size() > maxDevices) selected.resize(maxDevices);
+    if (selected.empty()) throw std::runtime_error("No devices selected for the multi-device run!");
+    return selected;
+}
+
+// Opens device `index` of a multi-device run. If anything fails, whatever was created for it is destroyed again.
+static DeviceContext createDeviceContext(VkPhysicalDevice physicalDevice, size_t index) {
+    DeviceContext context{};
+    context.physicalDevice = physicalDevice;
+    context.score = scorePhysicalDevice(context.physicalDevice);
+    context.weight = 1.0;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(context.physicalDevice, &properties);
+    context.name = properties.deviceName;
+    context.maxBufferBytes = std::min<VkDeviceSize>(properties.limits.maxStorageBufferRange, maxScratchBytes);
+
+    context.queueFamilyIndex = findComputeQueueFamily(context.physicalDevice);
+    context.device = createDevice(context.physicalDevice, context.queueFamilyIndex);
+    context.queue = getQueue(context.device, context.queueFamilyIndex, 0);
+
+    bool hasRegistry = false;
+    try {
+        // The command buffer is re-recorded for every piece of a shard
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = context.queueFamilyIndex;
+        if (vkCreateCommandPool(context.device, &poolInfo, nullptr, &context.commandPool) != VK_SUCCESS) {
+            context.commandPool = VK_NULL_HANDLE;
+            throw std::runtime_error("Failed to create command pool!");
+        }
+        context.commandBuffer = createCommandBuffer(context.device, context.commandPool);
+
+        // One pipeline cache file per device, they would overwrite each other's otherwise
+        context.registry = createPipelineRegistry(context.physicalDevice, context.device, "pipeline_cache_" + std::to_string(index) + ".bin");
+        hasRegistry = true;
+        context.stagingRing = createStagingRing(context.physicalDevice, context.device, context.queueFamilyIndex, context.queue, 16 << 20, 4);
+    } catch (...) {
+        if (hasRegistry) destroyPipelineRegistry(context.registry);
+        if (context.commandPool != VK_NULL_HANDLE) vkDestroyCommandPool(context.device, context.commandPool, nullptr);
+        vkDestroyDevice(context.device, nullptr);
+        throw;
+    }
+
+    return context;
+}
+
+// Devices opened before one that fails are closed again before the error is passed on
+MultiDevice createMultiDevice(const std::vector<VkPhysicalDevice>& physicalDevices) {
+    MultiDevice multi;
+
+    try {
+        for (size_t i = 0; i < physicalDevices.size(); i++) {
+            multi.devices.push_back(createDeviceContext(physicalDevices[i], i));
+        }
+    } catch (...) {
+        destroyMultiDevice(multi);
+        throw;
+    }
+
+    return multi;
+}
+
+// Elements per device, proportional to the device weights. Shards start on multiples of 4 elements,
+// so every device gets whole vec4s except the last one, which takes the rest.
+std::vector<uint64_t> shardCounts(const MultiDevice& multi, uint64_t nelem) {
+    double totalWeight = 0;
+    for (const DeviceContext& context : multi.devices) totalWeight += context.weight;
+
+    std::vector<uint64_t> counts;
+    double cumulativeWeight = 0;
+    uint64_t begin = 0;
+
+    for (size_t i = 0; i < multi.devices.size(); i++) {
+        cumulativeWeight += multi.devices[i].weight;
+        uint64_t end = nelem;
+        if (i + 1 < multi.devices.size()) end = std::min(nelem, uint64_t(nelem * (cumulativeWeight / totalWeight)) & ~uint64_t(3));
+        end = std::max(end, begin);
+
+        counts.push_back(end - begin);
+        begin = end;
+    }
+
+    return counts;
+}
+
+// Makes sure the device has `count` scratch buffers of at least `bytes` each
+static void ensureScratch(DeviceContext& context, uint32_t count, VkDeviceSize bytes) {
+    bool fits = context.scratch.size() >= count;
+    for (const Buffer& buffer : context.scratch) fits = fits && buffer.size >= bytes;
+    if (fits) return;
+
+    destroyBuffers(context.scratch);
+    context.scratch.clear();
+    for (uint32_t i = 0; i < count; i++) {
+        context.scratch.push_back(createBuffer(context.physicalDevice, context.device, bytes, i, MEMORY_DEVICE_LOCAL));
+    }
+}
+
+static void runOnDevice(DeviceContext& context, const std::function<void(VkCommandBuffer)>& record) {
+    vkResetCommandBuffer(context.commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(context.commandBuffer, &beginInfo);
+
+    record(context.commandBuffer);
+
+    vkEndCommandBuffer(context.commandBuffer);
+    executeCommandBuffer(context.device, context.commandBuffer, context.queue);
+}
+
+// Calls `shard(device index, first element, element count)` for every device with a non-empty shard,
+// each on a thread of its own. The first exception thrown on any of them is rethrown once all are done.
+static void forEachShard(MultiDevice& multi, uint64_t nelem, const std::function<void(uint32_t, uint64_t, uint64_t)>& shard) {
+    // The profiler records into the query pool of a single device
+    if (activeProfiler()) throw std::runtime_error("Multi-device runs can not be profiled!");
+
+    std::vector<uint64_t> counts = shardCounts(multi, nelem);
+    std::vector<std::exception_ptr> errors(counts.size());
+    std::vector<std::thread> threads;
+
+    uint64_t begin = 0;
+    for (uint32_t i = 0; i < counts.size(); i++) {
+        if (counts[i] > 0) {
+            threads.emplace_back([&, i, begin]() {
+                try {
+                    shard(i, begin, counts[i]);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            });
+        }
+        begin += counts[i];
+    }
+
+    for (std::thread& thread : threads) thread.join();
+    for (std::exception_ptr& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+// Splits an elementwise op over host arrays across the devices. `src` and `dest` hold `nelem` elements each.
+void runElementwiseMulti(MultiDevice& multi, Ops op, const std::vector<const void*>& src, void* dest, uint64_t nelem, const std::string& dtype, const std::string& destDtype) {
+    const std::string& outType = destDtype.empty() ? dtype : destDtype;
+    size_t srcSize = getTypeSize(dtype);
+    size_t destSize = getTypeSize(outType);
+    uint32_t arity = opArity(op);
+
+    if (src.size() != arity) throw std::runtime_error(std::string("Wrong number of sources for ") + opName(op) + "!");
+
+    forEachShard(multi, nelem, [&](uint32_t index, uint64_t begin, uint64_t count) {
+        DeviceContext& context = multi.devices[index];
+
+        // Pieces start on multiples of 4 elements, like the shards
+        uint64_t pieceElements = (context.maxBufferBytes / std::max(srcSize, destSize)) & ~uint64_t(3);
+        ensureScratch(context, arity + 1, std::min(count, pieceElements) * std::max(srcSize, destSize));
+
+        for (uint64_t done = 0; done < count; done += pieceElements) {
+            uint64_t elements = std::min(pieceElements, count - done);
+            uint64_t first = begin + done;
+
+            for (uint32_t i = 0; i < arity; i++) {
+                copyToBuffer(context.stagingRing, context.scratch[i], static_cast<const char*>(src[i]) + first * srcSize, 0, elements * srcSize);
+            }
+
+            // The kernel takes its element count from the size of the destination
+            std::vector<Buffer> sources(context.scratch.begin(), context.scratch.begin() + arity);
+            Buffer output = context.scratch[arity];
+            output.size = elements * destSize;
+
+            Kernel kernel = createKernel(context.registry, op, sources, output, dtype, destDtype);
+            runOnDevice(context, [&](VkCommandBuffer commandBuffer) { recordKernel(commandBuffer, kernel); });
+            destroyKernel(kernel);
+
+            copyBufferFromDevice(context.stagingRing, context.scratch[arity], static_cast<char*>(dest) + first * destSize, 0, elements * destSize);
+        }
+    });
+}
+
+template <typename T>
+static T combinePartials(Ops op, const std::vector<char>& bytes) {
+    const T* partials = reinterpret_cast<const T*>(bytes.data());
+    size_t count = bytes.size() / sizeof(T);
+
+    T result = partials[0];
+    for (size_t i = 1; i < count; i++) {
+        if (op == SUM) result += partials[i];
+        else if (op == PROD) result *= partials[i];
+        else result = std::max(result, partials[i]);
+    }
+    return result;
+}
+
+// Full reduction (SUM, PROD or REDUCE_MAX) of a host array across the devices. Every device reduces its shard
+// to one partial per piece, the partials are combined on the host and the single result is written to `result`.
+void runReduceMulti(MultiDevice& multi, Ops op, const void* src, void* result, uint64_t nelem, const std::string& dtype) {
+    if (op != SUM && op != PROD && op != REDUCE_MAX) throw std::runtime_error(std::string(opName(op)) + " is not a reduction!");
+    if (nelem == 0) throw std::runtime_error("Can not reduce an empty array!");
+
+    size_t typeSize = getTypeSize(dtype);
+    std::vector<std::vector<char>> partials(multi.devices.size());
+
+    forEachShard(multi, nelem, [&](uint32_t index, uint64_t begin, uint64_t count) {
+        DeviceContext& context = multi.devices[index];
+
+        uint64_t pieceElements = context.maxBufferBytes / typeSize;
+        ensureScratch(context, 2, std::min(count, pieceElements) * typeSize);
+
+        for (uint64_t done = 0; done < count; done += pieceElements) {
+            uint32_t elements = static_cast<uint32_t>(std::min(pieceElements, count - done));
+            copyToBuffer(context.stagingRing, context.scratch[0], static_cast<const char*>(src) + (begin + done) * typeSize, 0, elements * typeSize);
+
+            ReduceKernel kernel = createReduceKernel(context.registry, op, context.scratch[0], context.scratch[1], fullReduceShape(elements), dtype);
+            runOnDevice(context, [&](VkCommandBuffer commandBuffer) { recordReduceKernel(commandBuffer, kernel); });
+            destroyReduceKernel(kernel);
+
+            partials[index].resize(partials[index].size() + typeSize);
+            copyBufferFromDevice(context.stagingRing, context.scratch[1], partials[index].data() + partials[index].size() - typeSize, 0, typeSize);
+        }
+    });
+
+    std::vector<char> all;
+    for (const std::vector<char>& devicePartials : partials) all.insert(all.end(), devicePartials.begin(), devicePartials.end());
+
+    if (dtype == "float") *static_cast<float*>(result) = combinePartials<float>(op, all);
+    // int SUM and PROD wrap around like the kernels do, in uint32_t, where overflow is defined
+    else if (dtype == "int" && op == REDUCE_MAX) *static_cast<int32_t*>(result) = combinePartials<int32_t>(op, all);
+    else if (dtype == "int") *static_cast<int32_t*>(result) = static_cast<int32_t>(combinePartials<uint32_t>(op, all));
+    else if (dtype == "uint") *static_cast<uint32_t*>(result) = combinePartials<uint32_t>(op, all);
+    else throw std::runtime_error("Unsupported dtype for a multi-device reduction: " + dtype + "!");
+}
+
+void destroyMultiDevice(MultiDevice& multi) {
+    for (DeviceContext& context : multi.devices) {
+        destroyBuffers(context.scratch);
+        destroyStagingRing(context.stagingRing);
+        destroyPipelineRegistry(context.registry);
+        vkDestroyCommandPool(context.device, context.commandPool, nullptr);
+        vkDestroyDevice(context.device, nullptr);
+    }
+    multi.devices.clear();
+}
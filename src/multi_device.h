@@ -0,0 +1,47 @@
+#ifndef MULTI_DEVICE_H
+#define MULTI_DEVICE_H
+
+#include <string>
+
+#include "./util.h"
+#include "./staging.h"
+#include "./pipeline_cache.h"
+#include "./kernel.h"
+
+// One logical device taking part in a multi-device run, with its own queue, command buffer, pipelines and staging ring.
+// Shards go through device-local scratch buffers that are kept around and grown when a bigger shard comes along.
+struct DeviceContext {
+    VkPhysicalDevice physicalDevice;
+    std::string name;
+    uint64_t score;
+
+    VkDevice device;
+    uint32_t queueFamilyIndex;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    PipelineRegistry registry;
+    StagingRing stagingRing;
+    std::vector<Buffer> scratch;
+
+    // Shards larger than this are run in several pieces
+    VkDeviceSize maxBufferBytes;
+
+    // Share of the elements this device gets, relative to the other devices. 1 for all of them by default.
+    double weight;
+};
+
+// Data-parallel execution across several logical devices. Kernels are split into contiguous shards, one per device,
+// every device uploads, runs and downloads its shard on a thread of its own, and the host puts the results together.
+struct MultiDevice {
+    std::vector<DeviceContext> devices;
+};
+
+std::vector<VkPhysicalDevice> selectPhysicalDevices(VkInstance& instance, uint32_t maxDevices = UINT32_MAX);
+MultiDevice createMultiDevice(const std::vector<VkPhysicalDevice>& physicalDevices);
+std::vector<uint64_t> shardCounts(const MultiDevice& multi, uint64_t nelem);
+void runElementwiseMulti(MultiDevice& multi, Ops op, const std::vector<const void*>& src, void* dest, uint64_t nelem, const std::string& dtype = "float", const std::string& destDtype = "");
+void runReduceMulti(MultiDevice& multi, Ops op, const void* src, void* result, uint64_t nelem, const std::string& dtype = "float");
+void destroyMultiDevice(MultiDevice& multi);
+
+#endif // MULTI_DEVICE_H
@@ -0,0 +1,242 @@
+#include "./pipeline_cache.h"
+
+#include <cstdio>
+
+void SpecializationConstants::set(uint32_t constantId, uint32_t value) {
+    for (const VkSpecializationMapEntry& entry : entries) {
+        if (entry.constantID == constantId) {
+            memcpy(data.data() + entry.offset, &value, sizeof(value));
+            return;
+        }
+    }
+
+    VkSpecializationMapEntry entry{};
+    entry.constantID = constantId;
+    entry.offset = static_cast<uint32_t>(data.size());
+    entry.size = sizeof(value);
+    entries.push_back(entry);
+
+    data.resize(data.size() + sizeof(value));
+    memcpy(data.data() + entry.offset, &value, sizeof(value));
+}
+
+// The returned struct points into this object, so it must not outlive it
+VkSpecializationInfo SpecializationConstants::info() const {
+    VkSpecializationInfo specializationInfo{};
+    specializationInfo.mapEntryCount = static_cast<uint32_t>(entries.size());
+    specializationInfo.pMapEntries = entries.data();
+    specializationInfo.dataSize = data.size();
+    specializationInfo.pData = data.data();
+    return specializationInfo;
+}
+
+bool PipelineKey::operator<(const PipelineKey& other) const {
+    if (spirvHash != other.spirvHash) return spirvHash < other.spirvHash;
+    if (entryPoint != other.entryPoint) return entryPoint < other.entryPoint;
+    if (bindingCount != other.bindingCount) return bindingCount < other.bindingCount;
+    if (pushConstantSize != other.pushConstantSize) return pushConstantSize < other.pushConstantSize;
+    return specializationData < other.specializationData;
+}
+
+// 64 bit FNV-1a, good enough to tell shaders apart and cheap to compute
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+// Reads a previously saved pipeline cache. Caches written by a different GPU or driver
+// are dropped here rather than handed to the driver.
+static std::vector<char> loadPipelineCacheData(VkPhysicalDevice physicalDevice, const std::string& path) {
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) return {};
+
+    size_t fileSize = (size_t) file.tellg();
+    std::vector<char> data(fileSize);
+
+    file.seekg(0);
+    file.read(data.data(), fileSize);
+
+    if (fileSize < sizeof(VkPipelineCacheHeaderVersionOne)) return {};
+
+    VkPipelineCacheHeaderVersionOne header;
+    memcpy(&header, data.data(), sizeof(header));
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        header.vendorID != properties.vendorID ||
+        header.deviceID != properties.deviceID ||
+        memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        std::cout << "Ignoring pipeline cache " << path << ", it was created for a different device or driver." << std::endl;
+        return {};
+    }
+
+    return data;
+}
+
+// With `pushDescriptors` kernels bind their buffers with VK_KHR_push_descriptor when the device has it
+// (createDevice enables it), which takes descriptor sets out of kernel creation altogether.
+PipelineRegistry createPipelineRegistry(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& cachePath, bool pushDescriptors) {
+    PipelineRegistry registry;
+    registry.physicalDevice = physicalDevice;
+    registry.device = device;
+    registry.cachePath = cachePath;
+    registry.descriptorLayouts = createDescriptorLayoutCache(device);
+    registry.descriptorAllocator = createDescriptorAllocator(device);
+    registry.pushDescriptorSet = nullptr;
+    registry.storage16Bit = supportsDtype(physicalDevice, "float16");
+    registry.storage8Bit = supportsDtype(physicalDevice, "int8");
+    registry.hits = 0;
+    registry.misses = 0;
+    registry.mutex = std::make_shared<std::mutex>();
+
+    if (pushDescriptors && hasDeviceExtension(physicalDevice, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME)) {
+        registry.pushDescriptorSet = reinterpret_cast<PFN_vkCmdPushDescriptorSetKHR>(vkGetDeviceProcAddr(device, "vkCmdPushDescriptorSetKHR"));
+    }
+
+    std::vector<char> initialData = cachePath.empty() ? std::vector<char>() : loadPipelineCacheData(physicalDevice, cachePath);
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = initialData.size();
+    cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+    if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &registry.pipelineCache) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline cache!");
+    }
+
+    return registry;
+}
+
+// Returns the pipeline for a shader/entry point/specialization, building it on first use.
+// Shader modules are shared between all pipelines created from the same SPIR-V.
+Pipeline& getPipeline(PipelineRegistry& registry, const std::vector<char>& spirv, const std::string& entryPoint, uint32_t bindingCount, const SpecializationConstants* specialization, uint32_t pushConstantSize) {
+    PipelineKey key;
+    key.spirvHash = hashBytes(spirv.data(), spirv.size());
+    key.entryPoint = entryPoint;
+    key.bindingCount = bindingCount;
+    key.pushConstantSize = pushConstantSize;
+
+    if (specialization != nullptr) {
+        // The key holds the map entries as well as the values, the same bytes can mean different constants
+        const char* entries = reinterpret_cast<const char*>(specialization->entries.data());
+        key.specializationData.assign(entries, entries + specialization->entries.size() * sizeof(VkSpecializationMapEntry));
+        key.specializationData.insert(key.specializationData.end(), specialization->data.begin(), specialization->data.end());
+    }
+
+    std::lock_guard<std::mutex> lock(*registry.mutex);
+    auto it = registry.pipelines.find(key);
+    if (it != registry.pipelines.end()) {
+        registry.hits++;
+        return it->second;
+    }
+    registry.misses++;
+
+    VkShaderModule& shaderModule = registry.shaderModules[key.spirvHash];
+    if (shaderModule == VK_NULL_HANDLE) shaderModule = createShaderModule(registry.device, spirv);
+
+    Pipeline pipeline;
+    pipeline.shaderModule = shaderModule;
+    pipeline.bindingCount = bindingCount;
+    pipeline.pushConstantSize = pushConstantSize;
+
+    // Layouts with more bindings than a push descriptor layout can have fall back to descriptor sets
+    bool push = registry.pushDescriptorSet != nullptr && bindingCount <= maxPushBindings;
+    pipeline.pushDescriptorSet = push ? registry.pushDescriptorSet : nullptr;
+    pipeline.descriptorSetLayout = getDescriptorSetLayout(registry.descriptorLayouts, bindingCount, push);
+    pipeline.layout = createPipelineLayout(registry.device, pipeline.descriptorSetLayout, pushConstantSize);
+
+    if (specialization != nullptr) {
+        VkSpecializationInfo specializationInfo = specialization->info();
+        pipeline.pipeline = createPipeline(registry.device, pipeline.layout, shaderModule, entryPoint, registry.pipelineCache, &specializationInfo);
+    } else {
+        pipeline.pipeline = createPipeline(registry.device, pipeline.layout, shaderModule, entryPoint, registry.pipelineCache);
+    }
+
+    return registry.pipelines[key] = pipeline;
+}
+
+// Same as above, but loads the SPIR-V from disk (once per path)
+Pipeline& getPipeline(PipelineRegistry& registry, const std::string& spirvPath, const std::string& entryPoint, uint32_t bindingCount, const SpecializationConstants* specialization, uint32_t pushConstantSize) {
+    const std::vector<char>* spirv;
+    {
+        std::lock_guard<std::mutex> lock(*registry.mutex);
+        auto it = registry.spirvFiles.find(spirvPath);
+        if (it == registry.spirvFiles.end()) {
+            it = registry.spirvFiles.insert(std::make_pair(spirvPath, readFile(spirvPath))).first;
+        }
+        spirv = &it->second;
+    }
+
+    return getPipeline(registry, *spirv, entryPoint, bindingCount, specialization, pushConstantSize);
+}
+
+// 256 threads with one vec4 each, which is what the kernels were written for
+KernelConfig defaultKernelConfig() {
+    return KernelConfig{256, 1, 4};
+}
+
+KernelConfig getKernelConfig(const PipelineRegistry& registry, const std::string& kernelName) {
+    auto it = registry.kernelConfigs.find(kernelName);
+    return it == registry.kernelConfigs.end() ? defaultKernelConfig() : it->second;
+}
+
+// supportsDtype of the registry's device, from what createPipelineRegistry found
+bool supportsDtype(const PipelineRegistry& registry, const std::string& dtype) {
+    size_t size = getTypeSize(dtype);
+    if (size == 4) return true;
+    return size == 2 ? registry.storage16Bit : registry.storage8Bit;
+}
+
+// Writes the driver's pipeline cache to disk. The file is written next to the old one and then
+// renamed over it, so a crash half way through never leaves a truncated cache behind.
+void savePipelineCache(PipelineRegistry& registry) {
+    if (registry.cachePath.empty()) return;
+
+    size_t dataSize = 0;
+    vkGetPipelineCacheData(registry.device, registry.pipelineCache, &dataSize, nullptr);
+
+    std::vector<char> data(dataSize);
+    if (vkGetPipelineCacheData(registry.device, registry.pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to read pipeline cache data!");
+    }
+
+    std::string tmpPath = registry.cachePath + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) throw std::runtime_error("Failed to write pipeline cache!");
+        file.write(data.data(), dataSize);
+    }
+
+    std::rename(tmpPath.c_str(), registry.cachePath.c_str());
+}
+
+void destroyPipelineRegistry(PipelineRegistry& registry) {
+    savePipelineCache(registry);
+
+    for (auto& entry : registry.pipelines) {
+        vkDestroyPipeline(registry.device, entry.second.pipeline, nullptr);
+        vkDestroyPipelineLayout(registry.device, entry.second.layout, nullptr);
+    }
+
+    destroyDescriptorAllocator(registry.descriptorAllocator);
+    destroyDescriptorLayoutCache(registry.descriptorLayouts);
+
+    for (auto& entry : registry.shaderModules) {
+        vkDestroyShaderModule(registry.device, entry.second, nullptr);
+    }
+
+    vkDestroyPipelineCache(registry.device, registry.pipelineCache, nullptr);
+
+    registry.pipelines.clear();
+    registry.shaderModules.clear();
+    registry.spirvFiles.clear();
+}
@@ -0,0 +1,99 @@
+#ifndef PIPELINE_CACHE_H
+#define PIPELINE_CACHE_H
+
+#include <memory>
+#include <mutex>
+
+#include "./util.h"
+#include "./descriptors.h"
+
+// Specialization constant values for a pipeline, packed the way VkSpecializationInfo expects them
+struct SpecializationConstants {
+    std::vector<VkSpecializationMapEntry> entries;
+    std::vector<char> data;
+
+    void set(uint32_t constantId, uint32_t value);
+    VkSpecializationInfo info() const;
+};
+
+// Launch shape of an elementwise kernel, passed to the shader as specialization constants 1-3.
+// The best one depends on the device and the kernel, see autotune.h.
+struct KernelConfig {
+    uint32_t workgroupSize;
+    uint32_t itemsPerThread; // vec4s (or elements) per thread and grid-stride iteration
+    uint32_t vectorWidth; // 4 for vec4 loads and stores, 1 for scalar ones
+};
+
+// Everything that makes two pipelines different. Shaders are identified by the hash of their SPIR-V,
+// so the same code loaded from two places still maps to one pipeline.
+struct PipelineKey {
+    uint64_t spirvHash;
+    std::string entryPoint;
+    std::vector<char> specializationData;
+    uint32_t bindingCount;
+    uint32_t pushConstantSize;
+
+    bool operator<(const PipelineKey& other) const;
+};
+
+// A ready to dispatch compute pipeline, along with the layouts that go with it.
+// The descriptor set layout belongs to the registry's layout cache and may be shared with other pipelines.
+struct Pipeline {
+    VkPipeline pipeline;
+    VkPipelineLayout layout;
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkShaderModule shaderModule;
+    uint32_t bindingCount;
+    uint32_t pushConstantSize;
+
+    // Set when the layout is a push descriptor layout, buffers are then bound with this instead of a set (see descriptors.h)
+    PFN_vkCmdPushDescriptorSetKHR pushDescriptorSet;
+};
+
+// Builds every pipeline once per process and keeps the driver's VkPipelineCache on disk,
+// so that kernels compiled in a previous run are cheap to create again.
+struct PipelineRegistry {
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    VkPipelineCache pipelineCache;
+    std::string cachePath;
+
+    std::map<PipelineKey, Pipeline> pipelines;
+    std::map<uint64_t, VkShaderModule> shaderModules;
+    std::map<std::string, std::vector<char>> spirvFiles;
+
+    DescriptorLayoutCache descriptorLayouts;
+    DescriptorAllocator descriptorAllocator;
+
+    // nullptr when the device has no VK_KHR_push_descriptor or it was turned off
+    PFN_vkCmdPushDescriptorSetKHR pushDescriptorSet;
+
+    // 16 and 8 bit storage buffer access, queried once so supportsDtype on the registry costs no driver calls
+    bool storage16Bit;
+    bool storage8Bit;
+
+    // Tuned launch shapes by kernel name (see autotune.h), kernels without one use the default
+    std::map<std::string, KernelConfig> kernelConfigs;
+
+    // Matrix unit shapes from VK_KHR_cooperative_matrix (see matmul.h), empty until loadCooperativeMatrixShapes
+    std::vector<VkCooperativeMatrixPropertiesKHR> cooperativeMatrixShapes;
+
+    uint32_t hits;
+    uint32_t misses;
+
+    // Held while pipelines are looked up or built and while sets come from descriptorAllocator, so kernels can
+    // be created from several threads. A pointer since the registry is passed around by value.
+    std::shared_ptr<std::mutex> mutex;
+};
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
+PipelineRegistry createPipelineRegistry(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& cachePath = "pipeline_cache.bin", bool pushDescriptors = true);
+Pipeline& getPipeline(PipelineRegistry& registry, const std::vector<char>& spirv, const std::string& entryPoint, uint32_t bindingCount, const SpecializationConstants* specialization = nullptr, uint32_t pushConstantSize = 0);
+Pipeline& getPipeline(PipelineRegistry& registry, const std::string& spirvPath, const std::string& entryPoint, uint32_t bindingCount, const SpecializationConstants* specialization = nullptr, uint32_t pushConstantSize = 0);
+KernelConfig defaultKernelConfig();
+KernelConfig getKernelConfig(const PipelineRegistry& registry, const std::string& kernelName);
+bool supportsDtype(const PipelineRegistry& registry, const std::string& dtype);
+void savePipelineCache(PipelineRegistry& registry);
+void destroyPipelineRegistry(PipelineRegistry& registry);
+
+#endif // PIPELINE_CACHE_H
@@ -0,0 +1,265 @@
+#include "./profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+// Dispatches shorter than this are dominated by launch cost rather than by memory or ALU work
+static const double overheadBoundUs = 10.0;
+
+static Profiler* active = nullptr;
+
+// Timestamps are only written for the queue family the profiler was created for
+Profiler createProfiler(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamilyIndex, uint32_t maxScopes) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t validBits = queueFamilyIndex < queueFamilyCount ? queueFamilies[queueFamilyIndex].timestampValidBits : 0;
+
+    Profiler profiler;
+    profiler.device = device;
+    profiler.queryPool = VK_NULL_HANDLE;
+    profiler.queryCount = maxScopes * 2;
+    profiler.nextQuery = 0;
+    profiler.timestamps = validBits > 0 && properties.limits.timestampPeriod > 0.0f;
+    profiler.timestampPeriod = properties.limits.timestampPeriod;
+    profiler.timestampMask = validBits >= 64 ? UINT64_MAX : (uint64_t(1) << validBits) - 1;
+    profiler.origin = std::chrono::steady_clock::now();
+    profiler.firstSubmitUs = -1.0;
+    profiler.droppedScopes = 0;
+
+    if (profiler.timestamps) {
+        VkQueryPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = profiler.queryCount;
+
+        if (vkCreateQueryPool(device, &poolInfo, nullptr, &profiler.queryPool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create timestamp query pool!");
+        }
+    }
+
+    return profiler;
+}
+
+// The library records into the active profiler. Pass nullptr to stop profiling.
+void setActiveProfiler(Profiler* profiler) {
+    active = profiler;
+}
+
+Profiler* activeProfiler() {
+    return active;
+}
+
+double profilerTimeUs(const Profiler& profiler) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - profiler.origin).count();
+}
+
+HostScope::HostScope(const char* name, const char* category, VkDeviceSize bytes)
+    : profiler(active), name(name), category(category), bytes(bytes), startUs(0.0) {
+    if (profiler) startUs = profilerTimeUs(*profiler);
+}
+
+HostScope::~HostScope() {
+    if (!profiler) return;
+
+    ProfileEvent event;
+    event.name = name;
+    event.category = category;
+    event.gpu = false;
+    event.startUs = startUs;
+    event.durationUs = profilerTimeUs(*profiler) - startUs;
+    event.bytes = bytes;
+    profiler->events.push_back(event);
+}
+
+// Writes the begin timestamp of a scope. The queries are reset in the command buffer itself,
+// so recording does not depend on what happened to them before.
+uint32_t beginGpuScope(VkCommandBuffer commandBuffer, const std::string& name, const char* category, VkDeviceSize bytes) {
+    if (!active || !active->timestamps) return NO_SCOPE;
+
+    if (active->nextQuery + 2 > active->queryCount) {
+        active->droppedScopes++;
+        return NO_SCOPE;
+    }
+
+    GpuScope scope;
+    scope.name = name;
+    scope.category = category;
+    scope.query = active->nextQuery;
+    scope.bytes = bytes;
+    active->nextQuery += 2;
+
+    vkCmdResetQueryPool(commandBuffer, active->queryPool, scope.query, 2);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, active->queryPool, scope.query);
+
+    active->pending.push_back(scope);
+    return static_cast<uint32_t>(active->pending.size() - 1);
+}
+
+void endGpuScope(VkCommandBuffer commandBuffer, uint32_t scope) {
+    if (!active || scope == NO_SCOPE) return;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, active->queryPool, active->pending[scope].query + 1);
+}
+
+// Remembers when work first went to the GPU, collectProfile lines the GPU clock up with it
+void markSubmit() {
+    if (active && active->firstSubmitUs < 0.0) active->firstSubmitUs = profilerTimeUs(*active);
+}
+
+// Reads back the timestamps of every scope recorded since the last collect and turns them into events.
+// Call it once the work has finished; scopes whose command buffer never ran are dropped.
+// The GPU clock has no fixed relation to the host clock, so the earliest GPU timestamp is placed at
+// the first submission since the last collect. Spans and gaps between GPU events are exact.
+void collectProfile(Profiler& profiler) {
+    if (profiler.pending.empty()) {
+        profiler.firstSubmitUs = -1.0;
+        return;
+    }
+
+    // Value and availability for every query
+    std::vector<uint64_t> results(profiler.nextQuery * 2);
+    vkGetQueryPoolResults(profiler.device, profiler.queryPool, 0, profiler.nextQuery, results.size() * sizeof(uint64_t),
+                          results.data(), 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    auto available = [&](uint32_t query) { return results[query * 2 + 1] != 0; };
+    auto ticks = [&](uint32_t query) { return results[query * 2] & profiler.timestampMask; };
+
+    bool found = false;
+    uint64_t gpuOrigin = 0;
+    for (const GpuScope& scope : profiler.pending) {
+        if (!available(scope.query) || !available(scope.query + 1)) continue;
+        if (!found || ticks(scope.query) < gpuOrigin) gpuOrigin = ticks(scope.query);
+        found = true;
+    }
+
+    double hostOrigin = profiler.firstSubmitUs >= 0.0 ? profiler.firstSubmitUs : profilerTimeUs(profiler);
+    double usPerTick = profiler.timestampPeriod / 1000.0;
+
+    for (const GpuScope& scope : profiler.pending) {
+        if (!available(scope.query) || !available(scope.query + 1)) {
+            profiler.droppedScopes++;
+            continue;
+        }
+
+        uint64_t begin = ticks(scope.query);
+        uint64_t end = ticks(scope.query + 1);
+
+        ProfileEvent event;
+        event.name = scope.name;
+        event.category = scope.category;
+        event.gpu = true;
+        event.startUs = hostOrigin + ((begin - gpuOrigin) & profiler.timestampMask) * usPerTick;
+        event.durationUs = ((end - begin) & profiler.timestampMask) * usPerTick;
+        event.bytes = scope.bytes;
+        profiler.events.push_back(event);
+    }
+
+    profiler.pending.clear();
+    profiler.nextQuery = 0;
+    profiler.firstSubmitUs = -1.0;
+}
+
+// Totals per GPU event name, slowest first
+std::vector<ProfileSummary> summarizeProfile(const Profiler& profiler) {
+    std::map<std::string, ProfileSummary> byName;
+    for (const ProfileEvent& event : profiler.events) {
+        if (!event.gpu) continue;
+
+        ProfileSummary& summary = byName[event.name];
+        if (summary.count == 0) {
+            summary.name = event.name;
+            summary.category = event.category;
+        }
+        summary.count++;
+        summary.totalUs += event.durationUs;
+        summary.bytes += event.bytes;
+    }
+
+    std::vector<ProfileSummary> summaries;
+    for (auto& entry : byName) summaries.push_back(entry.second);
+    std::sort(summaries.begin(), summaries.end(), [](const ProfileSummary& a, const ProfileSummary& b) { return a.totalUs > b.totalUs; });
+    return summaries;
+}
+
+void printProfileSummary(const Profiler& profiler) {
+    std::vector<ProfileSummary> summaries = summarizeProfile(profiler);
+
+    printf("%-28s %8s %12s %10s %10s\n", "gpu", "count", "total ms", "avg us", "GB/s");
+    for (const ProfileSummary& summary : summaries) {
+        double avgUs = summary.totalUs / summary.count;
+        double gbps = summary.totalUs > 0.0 ? summary.bytes / (summary.totalUs * 1e3) : 0.0;
+        printf("%-28s %8u %12.3f %10.2f %10.2f%s\n", summary.name.c_str(), summary.count, summary.totalUs / 1000.0, avgUs, gbps,
+               avgUs < overheadBoundUs ? "  (dispatch overhead bound)" : "");
+    }
+
+    std::map<std::string, std::pair<uint32_t, double>> hostTotals;
+    for (const ProfileEvent& event : profiler.events) {
+        if (event.gpu) continue;
+        hostTotals[event.name].first++;
+        hostTotals[event.name].second += event.durationUs;
+    }
+
+    printf("%-28s %8s %12s %10s\n", "host", "count", "total ms", "avg us");
+    for (auto& entry : hostTotals) {
+        printf("%-28s %8u %12.3f %10.2f\n", entry.first.c_str(), entry.second.first, entry.second.second / 1000.0,
+               entry.second.second / entry.second.first);
+    }
+
+    if (!profiler.timestamps) printf("The queue family does not support timestamps, only host events were recorded.\n");
+    if (profiler.droppedScopes > 0) printf("%u GPU scopes were dropped (query pool full or never submitted).\n", profiler.droppedScopes);
+}
+
+static std::string escapeJson(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) continue;
+        escaped += c;
+    }
+    return escaped;
+}
+
+// Chrome trace event format, loads in chrome://tracing and ui.perfetto.dev.
+// Host and GPU events go on separate tracks of the same process.
+void writeChromeTrace(const Profiler& profiler, const std::string& path) {
+    std::ofstream file(path);
+    if (!file.is_open()) throw std::runtime_error("Failed to open trace file \"" + path + "\"!");
+
+    file << "{\"traceEvents\":[\n";
+    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"host\"}},\n";
+    file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"gpu\"}}";
+
+    char number[64];
+    for (const ProfileEvent& event : profiler.events) {
+        file << ",\n{\"name\":\"" << escapeJson(event.name) << "\",\"cat\":\"" << escapeJson(event.category)
+             << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event.gpu ? 2 : 1);
+
+        snprintf(number, sizeof(number), "%.3f", event.startUs);
+        file << ",\"ts\":" << number;
+        snprintf(number, sizeof(number), "%.3f", event.durationUs);
+        file << ",\"dur\":" << number;
+
+        if (event.bytes > 0) {
+            double gbps = event.durationUs > 0.0 ? event.bytes / (event.durationUs * 1e3) : 0.0;
+            snprintf(number, sizeof(number), "%.3f", gbps);
+            file << ",\"args\":{\"bytes\":" << event.bytes << ",\"GB/s\":" << number << "}";
+        }
+        file << "}";
+    }
+
+    file << "\n]}\n";
+}
+
+void destroyProfiler(Profiler& profiler) {
+    if (active == &profiler) active = nullptr;
+    if (profiler.queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(profiler.device, profiler.queryPool, nullptr);
+    profiler.queryPool = VK_NULL_HANDLE;
+}
@@ -0,0 +1,87 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <vulkan/vulkan.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Returned by beginGpuScope when nothing is recorded (no active profiler, or its query pool is full)
+static const uint32_t NO_SCOPE = UINT32_MAX;
+
+// One finished span on the trace, either measured on the host or read back from GPU timestamps.
+// GPU events are moved onto the host clock, see collectProfile.
+struct ProfileEvent {
+    std::string name;
+    std::string category;
+    bool gpu;
+    double startUs;
+    double durationUs;
+    VkDeviceSize bytes; // global memory traffic, 0 if it does not apply
+};
+
+// A pair of timestamp queries recorded into a command buffer but not read back yet
+struct GpuScope {
+    std::string name;
+    std::string category;
+    uint32_t query; // begin, end is query + 1
+    VkDeviceSize bytes;
+};
+
+// Opt-in profiler. While it is active (setActiveProfiler), dispatches and copies recorded by the library
+// are wrapped in timestamp queries and buffer creation, pipeline creation and submission are timed on the host.
+// Not thread safe, like the rest of the library.
+struct Profiler {
+    VkDevice device;
+    VkQueryPool queryPool;
+    uint32_t queryCount;
+    uint32_t nextQuery;
+
+    // Timestamps are only written if the queue family supports them, host events are recorded either way
+    bool timestamps;
+    double timestampPeriod; // nanoseconds per tick
+    uint64_t timestampMask;
+
+    std::chrono::steady_clock::time_point origin;
+    double firstSubmitUs; // host time of the first submission since the last collect, -1 if none
+
+    std::vector<GpuScope> pending;
+    std::vector<ProfileEvent> events;
+    uint32_t droppedScopes;
+};
+
+// Per-name totals over all GPU events of a profile
+struct ProfileSummary {
+    std::string name;
+    std::string category;
+    uint32_t count;
+    double totalUs;
+    VkDeviceSize bytes;
+};
+
+// Times the enclosing block on the host and adds it to the active profiler, if there is one
+struct HostScope {
+    Profiler* profiler;
+    const char* name;
+    const char* category;
+    VkDeviceSize bytes;
+    double startUs;
+
+    HostScope(const char* name, const char* category, VkDeviceSize bytes = 0);
+    ~HostScope();
+};
+
+Profiler createProfiler(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamilyIndex, uint32_t maxScopes = 4096);
+void setActiveProfiler(Profiler* profiler);
+Profiler* activeProfiler();
+double profilerTimeUs(const Profiler& profiler);
+uint32_t beginGpuScope(VkCommandBuffer commandBuffer, const std::string& name, const char* category, VkDeviceSize bytes = 0);
+void endGpuScope(VkCommandBuffer commandBuffer, uint32_t scope);
+void markSubmit();
+void collectProfile(Profiler& profiler);
+std::vector<ProfileSummary> summarizeProfile(const Profiler& profiler);
+void printProfileSummary(const Profiler& profiler);
+void writeChromeTrace(const Profiler& profiler, const std::string& path);
+void destroyProfiler(Profiler& profiler);
+
+#endif // PROFILER_H
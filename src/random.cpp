@@ -0,0 +1,143 @@
+#include "./random.h"
+#include "./profiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const uint32_t workgroupSize = 256;
+static const uint32_t maxGroupCount = 65535;
+
+// Mantissa bits of a uniform value in [0, 1), as many as the dtype holds exactly (see unitFloat in random.comp)
+static uint32_t mantissaBits(const std::string& dtype) {
+    if (dtype == "float") return 24;
+    if (dtype == "float16") return 11;
+    if (dtype == "bfloat16") return 8;
+    throw std::runtime_error("Random numbers are only generated for float, float16 and bfloat16, not " + dtype + ".");
+}
+
+// The largest value of `dtype` below `b`. It is exact in the dtype, so narrowing a float no larger than it stays below b.
+static float largestBelow(float b, const std::string& dtype) {
+    mantissaBits(dtype);
+    if (dtype == "float") return std::nextafter(b, -INFINITY);
+
+    bool half = dtype == "float16";
+    auto widen = [half](uint16_t bits) { return half ? toFloat(Float16{bits}) : toFloat(Bfloat16{bits}); };
+    uint16_t bits = half ? toFloat16(b).bits : toBfloat16(b).bits;
+    if (widen(bits) < b) return widen(bits);
+
+    // One step towards -infinity, both are sign and magnitude formats
+    if ((bits & 0x7fff) == 0) bits = 0x8001;
+    else if (bits & 0x8000) bits++;
+    else bits--;
+    return widen(bits);
+}
+
+RandomParams randomParams(uint32_t nelem, uint64_t key, uint64_t counter, float a, float b, const std::string& dtype) {
+    RandomParams params;
+    params.key[0] = static_cast<uint32_t>(key);
+    params.key[1] = static_cast<uint32_t>(key >> 32);
+    params.counter[0] = static_cast<uint32_t>(counter);
+    params.counter[1] = static_cast<uint32_t>(counter >> 32);
+    params.nelem = nelem;
+    params.a = a;
+    params.b = b;
+    params.upper = largestBelow(b, dtype);
+    return params;
+}
+
+RandomKernel createRandomKernel(PipelineRegistry& registry, Buffer dest, Distribution distribution, uint64_t key, uint64_t counter, float a, float b, const std::string& dtype) {
+    mantissaBits(dtype);
+    if (!supportsDtype(registry, dtype)) {
+        throw std::runtime_error("Device does not support " + dtype + " storage.");
+    }
+
+    VkDeviceSize nelem = dest.size / getTypeSize(dtype);
+    if (nelem == 0) throw std::runtime_error("Random fill of an empty buffer.");
+    if (nelem > UINT32_MAX) throw std::runtime_error("Too many elements for a random fill.");
+
+    RandomKernel kernel;
+    kernel.distribution = distribution;
+    kernel.dtype = dtype;
+    kernel.params = randomParams(static_cast<uint32_t>(nelem), key, counter, a, b, dtype);
+    kernel.device = registry.device;
+
+    // One invocation per pair of elements, the shader loops over whatever doesn't fit in the grid
+    uint32_t pairs = (kernel.params.nelem + 1) / 2;
+    kernel.groupCount = std::min((pairs + workgroupSize - 1) / workgroupSize, maxGroupCount);
+
+    SpecializationConstants constants;
+    constants.set(0, distribution);
+    kernel.pipeline = &getPipeline(registry, "shaders/random_" + dtype + ".spv", "main", 1, &constants, sizeof(RandomParams));
+
+    std::vector<Buffer> bindings = {dest};
+    bindings[0].binding = 0;
+    kernel.descriptors = createDescriptorBinding(registry, *kernel.pipeline, bindings);
+
+    return kernel;
+}
+
+void recordRandomKernel(VkCommandBuffer commandBuffer, RandomKernel& kernel) {
+    uint32_t scope = NO_SCOPE;
+    if (activeProfiler()) {
+        std::string name = std::string(kernel.distribution == DISTRIBUTION_NORMAL ? "NORMAL " : "UNIFORM ") + kernel.dtype;
+        scope = beginGpuScope(commandBuffer, name, "random", VkDeviceSize(kernel.params.nelem) * getTypeSize(kernel.dtype));
+    }
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, kernel.pipeline->pipeline);
+    bindDescriptors(commandBuffer, *kernel.pipeline, kernel.descriptors);
+    vkCmdPushConstants(commandBuffer, kernel.pipeline->layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(RandomParams), &kernel.params);
+    vkCmdDispatch(commandBuffer, kernel.groupCount, 1, 1);
+    endGpuScope(commandBuffer, scope);
+}
+
+void destroyRandomKernel(RandomKernel& kernel) {
+    destroyDescriptorBinding(kernel.device, kernel.descriptors);
+}
+
+static void narrowInto(float& dest, float value) { dest = value; }
+static void narrowInto(Float16& dest, float value) { dest = toFloat16(value); }
+static void narrowInto(Bfloat16& dest, float value) { dest = toBfloat16(value); }
+
+template <typename T>
+static void fillRandomChunk(T* dest, Distribution distribution, const RandomParams& params, uint32_t mantissa, size_t begin, size_t end) {
+    const float unit = 1.0f / float(1u << mantissa);
+
+    for (size_t p = begin; p < end; p++) {
+        uint32_t low = params.counter[0] + static_cast<uint32_t>(p);
+        uint32_t counter[2] = {low, params.counter[1] + (low < p ? 1u : 0u)};
+        uint32_t bits[2];
+        threefry2x32(params.key, counter, bits);
+
+        float values[2];
+        if (distribution == DISTRIBUTION_NORMAL) {
+            float u1 = float((bits[0] >> 8) + 1) * (1.0f / 16777216.0f);
+            float u2 = float(bits[1] >> 8) * (1.0f / 16777216.0f);
+            float radius = std::sqrt(-2.0f * std::log(u1));
+            float angle = 6.2831853071795864f * u2;
+            values[0] = params.a + params.b * radius * std::cos(angle);
+            values[1] = params.a + params.b * radius * std::sin(angle);
+        } else {
+            // Product and sum rounded separately like the precise expression in random.comp, -ffp-contract=off
+            // (CMakeLists.txt) keeps the compiler from fusing them on targets with FMA
+            for (int i = 0; i < 2; i++) {
+                float scaled = (params.b - params.a) * (float(bits[i] >> (32 - mantissa)) * unit);
+                values[i] = std::min(params.a + scaled, params.upper);
+            }
+        }
+
+        narrowInto(dest[2 * p], values[0]);
+        if (2 * p + 1 < params.nelem) narrowInto(dest[2 * p + 1], values[1]);
+    }
+}
+
+// What random.comp writes, computed on the CPU: the reference the device fill is checked against
+void fillRandomCpu(ThreadPool& pool, void* dest, Distribution distribution, const RandomParams& params, const std::string& dtype) {
+    uint32_t mantissa = mantissaBits(dtype);
+    size_t pairs = (size_t(params.nelem) + 1) / 2;
+
+    parallelFor(pool, pairs, 4096, [&](size_t begin, size_t end) {
+        if (dtype == "float") fillRandomChunk(static_cast<float*>(dest), distribution, params, mantissa, begin, end);
+        else if (dtype == "float16") fillRandomChunk(static_cast<Float16*>(dest), distribution, params, mantissa, begin, end);
+        else fillRandomChunk(static_cast<Bfloat16*>(dest), distribution, params, mantissa, begin, end);
+    });
+}
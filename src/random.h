@@ -0,0 +1,44 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include "./util.h"
+#include "./kernel.h"
+#include "./pipeline_cache.h"
+#include "./cpu_backend.h"
+
+// Random tensors generated on the device (random.comp), counter based with Threefry-2x32: the same key and
+// counter offset give the same tensor on every run. Element e comes from counter offset + e / 2, so a tensor
+// can be filled in pieces, each one starting at the offset where the previous one stopped (half its length).
+enum Distribution {
+    DISTRIBUTION_UNIFORM, // [a, b)
+    DISTRIBUTION_NORMAL,  // mean a, standard deviation b
+};
+
+// Push constants of random.comp, in declaration order
+struct RandomParams {
+    uint32_t key[2];
+    uint32_t counter[2];
+    uint32_t nelem;
+    float a;
+    float b;
+    float upper; // largest value of the dtype below b, uniform values are clamped to it
+};
+
+struct RandomKernel {
+    Distribution distribution;
+    std::string dtype;
+    RandomParams params;
+    uint32_t groupCount;
+
+    VkDevice device;
+    Pipeline* pipeline;
+    DescriptorBinding descriptors;
+};
+
+RandomParams randomParams(uint32_t nelem, uint64_t key, uint64_t counter, float a, float b, const std::string& dtype = "float");
+RandomKernel createRandomKernel(PipelineRegistry& registry, Buffer dest, Distribution distribution, uint64_t key, uint64_t counter = 0, float a = 0.0f, float b = 1.0f, const std::string& dtype = "float");
+void recordRandomKernel(VkCommandBuffer commandBuffer, RandomKernel& kernel);
+void destroyRandomKernel(RandomKernel& kernel);
+void fillRandomCpu(ThreadPool& pool, void* dest, Distribution distribution, const RandomParams& params, const std::string& dtype = "float");
+
+#endif // RANDOM_H
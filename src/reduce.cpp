@@ -0,0 +1,170 @@
+#include "./reduce.h"
+#include "./profiler.h"
+
+#include <algorithm>
+
+// Axes at most this long are reduced by a single invocation each, longer ones by whole workgroups
+static const uint32_t serialReduceLimit = 64;
+
+// Every invocation of a workgroup pass should get at least this many elements before its partial is written
+static const uint32_t elementsPerWorkgroup = 256 * 16;
+
+// Roughly enough workgroups to keep a large GPU busy, more only add partials for the next pass
+static const uint32_t targetWorkgroups = 1024;
+
+static const uint32_t maxGroupCount = 65535;
+
+ReduceShape fullReduceShape(uint32_t nelem) {
+    return ReduceShape{1, nelem, 1, 0, 1, 0};
+}
+
+// Reduces `axis` of a strided view. The axes before it are merged into `outer` and the ones
+// after into `inner`, which only works if each of those runs is laid out like a single axis.
+ReduceShape axisReduceShape(const std::vector<uint32_t>& shape, const std::vector<uint32_t>& strides, uint32_t axis) {
+    if (shape.size() != strides.size() || axis >= shape.size()) throw std::runtime_error("Invalid shape for reduction.");
+
+    // Merges dims [begin, end) into one, returns its count and stride
+    auto merge = [&](size_t begin, size_t end, uint32_t& count, uint32_t& stride) {
+        count = 1;
+        stride = 0;
+        for (size_t i = end; i-- > begin;) {
+            if (shape[i] == 1) continue;
+            if (count > 1 && strides[i] != stride * count) {
+                throw std::runtime_error("Reduction over a view whose other axes can not be merged.");
+            }
+            if (count == 1) stride = strides[i];
+            count *= shape[i];
+        }
+    };
+
+    ReduceShape result;
+    merge(0, axis, result.outerCount, result.outerStride);
+    merge(axis + 1, shape.size(), result.innerCount, result.innerStride);
+    result.reduceCount = shape[axis];
+    result.reduceStride = strides[axis];
+    return result;
+}
+
+// Plans one pass over `shape`. A groupsPerOutput above 1 means another pass has to follow.
+static ReducePass planPass(const ReduceShape& shape) {
+    uint32_t outputs = shape.outerCount * shape.innerCount;
+
+    ReducePass pass{};
+    pass.params.shape = shape;
+    pass.params.groupsPerOutput = 1;
+
+    if (shape.reduceCount <= serialReduceLimit) {
+        uint32_t groups = (outputs + 255) / 256;
+        pass.groupCountX = std::min(groups, maxGroupCount);
+        pass.groupCountY = (groups + maxGroupCount - 1) / maxGroupCount;
+        pass.groupCountZ = 1;
+        return pass;
+    }
+
+    // Split long axes across several workgroups, but not into more than the GPU can run at once
+    uint32_t byLength = (shape.reduceCount + elementsPerWorkgroup - 1) / elementsPerWorkgroup;
+    uint32_t byOccupancy = std::max(1u, targetWorkgroups / std::max(1u, outputs));
+    pass.params.groupsPerOutput = std::max(1u, std::min({byLength, byOccupancy, maxGroupCount}));
+
+    pass.groupCountX = pass.params.groupsPerOutput;
+    pass.groupCountY = std::min(outputs, maxGroupCount);
+    pass.groupCountZ = (outputs + maxGroupCount - 1) / maxGroupCount;
+    return pass;
+}
+
+// Reduces `src` viewed as `shape` into `dest`. Long axes on large inputs take several passes,
+// the partials in between live in device-local buffers owned by the kernel. There are no atomics,
+// so results are the same from run to run.
+ReduceKernel createReduceKernel(PipelineRegistry& registry, Ops op, Buffer src, Buffer dest, const ReduceShape& shape, const std::string& dtype) {
+    if (op != SUM && op != PROD && op != REDUCE_MAX) throw std::runtime_error(std::string(opName(op)) + " is not a reduce op.");
+    if (getTypeSize(dtype) != 4) throw std::runtime_error("Reductions only support float, int and uint.");
+
+    VkDeviceSize typeSize = getTypeSize(dtype);
+    uint64_t outputs = uint64_t(shape.outerCount) * shape.innerCount;
+    uint64_t lastIndex = uint64_t(shape.outerCount - 1) * shape.outerStride +
+                         uint64_t(shape.innerCount - 1) * shape.innerStride +
+                         uint64_t(shape.reduceCount - 1) * shape.reduceStride;
+
+    if (outputs == 0 || shape.reduceCount == 0) throw std::runtime_error("Empty reduction.");
+    if (outputs > UINT32_MAX) throw std::runtime_error("Too many outputs for a reduction.");
+    if ((lastIndex + 1) * typeSize > src.size) throw std::runtime_error("Reduction reads past the end of the source buffer.");
+    if (outputs * typeSize > dest.size) throw std::runtime_error("Destination buffer is too small for the reduction.");
+
+    ReduceKernel kernel;
+    kernel.op = op;
+    kernel.dtype = dtype;
+    kernel.shape = shape;
+    kernel.usesSubgroups = supportsSubgroupArithmetic(registry.physicalDevice);
+    kernel.device = registry.device;
+
+    std::string path = std::string("shaders/reduce_") + (kernel.usesSubgroups ? "subgroup_" : "") + dtype + ".spv";
+
+    Buffer input = src;
+    ReduceShape passShape = shape;
+
+    while (true) {
+        ReducePass pass = planPass(passShape);
+        bool last = pass.params.groupsPerOutput == 1;
+
+        // Everything the pass reads plus the outputs (or partials) it writes
+        pass.bytes = (VkDeviceSize(passShape.outerCount) * passShape.reduceCount * passShape.innerCount +
+                      VkDeviceSize(outputs) * pass.params.groupsPerOutput) * typeSize;
+
+        Buffer output = dest;
+        if (!last) {
+            VkDeviceSize partialBytes = VkDeviceSize(outputs) * pass.params.groupsPerOutput * typeSize;
+            output = createBuffer(registry.physicalDevice, registry.device, partialBytes, 1, MEMORY_DEVICE_LOCAL);
+            kernel.partials.push_back(output);
+        }
+
+        SpecializationConstants constants;
+        constants.set(0, op);
+        constants.set(1, passShape.reduceCount <= serialReduceLimit);
+        pass.pipeline = &getPipeline(registry, path, "main", 2, &constants, sizeof(ReduceParams));
+
+        std::vector<Buffer> bindings = {input, output};
+        bindings[0].binding = 0;
+        bindings[1].binding = 1;
+        pass.descriptors = createDescriptorBinding(registry, *pass.pipeline, bindings);
+
+        kernel.passes.push_back(pass);
+        if (last) break;
+
+        // The partials of each output are contiguous, the next pass reduces them as the axis
+        uint32_t partialCount = pass.params.groupsPerOutput;
+        passShape = ReduceShape{static_cast<uint32_t>(outputs), partialCount, 1, partialCount, 1, 0};
+        input = output;
+    }
+
+    return kernel;
+}
+
+// Records all passes of the reduction, with a barrier after each one that feeds the next
+void recordReduceKernel(VkCommandBuffer commandBuffer, ReduceKernel& kernel) {
+    for (size_t i = 0; i < kernel.passes.size(); i++) {
+        ReducePass& pass = kernel.passes[i];
+        if (i > 0) recordKernelBarrier(commandBuffer);
+
+        uint32_t scope = NO_SCOPE;
+        if (activeProfiler()) {
+            std::string name = std::string(opName(kernel.op)) + " " + kernel.dtype + " pass " + std::to_string(i);
+            scope = beginGpuScope(commandBuffer, name, "reduce", pass.bytes);
+        }
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass.pipeline->pipeline);
+        bindDescriptors(commandBuffer, *pass.pipeline, pass.descriptors);
+        vkCmdPushConstants(commandBuffer, pass.pipeline->layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ReduceParams), &pass.params);
+        vkCmdDispatch(commandBuffer, pass.groupCountX, pass.groupCountY, pass.groupCountZ);
+        endGpuScope(commandBuffer, scope);
+    }
+}
+
+void destroyReduceKernel(ReduceKernel& kernel) {
+    for (ReducePass& pass : kernel.passes) {
+        destroyDescriptorBinding(kernel.device, pass.descriptors);
+    }
+
+    destroyBuffers(kernel.partials);
+    kernel.passes.clear();
+    kernel.partials.clear();
+}
@@ -0,0 +1,54 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include "./util.h"
+#include "./kernel.h"
+#include "./pipeline_cache.h"
+
+// The source seen as [outer, reduce, inner], with a stride (in elements) for each of the three.
+// The result is contiguous [outer, inner].
+struct ReduceShape {
+    uint32_t outerCount;
+    uint32_t reduceCount;
+    uint32_t innerCount;
+    uint32_t outerStride;
+    uint32_t reduceStride;
+    uint32_t innerStride;
+};
+
+// Push constants of reduce.comp, in declaration order
+struct ReduceParams {
+    ReduceShape shape;
+    uint32_t groupsPerOutput;
+};
+
+// One dispatch of a reduction. Large reductions take several: every pass but the last writes
+// `groupsPerOutput` partials per output, which the next pass reduces further.
+struct ReducePass {
+    ReduceParams params;
+    Pipeline* pipeline;
+    DescriptorBinding descriptors;
+    uint32_t groupCountX;
+    uint32_t groupCountY;
+    uint32_t groupCountZ;
+    VkDeviceSize bytes;
+};
+
+struct ReduceKernel {
+    Ops op;
+    std::string dtype;
+    ReduceShape shape;
+    bool usesSubgroups;
+
+    VkDevice device;
+    std::vector<ReducePass> passes;
+    std::vector<Buffer> partials;
+};
+
+ReduceShape fullReduceShape(uint32_t nelem);
+ReduceShape axisReduceShape(const std::vector<uint32_t>& shape, const std::vector<uint32_t>& strides, uint32_t axis);
+ReduceKernel createReduceKernel(PipelineRegistry& registry, Ops op, Buffer src, Buffer dest, const ReduceShape& shape, const std::string& dtype = "float");
+void recordReduceKernel(VkCommandBuffer commandBuffer, ReduceKernel& kernel);
+void destroyReduceKernel(ReduceKernel& kernel);
+
+#endif // REDUCE_H
@@ -0,0 +1,178 @@
+#include "./runtime.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+
+// Used when the threshold is neither calibrated nor set with VKCOMPUTE_GPU_THRESHOLD
+static const uint32_t defaultGpuThreshold = 1 << 18;
+
+// VKCOMPUTE_GPU_THRESHOLD as a number of elements. Anything else is an error rather than a threshold of 0,
+// which would quietly send every kernel to the GPU.
+static uint32_t parseGpuThreshold(const char* value) {
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long threshold = std::strtoull(value, &end, 10);
+    if (!isdigit(static_cast<unsigned char>(value[0])) || *end != '\0' || errno == ERANGE || threshold > UINT32_MAX) {
+        throw std::runtime_error("VKCOMPUTE_GPU_THRESHOLD \"" + std::string(value) + "\" is not a number of elements!");
+    }
+    return static_cast<uint32_t>(threshold);
+}
+
+// Brings up Vulkan if it can and calibrates the CPU/GPU threshold.
+// VKCOMPUTE_GPU_THRESHOLD=<elements> skips the calibration, 0 sends everything to the GPU.
+Runtime createRuntime(bool calibrate) {
+    // Checked before anything is created, a bad value throws without leaking the device
+    const char* threshold = std::getenv("VKCOMPUTE_GPU_THRESHOLD");
+    uint32_t thresholdElements = threshold ? parseGpuThreshold(threshold) : 0;
+
+    Runtime runtime{};
+    runtime.hasGpu = false;
+    runtime.gpuThreshold = UINT32_MAX;
+    runtime.threadPool = createThreadPool();
+
+    try {
+        runtime.instance = createInstance();
+        runtime.physicalDevice = selectPhysicalDevice(runtime.instance);
+        runtime.queueFamilyIndex = findComputeQueueFamily(runtime.physicalDevice);
+        runtime.device = createDevice(runtime.physicalDevice, runtime.queueFamilyIndex);
+        runtime.queue = getQueue(runtime.device, runtime.queueFamilyIndex, 0);
+
+        // runKernel re-records the same command buffer for every GPU kernel
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = runtime.queueFamilyIndex;
+        if (vkCreateCommandPool(runtime.device, &poolInfo, nullptr, &runtime.commandPool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create command pool!");
+        }
+
+        runtime.commandBuffer = createCommandBuffer(runtime.device, runtime.commandPool);
+        runtime.registry = createPipelineRegistry(runtime.physicalDevice, runtime.device);
+        loadKernelConfigs(runtime.registry);
+        loadCooperativeMatrixShapes(runtime.instance, runtime.registry);
+        runtime.hasGpu = true;
+    } catch (const std::exception& e) {
+        std::cerr << "No usable Vulkan device (" << e.what() << "), running on the CPU." << std::endl;
+
+        if (runtime.commandPool != VK_NULL_HANDLE) vkDestroyCommandPool(runtime.device, runtime.commandPool, nullptr);
+        if (runtime.device != VK_NULL_HANDLE) vkDestroyDevice(runtime.device, nullptr);
+        if (runtime.instance != VK_NULL_HANDLE) vkDestroyInstance(runtime.instance, nullptr);
+        return runtime;
+    }
+
+    if (threshold) runtime.gpuThreshold = thresholdElements;
+    else runtime.gpuThreshold = calibrate ? measureGpuThreshold(runtime) : defaultGpuThreshold;
+
+    return runtime;
+}
+
+static double medianUs(std::vector<double> times) {
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+template <typename F>
+static double timeUs(F f) {
+    std::vector<double> times;
+    for (int i = 0; i < 5; i++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    return medianUs(times);
+}
+
+// Times ADD end to end on both backends for growing sizes and returns the first size where the GPU wins,
+// including the submission and the wait. UINT32_MAX if the CPU was faster all the way up.
+uint32_t measureGpuThreshold(Runtime& runtime) {
+    if (!runtime.hasGpu) return UINT32_MAX;
+
+    for (uint32_t nelem = 1 << 8; nelem <= (1 << 24); nelem *= 4) {
+        VkDeviceSize bytes = VkDeviceSize(nelem) * sizeof(float);
+        std::vector<Buffer> buffers = {
+            createRuntimeBuffer(runtime, bytes, 0),
+            createRuntimeBuffer(runtime, bytes, 1),
+            createRuntimeBuffer(runtime, bytes, 2),
+        };
+
+        float* a = hostPointer<float>(buffers[0]);
+        float* b = hostPointer<float>(buffers[1]);
+        for (uint32_t i = 0; i < nelem; i++) {
+            a[i] = float(i % 1024);
+            b[i] = float(i % 7);
+        }
+
+        Kernel cpu = createCpuKernel(ADD, {buffers[0], buffers[1]}, buffers[2]);
+        Kernel gpu = createKernel(runtime.registry, ADD, {buffers[0], buffers[1]}, buffers[2]);
+
+        runCpuKernel(*runtime.threadPool, cpu);
+        runKernel(runtime, gpu);
+        double cpuUs = timeUs([&]() { runCpuKernel(*runtime.threadPool, cpu); });
+        double gpuUs = timeUs([&]() { runKernel(runtime, gpu); });
+
+        destroyKernel(gpu);
+        destroyKernel(cpu);
+        destroyBuffers(buffers);
+
+        if (gpuUs < cpuUs) return nelem;
+    }
+
+    return UINT32_MAX;
+}
+
+// Host-visible when there is a GPU, so both backends can use it, plain host memory otherwise
+Buffer createRuntimeBuffer(Runtime& runtime, VkDeviceSize size, uint32_t binding) {
+    if (runtime.hasGpu) return createBuffer(runtime.physicalDevice, runtime.device, size, binding, MEMORY_HOST_VISIBLE);
+    return createHostBuffer(size, binding);
+}
+
+// Small kernels go to the CPU, where they skip the submission and the wait. So do dtypes the GPU can't store.
+Kernel createRuntimeKernel(Runtime& runtime, Ops op, std::vector<Buffer> src, Buffer dest, const std::string& dtype, const std::string& destDtype) {
+    const std::string& outType = destDtype.empty() ? dtype : destDtype;
+    uint64_t nelem = dest.size / getTypeSize(outType);
+
+    bool gpuStores = runtime.hasGpu && supportsDtype(runtime.registry, dtype) && supportsDtype(runtime.registry, outType);
+    if (!gpuStores || nelem < runtime.gpuThreshold) return createCpuKernel(op, src, dest, dtype, destDtype);
+    return createKernel(runtime.registry, op, src, dest, dtype, destDtype);
+}
+
+// Runs the kernel to completion on its backend. Results can be read from the destination's mapping afterwards.
+void runKernel(Runtime& runtime, Kernel& kernel) {
+    if (kernel.backend == BACKEND_CPU) {
+        runCpuKernel(*runtime.threadPool, kernel);
+        return;
+    }
+
+    vkResetCommandBuffer(runtime.commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(runtime.commandBuffer, &beginInfo);
+
+    recordKernel(runtime.commandBuffer, kernel);
+
+    // The host reads the result through the mapping
+    VkMemoryBarrier toHost{};
+    toHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    toHost.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(runtime.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &toHost, 0, nullptr, 0, nullptr);
+
+    vkEndCommandBuffer(runtime.commandBuffer);
+    executeCommandBuffer(runtime.device, runtime.commandBuffer, runtime.queue);
+}
+
+void destroyRuntime(Runtime& runtime) {
+    destroyThreadPool(runtime.threadPool);
+    runtime.threadPool = nullptr;
+
+    if (!runtime.hasGpu) return;
+    destroyPipelineRegistry(runtime.registry);
+    vkDestroyCommandPool(runtime.device, runtime.commandPool, nullptr);
+    vkDestroyDevice(runtime.device, nullptr);
+    vkDestroyInstance(runtime.instance, nullptr);
+}
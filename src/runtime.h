@@ -0,0 +1,37 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include "./util.h"
+#include "./pipeline_cache.h"
+#include "./kernel.h"
+#include "./cpu_backend.h"
+#include "./autotune.h"
+
+// Runs elementwise kernels on whichever backend is faster for their size.
+// Buffers from createRuntimeBuffer are visible to both the CPU and the GPU, so the choice is made per kernel.
+// Without a usable Vulkan device everything runs on the CPU.
+struct Runtime {
+    bool hasGpu;
+    VkInstance instance;
+    VkPhysicalDevice physicalDevice;
+    VkDevice device;
+    uint32_t queueFamilyIndex;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    PipelineRegistry registry;
+
+    ThreadPool* threadPool;
+
+    // Kernels with fewer elements than this run on the CPU
+    uint32_t gpuThreshold;
+};
+
+Runtime createRuntime(bool calibrate = true);
+uint32_t measureGpuThreshold(Runtime& runtime);
+Buffer createRuntimeBuffer(Runtime& runtime, VkDeviceSize size, uint32_t binding);
+Kernel createRuntimeKernel(Runtime& runtime, Ops op, std::vector<Buffer> src, Buffer dest, const std::string& dtype = "float", const std::string& destDtype = "");
+void runKernel(Runtime& runtime, Kernel& kernel);
+void destroyRuntime(Runtime& runtime);
+
+#endif // RUNTIME_H
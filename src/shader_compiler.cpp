@@ -0,0 +1,295 @@
+#include "./shader_compiler.h"
+#include "./util.h"
+#include "./pipeline_cache.h"
+#include "./cpu_backend.h"
+#include "./profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef VKCOMPUTE_SHADERC
+#include <shaderc/shaderc.h>
+#endif
+
+// Both are set by CMake, the defaults only work when running from the build directory with glslangValidator in PATH
+#ifndef GLSLANG_VALIDATOR
+#define GLSLANG_VALIDATOR "glslangValidator"
+#endif
+#ifndef SHADER_INCLUDE_DIR
+#define SHADER_INCLUDE_DIR "shaders"
+#endif
+
+// Part of every cache key, bump it when the compile options change
+static const char* const spirvCacheVersion = "1";
+
+static std::atomic<uint32_t> compiledShaders(0);
+static std::atomic<uint32_t> cachedShaders(0);
+static std::atomic<uint64_t> compileMicroseconds(0);
+
+const char* shaderCompilerName() {
+#ifdef VKCOMPUTE_SHADERC
+    return "shaderc";
+#else
+    return "glslangValidator";
+#endif
+}
+
+std::string spirvCacheDirectory() {
+    const char* directory = std::getenv("VKCOMPUTE_SPIRV_CACHE");
+    return directory != nullptr ? directory : "spirv_cache";
+}
+
+ShaderCompilerStats shaderCompilerStats() {
+    ShaderCompilerStats stats;
+    stats.compiled = compiledShaders;
+    stats.cacheHits = cachedShaders;
+    stats.compileMs = compileMicroseconds / 1000.0;
+    return stats;
+}
+
+static bool readText(const std::string& path, std::string& text) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    text = contents.str();
+    return true;
+}
+
+// Folds every file the source includes (and what they include) into the hash, so editing a .glsl invalidates
+// the kernels that use it
+static uint64_t hashIncludes(const std::string& source, uint64_t hash, std::set<std::string>& seen) {
+    std::istringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t directive = line.find("#include");
+        size_t open = line.find('"');
+        size_t close = line.rfind('"');
+        if (directive == std::string::npos || open == std::string::npos || close <= open) continue;
+
+        std::string name = line.substr(open + 1, close - open - 1);
+        if (!seen.insert(name).second) continue;
+
+        std::string included;
+        if (!readText(std::string(SHADER_INCLUDE_DIR) + "/" + name, included)) continue;
+        hash = hashBytes(included.data(), included.size(), hash);
+        hash = hashIncludes(included, hash, seen);
+    }
+    return hash;
+}
+
+static uint64_t shaderHash(const std::string& source, const std::vector<std::string>& defines) {
+    uint64_t hash = hashBytes(spirvCacheVersion, std::strlen(spirvCacheVersion));
+    hash = hashBytes(shaderCompilerName(), std::strlen(shaderCompilerName()), hash);
+    for (const std::string& define : defines) hash = hashBytes(define.c_str(), define.size() + 1, hash);
+    hash = hashBytes(source.data(), source.size(), hash);
+
+    std::set<std::string> seen;
+    return hashIncludes(source, hash, seen);
+}
+
+static std::string cachePath(uint64_t hash) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(hash));
+    return spirvCacheDirectory() + "/" + name;
+}
+
+static bool loadCachedSpirv(uint64_t hash, std::vector<char>& spirv) {
+    if (spirvCacheDirectory().empty()) return false;
+
+    std::string text;
+    if (!readText(cachePath(hash), text)) return false;
+
+    // Anything but whole words starting with the SPIR-V magic number is a broken write, compile it again
+    uint32_t magic = 0;
+    if (text.size() >= sizeof(magic)) std::memcpy(&magic, text.data(), sizeof(magic));
+    if (text.size() % 4 != 0 || magic != 0x07230203) return false;
+
+    spirv.assign(text.begin(), text.end());
+    return true;
+}
+
+// Written to a temporary file and renamed, so other threads and processes never see half a shader
+static void storeCachedSpirv(uint64_t hash, const std::vector<char>& spirv) {
+    std::string directory = spirvCacheDirectory();
+    if (directory.empty()) return;
+    mkdir(directory.c_str(), 0755);
+
+    static std::atomic<uint32_t> writes(0);
+    std::string path = cachePath(hash);
+    std::string temporary = path + "." + std::to_string(getpid()) + "." + std::to_string(writes++) + ".tmp";
+
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return;
+    file.write(spirv.data(), spirv.size());
+    file.close();
+
+    if (!file || std::rename(temporary.c_str(), path.c_str()) != 0) std::remove(temporary.c_str());
+}
+
+#ifdef VKCOMPUTE_SHADERC
+
+struct IncludedFile {
+    shaderc_include_result result;
+    std::string name;
+    std::string content;
+};
+
+// #include "name" resolves against the shader directory, like -I for glslangValidator.
+// An empty source name tells shaderc the include failed, the content is the error then.
+static shaderc_include_result* resolveInclude(void*, const char* requested, int, const char*, size_t) {
+    IncludedFile* file = new IncludedFile();
+    file->name = std::string(SHADER_INCLUDE_DIR) + "/" + requested;
+    if (!readText(file->name, file->content)) {
+        file->content = "Can not open " + file->name;
+        file->name.clear();
+    }
+
+    file->result.source_name = file->name.c_str();
+    file->result.source_name_length = file->name.size();
+    file->result.content = file->content.c_str();
+    file->result.content_length = file->content.size();
+    file->result.user_data = file;
+    return &file->result;
+}
+
+static void releaseInclude(void*, shaderc_include_result* result) {
+    delete static_cast<IncludedFile*>(result->user_data);
+}
+
+// One compiler for the process, shaderc allows compiling with it from several threads at once
+static shaderc_compiler_t sharedCompiler() {
+    static shaderc_compiler_t compiler = shaderc_compiler_initialize();
+    if (compiler == nullptr) throw std::runtime_error("Failed to initialize shaderc!");
+    return compiler;
+}
+
+static std::vector<char> runCompiler(const std::string& source, const std::vector<std::string>& defines) {
+    shaderc_compile_options_t options = shaderc_compile_options_initialize();
+    shaderc_compile_options_set_include_callbacks(options, resolveInclude, releaseInclude, nullptr);
+    for (const std::string& define : defines) {
+        size_t equals = define.find('=');
+        std::string name = define.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : define.substr(equals + 1);
+        shaderc_compile_options_add_macro_definition(options, name.data(), name.size(), value.data(), value.size());
+    }
+
+    shaderc_compilation_result_t result = shaderc_compile_into_spv(sharedCompiler(), source.data(), source.size(),
+                                                                   shaderc_compute_shader, "generated.comp", "main", options);
+    shaderc_compile_options_release(options);
+
+    if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success) {
+        std::string log = shaderc_result_get_error_message(result);
+        shaderc_result_release(result);
+        throw std::runtime_error("Failed to compile generated shader!\n" + log + "\n" + source);
+    }
+
+    std::vector<char> spirv(shaderc_result_get_bytes(result), shaderc_result_get_bytes(result) + shaderc_result_get_length(result));
+    shaderc_result_release(result);
+    return spirv;
+}
+
+#else
+
+// Runs glslangValidator on a temporary file
+static std::vector<char> runCompiler(const std::string& source, const std::vector<std::string>& defines) {
+    static std::atomic<uint32_t> runs(0);
+
+    const char* tmpDir = getenv("TMPDIR");
+    std::ostringstream base;
+    base << (tmpDir != nullptr ? tmpDir : "/tmp") << "/fused_" << std::hex << hashBytes(source.data(), source.size()) << "_"
+         << std::dec << getpid() << "_" << runs++;
+
+    std::string glslPath = base.str() + ".comp";
+    std::string spirvPath = base.str() + ".spv";
+
+    {
+        std::ofstream file(glslPath, std::ios::trunc);
+        if (!file.is_open()) throw std::runtime_error("Failed to write generated shader!");
+        file << source;
+    }
+
+    std::string command = std::string("\"") + GLSLANG_VALIDATOR + "\" -V -I\"" + SHADER_INCLUDE_DIR + "\"";
+    for (const std::string& define : defines) command += " \"-D" + define + "\"";
+    command += " \"" + glslPath + "\" -o \"" + spirvPath + "\" 2>&1";
+
+    FILE* pipe = popen(command.c_str(), "r");
+    if (pipe == nullptr) throw std::runtime_error("Failed to run glslangValidator!");
+
+    std::string log;
+    char line[256];
+    while (fgets(line, sizeof(line), pipe) != nullptr) log += line;
+
+    int status = pclose(pipe);
+    std::remove(glslPath.c_str());
+
+    if (status != 0) {
+        std::remove(spirvPath.c_str());
+        throw std::runtime_error("Failed to compile generated shader!\n" + log + "\n" + source);
+    }
+
+    std::vector<char> spirv = readFile(spirvPath);
+    std::remove(spirvPath.c_str());
+    return spirv;
+}
+
+#endif
+
+std::vector<char> compileGlsl(const std::string& source, const std::vector<std::string>& defines) {
+    uint64_t hash = shaderHash(source, defines);
+
+    std::vector<char> spirv;
+    if (loadCachedSpirv(hash, spirv)) {
+        cachedShaders++;
+        return spirv;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    spirv = runCompiler(source, defines);
+    compileMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    compiledShaders++;
+
+    storeCachedSpirv(hash, spirv);
+    return spirv;
+}
+
+// Compiles independent shaders side by side on a pool of its own, one shader per task.
+// Calls from several threads take turns on the pool.
+std::vector<std::vector<char>> compileGlslParallel(const std::vector<ShaderSource>& shaders) {
+    static std::mutex poolMutex;
+    static ThreadPool* pool = nullptr;
+
+    std::vector<std::vector<char>> spirv(shaders.size());
+    std::vector<std::string> errors(shaders.size());
+
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (pool == nullptr) pool = createThreadPool();
+
+    // The profiler is not thread safe, the whole batch is one scope on this thread
+    HostScope profile("compileGlslParallel", "compile", shaders.size());
+
+    parallelEach(*pool, shaders.size(), [&](size_t i) {
+        try {
+            spirv[i] = compileGlsl(shaders[i].source, shaders[i].defines);
+        } catch (const std::exception& e) {
+            errors[i] = e.what();
+        }
+    });
+
+    for (const std::string& error : errors) {
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+    return spirv;
+}
+
+// A .comp file compiled at runtime instead of through add_shader, e.g. with defines only known at runtime
+std::vector<char> compileGlslFile(const std::string& path, const std::vector<std::string>& defines) {
+    std::string source;
+    if (!readText(path, source)) throw std::runtime_error("Failed to open " + path + "!");
+    return compileGlsl(source, defines);
+}
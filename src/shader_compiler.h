@@ -0,0 +1,32 @@
+#ifndef SHADER_COMPILER_H
+#define SHADER_COMPILER_H
+
+#include <string>
+#include <vector>
+
+// GLSL -> SPIR-V at runtime, for kernels that only exist once a graph is known.
+// With shaderc (found by CMake) the compiler runs in-process, otherwise glslangValidator is started per shader.
+// Either way the SPIR-V goes into an on-disk cache keyed by the hash of the source and the defines, so a kernel is
+// only ever compiled once per machine. The cache lives in ./spirv_cache, VKCOMPUTE_SPIRV_CACHE moves it
+// (an empty value turns it off). #include resolves against src/shaders.
+
+// One shader to compile. Defines are NAME=VALUE (or just NAME), as with -D.
+struct ShaderSource {
+    std::string source;
+    std::vector<std::string> defines;
+};
+
+struct ShaderCompilerStats {
+    uint32_t compiled;
+    uint32_t cacheHits;
+    double compileMs; // summed over threads
+};
+
+std::vector<char> compileGlsl(const std::string& source, const std::vector<std::string>& defines = {});
+std::vector<std::vector<char>> compileGlslParallel(const std::vector<ShaderSource>& shaders);
+std::vector<char> compileGlslFile(const std::string& path, const std::vector<std::string>& defines = {});
+const char* shaderCompilerName();
+std::string spirvCacheDirectory();
+ShaderCompilerStats shaderCompilerStats();
+
+#endif // SHADER_COMPILER_H
@@ -0,0 +1,36 @@
+// Opcodes shared between the kernels and src/kernel.h (see optypes)
+
+// Unary
+#define OP_EXP2 0
+#define OP_LOG2 1
+#define OP_CAST 2
+#define OP_BITCAST 3
+#define OP_SIN 4
+#define OP_SQRT 5
+#define OP_RECIP 6
+#define OP_NEG 7
+
+// Binary
+#define OP_ADD 8
+#define OP_MUL 9
+#define OP_IDIV 10
+#define OP_MAX 11
+#define OP_MOD 12
+#define OP_CMPLT 13
+#define OP_CMPNE 14
+#define OP_XOR 15
+#define OP_SHL 16
+#define OP_SHR 17
+#define OP_OR 18
+#define OP_AND 19
+#define OP_THREEFRY 20
+#define OP_SUB 21
+
+// Ternary
+#define OP_WHERE 22
+#define OP_MULACC 23
+
+// Reduce
+#define OP_SUM 24
+#define OP_PROD 25
+#define OP_REDUCE_MAX 26
@@ -0,0 +1,27 @@
+// Helpers for the narrow dtypes. Kernels load float16, bfloat16 and int8 values, widen them to the
+// type they compute in (float or int), and narrow the result again on the way out.
+// float16 and int8 are native storage types (16 and 8 bit storage), bfloat16 is stored as uint16_t.
+
+// bfloat16 is the upper half of a float
+vec4 bfloat16ToFloat(uvec4 bits) { return uintBitsToFloat(bits << 16); }
+float bfloat16ToFloat(uint bits) { return uintBitsToFloat(bits << 16); }
+
+// Rounds to nearest even, NaNs stay NaNs
+uvec4 floatToBfloat16(vec4 value) {
+    uvec4 bits = floatBitsToUint(value);
+    uvec4 rounded = (bits + 0x7fffu + ((bits >> 16) & 1u)) >> 16;
+    return mix(rounded, (bits >> 16) | 0x40u, isnan(value));
+}
+uint floatToBfloat16(float value) { return floatToBfloat16(vec4(value)).x; }
+
+// float16 bits of a float and back, through the pack functions, which need no 16 bit arithmetic.
+// Only fused kernels need these, for a BITCAST between float16 and bfloat16.
+uvec4 floatToFloat16(vec4 value) {
+    uint xy = packHalf2x16(value.xy);
+    uint zw = packHalf2x16(value.zw);
+    return uvec4(xy & 0xffffu, xy >> 16, zw & 0xffffu, zw >> 16);
+}
+uint floatToFloat16(float value) { return packHalf2x16(vec2(value, 0.0)); }
+
+vec4 float16ToFloat(uvec4 bits) { return vec4(unpackHalf2x16(bits.x | (bits.y << 16)), unpackHalf2x16(bits.z | (bits.w << 16))); }
+float float16ToFloat(uint bits) { return unpackHalf2x16(bits).x; }
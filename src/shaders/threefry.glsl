@@ -0,0 +1,38 @@
+// Threefry-2x32 with 20 rounds (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+// Counter based: the same key and counter always give the same bits, on any device.
+
+uint rotl32(uint x, uint r) {
+    return (x << r) | (x >> (32u - r));
+}
+
+uvec2 threefry2x32(uvec2 key, uvec2 counter) {
+    const uint rotations[8] = uint[8](13u, 15u, 26u, 6u, 17u, 29u, 16u, 24u);
+    uint ks[3] = uint[3](key.x, key.y, 0x1BD11BDAu ^ key.x ^ key.y);
+
+    uvec2 x = counter + key;
+
+    for (uint r = 0u; r < 20u; r++) {
+        x.x += x.y;
+        x.y = rotl32(x.y, rotations[r % 8u]);
+        x.y ^= x.x;
+
+        // Key injection after every fourth round
+        if (r % 4u == 3u) {
+            uint s = r / 4u + 1u;
+            x.x += ks[s % 3u];
+            x.y += ks[(s + 1u) % 3u] + s;
+        }
+    }
+
+    return x;
+}
+
+// 32 random bits per element: the element is the counter, the key comes from the second operand
+uint threefryBits(uint counter, uint key) {
+    return threefry2x32(uvec2(key, 0u), uvec2(counter, 0u)).x;
+}
+
+uvec4 threefryBits(uvec4 counter, uvec4 key) {
+    return uvec4(threefryBits(counter.x, key.x), threefryBits(counter.y, key.y),
+                 threefryBits(counter.z, key.z), threefryBits(counter.w, key.w));
+}
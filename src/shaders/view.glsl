@@ -0,0 +1,21 @@
+// Strided loads for generated shaders, the GLSL side of src/view.h.
+// Views come in through push constants (ViewParams), so one shader serves every view of the same inputs.
+
+#define MAX_VIEW_DIMS 4
+
+struct View {
+    uint offset;
+    uint shape[MAX_VIEW_DIMS];
+    int strides[MAX_VIEW_DIMS];
+};
+
+// Buffer index of element `i` of the view, counting in row-major order over its shape.
+// Unused dimensions have a size of 1, broadcast ones a stride of 0.
+uint viewIndex(View view, uint i) {
+    int index = int(view.offset);
+    for (int d = MAX_VIEW_DIMS - 1; d >= 0; d--) {
+        index += int(i % view.shape[d]) * view.strides[d];
+        i /= view.shape[d];
+    }
+    return uint(index);
+}
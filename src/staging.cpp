@@ -0,0 +1,187 @@
+#include "./staging.h"
+#include "./profiler.h"
+
+#include <algorithm>
+
+// Segments are kept 256 byte aligned, copies out of nicely aligned offsets are faster on most hardware
+static VkDeviceSize segmentCapacity(VkDeviceSize ringSize, size_t segmentCount) {
+    return (ringSize / segmentCount) & ~VkDeviceSize(255);
+}
+
+StagingRing createStagingRing(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamilyIndex, VkQueue queue, VkDeviceSize size, uint32_t segmentCount) {
+    if (segmentCount == 0) throw std::runtime_error("Staging ring needs at least one segment!");
+
+    StagingRing ring;
+    ring.device = device;
+    ring.queue = queue;
+    ring.staging = createBuffer(physicalDevice, device, size, 0, MEMORY_HOST_VISIBLE);
+    ring.next = 0;
+
+    ring.mapped = hostPointer<char>(ring.staging);
+
+    // The segment command buffers get re-recorded for every chunk, so they need to be individually resettable
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &ring.commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create staging command pool!");
+    }
+
+    VkDeviceSize segmentSize = segmentCapacity(size, segmentCount);
+    if (segmentSize == 0) throw std::runtime_error("Staging ring is too small for the requested number of segments!");
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    ring.segments.resize(segmentCount);
+    for (uint32_t i = 0; i < segmentCount; i++) {
+        StagingSegment& segment = ring.segments[i];
+        segment.offset = i * segmentSize;
+        segment.commandBuffer = createCommandBuffer(device, ring.commandPool);
+        vkCreateFence(device, &fenceInfo, nullptr, &segment.fence);
+        segment.pending = false;
+        segment.hostDest = nullptr;
+        segment.bytes = 0;
+    }
+
+    return ring;
+}
+
+// Waits until the GPU is done with a segment. For downloads this is where the data reaches the host.
+static void finishSegment(StagingRing& ring, StagingSegment& segment) {
+    if (!segment.pending) return;
+
+    vkWaitForFences(ring.device, 1, &segment.fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(ring.device, 1, &segment.fence);
+
+    if (segment.hostDest != nullptr) {
+        memcpy(segment.hostDest, ring.mapped + segment.offset, segment.bytes);
+        segment.hostDest = nullptr;
+    }
+
+    segment.pending = false;
+}
+
+// Records a single copy between the staging buffer and a device buffer.
+// The barriers make sure the copy does not race with kernels that use the device buffer
+// before or after the transfer, and that downloaded data is visible to the host.
+static void recordStagingCopy(StagingSegment& segment, VkBuffer srcBuffer, VkBuffer dstBuffer, VkBufferCopy region, bool upload) {
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(segment.commandBuffer, &beginInfo);
+
+    VkMemoryBarrier before{};
+    before.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    before.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    before.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(segment.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &before, 0, nullptr, 0, nullptr);
+
+    uint32_t scope = beginGpuScope(segment.commandBuffer, upload ? "upload" : "download", "copy", region.size);
+    vkCmdCopyBuffer(segment.commandBuffer, srcBuffer, dstBuffer, 1, &region);
+    endGpuScope(segment.commandBuffer, scope);
+
+    VkMemoryBarrier after{};
+    after.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    after.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    after.dstAccessMask = upload ? VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT : VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(segment.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         upload ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &after, 0, nullptr, 0, nullptr);
+
+    vkEndCommandBuffer(segment.commandBuffer);
+}
+
+static void submitSegment(StagingRing& ring, StagingSegment& segment) {
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &segment.commandBuffer;
+
+    markSubmit();
+    if (vkQueueSubmit(ring.queue, 1, &submitInfo, segment.fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit staging copy!");
+    }
+    segment.pending = true;
+}
+
+// Moves `size` bytes through the ring, one segment-sized chunk at a time.
+// While the GPU copies chunk N out of (or into) one segment, the CPU fills (or drains) the next one.
+static void stagedTransfer(StagingRing& ring, Buffer& buffer, char* host, VkDeviceSize offset, VkDeviceSize size, bool upload) {
+    if (offset + size > buffer.size) throw std::runtime_error("Staged transfer exceeds buffer bounds!");
+
+    VkDeviceSize chunkSize = segmentCapacity(ring.staging.size, ring.segments.size());
+    VkDeviceSize done = 0;
+
+    while (done < size) {
+        StagingSegment& segment = ring.segments[ring.next];
+        ring.next = (ring.next + 1) % ring.segments.size();
+
+        finishSegment(ring, segment);
+
+        VkDeviceSize bytes = std::min(chunkSize, size - done);
+
+        VkBufferCopy region{};
+        region.size = bytes;
+
+        if (upload) {
+            memcpy(ring.mapped + segment.offset, host + done, bytes);
+            region.srcOffset = segment.offset;
+            region.dstOffset = buffer.descriptorInfo.offset + offset + done;
+            recordStagingCopy(segment, ring.staging.buffer, buffer.buffer, region, true);
+        } else {
+            region.srcOffset = buffer.descriptorInfo.offset + offset + done;
+            region.dstOffset = segment.offset;
+            recordStagingCopy(segment, buffer.buffer, ring.staging.buffer, region, false);
+            segment.hostDest = host + done;
+        }
+
+        segment.bytes = bytes;
+        submitSegment(ring, segment);
+        done += bytes;
+    }
+
+    // Transfers are synchronous from the caller's point of view, just like the mapped copies
+    for (StagingSegment& segment : ring.segments) {
+        finishSegment(ring, segment);
+    }
+}
+
+// Copies data from CPU memory into a buffer through the staging ring
+void uploadToBuffer(StagingRing& ring, Buffer& dest, const void* src, VkDeviceSize offset, VkDeviceSize size) {
+    stagedTransfer(ring, dest, static_cast<char*>(const_cast<void*>(src)), offset, size, true);
+}
+
+// Copies data from a buffer back to CPU memory through the staging ring
+void downloadFromBuffer(StagingRing& ring, Buffer& src, void* dest, VkDeviceSize offset, VkDeviceSize size) {
+    stagedTransfer(ring, src, static_cast<char*>(dest), offset, size, false);
+}
+
+// Copies data from CPU memory to VRAM
+// Host-visible buffers are written through their mapping, device-local buffers go through the staging ring.
+void copyToBuffer(StagingRing& ring, Buffer& dest, const void* src, VkDeviceSize offset, VkDeviceSize size) {
+    if (dest.memoryMode == MEMORY_DEVICE_LOCAL) uploadToBuffer(ring, dest, src, offset, size);
+    else copyToBuffer(dest, src, offset, size);
+}
+
+// Copies data from VRAM to CPU memory
+void copyBufferFromDevice(StagingRing& ring, Buffer& src, void* dest, VkDeviceSize offset, VkDeviceSize size) {
+    if (src.memoryMode == MEMORY_DEVICE_LOCAL) downloadFromBuffer(ring, src, dest, offset, size);
+    else copyBufferFromDevice(src, dest, offset, size);
+}
+
+void destroyStagingRing(StagingRing& ring) {
+    for (StagingSegment& segment : ring.segments) {
+        finishSegment(ring, segment);
+        vkDestroyFence(ring.device, segment.fence, nullptr);
+    }
+
+    vkDestroyCommandPool(ring.device, ring.commandPool, nullptr);
+
+    std::vector<Buffer> buffers = {ring.staging};
+    destroyBuffers(buffers);
+}
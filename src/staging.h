@@ -0,0 +1,37 @@
+#ifndef STAGING_H
+#define STAGING_H
+
+#include "./util.h"
+
+// One slice of the staging ring. Each segment has its own command buffer and fence,
+// so the CPU can fill one segment while the GPU is still copying out of another.
+struct StagingSegment {
+    VkDeviceSize offset;
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    bool pending;
+
+    // Set for downloads: where the segment contents go once the fence has signaled
+    void* hostDest;
+    VkDeviceSize bytes;
+};
+
+// A reusable host-visible buffer that is used to move data between the CPU and device-local buffers
+struct StagingRing {
+    VkDevice device;
+    VkQueue queue;
+    Buffer staging;
+    char* mapped;
+    VkCommandPool commandPool;
+    std::vector<StagingSegment> segments;
+    uint32_t next;
+};
+
+StagingRing createStagingRing(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamilyIndex, VkQueue queue, VkDeviceSize size, uint32_t segmentCount = 2);
+void uploadToBuffer(StagingRing& ring, Buffer& dest, const void* src, VkDeviceSize offset, VkDeviceSize size);
+void downloadFromBuffer(StagingRing& ring, Buffer& src, void* dest, VkDeviceSize offset, VkDeviceSize size);
+void copyToBuffer(StagingRing& ring, Buffer& dest, const void* src, VkDeviceSize offset, VkDeviceSize size);
+void copyBufferFromDevice(StagingRing& ring, Buffer& src, void* dest, VkDeviceSize offset, VkDeviceSize size);
+void destroyStagingRing(StagingRing& ring);
+
+#endif // STAGING_H
@@ -0,0 +1,275 @@
+#include "./stream.h"
+#include "./profiler.h"
+
+#include <algorithm>
+#include <chrono>
+
+StreamQueues getStreamQueues(VkDevice device, uint32_t computeFamily, uint32_t transferFamily) {
+    StreamQueues queues;
+    queues.computeFamily = computeFamily;
+    queues.compute = getQueue(device, computeFamily, 0);
+
+    if (transferFamily == UINT32_MAX || transferFamily == computeFamily) {
+        queues.transferFamily = computeFamily;
+        queues.transfer = queues.compute;
+    } else {
+        queues.transferFamily = transferFamily;
+        queues.transfer = getQueue(device, transferFamily, 0);
+    }
+
+    return queues;
+}
+
+static VkCommandPool createResettableCommandPool(VkDevice device, uint32_t queueFamilyIndex) {
+    // Every chunk re-records the command buffers of its tile
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+    VkCommandPool commandPool;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create stream command pool!");
+    }
+    return commandPool;
+}
+
+// Each tile holds `tileBytes` of every input and output, in device-local memory and in staging memory.
+// Use at least two tiles, with one there is nothing to overlap.
+Stream createStream(VkPhysicalDevice physicalDevice, VkDevice device, const StreamQueues& queues, uint32_t inputCount, uint32_t outputCount, VkDeviceSize tileBytes, uint32_t tileCount) {
+    if (tileCount == 0 || tileBytes == 0) throw std::runtime_error("A stream needs at least one non-empty tile!");
+
+    Stream stream;
+    stream.device = device;
+    stream.queues = queues;
+    stream.dedicatedTransfer = queues.transferFamily != queues.computeFamily;
+    stream.computePool = createResettableCommandPool(device, queues.computeFamily);
+    stream.transferPool = stream.dedicatedTransfer ? createResettableCommandPool(device, queues.transferFamily) : stream.computePool;
+    stream.tileBytes = tileBytes;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    stream.tiles.resize(tileCount);
+    for (StreamTile& tile : stream.tiles) {
+        for (uint32_t i = 0; i < inputCount; i++) {
+            tile.inputs.push_back(createBuffer(physicalDevice, device, tileBytes, i, MEMORY_DEVICE_LOCAL));
+        }
+        for (uint32_t i = 0; i < outputCount; i++) {
+            tile.outputs.push_back(createBuffer(physicalDevice, device, tileBytes, inputCount + i, MEMORY_DEVICE_LOCAL));
+        }
+
+        tile.staging = createBuffer(physicalDevice, device, tileBytes * (inputCount + outputCount), 0, MEMORY_HOST_VISIBLE);
+        tile.mapped = hostPointer<char>(tile.staging);
+
+        tile.uploadCommands = createCommandBuffer(device, stream.transferPool);
+        tile.computeCommands = createCommandBuffer(device, stream.computePool);
+        tile.downloadCommands = createCommandBuffer(device, stream.transferPool);
+
+        if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &tile.uploaded) != VK_SUCCESS ||
+            vkCreateSemaphore(device, &semaphoreInfo, nullptr, &tile.computed) != VK_SUCCESS ||
+            vkCreateFence(device, &fenceInfo, nullptr, &tile.downloaded) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create stream synchronization objects!");
+        }
+
+        tile.pending = false;
+        tile.chunkOffset = 0;
+        tile.chunkBytes = 0;
+    }
+
+    return stream;
+}
+
+// Hands a buffer over from one queue family to another. The same barrier is recorded on both sides:
+// as the release on the source queue and as the acquire on the destination queue.
+static void recordOwnershipTransfer(VkCommandBuffer commandBuffer, const std::vector<Buffer>& buffers, uint32_t srcFamily, uint32_t dstFamily,
+                                    VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    std::vector<VkBufferMemoryBarrier> barriers;
+    for (const Buffer& buffer : buffers) {
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        barrier.srcQueueFamilyIndex = srcFamily;
+        barrier.dstQueueFamilyIndex = dstFamily;
+        barrier.buffer = buffer.buffer;
+        barrier.offset = buffer.descriptorInfo.offset;
+        barrier.size = buffer.size;
+        barriers.push_back(barrier);
+    }
+
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr,
+                         static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+}
+
+static void beginCommands(VkCommandBuffer commandBuffer) {
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+}
+
+static void submit(VkQueue queue, VkCommandBuffer commandBuffer, VkSemaphore wait, VkPipelineStageFlags waitStage, VkSemaphore signal, VkFence fence) {
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.waitSemaphoreCount = wait != VK_NULL_HANDLE ? 1 : 0;
+    submitInfo.pWaitSemaphores = &wait;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.signalSemaphoreCount = signal != VK_NULL_HANDLE ? 1 : 0;
+    submitInfo.pSignalSemaphores = &signal;
+
+    markSubmit();
+    if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit stream commands!");
+    }
+}
+
+// Copies the chunk's inputs to the tile and runs the compute on it
+static void submitUploadAndCompute(Stream& stream, StreamTile& tile, uint32_t tileIndex, const StreamComputeFn& recordCompute) {
+    const StreamQueues& queues = stream.queues;
+
+    beginCommands(tile.uploadCommands);
+    for (size_t i = 0; i < tile.inputs.size(); i++) {
+        VkBufferCopy region{};
+        region.srcOffset = tile.staging.descriptorInfo.offset + i * stream.tileBytes;
+        region.dstOffset = tile.inputs[i].descriptorInfo.offset;
+        region.size = tile.chunkBytes;
+        vkCmdCopyBuffer(tile.uploadCommands, tile.staging.buffer, tile.inputs[i].buffer, 1, &region);
+    }
+    if (stream.dedicatedTransfer) {
+        recordOwnershipTransfer(tile.uploadCommands, tile.inputs, queues.transferFamily, queues.computeFamily,
+                                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+    }
+    vkEndCommandBuffer(tile.uploadCommands);
+
+    beginCommands(tile.computeCommands);
+    if (stream.dedicatedTransfer) {
+        recordOwnershipTransfer(tile.computeCommands, tile.inputs, queues.transferFamily, queues.computeFamily,
+                                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    }
+
+    recordCompute(tile.computeCommands, tile, tileIndex, tile.chunkBytes);
+
+    if (stream.dedicatedTransfer) {
+        recordOwnershipTransfer(tile.computeCommands, tile.outputs, queues.computeFamily, queues.transferFamily,
+                                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+    }
+    vkEndCommandBuffer(tile.computeCommands);
+
+    // The semaphores carry the memory dependency between the queues (and on a shared queue as well)
+    submit(queues.transfer, tile.uploadCommands, VK_NULL_HANDLE, 0, tile.uploaded, VK_NULL_HANDLE);
+    submit(queues.compute, tile.computeCommands, tile.uploaded, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, tile.computed, VK_NULL_HANDLE);
+}
+
+// Copies the tile's outputs back to staging once its compute is done
+static void submitDownload(Stream& stream, StreamTile& tile) {
+    const StreamQueues& queues = stream.queues;
+    size_t inputCount = tile.inputs.size();
+
+    beginCommands(tile.downloadCommands);
+    if (stream.dedicatedTransfer) {
+        recordOwnershipTransfer(tile.downloadCommands, tile.outputs, queues.computeFamily, queues.transferFamily,
+                                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    }
+    for (size_t i = 0; i < tile.outputs.size(); i++) {
+        VkBufferCopy region{};
+        region.srcOffset = tile.outputs[i].descriptorInfo.offset;
+        region.dstOffset = tile.staging.descriptorInfo.offset + (inputCount + i) * stream.tileBytes;
+        region.size = tile.chunkBytes;
+        vkCmdCopyBuffer(tile.downloadCommands, tile.outputs[i].buffer, tile.staging.buffer, 1, &region);
+    }
+
+    VkMemoryBarrier toHost{};
+    toHost.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(tile.downloadCommands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &toHost, 0, nullptr, 0, nullptr);
+    vkEndCommandBuffer(tile.downloadCommands);
+
+    submit(queues.transfer, tile.downloadCommands, tile.computed, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_NULL_HANDLE, tile.downloaded);
+    tile.pending = true;
+}
+
+// Waits for the tile's last chunk and copies its outputs to the host arrays
+static void finishTile(Stream& stream, StreamTile& tile, const std::vector<void*>& outputs) {
+    if (!tile.pending) return;
+
+    vkWaitForFences(stream.device, 1, &tile.downloaded, VK_TRUE, UINT64_MAX);
+    vkResetFences(stream.device, 1, &tile.downloaded);
+
+    size_t inputCount = tile.inputs.size();
+    for (size_t i = 0; i < outputs.size(); i++) {
+        memcpy(static_cast<char*>(outputs[i]) + tile.chunkOffset, tile.mapped + (inputCount + i) * stream.tileBytes, tile.chunkBytes);
+    }
+
+    tile.pending = false;
+}
+
+// Runs `recordCompute` over `bytes` bytes of every input, writing `bytes` bytes of every output.
+// Chunk N is uploaded and computed, then the download of chunk N-1 is queued behind it, so the
+// transfer queue never waits on a compute that is still running while it could be uploading.
+StreamStats runStream(Stream& stream, const std::vector<const void*>& inputs, const std::vector<void*>& outputs, VkDeviceSize bytes, const StreamComputeFn& recordCompute) {
+    StreamTile& first = stream.tiles[0];
+    if (inputs.size() != first.inputs.size() || outputs.size() != first.outputs.size()) {
+        throw std::runtime_error("Stream was created for a different number of inputs or outputs!");
+    }
+
+    uint32_t tileCount = static_cast<uint32_t>(stream.tiles.size());
+    uint32_t chunks = static_cast<uint32_t>((bytes + stream.tileBytes - 1) / stream.tileBytes);
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t chunk = 0; chunk <= chunks; chunk++) {
+        if (chunk < chunks) {
+            uint32_t tileIndex = chunk % tileCount;
+            StreamTile& tile = stream.tiles[tileIndex];
+            finishTile(stream, tile, outputs);
+
+            tile.chunkOffset = VkDeviceSize(chunk) * stream.tileBytes;
+            tile.chunkBytes = std::min(stream.tileBytes, bytes - tile.chunkOffset);
+            for (size_t i = 0; i < inputs.size(); i++) {
+                memcpy(tile.mapped + i * stream.tileBytes, static_cast<const char*>(inputs[i]) + tile.chunkOffset, tile.chunkBytes);
+            }
+
+            submitUploadAndCompute(stream, tile, tileIndex, recordCompute);
+
+            // A single tile has nothing to overlap with, it gets downloaded straight away
+            if (tileCount == 1) submitDownload(stream, tile);
+        }
+
+        if (chunk > 0 && tileCount > 1) submitDownload(stream, stream.tiles[(chunk - 1) % tileCount]);
+    }
+
+    for (StreamTile& tile : stream.tiles) finishTile(stream, tile, outputs);
+
+    StreamStats stats;
+    stats.chunks = chunks;
+    stats.bytesUploaded = bytes * inputs.size();
+    stats.bytesDownloaded = bytes * outputs.size();
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+void destroyStream(Stream& stream) {
+    for (StreamTile& tile : stream.tiles) {
+        if (tile.pending) vkWaitForFences(stream.device, 1, &tile.downloaded, VK_TRUE, UINT64_MAX);
+
+        vkDestroySemaphore(stream.device, tile.uploaded, nullptr);
+        vkDestroySemaphore(stream.device, tile.computed, nullptr);
+        vkDestroyFence(stream.device, tile.downloaded, nullptr);
+
+        std::vector<Buffer> buffers = tile.inputs;
+        buffers.insert(buffers.end(), tile.outputs.begin(), tile.outputs.end());
+        buffers.push_back(tile.staging);
+        destroyBuffers(buffers);
+    }
+
+    vkDestroyCommandPool(stream.device, stream.computePool, nullptr);
+    if (stream.dedicatedTransfer) vkDestroyCommandPool(stream.device, stream.transferPool, nullptr);
+    stream.tiles.clear();
+}
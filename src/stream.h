@@ -0,0 +1,70 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <functional>
+
+#include "./util.h"
+
+// The queues a stream runs on. Without a dedicated transfer family both entries name the compute queue.
+struct StreamQueues {
+    uint32_t computeFamily;
+    VkQueue compute;
+    uint32_t transferFamily;
+    VkQueue transfer;
+};
+
+// One of the two or three slots chunks rotate through. Each slot has its own device buffers,
+// staging memory and command buffers, so up to `tileCount` chunks can be in different stages at once.
+struct StreamTile {
+    std::vector<Buffer> inputs;
+    std::vector<Buffer> outputs;
+
+    // Inputs first, then outputs, each tileBytes long
+    Buffer staging;
+    char* mapped;
+
+    VkCommandBuffer uploadCommands;
+    VkCommandBuffer computeCommands;
+    VkCommandBuffer downloadCommands;
+
+    // upload -> compute -> download, across queues
+    VkSemaphore uploaded;
+    VkSemaphore computed;
+
+    // Signaled once the download has landed in `staging`
+    VkFence downloaded;
+    bool pending;
+    VkDeviceSize chunkOffset;
+    VkDeviceSize chunkBytes;
+};
+
+// Streams inputs that may be much larger than device memory through fixed-size tiles:
+// the upload of chunk N+1 and the download of chunk N-1 overlap with the compute of chunk N.
+struct Stream {
+    VkDevice device;
+    StreamQueues queues;
+    bool dedicatedTransfer;
+
+    VkCommandPool computePool;
+    VkCommandPool transferPool;
+
+    VkDeviceSize tileBytes;
+    std::vector<StreamTile> tiles;
+};
+
+struct StreamStats {
+    uint32_t chunks;
+    VkDeviceSize bytesUploaded;
+    VkDeviceSize bytesDownloaded;
+    double milliseconds;
+};
+
+// Records the compute work for one chunk of `bytes` bytes (per input and output) into `commandBuffer`
+typedef std::function<void(VkCommandBuffer commandBuffer, StreamTile& tile, uint32_t tileIndex, VkDeviceSize bytes)> StreamComputeFn;
+
+StreamQueues getStreamQueues(VkDevice device, uint32_t computeFamily, uint32_t transferFamily);
+Stream createStream(VkPhysicalDevice physicalDevice, VkDevice device, const StreamQueues& queues, uint32_t inputCount, uint32_t outputCount, VkDeviceSize tileBytes, uint32_t tileCount = 3);
+StreamStats runStream(Stream& stream, const std::vector<const void*>& inputs, const std::vector<void*>& outputs, VkDeviceSize bytes, const StreamComputeFn& recordCompute);
+void destroyStream(Stream& stream);
+
+#endif // STREAM_H
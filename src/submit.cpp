@@ -0,0 +1,137 @@
+#include "./submit.h"
+#include "./profiler.h"
+
+#include <algorithm>
+
+SubmitQueue createSubmitQueue(VkDevice device, VkQueue queue, uint32_t maxInFlight) {
+    SubmitQueue submitQueue;
+    submitQueue.device = device;
+    submitQueue.queue = queue;
+    submitQueue.maxInFlight = std::max(1u, maxInFlight);
+    submitQueue.submitted = 0;
+    submitQueue.completed = 0;
+    return submitQueue;
+}
+
+static VkFence acquireFence(SubmitQueue& submitQueue) {
+    if (!submitQueue.freeFences.empty()) {
+        VkFence fence = submitQueue.freeFences.back();
+        submitQueue.freeFences.pop_back();
+        return fence;
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkFence fence;
+    if (vkCreateFence(submitQueue.device, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create fence!");
+    }
+    return fence;
+}
+
+// Takes every finished submission off the in-flight list, recycles its fence and then runs the callbacks.
+// The callbacks run last, so they are free to submit more work.
+static uint32_t retireCompleted(SubmitQueue& submitQueue) {
+    std::vector<std::shared_ptr<SubmissionState>> finished;
+
+    for (auto it = submitQueue.inFlight.begin(); it != submitQueue.inFlight.end();) {
+        SubmissionState& state = **it;
+        if (vkGetFenceStatus(submitQueue.device, state.fence) != VK_SUCCESS) {
+            ++it;
+            continue;
+        }
+
+        vkResetFences(submitQueue.device, 1, &state.fence);
+        submitQueue.freeFences.push_back(state.fence);
+        state.fence = VK_NULL_HANDLE;
+        state.done = true;
+
+        finished.push_back(*it);
+        it = submitQueue.inFlight.erase(it);
+    }
+
+    submitQueue.completed += finished.size();
+
+    for (const std::shared_ptr<SubmissionState>& state : finished) {
+        if (state->onComplete) {
+            std::function<void()> onComplete = std::move(state->onComplete);
+            state->onComplete = nullptr;
+            onComplete();
+        }
+    }
+
+    return static_cast<uint32_t>(finished.size());
+}
+
+// Submits the command buffers and returns right away. If the queue already has maxInFlight
+// submissions pending, this first waits for the oldest one to finish.
+Submission submitAsync(SubmitQueue& submitQueue, const std::vector<VkCommandBuffer>& commandBuffers, std::function<void()> onComplete) {
+    HostScope profile("submitAsync", "submit");
+
+    if (submitQueue.inFlight.size() >= submitQueue.maxInFlight) {
+        waitSubmission(submitQueue, Submission{submitQueue.inFlight.front()});
+    }
+
+    std::shared_ptr<SubmissionState> state = std::make_shared<SubmissionState>();
+    state->id = submitQueue.submitted;
+    state->fence = acquireFence(submitQueue);
+    state->done = false;
+    state->onComplete = std::move(onComplete);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+    submitInfo.pCommandBuffers = commandBuffers.data();
+
+    markSubmit();
+    if (vkQueueSubmit(submitQueue.queue, 1, &submitInfo, state->fence) != VK_SUCCESS) {
+        submitQueue.freeFences.push_back(state->fence);
+        throw std::runtime_error("Failed to submit command buffer!");
+    }
+
+    submitQueue.submitted++;
+    submitQueue.inFlight.push_back(state);
+    return Submission{state};
+}
+
+Submission submitAsync(SubmitQueue& submitQueue, VkCommandBuffer commandBuffer, std::function<void()> onComplete) {
+    return submitAsync(submitQueue, std::vector<VkCommandBuffer>{commandBuffer}, std::move(onComplete));
+}
+
+// Returns whether the submission has finished, without blocking. Runs the callbacks of everything that did.
+bool pollSubmission(SubmitQueue& submitQueue, const Submission& submission) {
+    if (!submission.state->done) retireCompleted(submitQueue);
+    return submission.state->done;
+}
+
+// Blocks until the submission has finished
+void waitSubmission(SubmitQueue& submitQueue, const Submission& submission) {
+    if (submission.state->done) return;
+
+    if (vkWaitForFences(submitQueue.device, 1, &submission.state->fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to wait for fence!");
+    }
+
+    retireCompleted(submitQueue);
+}
+
+// Retires whatever has finished so far and returns how many submissions that was
+uint32_t pollSubmissions(SubmitQueue& submitQueue) {
+    return retireCompleted(submitQueue);
+}
+
+void waitIdle(SubmitQueue& submitQueue) {
+    while (!submitQueue.inFlight.empty()) {
+        waitSubmission(submitQueue, Submission{submitQueue.inFlight.front()});
+    }
+}
+
+void destroySubmitQueue(SubmitQueue& submitQueue) {
+    waitIdle(submitQueue);
+
+    for (VkFence fence : submitQueue.freeFences) {
+        vkDestroyFence(submitQueue.device, fence, nullptr);
+    }
+    submitQueue.freeFences.clear();
+}
@@ -0,0 +1,49 @@
+#ifndef SUBMIT_H
+#define SUBMIT_H
+
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include "./util.h"
+
+// Shared between the queue and every Submission handle that refers to it.
+// Once `done` is set the fence has gone back to the pool.
+struct SubmissionState {
+    uint64_t id;
+    VkFence fence;
+    bool done;
+    std::function<void()> onComplete;
+};
+
+// Future for one vkQueueSubmit. Cheap to copy, all copies see the same state.
+struct Submission {
+    std::shared_ptr<SubmissionState> state;
+};
+
+// Non-blocking submission to one queue. Fences are recycled instead of created per submit, and up to
+// `maxInFlight` submissions can be pending at once before submitAsync waits for the oldest one.
+// Completion callbacks run on whichever thread polls or waits, in submission order.
+// Not thread safe: use one SubmitQueue per thread, or lock around it. executor.h shares queues between threads.
+struct SubmitQueue {
+    VkDevice device;
+    VkQueue queue;
+    uint32_t maxInFlight;
+
+    std::vector<VkFence> freeFences;
+    std::deque<std::shared_ptr<SubmissionState>> inFlight;
+
+    uint64_t submitted;
+    uint64_t completed;
+};
+
+SubmitQueue createSubmitQueue(VkDevice device, VkQueue queue, uint32_t maxInFlight = 64);
+Submission submitAsync(SubmitQueue& submitQueue, const std::vector<VkCommandBuffer>& commandBuffers, std::function<void()> onComplete = nullptr);
+Submission submitAsync(SubmitQueue& submitQueue, VkCommandBuffer commandBuffer, std::function<void()> onComplete = nullptr);
+bool pollSubmission(SubmitQueue& submitQueue, const Submission& submission);
+void waitSubmission(SubmitQueue& submitQueue, const Submission& submission);
+uint32_t pollSubmissions(SubmitQueue& submitQueue);
+void waitIdle(SubmitQueue& submitQueue);
+void destroySubmitQueue(SubmitQueue& submitQueue);
+
+#endif // SUBMIT_H
@@ -1,9 +1,17 @@
 #include "./util.h"
+#include "./allocator.h"
+#include "./profiler.h"
+
+#include <algorithm>
+#include <cmath>
 
 std::map<std::string, unsigned long> typeMap = {
     {"int", sizeof(int)},
     {"uint", sizeof(unsigned int)},
     {"float", sizeof(float)},
+    {"float16", sizeof(Float16)},
+    {"bfloat16", sizeof(Bfloat16)},
+    {"int8", sizeof(int8_t)},
 };
 
 size_t getTypeSize(std::string type) {
@@ -12,6 +20,69 @@ size_t getTypeSize(std::string type) {
     return static_cast<size_t>(it->second);
 }
 
+bool isFloatDtype(const std::string& dtype) {
+    return dtype == "float" || dtype == "float16" || dtype == "bfloat16";
+}
+
+float toFloat(Float16 value) {
+    uint32_t sign = uint32_t(value.bits & 0x8000) << 16;
+    uint32_t exponent = (value.bits >> 10) & 0x1f;
+    uint32_t mantissa = value.bits & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else {
+        // Subnormal (or zero): the value is just mantissa * 2^-24, which a float holds exactly
+        float magnitude = float(mantissa) * (1.0f / 16777216.0f);
+        memcpy(&bits, &magnitude, sizeof(bits));
+        bits |= sign;
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+float toFloat(Bfloat16 value) {
+    uint32_t bits = uint32_t(value.bits) << 16;
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+Float16 toFloat16(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude > 0x7f800000) return Float16{uint16_t(sign | 0x7e00)}; // NaN
+    if (magnitude >= 0x477ff000) return Float16{uint16_t(sign | 0x7c00)}; // rounds to infinity
+
+    if (magnitude < 0x38800000) {
+        // Below the smallest normal float16, 2^-14: round to a multiple of 2^-24
+        float scaled;
+        memcpy(&scaled, &magnitude, sizeof(scaled));
+        return Float16{uint16_t(sign | uint16_t(std::nearbyint(scaled * 16777216.0f)))};
+    }
+
+    // Drop 13 mantissa bits, rounding to nearest even. A carry into the exponent is still correct.
+    uint32_t rounded = magnitude + 0xfff + ((magnitude >> 13) & 1);
+    return Float16{uint16_t(sign | ((rounded - 0x38000000) >> 13))};
+}
+
+Bfloat16 toBfloat16(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if ((bits & 0x7fffffff) > 0x7f800000) return Bfloat16{uint16_t((bits >> 16) | 0x40)}; // NaN stays NaN
+    return Bfloat16{uint16_t((bits + 0x7fff + ((bits >> 16) & 1)) >> 16)};
+}
+
 // Function to read the SPIR-V shader code from a file
 std::vector<char> readFile(const std::string& filename) {
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
@@ -39,7 +110,10 @@ VkInstance createInstance() {
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    // 1.1 is needed for vkGetPhysicalDeviceProperties2 and external memory (host pointer import),
+    // 1.3 for the SPIR-V of the cooperative matrix shader. Asking for more than a driver has is fine since 1.1,
+    // devices still only get their own version.
+    appInfo.apiVersion = VK_API_VERSION_1_3;
     
     VkInstanceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -53,19 +127,95 @@ VkInstance createInstance() {
     return instance;
 }
 
-VkPhysicalDevice selectPhysicalDevice(VkInstance &instance) {
-    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+// Compute units are not part of core Vulkan, only AMD and NVIDIA report them (as CUs and SMs). 0 if unknown.
+uint32_t getComputeUnitCount(VkPhysicalDevice physicalDevice) {
+    if (hasDeviceExtension(physicalDevice, VK_AMD_SHADER_CORE_PROPERTIES_EXTENSION_NAME)) {
+        VkPhysicalDeviceShaderCorePropertiesAMD coreProperties{};
+        coreProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CORE_PROPERTIES_AMD;
+
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &coreProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+        return coreProperties.shaderEngineCount * coreProperties.shaderArraysPerEngineCount * coreProperties.computeUnitsPerShaderArray;
+    }
+
+    if (hasDeviceExtension(physicalDevice, VK_NV_SHADER_SM_BUILTINS_EXTENSION_NAME)) {
+        VkPhysicalDeviceShaderSMBuiltinsPropertiesNV smProperties{};
+        smProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_SM_BUILTINS_PROPERTIES_NV;
+
+        VkPhysicalDeviceProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &smProperties;
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+        return smProperties.shaderSMCount;
+    }
 
+    return 0;
+}
+
+// Higher is better. Discrete GPUs come before integrated ones, then virtual GPUs, then CPU drivers like lavapipe.
+// Within a type the device with the largest device-local heap wins, then the one with more compute units.
+uint64_t scorePhysicalDevice(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    uint64_t typeRank = 0;
+    switch (deviceProperties.deviceType) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: typeRank = 4; break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: typeRank = 3; break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: typeRank = 2; break;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU: typeRank = 1; break;
+        default: break;
+    }
+
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    uint64_t heapMiB = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+        if (!(memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)) continue;
+        uint64_t size = memoryProperties.memoryHeaps[i].size >> 20;
+        if (size > heapMiB) heapMiB = size;
+    }
+
+    // [type:8][heap MiB:32][compute units:24]
+    uint64_t computeUnits = getComputeUnitCount(physicalDevice);
+    if (heapMiB > 0xFFFFFFFFull) heapMiB = 0xFFFFFFFFull;
+    if (computeUnits > 0xFFFFFFull) computeUnits = 0xFFFFFFull;
+    return (typeRank << 56) | (heapMiB << 24) | computeUnits;
+}
+
+// Every device in the system, best first (see scorePhysicalDevice)
+std::vector<VkPhysicalDevice> rankPhysicalDevices(VkInstance &instance) {
     uint32_t deviceCount = 0;
     vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
-    
+
     if (deviceCount == 0) {
         throw std::runtime_error("Failed to find GPUs with Vulkan support!");
     }
-    
+
     std::vector<VkPhysicalDevice> devices(deviceCount);
     vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
+    std::vector<std::pair<uint64_t, uint32_t>> scores;
+    for (uint32_t i = 0; i < deviceCount; i++) scores.push_back({scorePhysicalDevice(devices[i]), i});
+
+    // Stable, so equal devices keep the driver's order
+    std::stable_sort(scores.begin(), scores.end(), [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) {
+        return a.first > b.first;
+    });
+
+    std::vector<VkPhysicalDevice> ranked;
+    for (const auto& score : scores) ranked.push_back(devices[score.second]);
+    return ranked;
+}
+
+VkPhysicalDevice selectPhysicalDevice(VkInstance &instance) {
+    std::vector<VkPhysicalDevice> devices = rankPhysicalDevices(instance);
+
     VkPhysicalDeviceProperties deviceProperties;
     std::cout << "Found these devices:" << std::endl;
 
@@ -74,9 +224,25 @@ VkPhysicalDevice selectPhysicalDevice(VkInstance &instance) {
         std::cout << "  Device Name: " << deviceProperties.deviceName << std::endl;
     }
 
-    // here you could look into running kernels device-parallel
-    // currently just picking the first device for simplicity
-    physicalDevice = devices[0];
+    // Picking the best device (to run on several at once, see multi_device.h),
+    // unless VKCOMPUTE_DEVICE names (part of) another one, e.g. "llvmpipe" for Mesa's CPU driver
+    VkPhysicalDevice physicalDevice = devices[0];
+
+    const char* wanted = std::getenv("VKCOMPUTE_DEVICE");
+    if (wanted) {
+        physicalDevice = VK_NULL_HANDLE;
+        for (const VkPhysicalDevice& device : devices) {
+            vkGetPhysicalDeviceProperties(device, &deviceProperties);
+            if (strstr(deviceProperties.deviceName, wanted)) {
+                physicalDevice = device;
+                break;
+            }
+        }
+        if (physicalDevice == VK_NULL_HANDLE) {
+            throw std::runtime_error(std::string("No device matches VKCOMPUTE_DEVICE=") + wanted + "!");
+        }
+    }
+
     vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
     std::cout << "Selected the following device: " << deviceProperties.deviceName << std::endl;
 
@@ -108,23 +274,191 @@ uint32_t findComputeQueueFamily(VkPhysicalDevice physicalDevice) {
     return queueFamilyIndex;
 }
 
-VkDevice createDevice(VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex) {
+// Find a queue family that only does transfers (a DMA engine on most discrete GPUs).
+// Returns UINT32_MAX if there is none, transfers then have to share a family with compute.
+uint32_t findTransferQueueFamily(VkPhysicalDevice physicalDevice) {
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    for (uint32_t i = 0; i < queueFamilies.size(); i++) {
+        VkQueueFlags flags = queueFamilies[i].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT))) return i;
+    }
+
+    return UINT32_MAX;
+}
+
+bool hasDeviceExtension(VkPhysicalDevice physicalDevice, const char* extensionName) {
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+
+    for (const VkExtensionProperties& extension : extensions) {
+        if (strcmp(extension.extensionName, extensionName) == 0) return true;
+    }
+
+    return false;
+}
+
+// Subgroup operations are core since Vulkan 1.1, but which ones a device supports in which stages varies
+bool supportsSubgroupArithmetic(VkPhysicalDevice physicalDevice) {
+    VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+    subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &subgroupProperties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    VkSubgroupFeatureFlags required = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+    return (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+           (subgroupProperties.supportedOperations & required) == required;
+}
+
+// Every optional feature kernels can use, chained behind one VkPhysicalDeviceFeatures2.
+// Structs the device's Vulkan version does not know are left out of the chain and stay zero.
+struct OptionalFeatures {
+    VkPhysicalDeviceFeatures2 features;
+    VkPhysicalDevice16BitStorageFeatures storage16;
+    VkPhysicalDevice8BitStorageFeatures storage8;
+    VkPhysicalDeviceShaderFloat16Int8Features float16Int8;
+    VkPhysicalDeviceVulkanMemoryModelFeatures memoryModel;
+    VkPhysicalDeviceCooperativeMatrixFeaturesKHR cooperativeMatrix;
+};
+
+// Zeroes every struct and links the ones the device knows. The chain points into `optional`,
+// so it is set up in place rather than returned.
+static void initOptionalFeatures(VkPhysicalDevice physicalDevice, OptionalFeatures& optional) {
+    optional = OptionalFeatures{};
+    optional.features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    optional.storage16.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES;
+    optional.storage8.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_8BIT_STORAGE_FEATURES;
+    optional.float16Int8.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES;
+    optional.memoryModel.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_MEMORY_MODEL_FEATURES;
+    optional.cooperativeMatrix.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_COOPERATIVE_MATRIX_FEATURES_KHR;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    // 16 bit storage is core since 1.1, 8 bit storage, float16 arithmetic and the memory model since 1.2
+    optional.features.pNext = &optional.storage16;
+    if (properties.apiVersion >= VK_API_VERSION_1_2) {
+        optional.storage16.pNext = &optional.storage8;
+        optional.storage8.pNext = &optional.float16Int8;
+        optional.float16Int8.pNext = &optional.memoryModel;
+    }
+    if (properties.apiVersion >= VK_API_VERSION_1_3 && hasDeviceExtension(physicalDevice, VK_KHR_COOPERATIVE_MATRIX_EXTENSION_NAME)) {
+        optional.memoryModel.pNext = &optional.cooperativeMatrix;
+    }
+}
+
+static void queryOptionalFeatures(VkPhysicalDevice physicalDevice, OptionalFeatures& optional) {
+    initOptionalFeatures(physicalDevice, optional);
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &optional.features);
+}
+
+// float16 arithmetic in shaders (shaderFloat16). The float16 dtype does not need it, kernels compute in float.
+bool supportsFloat16Arithmetic(VkPhysicalDevice physicalDevice) {
+    OptionalFeatures optional;
+    queryOptionalFeatures(physicalDevice, optional);
+    return optional.float16Int8.shaderFloat16;
+}
+
+// VK_KHR_cooperative_matrix with what the shaders that use it need on top: the Vulkan memory model and SPIR-V 1.6.
+// createDevice turns all of it on whenever this is true.
+bool supportsCooperativeMatrix(VkPhysicalDevice physicalDevice) {
+    OptionalFeatures optional;
+    queryOptionalFeatures(physicalDevice, optional);
+    return optional.cooperativeMatrix.cooperativeMatrix && optional.memoryModel.vulkanMemoryModel;
+}
+
+// Whether kernels can read and write buffers of `dtype`. The 32 bit types always work,
+// the narrow ones need 16 or 8 bit storage buffer access.
+bool supportsDtype(VkPhysicalDevice physicalDevice, const std::string& dtype) {
+    size_t size = getTypeSize(dtype);
+    if (size == 4) return true;
+
+    OptionalFeatures optional;
+    queryOptionalFeatures(physicalDevice, optional);
+    return size == 2 ? optional.storage16.storageBuffer16BitAccess : optional.storage8.storageBuffer8BitAccess;
+}
+
+// How many queues the family has. Submissions to different queues need no synchronization between them.
+uint32_t queueCountOf(VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex) {
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    if (queueFamilyIndex >= queueFamilyCount) throw std::runtime_error("Invalid queue family index!");
+    return queueFamilies[queueFamilyIndex].queueCount;
+}
+
+VkDevice createDevice(VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t transferQueueFamilyIndex, uint32_t computeQueueCount) {
     // helps vk decide how to allocate gpu time between multiple queues
     // each queue can assign a value between 0.0 (lowest priority) and 1.0 (highest)
-    float queuePriority = 1.0f;
+    // asking for more compute queues than the family has gets as many as it has
+    computeQueueCount = std::max(1u, std::min(computeQueueCount, queueCountOf(physicalDevice, queueFamilyIndex)));
+    std::vector<float> queuePriorities(computeQueueCount, 1.0f);
     VkDeviceQueueCreateInfo queueCreateInfo{};
     queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO; // helps identify this struct
     queueCreateInfo.queueFamilyIndex = queueFamilyIndex; // defines which family this queue should be created in / belongs to
-    queueCreateInfo.queueCount = 1; // sepcifies the number of queues to create in the family
-    queueCreateInfo.pQueuePriorities = &queuePriority; // pointer to an array of priority floats, if queueCount is 1, you can just point to a regular float
+    queueCreateInfo.queueCount = computeQueueCount; // sepcifies the number of queues to create in the family
+    queueCreateInfo.pQueuePriorities = queuePriorities.data(); // pointer to an array of priority floats, one per queue
+
+    std::vector<VkDeviceQueueCreateInfo> queueCreateInfos = {queueCreateInfo};
+
+    // a dedicated transfer queue lives in a family of its own, so it needs its own create info
+    if (transferQueueFamilyIndex != UINT32_MAX && transferQueueFamilyIndex != queueFamilyIndex) {
+        queueCreateInfo.queueFamilyIndex = transferQueueFamilyIndex;
+        queueCreateInfo.queueCount = 1;
+        queueCreateInfos.push_back(queueCreateInfo);
+    }
 
     VkDeviceCreateInfo deviceCreateInfo{};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO; // again, used to identify this struct
     // if you need to create queues in multiple families, you need multiple queueCreateInfo structs.
     // in that case you would set this int to the desired number of infos, and pass in a pointer
     // to an array of create infos in the pQueueCreateInfos field
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+    deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+    deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+
+    // optional extensions are enabled whenever the device supports them,
+    // code that depends on them checks hasDeviceExtension before using them
+    std::vector<const char*> extensions;
+    if (hasDeviceExtension(physicalDevice, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) {
+        extensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    }
+    if (hasDeviceExtension(physicalDevice, VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME)) {
+        extensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+    }
+
+    // optional features work the same way, they go in a chain of feature structs instead of pEnabledFeatures.
+    // only what kernels actually use is turned on, not everything the device reports.
+    OptionalFeatures supported;
+    queryOptionalFeatures(physicalDevice, supported);
+
+    OptionalFeatures enabled;
+    initOptionalFeatures(physicalDevice, enabled);
+    enabled.storage16.storageBuffer16BitAccess = supported.storage16.storageBuffer16BitAccess;
+    enabled.storage8.storageBuffer8BitAccess = supported.storage8.storageBuffer8BitAccess;
+    enabled.float16Int8.shaderFloat16 = supported.float16Int8.shaderFloat16;
+
+    if (supported.cooperativeMatrix.cooperativeMatrix && supported.memoryModel.vulkanMemoryModel) {
+        extensions.push_back(VK_KHR_COOPERATIVE_MATRIX_EXTENSION_NAME);
+        enabled.cooperativeMatrix.cooperativeMatrix = VK_TRUE;
+        enabled.memoryModel.vulkanMemoryModel = VK_TRUE;
+    }
+
+    deviceCreateInfo.pNext = &enabled.features;
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = extensions.data();
 
     // use the physical device and the deviceCreateInfo (that also contains the queueCreateInfos) to
     // create a logical device. a reference to device will be stored in `device`
@@ -146,20 +480,50 @@ VkQueue getQueue(VkDevice device, uint32_t queueFamilyIndex, uint32_t queueIndex
     return computeQueue;
 }
 
+// Host-visible memory can be mapped by the CPU, device-local memory is the fast memory
+// the GPU reads from. On integrated GPUs and lavapipe both usually refer to the same memory type.
+VkMemoryPropertyFlags memoryModeProperties(MemoryMode memoryMode) {
+    if (memoryMode == MEMORY_DEVICE_LOCAL) return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    return VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
+
+// Searches through the available memory types provided by the physical device
+// to find one that satisfies both the buffer's memory requirements and the desired properties
+uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) {
+    // Describes a number of memory heaps and memory types of the physical device that can be accessed
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((memoryTypeBits & (1 << i)) &&
+            (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("Failed to find suitable memory type!");
+}
+
 // Creates a buffer on a physical device, allocates memory, and binds the buffer
-Buffer createBuffer( VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize size, uint32_t binding) {    
+Buffer createBuffer(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize size, uint32_t binding, MemoryMode memoryMode) {
+    HostScope profile("createBuffer", "memory", size);
+
     VkBuffer buffer;
     VkDeviceMemory deviceMemory;
 
     // This struct is used to hold the information required for buffer creation
+    // Every buffer can be the source or target of a copy, this is what the staging ring uses
+    // to move data in and out of device-local memory.
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
-    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
     // Third param can be used for controlling allocation
     // Could be used for debugging purposes
-    vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create buffer!");
+    }
 
     // Get device-specific memory requirements info like size, alignment, and memory type
     VkMemoryRequirements memRequirements;
@@ -168,32 +532,32 @@ Buffer createBuffer( VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceS
     VkMemoryAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     allocInfo.allocationSize = memRequirements.size;
-
-    // Describes a number of memory heaps and memory types of the physical device that can be accessed
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-    // Searches through the available memory types provided by the physical device
-    // to find one that satisfies both the buffer's memory requirements and the desired
-    // properties for CPU access.
-    uint32_t memoryTypeIndex = 0;
-    bool found = false;
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((memRequirements.memoryTypeBits & (1 << i)) &&
-            (memProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
-            (memProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
-            memoryTypeIndex = i;
-            found = true;
-            break;
-        }
+    try {
+        allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, memoryModeProperties(memoryMode));
+    } catch (...) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        throw;
     }
 
-    if (!found) throw std::runtime_error("Failed to find suitable memory type!");
-    allocInfo.memoryTypeIndex = memoryTypeIndex;
+    // Allocate and bind, whatever was created so far is released again if a step fails
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &deviceMemory) != VK_SUCCESS) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        throw std::runtime_error("Failed to allocate buffer memory!");
+    }
+    if (vkBindBufferMemory(device, buffer, deviceMemory, 0) != VK_SUCCESS) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        vkFreeMemory(device, deviceMemory, nullptr);
+        throw std::runtime_error("Failed to bind buffer memory!");
+    }
 
-    // Allocate and bind
-    vkAllocateMemory(device, &allocInfo, nullptr, &deviceMemory);
-    vkBindBufferMemory(device, buffer, deviceMemory, 0);
+    // Host-visible memory stays mapped until the buffer is destroyed, so transfers are a plain memcpy
+    void* mapped = nullptr;
+    if (memoryMode == MEMORY_HOST_VISIBLE &&
+        vkMapMemory(device, deviceMemory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        vkFreeMemory(device, deviceMemory, nullptr);
+        throw std::runtime_error("Failed to map buffer memory!");
+    }
 
     VkDescriptorBufferInfo bufferDescriptorInfo{};
     bufferDescriptorInfo.buffer = buffer;
@@ -207,32 +571,177 @@ Buffer createBuffer( VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceS
     b.device = device;
     b.size = size;
     b.binding = binding;
+    b.memoryMode = memoryMode;
+    b.mapped = mapped;
+    b.arena = nullptr;
+
+    return b;
+}
+
+// Returns the alignment that host pointers (and sizes) need for importHostBuffer,
+// or 0 if the device can not import host memory.
+VkDeviceSize getHostImportAlignment(VkPhysicalDevice physicalDevice) {
+    if (!hasDeviceExtension(physicalDevice, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) return 0;
+
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties{};
+    hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &hostProperties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    return hostProperties.minImportedHostPointerAlignment;
+}
+
+// Wraps existing host memory (an AlignedAllocator vector, an mmap'ed file, ...) as a storage buffer.
+// The GPU reads and writes the host memory directly, no copies are involved.
+// The memory has to outlive the buffer, destroyBuffers does not free it.
+Buffer importHostBuffer(VkPhysicalDevice physicalDevice, VkDevice device, void* hostPointer, VkDeviceSize size, uint32_t binding) {
+    HostScope profile("importHostBuffer", "memory", size);
+
+    VkDeviceSize alignment = getHostImportAlignment(physicalDevice);
+    if (alignment == 0) throw std::runtime_error("Device does not support importing host memory!");
+
+    if (reinterpret_cast<uintptr_t>(hostPointer) % alignment != 0 || size % alignment != 0) {
+        std::ostringstream msg;
+        msg << "Imported host memory has to be aligned to " << alignment << " bytes.";
+        throw std::runtime_error(msg.str());
+    }
+
+    VkExternalMemoryBufferCreateInfo externalInfo{};
+    externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.pNext = &externalInfo;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    VkBuffer buffer;
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+    if (memRequirements.size > size) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        throw std::runtime_error("Imported host memory is smaller than the buffer requires!");
+    }
+
+    // Extension functions are not exported by the loader, they have to be looked up at runtime
+    auto getMemoryHostPointerProperties = reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(
+        vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT"));
+
+    VkMemoryHostPointerPropertiesEXT pointerProperties{};
+    pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+    if (getMemoryHostPointerProperties == nullptr ||
+        getMemoryHostPointerProperties(device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, hostPointer, &pointerProperties) != VK_SUCCESS) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        throw std::runtime_error("Failed to query host pointer properties!");
+    }
+
+    VkImportMemoryHostPointerInfoEXT importInfo{};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    importInfo.pHostPointer = hostPointer;
+
+    // The host pointer is used as-is, so the memory type has to be coherent to skip flushes
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = &importInfo;
+    allocInfo.allocationSize = size;
+    try {
+        allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits & pointerProperties.memoryTypeBits,
+                                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    } catch (...) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        throw;
+    }
+
+    VkDeviceMemory deviceMemory;
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &deviceMemory) != VK_SUCCESS) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        throw std::runtime_error("Failed to import host memory!");
+    }
+    if (vkBindBufferMemory(device, buffer, deviceMemory, 0) != VK_SUCCESS) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        vkFreeMemory(device, deviceMemory, nullptr);
+        throw std::runtime_error("Failed to bind imported host memory!");
+    }
+
+    Buffer b;
+    b.buffer = buffer;
+    b.deviceMemory = deviceMemory;
+    b.descriptorInfo.buffer = buffer;
+    b.descriptorInfo.offset = 0;
+    b.descriptorInfo.range = size;
+    b.device = device;
+    b.size = size;
+    b.binding = binding;
+    b.memoryMode = MEMORY_HOST_IMPORTED;
+    b.mapped = hostPointer;
+    b.arena = nullptr;
 
     return b;
 }
 
-// Copies data from CPU memory to VRAM
-void copyToBuffer(VkDevice destDevice, VkDeviceMemory destDeviceMemory, void* srcBuffer, VkDeviceSize offset, VkDeviceSize bufferSize) {
-    void* data;
-    vkMapMemory(destDevice, destDeviceMemory, offset, bufferSize, 0, &data);
-    memcpy(data, srcBuffer, bufferSize);
-    vkUnmapMemory(destDevice, destDeviceMemory);
+// A buffer that only lives in host memory, for when there is no Vulkan device at all.
+// Cache line aligned, so the CPU backend's vector loads never straddle lines at the start of a buffer.
+Buffer createHostBuffer(VkDeviceSize size, uint32_t binding) {
+    HostScope profile("createHostBuffer", "memory", size);
+
+    void* mapped = nullptr;
+    if (posix_memalign(&mapped, 64, alignUp(size > 0 ? size : 1, 64)) != 0) throw std::bad_alloc();
+
+    Buffer b{};
+    b.buffer = VK_NULL_HANDLE;
+    b.deviceMemory = VK_NULL_HANDLE;
+    b.descriptorInfo.buffer = VK_NULL_HANDLE;
+    b.descriptorInfo.offset = 0;
+    b.descriptorInfo.range = size;
+    b.device = VK_NULL_HANDLE;
+    b.size = size;
+    b.binding = binding;
+    b.memoryMode = MEMORY_HOST_ONLY;
+    b.mapped = mapped;
+    b.arena = nullptr;
+
+    return b;
+}
+
+// Copies data from CPU memory into a host-visible or imported buffer through its persistent mapping
+void copyToBuffer(Buffer& dest, const void* src, VkDeviceSize offset, VkDeviceSize size) {
+    if (offset + size > dest.size) throw std::runtime_error("Copy exceeds buffer bounds!");
+    memcpy(hostPointer<char>(dest) + offset, src, size);
 }
 
-// Copies data from VRAM to CPU memory
-void copyBufferFromDevice(VkDevice srcDevice, VkDeviceMemory srcDeviceMemory, void* destBuffer, VkDeviceSize offset, VkDeviceSize bufferSize) {
-    void* data;
-    vkMapMemory(srcDevice, srcDeviceMemory, 0, bufferSize, 0, &data);
-    memcpy(destBuffer, data, bufferSize);   // segfault happens here.
-    vkUnmapMemory(srcDevice, srcDeviceMemory);
+// Copies data from a host-visible or imported buffer back to CPU memory through its persistent mapping
+void copyBufferFromDevice(Buffer& src, void* dest, VkDeviceSize offset, VkDeviceSize size) {
+    if (offset + size > src.size) throw std::runtime_error("Copy exceeds buffer bounds!");
+    memcpy(dest, hostPointer<char>(src) + offset, size);
 }
 
-VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout descriptorSetLayout) {
+VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout descriptorSetLayout, uint32_t pushConstantSize) {
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = 1;
     pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
 
+    // Small per-dispatch parameters (element counts, ...) are passed as push constants
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = pushConstantSize;
+
+    if (pushConstantSize > 0) {
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    }
+
     VkPipelineLayout pipelineLayout;
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create pipeline layout!");
@@ -241,17 +750,22 @@ VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout des
     return pipelineLayout;
 }
 
-VkPipeline createPipeline(VkDevice device, VkPipelineLayout pipelineLayout, VkShaderModule shaderModule, std::string name) {
+// The pipeline cache lets the driver skip compiling shaders it has seen before (see pipeline_cache.h),
+// specialization constants are baked into the pipeline at creation time.
+VkPipeline createPipeline(VkDevice device, VkPipelineLayout pipelineLayout, VkShaderModule shaderModule, std::string name, VkPipelineCache pipelineCache, const VkSpecializationInfo* specializationInfo) {
+    HostScope profile("createPipeline", "pipeline");
+
     VkComputePipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
     pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
     pipelineInfo.stage.module = shaderModule;
     pipelineInfo.stage.pName = name.c_str();
+    pipelineInfo.stage.pSpecializationInfo = specializationInfo;
     pipelineInfo.layout = pipelineLayout;
 
     VkPipeline computePipeline;
-    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS) {
+    if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS) {
         std::ostringstream msg;
         msg << "Failed to create compute pipeline \"" << name << "\".";
         throw std::runtime_error(msg.str());
@@ -313,7 +827,7 @@ VkDescriptorSet createDescriptorSet(VkDevice device, VkDescriptorPool descriptor
     return descriptorSet;
 }
 
-VkShaderModule createShaderModule(VkDevice device, std::vector<char>& shaderCode) {  
+VkShaderModule createShaderModule(VkDevice device, const std::vector<char>& shaderCode) {  
     VkShaderModuleCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     createInfo.codeSize = shaderCode.size();
@@ -327,9 +841,11 @@ VkShaderModule createShaderModule(VkDevice device, std::vector<char>& shaderCode
     return computeShaderModule;
 }
 
-VkCommandPool createCommandPool(VkDevice device, uint32_t queueFamilyIndex) {
+// VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT in `flags` lets command buffers be recorded again without freeing them
+VkCommandPool createCommandPool(VkDevice device, uint32_t queueFamilyIndex, VkCommandPoolCreateFlags flags) {
     VkCommandPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = flags;
     poolInfo.queueFamilyIndex = queueFamilyIndex;
 
     VkCommandPool commandPool;
@@ -381,6 +897,30 @@ VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device, std::vector<Buf
     return descriptorSetLayout;
 }
 
+// Layout with `bindingCount` storage buffers at bindings 0..bindingCount-1, which is what all our kernels use
+VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device, uint32_t bindingCount) {
+    std::vector<VkDescriptorSetLayoutBinding> bindings(bindingCount);
+
+    for (uint32_t i = 0; i < bindingCount; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = bindingCount;
+    layoutInfo.pBindings = bindings.data();
+
+    VkDescriptorSetLayout descriptorSetLayout;
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout!");
+    }
+
+    return descriptorSetLayout;
+}
+
 void recordCommandBuffer(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkPipelineLayout pipelineLayout, VkDescriptorSet descriptorSet, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ) {
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -390,12 +930,16 @@ void recordCommandBuffer(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkP
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
 
+    uint32_t scope = beginGpuScope(commandBuffer, "dispatch", "dispatch");
     vkCmdDispatch(commandBuffer, groupCountX, groupCountY, groupCountZ);
+    endGpuScope(commandBuffer, scope);
 
     vkEndCommandBuffer(commandBuffer);
 }
 
 void executeCommandBuffer(VkDevice device, VkCommandBuffer commandBuffer, VkQueue queue) {
+    HostScope profile("executeCommandBuffer", "submit");
+
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.commandBufferCount = 1;
@@ -406,6 +950,7 @@ void executeCommandBuffer(VkDevice device, VkCommandBuffer commandBuffer, VkQueu
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     vkCreateFence(device, &fenceInfo, nullptr, &fence);
 
+    markSubmit();
     vkQueueSubmit(queue, 1, &submitInfo, fence);
     vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
 
@@ -414,6 +959,21 @@ void executeCommandBuffer(VkDevice device, VkCommandBuffer commandBuffer, VkQueu
 
 void destroyBuffers(std::vector<Buffer>& buffers) {
     for (Buffer buffer : buffers) {
+        // Arena buffers only give their range back, the block stays around for the next buffer
+        if (buffer.arena != nullptr) {
+            arenaFree(*buffer.arena, buffer);
+            continue;
+        }
+
+        if (buffer.memoryMode == MEMORY_HOST_ONLY) {
+            free(buffer.mapped);
+            continue;
+        }
+
+        // Imported memory is owned by the host, only our handle to it goes away
+        if (buffer.mapped != nullptr && buffer.memoryMode == MEMORY_HOST_VISIBLE) {
+            vkUnmapMemory(buffer.device, buffer.deviceMemory);
+        }
         vkDestroyBuffer(buffer.device, buffer.buffer, nullptr);
         vkFreeMemory(buffer.device, buffer.deviceMemory, nullptr);
     }
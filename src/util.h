@@ -9,37 +9,121 @@
 #include <cstring>
 #include <sstream>
 #include <math.h>
+#include <stdexcept>
+#include <cstdlib>
+#include <new>
 
 struct ExtendedVkDescriptorBufferInfo : public VkDescriptorBufferInfo {
     uint32_t binding;
 };
 
+// Where the memory backing a buffer lives.
+// Host-visible buffers are mapped once when they are created and written directly by the CPU,
+// device-local buffers live in VRAM (on discrete GPUs) and can only be reached through a staging ring (see staging.h).
+// Imported buffers wrap memory the host already owns (VK_EXT_external_memory_host), so there is nothing to copy at all.
+// Host-only buffers are plain host memory without any Vulkan object, only the CPU backend (cpu_backend.h) can use them.
+enum MemoryMode {
+    MEMORY_HOST_VISIBLE,
+    MEMORY_DEVICE_LOCAL,
+    MEMORY_HOST_IMPORTED,
+    MEMORY_HOST_ONLY,
+};
+
+struct MemoryArena;
+
 struct Buffer {
     VkBuffer buffer;
     VkDeviceMemory deviceMemory;
     VkDescriptorBufferInfo descriptorInfo;
     VkDevice device;
-    uint32_t size;
+    VkDeviceSize size;
     uint32_t binding;
+    MemoryMode memoryMode;
+    void* mapped; // nullptr for device-local buffers
+    MemoryArena* arena; // set when the buffer is a range of an arena block (see allocator.h)
 };
 
+// Typed access to the persistent mapping of a host-visible or imported buffer
+template <typename T>
+T* hostPointer(Buffer& buffer) {
+    if (buffer.mapped == nullptr) throw std::runtime_error("Buffer is not host-visible!");
+    return static_cast<T*>(buffer.mapped);
+}
+
+inline VkDeviceSize alignUp(VkDeviceSize size, VkDeviceSize alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Allocator for host arrays that are going to be imported with importHostBuffer.
+// Allocations are aligned and padded to whole pages, which satisfies minImportedHostPointerAlignment on common drivers.
+template <typename T, size_t Alignment = 4096>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) {
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, Alignment, alignUp(n * sizeof(T), Alignment)) != 0) throw std::bad_alloc();
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t) { free(ptr); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+// Host side storage of the 16 bit float dtypes ("float16", "bfloat16"). Kernels widen them to float,
+// compute, and round the result back (to nearest even), toFloat and the from* functions do the same on the host.
+struct Float16 { uint16_t bits; };
+struct Bfloat16 { uint16_t bits; };
+
 size_t getTypeSize(std::string type);
+bool isFloatDtype(const std::string& dtype);
+float toFloat(Float16 value);
+float toFloat(Bfloat16 value);
+Float16 toFloat16(float value);
+Bfloat16 toBfloat16(float value);
 std::vector<char> readFile(const std::string& filename);
 VkInstance createInstance();
+uint32_t getComputeUnitCount(VkPhysicalDevice physicalDevice);
+uint64_t scorePhysicalDevice(VkPhysicalDevice physicalDevice);
+std::vector<VkPhysicalDevice> rankPhysicalDevices(VkInstance &instance);
 VkPhysicalDevice selectPhysicalDevice(VkInstance &instance);
 uint32_t findComputeQueueFamily(VkPhysicalDevice physicalDevice);
-VkDevice createDevice(VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex);
+uint32_t findTransferQueueFamily(VkPhysicalDevice physicalDevice);
+bool hasDeviceExtension(VkPhysicalDevice physicalDevice, const char* extensionName);
+bool supportsSubgroupArithmetic(VkPhysicalDevice physicalDevice);
+bool supportsFloat16Arithmetic(VkPhysicalDevice physicalDevice);
+bool supportsCooperativeMatrix(VkPhysicalDevice physicalDevice);
+bool supportsDtype(VkPhysicalDevice physicalDevice, const std::string& dtype);
+uint32_t queueCountOf(VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex);
+VkDevice createDevice(VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t transferQueueFamilyIndex = UINT32_MAX, uint32_t computeQueueCount = 1);
 VkQueue getQueue(VkDevice device, uint32_t queueFamilyIndex, uint32_t queueIndex);
-Buffer createBuffer(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize size, uint32_t binding);
-void copyToBuffer(VkDevice destDevice, VkDeviceMemory destDeviceMemory, void* srcBuffer, VkDeviceSize offset, VkDeviceSize bufferSize);
-void copyBufferFromDevice(VkDevice srcDevice, VkDeviceMemory srcDeviceMemory, void* destBuffer, VkDeviceSize offset, VkDeviceSize bufferSize);
-VkCommandPool createCommandPool(VkDevice device, uint32_t computeQueueFamily);
+VkMemoryPropertyFlags memoryModeProperties(MemoryMode memoryMode);
+uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t memoryTypeBits, VkMemoryPropertyFlags properties);
+Buffer createBuffer(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize size, uint32_t binding, MemoryMode memoryMode = MEMORY_HOST_VISIBLE);
+VkDeviceSize getHostImportAlignment(VkPhysicalDevice physicalDevice);
+Buffer importHostBuffer(VkPhysicalDevice physicalDevice, VkDevice device, void* hostPointer, VkDeviceSize size, uint32_t binding);
+Buffer createHostBuffer(VkDeviceSize size, uint32_t binding);
+void copyToBuffer(Buffer& dest, const void* src, VkDeviceSize offset, VkDeviceSize size);
+void copyBufferFromDevice(Buffer& src, void* dest, VkDeviceSize offset, VkDeviceSize size);
+VkCommandPool createCommandPool(VkDevice device, uint32_t computeQueueFamily, VkCommandPoolCreateFlags flags = 0);
 VkCommandBuffer createCommandBuffer(VkDevice device, VkCommandPool commandPool);
-VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout descriptorSetLayout);
-VkPipeline createPipeline(VkDevice device, VkPipelineLayout pipelineLayout, VkShaderModule shaderModule, std::string name);
+VkPipelineLayout createPipelineLayout(VkDevice device, VkDescriptorSetLayout descriptorSetLayout, uint32_t pushConstantSize = 0);
+VkPipeline createPipeline(VkDevice device, VkPipelineLayout pipelineLayout, VkShaderModule shaderModule, std::string name, VkPipelineCache pipelineCache = VK_NULL_HANDLE, const VkSpecializationInfo* specializationInfo = nullptr);
 VkDescriptorPool createDescriptorPool(VkDevice device, std::vector<Buffer>& bufferDescriptors);
-VkShaderModule createShaderModule(VkDevice device, std::vector<char>& shaderCode);
+VkShaderModule createShaderModule(VkDevice device, const std::vector<char>& shaderCode);
 VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device, std::vector<Buffer>& bufferDescriptors);
+VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device, uint32_t bindingCount);
 VkDescriptorSet createDescriptorSet(VkDevice device, VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout, std::vector<Buffer>& bufferDescriptors);
 void recordCommandBuffer(VkCommandBuffer commandBuffer, VkPipeline pipeline, VkPipelineLayout pipelineLayout, VkDescriptorSet descriptorSet, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ);
 void executeCommandBuffer(VkDevice device, VkCommandBuffer commandBuffer, VkQueue queue);
@@ -0,0 +1,224 @@
+#include "./view.h"
+
+#include <algorithm>
+
+static std::string shapeString(const std::vector<uint32_t>& shape) {
+    std::ostringstream out;
+    out << "[";
+    for (size_t i = 0; i < shape.size(); i++) out << (i > 0 ? ", " : "") << shape[i];
+    out << "]";
+    return out.str();
+}
+
+static void checkShape(const std::vector<uint32_t>& shape) {
+    if (shape.empty() || shape.size() > maxViewDims) {
+        throw std::runtime_error("Views have 1 to " + std::to_string(maxViewDims) + " dimensions, got " + shapeString(shape) + ".");
+    }
+    uint64_t nelem = 1;
+    for (uint32_t size : shape) {
+        if (size == 0) throw std::runtime_error("Empty view " + shapeString(shape) + ".");
+        nelem *= size;
+    }
+    if (nelem > UINT32_MAX) throw std::runtime_error("View " + shapeString(shape) + " has too many elements.");
+}
+
+// Row-major strides, the last dimension is the one that is adjacent in memory
+View contiguousView(const std::vector<uint32_t>& shape) {
+    checkShape(shape);
+
+    View view{};
+    view.ndim = static_cast<uint32_t>(shape.size());
+    int32_t stride = 1;
+    for (int d = maxViewDims - 1; d >= 0; d--) {
+        if (d >= static_cast<int>(view.ndim)) {
+            view.shape[d] = 1;
+            view.strides[d] = 0;
+            continue;
+        }
+        view.shape[d] = shape[d];
+        view.strides[d] = stride;
+        stride *= static_cast<int32_t>(shape[d]);
+    }
+    return view;
+}
+
+uint32_t viewNelem(const View& view) {
+    uint32_t nelem = 1;
+    for (uint32_t d = 0; d < view.ndim; d++) nelem *= view.shape[d];
+    return nelem;
+}
+
+std::vector<uint32_t> viewShape(const View& view) {
+    return std::vector<uint32_t>(view.shape, view.shape + view.ndim);
+}
+
+bool sameShape(const View& a, const View& b) {
+    return viewShape(a) == viewShape(b);
+}
+
+// Whether the view reads its buffer front to back without gaps, i.e. it is the buffer (or the start of it).
+// Strides of dimensions with a size of 1 don't matter.
+bool isContiguous(const View& view) {
+    if (view.offset != 0) return false;
+
+    int64_t expected = 1;
+    for (int d = static_cast<int>(view.ndim) - 1; d >= 0; d--) {
+        if (view.shape[d] != 1 && view.strides[d] != expected) return false;
+        expected *= view.shape[d];
+    }
+    return true;
+}
+
+// Merges runs of dimensions that are contiguous with each other and splits them up again into `shape`,
+// like numpy does. Fails when `shape` would need to split across dimensions that are not, e.g. reshaping
+// a transposed matrix back to 1D.
+static bool tryReshape(const View& view, const std::vector<uint32_t>& shape, View& result) {
+    checkShape(shape);
+
+    uint64_t nelem = 1;
+    for (uint32_t size : shape) nelem *= size;
+    if (nelem != viewNelem(view)) return false;
+
+    // Dimensions with a size of 1 take no part, whatever their stride
+    std::vector<uint32_t> oldShape;
+    std::vector<int64_t> oldStrides;
+    for (uint32_t d = 0; d < view.ndim; d++) {
+        if (view.shape[d] == 1) continue;
+        oldShape.push_back(view.shape[d]);
+        oldStrides.push_back(view.strides[d]);
+    }
+
+    std::vector<int64_t> strides(shape.size(), 0);
+    size_t oi = 0, oj = 1, ni = 0, nj = 1;
+    while (ni < shape.size() && oi < oldShape.size()) {
+        uint64_t newProduct = shape[ni];
+        uint64_t oldProduct = oldShape[oi];
+        while (newProduct != oldProduct) {
+            if (newProduct < oldProduct) newProduct *= shape[nj++];
+            else oldProduct *= oldShape[oj++];
+        }
+
+        for (size_t k = oi; k + 1 < oj; k++) {
+            if (oldStrides[k] != int64_t(oldShape[k + 1]) * oldStrides[k + 1]) return false;
+        }
+
+        strides[nj - 1] = oldStrides[oj - 1];
+        for (size_t k = nj - 1; k > ni; k--) strides[k - 1] = strides[k] * shape[k];
+
+        ni = nj++;
+        oi = oj++;
+    }
+
+    result = contiguousView(shape);
+    result.offset = view.offset;
+    for (size_t d = 0; d < shape.size(); d++) result.strides[d] = shape[d] == 1 ? 0 : static_cast<int32_t>(strides[d]);
+    return true;
+}
+
+bool canReshape(const View& view, const std::vector<uint32_t>& shape) {
+    View result;
+    return tryReshape(view, shape, result);
+}
+
+// Buffer index of element `i`, counting in row-major order over the view's shape
+uint32_t viewIndex(const View& view, uint32_t i) {
+    int64_t index = view.offset;
+    for (int d = static_cast<int>(view.ndim) - 1; d >= 0; d--) {
+        index += int64_t(i % view.shape[d]) * view.strides[d];
+        i /= view.shape[d];
+    }
+    return static_cast<uint32_t>(index);
+}
+
+// Lowest and highest buffer index the view reads
+void viewRange(const View& view, int64_t& lowest, int64_t& highest) {
+    lowest = highest = view.offset;
+    for (uint32_t d = 0; d < view.ndim; d++) {
+        int64_t extent = int64_t(view.shape[d] - 1) * view.strides[d];
+        if (extent < 0) lowest += extent;
+        else highest += extent;
+    }
+}
+
+View reshapeView(const View& view, const std::vector<uint32_t>& shape) {
+    View result;
+    if (!tryReshape(view, shape, result)) {
+        throw std::runtime_error("Can not reshape " + viewString(view) + " to " + shapeString(shape) + " without a copy.");
+    }
+    return result;
+}
+
+// Dimension d of the result is dimension order[d] of `view`
+View permuteView(const View& view, const std::vector<uint32_t>& order) {
+    std::vector<uint32_t> sorted = order;
+    std::sort(sorted.begin(), sorted.end());
+    bool valid = sorted.size() == view.ndim;
+    for (uint32_t d = 0; d < sorted.size(); d++) valid = valid && sorted[d] == d;
+    if (!valid) throw std::runtime_error("Permutation " + shapeString(order) + " does not fit " + viewString(view) + ".");
+
+    View result = view;
+    for (uint32_t d = 0; d < view.ndim; d++) {
+        result.shape[d] = view.shape[order[d]];
+        result.strides[d] = view.strides[order[d]];
+    }
+    return result;
+}
+
+// Elements start, start + step, ... below end of dimension `dim`. A negative step walks from end - 1 down to start.
+View sliceView(const View& view, uint32_t dim, uint32_t start, uint32_t end, int32_t step) {
+    if (dim >= view.ndim || start >= end || end > view.shape[dim] || step == 0) {
+        throw std::runtime_error("Slice [" + std::to_string(start) + ", " + std::to_string(end) + ") of dimension " +
+                                 std::to_string(dim) + " does not fit " + viewString(view) + ".");
+    }
+
+    uint32_t magnitude = static_cast<uint32_t>(step < 0 ? -int64_t(step) : step);
+    uint32_t first = step > 0 ? start : end - 1;
+
+    View result = view;
+    result.shape[dim] = (end - start + magnitude - 1) / magnitude;
+    result.strides[dim] = view.strides[dim] * step;
+    result.offset = static_cast<uint32_t>(int64_t(view.offset) + int64_t(first) * view.strides[dim]);
+    return result;
+}
+
+// Numpy broadcasting: dimensions are matched from the back, missing ones are added in front,
+// and dimensions with a size of 1 repeat with a stride of 0
+View expandView(const View& view, const std::vector<uint32_t>& shape) {
+    checkShape(shape);
+    if (shape.size() < view.ndim) throw std::runtime_error("Can not broadcast " + viewString(view) + " to " + shapeString(shape) + ".");
+
+    View result = contiguousView(shape);
+    result.offset = view.offset;
+
+    uint32_t lead = static_cast<uint32_t>(shape.size()) - view.ndim;
+    for (uint32_t d = 0; d < shape.size(); d++) {
+        if (d < lead) {
+            result.strides[d] = 0;
+        } else if (view.shape[d - lead] == shape[d]) {
+            result.strides[d] = view.strides[d - lead];
+        } else if (view.shape[d - lead] == 1) {
+            result.strides[d] = 0;
+        } else {
+            throw std::runtime_error("Can not broadcast " + viewString(view) + " to " + shapeString(shape) + ".");
+        }
+    }
+    return result;
+}
+
+ViewParams viewParams(const View& view) {
+    ViewParams params;
+    params.offset = view.offset;
+    for (uint32_t d = 0; d < maxViewDims; d++) {
+        params.shape[d] = view.shape[d];
+        params.strides[d] = view.strides[d];
+    }
+    return params;
+}
+
+std::string viewString(const View& view) {
+    std::ostringstream out;
+    out << shapeString(viewShape(view)) << " strides [";
+    for (uint32_t d = 0; d < view.ndim; d++) out << (d > 0 ? ", " : "") << view.strides[d];
+    out << "] offset " << view.offset;
+    return out.str();
+}
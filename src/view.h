@@ -0,0 +1,43 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include "./util.h"
+
+const uint32_t maxViewDims = 4;
+
+// Shape tracker: how the elements of a tensor map onto the buffer that holds them.
+// Element (i0, ..., in-1) is read from offset + i0 * strides[0] + ... + in-1 * strides[n-1], all in elements.
+// A stride of 0 broadcasts a dimension, negative strides flip one. Reshapes, transposes, slices and
+// broadcasts only change the view, the buffer stays as it is.
+// Unused dimensions are trailing, with a size of 1 and a stride of 0.
+struct View {
+    uint32_t ndim;
+    uint32_t shape[maxViewDims];
+    int32_t strides[maxViewDims];
+    uint32_t offset;
+};
+
+// Push constants of a strided load in generated shaders (src/shaders/view.glsl), in declaration order
+struct ViewParams {
+    uint32_t offset;
+    uint32_t shape[maxViewDims];
+    int32_t strides[maxViewDims];
+};
+
+View contiguousView(const std::vector<uint32_t>& shape);
+uint32_t viewNelem(const View& view);
+std::vector<uint32_t> viewShape(const View& view);
+bool sameShape(const View& a, const View& b);
+bool isContiguous(const View& view);
+bool canReshape(const View& view, const std::vector<uint32_t>& shape);
+uint32_t viewIndex(const View& view, uint32_t i);
+void viewRange(const View& view, int64_t& lowest, int64_t& highest);
+
+View reshapeView(const View& view, const std::vector<uint32_t>& shape);
+View permuteView(const View& view, const std::vector<uint32_t>& order);
+View sliceView(const View& view, uint32_t dim, uint32_t start, uint32_t end, int32_t step = 1);
+View expandView(const View& view, const std::vector<uint32_t>& shape);
+ViewParams viewParams(const View& view);
+std::string viewString(const View& view);
+
+#endif // VIEW_H